@@ -0,0 +1,612 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include "maxminddb_writer.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <libgen.h>
+#endif
+
+struct options {
+    const char *file;
+    const char *output;
+    bool keep_key_order;
+    bool quiet;
+    const char **languages;
+    size_t language_count;
+    const char **keys;
+    size_t key_count;
+};
+
+// The values already copied from the source database, by their offset in its
+// data section. Networks usually share a few records, so each record is only
+// decoded and deduplicated once.
+struct value_cache {
+    uint32_t *offsets;
+    MMDB_writer_value_s **values;
+    size_t size;
+    size_t count;
+};
+
+struct compact_stats {
+    unsigned long long networks;
+    unsigned long long records;
+};
+
+static void usage(char *program, int exit_code, const char *error);
+static void get_options(int argc, char **argv, struct options *const options);
+static bool add_option(const char ***const list,
+                       size_t *const count,
+                       const char *const value);
+static bool has_option(const char *const *const list,
+                       size_t count,
+                       const char *const value,
+                       size_t length);
+static bool compact(const struct options *const options);
+static bool copy_metadata(MMDB_writer_s *const writer,
+                          const MMDB_s *const mmdb,
+                          const struct options *const options);
+static uint32_t ipv4_alias_flags(const MMDB_s *const mmdb);
+static bool copy_networks(MMDB_writer_s *const writer,
+                          const MMDB_s *const mmdb,
+                          const struct options *const options,
+                          struct compact_stats *const stats);
+static int copy_value(MMDB_writer_s *const writer,
+                      const struct options *const options,
+                      struct value_cache *const cache,
+                      MMDB_entry_s *const entry,
+                      MMDB_writer_value_s **const value);
+static MMDB_entry_data_list_s *
+project_value(const struct options *const options,
+              MMDB_entry_data_list_s *const entry_data_list,
+              bool is_record,
+              bool is_names);
+static MMDB_writer_value_s **cache_slot(struct value_cache *const cache,
+                                        uint32_t offset);
+static bool grow_cache(struct value_cache *const cache);
+static bool report(const MMDB_s *const source,
+                   const char *const output,
+                   const struct compact_stats *const stats);
+
+int main(int argc, char **argv) {
+    struct options options = {0};
+
+    get_options(argc, argv, &options);
+
+    bool const compacted = compact(&options);
+    free(options.languages);
+    free(options.keys);
+    return compacted ? 0 : 1;
+}
+
+static void usage(char *program, int exit_code, const char *error) {
+    if (NULL != error) {
+        fprintf(stderr, "\n  *ERROR: %s\n", error);
+    }
+
+    char *usage =
+        "\n"
+        "  %s --file /path/to/file.mmdb --output /path/to/compact.mmdb\n"
+        "\n"
+        "  This application accepts the following options:\n"
+        "\n"
+        "      --file (-f)       The path to the MMDB file to compact. "
+        "Required.\n"
+        "\n"
+        "      --output (-o)     The path of the MMDB file to write. "
+        "Required.\n"
+        "\n"
+        "      --keep-key-order  Don't sort the keys of maps. Maps that only "
+        "differ\n"
+        "                        in the order of their keys are then stored "
+        "more than\n"
+        "                        once.\n"
+        "\n"
+        "      --language (-l)   Only keep the names in this language. May be "
+        "given\n"
+        "                        more than once. Defaults to every language.\n"
+        "\n"
+        "      --key (-k)        Only keep this key of each record. May be "
+        "given more\n"
+        "                        than once. Defaults to every key.\n"
+        "\n"
+        "      --quiet (-q)      Don't print the sizes of the databases.\n"
+        "\n"
+        "      --version         Print the program's version number and "
+        "exit.\n"
+        "\n"
+        "      --help (-h -?)    Show usage information.\n"
+        "\n";
+
+    fprintf(stdout, usage, program);
+    exit(exit_code);
+}
+
+static void get_options(int argc, char **argv, struct options *const options) {
+    static int help = 0;
+    static int version = 0;
+
+    enum {
+        OPTION_KEEP_KEY_ORDER = 256,
+        OPTION_VERSION,
+    };
+
+#ifdef _WIN32
+    char *program = alloca(strlen(argv[0]) + 1);
+    _splitpath(argv[0], NULL, NULL, program, NULL);
+    _splitpath(argv[0], NULL, NULL, NULL, program + strlen(program));
+#else
+    char *program = basename(argv[0]);
+#endif
+
+    while (1) {
+        static struct option long_options[] = {
+            {"file", required_argument, 0, 'f'},
+            {"output", required_argument, 0, 'o'},
+            {"keep-key-order", no_argument, 0, OPTION_KEEP_KEY_ORDER},
+            {"language", required_argument, 0, 'l'},
+            {"key", required_argument, 0, 'k'},
+            {"quiet", no_argument, 0, 'q'},
+            {"version", no_argument, 0, OPTION_VERSION},
+            {"help", no_argument, 0, 'h'},
+            {"?", no_argument, 0, 1},
+            {0, 0, 0, 0}};
+
+        int opt_index;
+        int opt_char =
+            getopt_long(argc, argv, "f:o:l:k:qh?", long_options, &opt_index);
+
+        if (-1 == opt_char) {
+            break;
+        }
+
+        if ('f' == opt_char) {
+            options->file = optarg;
+        } else if ('o' == opt_char) {
+            options->output = optarg;
+        } else if (OPTION_KEEP_KEY_ORDER == opt_char) {
+            options->keep_key_order = true;
+        } else if ('l' == opt_char) {
+            if (!add_option(&options->languages,
+                            &options->language_count,
+                            optarg)) {
+                fprintf(stderr, "realloc(): %s\n", strerror(errno));
+                exit(1);
+            }
+        } else if ('k' == opt_char) {
+            if (!add_option(&options->keys, &options->key_count, optarg)) {
+                fprintf(stderr, "realloc(): %s\n", strerror(errno));
+                exit(1);
+            }
+        } else if ('q' == opt_char) {
+            options->quiet = true;
+        } else if (OPTION_VERSION == opt_char) {
+            version = 1;
+        } else if ('h' == opt_char || '?' == opt_char) {
+            help = 1;
+        }
+    }
+
+    if (help) {
+        usage(program, 0, NULL);
+    }
+
+    if (version) {
+        fprintf(stdout, "\n  %s version %s\n\n", program, PACKAGE_VERSION);
+        exit(0);
+    }
+
+    if (NULL == options->file) {
+        usage(program, 1, "You must provide a filename with --file");
+    }
+
+    if (NULL == options->output) {
+        usage(program, 1, "You must provide a filename with --output");
+    }
+}
+
+static bool add_option(const char ***const list,
+                       size_t *const count,
+                       const char *const value) {
+    const char **const values =
+        realloc((void *)*list, (*count + 1) * sizeof(const char *));
+    if (!values) {
+        return false;
+    }
+    values[(*count)++] = value;
+    *list = values;
+    return true;
+}
+
+// An empty list means that every value is kept.
+static bool has_option(const char *const *const list,
+                       size_t count,
+                       const char *const value,
+                       size_t length) {
+    if (count == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (strlen(list[i]) == length && memcmp(list[i], value, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool compact(const struct options *const options) {
+    MMDB_s mmdb;
+    int status = MMDB_open(options->file, MMDB_MODE_MMAP, &mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                options->file,
+                MMDB_strerror(status));
+        return false;
+    }
+
+    uint32_t flags = ipv4_alias_flags(&mmdb);
+    if (!options->keep_key_order) {
+        flags |= MMDB_WRITER_SORT_MAP_KEYS;
+    }
+
+    MMDB_writer_s *writer = NULL;
+    status = MMDB_writer_new(mmdb.metadata.ip_version,
+                             mmdb.metadata.database_type,
+                             flags,
+                             &writer);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr, "MMDB_writer_new(): %s\n", MMDB_strerror(status));
+        MMDB_close(&mmdb);
+        return false;
+    }
+
+    bool ok = false;
+    struct compact_stats stats = {0};
+    if (!copy_metadata(writer, &mmdb, options) ||
+        !copy_networks(writer, &mmdb, options, &stats)) {
+        goto end;
+    }
+
+    status = MMDB_writer_write(writer, options->output);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_writer_write(): %s: %s\n",
+                options->output,
+                MMDB_strerror(status));
+        goto end;
+    }
+
+    ok = options->quiet || report(&mmdb, options->output, &stats);
+
+end:
+    MMDB_writer_free(writer);
+    MMDB_close(&mmdb);
+    return ok;
+}
+
+static bool copy_metadata(MMDB_writer_s *const writer,
+                          const MMDB_s *const mmdb,
+                          const struct options *const options) {
+    MMDB_writer_set_build_epoch(writer, mmdb->metadata.build_epoch);
+
+    int status;
+    for (size_t i = 0; i < mmdb->metadata.languages.count; i++) {
+        const char *const language = mmdb->metadata.languages.names[i];
+        if (!has_option(options->languages,
+                        options->language_count,
+                        language,
+                        strlen(language))) {
+            continue;
+        }
+        status = MMDB_writer_add_language(writer, language);
+        if (status != MMDB_SUCCESS) {
+            fprintf(stderr,
+                    "MMDB_writer_add_language(): %s\n",
+                    MMDB_strerror(status));
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < mmdb->metadata.description.count; i++) {
+        const MMDB_description_s *const description =
+            mmdb->metadata.description.descriptions[i];
+        status = MMDB_writer_add_description(
+            writer, description->language, description->description);
+        if (status != MMDB_SUCCESS) {
+            fprintf(stderr,
+                    "MMDB_writer_add_description(): %s\n",
+                    MMDB_strerror(status));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// An alias is a record that points to the same node as ::/96, where the IPv4
+// networks are. The writer adds the same aliases back.
+static uint32_t ipv4_alias_flags(const MMDB_s *const mmdb) {
+    static const struct {
+        uint32_t flag;
+        uint8_t address[16];
+        uint16_t netmask;
+    } aliases[] = {
+        {MMDB_WRITER_ALIAS_IPV4_MAPPED,
+         {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0, 0},
+         96},
+        {MMDB_WRITER_ALIAS_TEREDO,
+         {0x20, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+         32},
+        {MMDB_WRITER_ALIAS_6TO4,
+         {0x20, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+         16},
+    };
+
+    uint32_t flags = 0;
+    MMDB_ipv4_start_node_s start_node;
+    if (mmdb->metadata.ip_version != 6 ||
+        MMDB_get_ipv4_start_node(mmdb, &start_node) != MMDB_SUCCESS ||
+        start_node.netmask != 96) {
+        return flags;
+    }
+
+    for (size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+        uint64_t record = 0;
+        for (uint16_t bit = 0; bit < aliases[i].netmask; bit++) {
+            MMDB_search_node_s search_node;
+            if (record >= mmdb->metadata.node_count ||
+                MMDB_read_node(mmdb, (uint32_t)record, &search_node) !=
+                    MMDB_SUCCESS) {
+                break;
+            }
+            record = (aliases[i].address[bit >> 3] >> (7 - bit % 8)) & 1
+                         ? search_node.right_record
+                         : search_node.left_record;
+            if (bit == aliases[i].netmask - 1 &&
+                record == start_node.node_value) {
+                flags |= aliases[i].flag;
+            }
+        }
+    }
+    return flags;
+}
+
+static bool copy_networks(MMDB_writer_s *const writer,
+                          const MMDB_s *const mmdb,
+                          const struct options *const options,
+                          struct compact_stats *const stats) {
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init(
+        mmdb, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_network_iterator_init(): %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+
+    struct value_cache cache = {0};
+    if (!grow_cache(&cache)) {
+        return false;
+    }
+
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        MMDB_writer_value_s *value;
+        status = copy_value(writer, options, &cache, &network.entry, &value);
+        if (status != MMDB_SUCCESS) {
+            break;
+        }
+
+        status = MMDB_writer_insert(writer,
+                                    network.address,
+                                    network.ip_version,
+                                    network.netmask,
+                                    value,
+                                    MMDB_WRITER_INSERT_REPLACE);
+        if (status != MMDB_SUCCESS) {
+            break;
+        }
+        stats->networks++;
+    }
+    stats->records = cache.count;
+
+    free(cache.offsets);
+    free(cache.values);
+
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "Error copying the networks: %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+    return true;
+}
+
+static int copy_value(MMDB_writer_s *const writer,
+                      const struct options *const options,
+                      struct value_cache *const cache,
+                      MMDB_entry_s *const entry,
+                      MMDB_writer_value_s **const value) {
+    MMDB_writer_value_s **const slot = cache_slot(cache, entry->offset);
+    if (*slot != NULL) {
+        *value = *slot;
+        return MMDB_SUCCESS;
+    }
+
+    MMDB_entry_data_list_s *entry_data_list;
+    int status = MMDB_get_entry_data_list(entry, &entry_data_list);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+    if (options->language_count > 0 || options->key_count > 0) {
+        project_value(options, entry_data_list, true, false);
+    }
+    MMDB_writer_value_s *copy;
+    status =
+        MMDB_writer_value_from_entry_data_list(writer, entry_data_list, &copy);
+    MMDB_free_entry_data_list(entry_data_list);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+    // The canonical value can be inserted for every network with this record.
+    status = MMDB_writer_intern(writer, copy, value);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    cache->offsets[slot - cache->values] = entry->offset;
+    *slot = *value;
+    cache->count++;
+    if (cache->count * 2 > cache->size && !grow_cache(cache)) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    return MMDB_SUCCESS;
+}
+
+// Drops the keys that weren't asked for from the record, and the languages
+// that weren't asked for from every map under a names key, by unlinking them
+// from the entry data list. The entries stay in the list's pool until it is
+// freed. Returns the last entry of the value.
+static MMDB_entry_data_list_s *
+project_value(const struct options *const options,
+              MMDB_entry_data_list_s *const entry_data_list,
+              bool is_record,
+              bool is_names) {
+    uint32_t const type = entry_data_list->entry_data.type;
+    if (type != MMDB_DATA_TYPE_MAP && type != MMDB_DATA_TYPE_ARRAY) {
+        return entry_data_list;
+    }
+
+    uint32_t const size = entry_data_list->entry_data.data_size;
+    uint32_t kept = 0;
+    MMDB_entry_data_list_s *last = entry_data_list;
+    for (uint32_t i = 0; i < size && last->next != NULL; i++) {
+        if (type == MMDB_DATA_TYPE_ARRAY) {
+            last = project_value(options, last->next, false, false);
+            kept++;
+            continue;
+        }
+
+        MMDB_entry_data_list_s *const key = last->next;
+        if (key->next == NULL) {
+            break;
+        }
+        const char *const name = key->entry_data.utf8_string;
+        uint32_t const length = key->entry_data.data_size;
+        bool keep = true;
+        if (is_record) {
+            keep = has_option(options->keys, options->key_count, name, length);
+        } else if (is_names) {
+            keep = has_option(
+                options->languages, options->language_count, name, length);
+        }
+        MMDB_entry_data_list_s *const value_last = project_value(
+            options,
+            key->next,
+            false,
+            length == 5 && memcmp(name, "names", 5) == 0);
+        if (keep) {
+            last = value_last;
+            kept++;
+        } else {
+            last->next = value_last->next;
+        }
+    }
+
+    entry_data_list->entry_data.data_size = kept;
+    return last;
+}
+
+static MMDB_writer_value_s **cache_slot(struct value_cache *const cache,
+                                        uint32_t offset) {
+    size_t const mask = cache->size - 1;
+    size_t i = (size_t)((offset * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & mask;
+    while (cache->values[i] != NULL && cache->offsets[i] != offset) {
+        i = (i + 1) & mask;
+    }
+    return &cache->values[i];
+}
+
+static bool grow_cache(struct value_cache *const cache) {
+    struct value_cache grown = {
+        .size = cache->size == 0 ? 1024 : cache->size * 2,
+        .count = cache->count,
+    };
+    grown.offsets = malloc(grown.size * sizeof(uint32_t));
+    grown.values = calloc(grown.size, sizeof(MMDB_writer_value_s *));
+    if (grown.offsets == NULL || grown.values == NULL) {
+        fprintf(stderr, "malloc(): %s\n", strerror(errno));
+        free(grown.offsets);
+        free(grown.values);
+        return false;
+    }
+
+    for (size_t i = 0; i < cache->size; i++) {
+        if (cache->values[i] != NULL) {
+            MMDB_writer_value_s **const slot =
+                cache_slot(&grown, cache->offsets[i]);
+            grown.offsets[slot - grown.values] = cache->offsets[i];
+            *slot = cache->values[i];
+        }
+    }
+
+    free(cache->offsets);
+    free(cache->values);
+    *cache = grown;
+    return true;
+}
+
+static bool report(const MMDB_s *const source,
+                   const char *const output,
+                   const struct compact_stats *const stats) {
+    MMDB_s mmdb;
+    int const status = MMDB_open(output, MMDB_MODE_MMAP, &mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                output,
+                MMDB_strerror(status));
+        return false;
+    }
+
+    fprintf(stdout,
+            "\n  Copied %llu networks with %llu distinct records.\n"
+            "\n"
+            "    %-14s %12s %12s\n"
+            "    %-14s %12u %12u\n"
+            "    %-14s %12u %12u\n"
+            "    %-14s %12lld %12lld\n"
+            "\n",
+            stats->networks,
+            stats->records,
+            "",
+            "before",
+            "after",
+            "nodes",
+            (unsigned int)source->metadata.node_count,
+            (unsigned int)mmdb.metadata.node_count,
+            "data bytes",
+            (unsigned int)source->data_section_size,
+            (unsigned int)mmdb.data_section_size,
+            "file bytes",
+            (long long)source->file_size,
+            (long long)mmdb.file_size);
+
+    MMDB_close(&mmdb);
+    return true;
+}
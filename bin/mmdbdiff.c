@@ -0,0 +1,287 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <arpa/inet.h>
+    #include <libgen.h>
+#endif
+
+#define EXIT_SAME (0)
+#define EXIT_DIFFERENT (1)
+#define EXIT_ERROR (2)
+
+struct options {
+    const char *old_file;
+    const char *new_file;
+    uint32_t flags;
+    bool data;
+    bool quiet;
+};
+
+struct diff_counts {
+    unsigned long long added;
+    unsigned long long removed;
+    unsigned long long changed;
+};
+
+static void usage(char *program, int exit_code, const char *error);
+static void get_options(int argc, char **argv, struct options *const options);
+static int diff(const struct options *const options);
+static bool print_diff(const MMDB_network_diff_s *const network_diff,
+                       bool data,
+                       struct diff_counts *const counts);
+static bool print_data(const char *const label, MMDB_entry_s *const entry);
+
+int main(int argc, char **argv) {
+    struct options options = {0};
+
+    get_options(argc, argv, &options);
+
+    return diff(&options);
+}
+
+static void usage(char *program, int exit_code, const char *error) {
+    if (NULL != error) {
+        fprintf(stderr, "\n  *ERROR: %s\n", error);
+    }
+
+    char *usage =
+        "\n"
+        "  %s [options] /path/to/old.mmdb /path/to/new.mmdb\n"
+        "\n"
+        "  This application prints each network whose data differs between "
+        "two\n"
+        "  databases, prefixed with + if it was added, - if it was removed "
+        "and\n"
+        "  ~ if its data changed. It exits with 0 if the databases have the "
+        "same\n"
+        "  data, 1 if they differ and 2 on error.\n"
+        "\n"
+        "  This application accepts the following options:\n"
+        "\n"
+        "      --data (-d)     Also print the old and new data of each "
+        "network.\n"
+        "\n"
+        "      --include-aliased\n"
+        "                      Also compare the IPv4 networks aliased into "
+        "the\n"
+        "                      IPv6 address space, such as ::ffff:0:0/96.\n"
+        "\n"
+        "      --quiet (-q)    Don't print the number of networks added, "
+        "removed\n"
+        "                      and changed at the end.\n"
+        "\n"
+        "      --version       Print the program's version number and exit.\n"
+        "\n"
+        "      --help (-h -?)  Show usage information.\n"
+        "\n";
+
+    fprintf(stdout, usage, program);
+    exit(exit_code);
+}
+
+static void get_options(int argc, char **argv, struct options *const options) {
+    static int help = 0;
+    static int version = 0;
+
+    enum {
+        OPTION_INCLUDE_ALIASED = 256,
+        OPTION_VERSION,
+    };
+
+#ifdef _WIN32
+    char *program = alloca(strlen(argv[0]) + 1);
+    _splitpath(argv[0], NULL, NULL, program, NULL);
+    _splitpath(argv[0], NULL, NULL, NULL, program + strlen(program));
+#else
+    char *program = basename(argv[0]);
+#endif
+
+    while (1) {
+        static struct option long_options[] = {
+            {"data", no_argument, 0, 'd'},
+            {"include-aliased", no_argument, 0, OPTION_INCLUDE_ALIASED},
+            {"quiet", no_argument, 0, 'q'},
+            {"version", no_argument, 0, OPTION_VERSION},
+            {"help", no_argument, 0, 'h'},
+            {"?", no_argument, 0, 1},
+            {0, 0, 0, 0}};
+
+        int opt_index;
+        int opt_char =
+            getopt_long(argc, argv, "dqh?", long_options, &opt_index);
+
+        if (-1 == opt_char) {
+            break;
+        }
+
+        if ('d' == opt_char) {
+            options->data = true;
+        } else if (OPTION_INCLUDE_ALIASED == opt_char) {
+            options->flags |= MMDB_ITERATOR_INCLUDE_ALIASED_NETWORKS;
+        } else if ('q' == opt_char) {
+            options->quiet = true;
+        } else if (OPTION_VERSION == opt_char) {
+            version = 1;
+        } else if ('h' == opt_char || '?' == opt_char) {
+            help = 1;
+        }
+    }
+
+    if (help) {
+        usage(program, EXIT_SAME, NULL);
+    }
+
+    if (version) {
+        fprintf(stdout, "\n  %s version %s\n\n", program, PACKAGE_VERSION);
+        exit(EXIT_SAME);
+    }
+
+    if (argc - optind != 2) {
+        usage(program, EXIT_ERROR, "You must provide an old and a new file");
+    }
+
+    options->old_file = argv[optind];
+    options->new_file = argv[optind + 1];
+}
+
+static int diff(const struct options *const options) {
+    MMDB_s old_mmdb;
+    int status = MMDB_open(options->old_file, MMDB_MODE_MMAP, &old_mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                options->old_file,
+                MMDB_strerror(status));
+        return EXIT_ERROR;
+    }
+
+    MMDB_s new_mmdb;
+    status = MMDB_open(options->new_file, MMDB_MODE_MMAP, &new_mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                options->new_file,
+                MMDB_strerror(status));
+        MMDB_close(&old_mmdb);
+        return EXIT_ERROR;
+    }
+
+    int exit_code = EXIT_ERROR;
+    MMDB_diff_iterator_s iterator;
+    status = MMDB_diff_iterator_init(
+        &old_mmdb, &new_mmdb, options->flags, &iterator);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_diff_iterator_init(): %s\n",
+                MMDB_strerror(status));
+        goto end;
+    }
+
+    struct diff_counts counts = {0};
+    MMDB_network_diff_s network_diff;
+    while (MMDB_diff_iterator_next(&iterator, &network_diff, &status)) {
+        if (!print_diff(&network_diff, options->data, &counts)) {
+            goto end;
+        }
+    }
+
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "Error comparing the databases: %s\n",
+                MMDB_strerror(status));
+        goto end;
+    }
+
+    if (!options->quiet) {
+        fprintf(stderr,
+                "%llu networks added, %llu removed, %llu changed\n",
+                counts.added,
+                counts.removed,
+                counts.changed);
+    }
+
+    exit_code = counts.added || counts.removed || counts.changed
+                    ? EXIT_DIFFERENT
+                    : EXIT_SAME;
+
+end:
+    MMDB_close(&new_mmdb);
+    MMDB_close(&old_mmdb);
+    return exit_code;
+}
+
+static bool print_diff(const MMDB_network_diff_s *const network_diff,
+                       bool data,
+                       struct diff_counts *const counts) {
+    char address[INET6_ADDRSTRLEN];
+    if (!inet_ntop(network_diff->ip_version == 4 ? AF_INET : AF_INET6,
+                   network_diff->address,
+                   address,
+                   sizeof(address))) {
+        fprintf(stderr, "inet_ntop(): %s\n", strerror(errno));
+        return false;
+    }
+
+    char change;
+    if (!network_diff->old_found_entry) {
+        change = '+';
+        counts->added++;
+    } else if (!network_diff->new_found_entry) {
+        change = '-';
+        counts->removed++;
+    } else {
+        change = '~';
+        counts->changed++;
+    }
+    fprintf(stdout, "%c %s/%d\n", change, address, network_diff->netmask);
+
+    if (!data) {
+        return true;
+    }
+
+    // The entries are copied as the data lookup functions take a non-const
+    // entry.
+    MMDB_entry_s old_entry = network_diff->old_entry;
+    MMDB_entry_s new_entry = network_diff->new_entry;
+    return (!network_diff->old_found_entry || print_data("old", &old_entry)) &&
+           (!network_diff->new_found_entry || print_data("new", &new_entry));
+}
+
+static bool print_data(const char *const label, MMDB_entry_s *const entry) {
+    MMDB_entry_data_list_s *entry_data_list = NULL;
+    int status = MMDB_get_entry_data_list(entry, &entry_data_list);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_get_entry_data_list(): %s\n",
+                MMDB_strerror(status));
+        MMDB_free_entry_data_list(entry_data_list);
+        return false;
+    }
+
+    fprintf(stdout, "  %s:\n", label);
+    status = MMDB_dump_entry_data_list(stdout, entry_data_list, 4);
+    MMDB_free_entry_data_list(entry_data_list);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_dump_entry_data_list(): %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+    fprintf(stdout, "\n");
+    return true;
+}
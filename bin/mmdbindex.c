@@ -0,0 +1,251 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <arpa/inet.h>
+    #include <libgen.h>
+#endif
+
+struct options {
+    const char *mmdb_file;
+    const char *index_file;
+    bool build;
+    bool data;
+    // The lookup path to build the index on, or the key to query.
+    const char *const *args;
+};
+
+static void usage(char *program, int exit_code, const char *error);
+static void get_options(int argc, char **argv, struct options *const options);
+static int build(const MMDB_s *const mmdb,
+                 const struct options *const options);
+static int query(const MMDB_s *const mmdb,
+                 const struct options *const options);
+static bool print_network(MMDB_network_s *const network, bool data);
+
+int main(int argc, char **argv) {
+    struct options options = {0};
+
+    get_options(argc, argv, &options);
+
+    MMDB_s mmdb;
+    int status = MMDB_open(options.mmdb_file, MMDB_MODE_MMAP, &mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                options.mmdb_file,
+                MMDB_strerror(status));
+        exit(1);
+    }
+
+    int exit_code =
+        options.build ? build(&mmdb, &options) : query(&mmdb, &options);
+
+    MMDB_close(&mmdb);
+    return exit_code;
+}
+
+static void usage(char *program, int exit_code, const char *error) {
+    if (NULL != error) {
+        fprintf(stderr, "\n  *ERROR: %s\n", error);
+    }
+
+    char *usage =
+        "\n"
+        "  %s --build /path/to/db.mmdb /path/to/index [lookup path]\n"
+        "  %s [options] /path/to/db.mmdb /path/to/index key\n"
+        "\n"
+        "  This application builds and queries reverse indexes, which find "
+        "the\n"
+        "  networks of a database with a given value.\n"
+        "\n"
+        "  With --build, the index is built on the values at the lookup "
+        "path,\n"
+        "  such as country iso_code. Without a lookup path it is built on "
+        "the\n"
+        "  data records themselves and their offsets in the data section "
+        "are\n"
+        "  the keys.\n"
+        "\n"
+        "  Otherwise, the networks whose value is the key are printed in "
+        "address\n"
+        "  order. Values are written the same way as mmdblookup prints "
+        "them,\n"
+        "  without the quotes around strings.\n"
+        "\n"
+        "  This application accepts the following options:\n"
+        "\n"
+        "      --build (-b)    Build the index.\n"
+        "\n"
+        "      --data (-d)     Also print the data of each network found.\n"
+        "\n"
+        "      --version       Print the program's version number and exit.\n"
+        "\n"
+        "      --help (-h -?)  Show usage information.\n"
+        "\n";
+
+    fprintf(stdout, usage, program, program);
+    exit(exit_code);
+}
+
+static void get_options(int argc, char **argv, struct options *const options) {
+    static int help = 0;
+    static int version = 0;
+
+    enum {
+        OPTION_VERSION = 256,
+    };
+
+#ifdef _WIN32
+    char *program = alloca(strlen(argv[0]) + 1);
+    _splitpath(argv[0], NULL, NULL, program, NULL);
+    _splitpath(argv[0], NULL, NULL, NULL, program + strlen(program));
+#else
+    char *program = basename(argv[0]);
+#endif
+
+    while (1) {
+        static struct option long_options[] = {
+            {"build", no_argument, 0, 'b'},
+            {"data", no_argument, 0, 'd'},
+            {"version", no_argument, 0, OPTION_VERSION},
+            {"help", no_argument, 0, 'h'},
+            {"?", no_argument, 0, 1},
+            {0, 0, 0, 0}};
+
+        int opt_index;
+        int opt_char =
+            getopt_long(argc, argv, "bdh?", long_options, &opt_index);
+
+        if (-1 == opt_char) {
+            break;
+        }
+
+        if ('b' == opt_char) {
+            options->build = true;
+        } else if ('d' == opt_char) {
+            options->data = true;
+        } else if (OPTION_VERSION == opt_char) {
+            version = 1;
+        } else if ('h' == opt_char || '?' == opt_char) {
+            help = 1;
+        }
+    }
+
+    if (help) {
+        usage(program, 0, NULL);
+    }
+
+    if (version) {
+        fprintf(stdout, "\n  %s version %s\n\n", program, PACKAGE_VERSION);
+        exit(0);
+    }
+
+    if (argc - optind < 2) {
+        usage(program, 1, "You must provide a database and an index file");
+    }
+    if (!options->build && argc - optind != 3) {
+        usage(program, 1, "You must provide one key to query");
+    }
+
+    options->mmdb_file = argv[optind];
+    options->index_file = argv[optind + 1];
+    options->args = (const char *const *)argv + optind + 2;
+}
+
+static int build(const MMDB_s *const mmdb,
+                 const struct options *const options) {
+    int status = MMDB_index_build(mmdb, options->args, options->index_file);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_index_build(): %s: %s\n",
+                options->index_file,
+                MMDB_strerror(status));
+        return 1;
+    }
+    return 0;
+}
+
+static int query(const MMDB_s *const mmdb,
+                 const struct options *const options) {
+    MMDB_index_s index;
+    int status = MMDB_index_open(options->index_file, mmdb, &index);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_index_open(): %s: %s\n",
+                options->index_file,
+                MMDB_strerror(status));
+        return 1;
+    }
+
+    int exit_code = 1;
+    MMDB_index_iterator_s iterator;
+    status = MMDB_index_iterator_init(&index, options->args[0], &iterator);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_index_iterator_init(): %s\n",
+                MMDB_strerror(status));
+        goto end;
+    }
+
+    MMDB_network_s network;
+    while (MMDB_index_iterator_next(&iterator, &network, &status)) {
+        if (!print_network(&network, options->data)) {
+            goto end;
+        }
+    }
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "Error reading the index: %s\n",
+                MMDB_strerror(status));
+        goto end;
+    }
+    exit_code = 0;
+
+end:
+    MMDB_index_close(&index);
+    return exit_code;
+}
+
+static bool print_network(MMDB_network_s *const network, bool data) {
+    char address[INET6_ADDRSTRLEN];
+    if (!inet_ntop(network->ip_version == 4 ? AF_INET : AF_INET6,
+                   network->address,
+                   address,
+                   sizeof(address))) {
+        fprintf(stderr, "inet_ntop(): %s\n", strerror(errno));
+        return false;
+    }
+    fprintf(stdout, "%s/%d\n", address, network->netmask);
+
+    if (!data) {
+        return true;
+    }
+
+    MMDB_entry_data_list_s *entry_data_list = NULL;
+    int status = MMDB_get_entry_data_list(&network->entry, &entry_data_list);
+    if (status == MMDB_SUCCESS) {
+        status = MMDB_dump_entry_data_list(stdout, entry_data_list, 2);
+    }
+    MMDB_free_entry_data_list(entry_data_list);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr, "Error printing the data: %s\n", MMDB_strerror(status));
+        return false;
+    }
+    fprintf(stdout, "\n");
+    return true;
+}
@@ -13,6 +13,7 @@
     #include <pthread.h>
 #endif
 #include <limits.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,10 +26,21 @@
     #endif
     #include <malloc.h>
 #else
+    #include <arpa/inet.h>
     #include <libgen.h>
     #include <unistd.h>
 #endif
 
+struct export_buffer;
+struct export_field;
+struct export_record;
+struct export_pair;
+struct export_flat;
+struct export_column;
+struct export_columns;
+struct export_state;
+struct export_thread_info;
+
 static void usage(char *program, int exit_code, const char *error);
 static const char **get_options(int argc,
                                 char **argv,
@@ -38,7 +50,8 @@ static const char **get_options(int argc,
                                 int *iterations,
                                 int *lookup_path_length,
                                 int *const thread_count,
-                                char **const ip_file);
+                                char **const ip_file,
+                                char **const export_format);
 static MMDB_s open_or_die(const char *fname);
 static void dump_meta(MMDB_s *mmdb);
 static bool lookup_from_file(MMDB_s *const mmdb,
@@ -52,6 +65,77 @@ static int lookup_and_print(MMDB_s *mmdb,
 static int benchmark(MMDB_s *mmdb, int iterations);
 static MMDB_lookup_result_s lookup_or_die(MMDB_s *mmdb, const char *ipstr);
 static void random_ipv4(char *ip);
+static bool export_database(MMDB_s *const mmdb,
+                            const char *const format,
+                            int thread_count,
+                            const char *const network);
+static bool export_find_subtree(struct export_state *const state,
+                                const char *const network);
+static size_t export_hash_offset(uint32_t offset);
+static struct export_record *
+export_find_record(const struct export_state *const state, uint32_t offset);
+static bool export_add_record(struct export_state *const state,
+                              uint32_t offset);
+static void export_free_records(struct export_state *const state);
+static bool export_collect_records(struct export_state *const state);
+static int export_render_range(struct export_thread_info *const tinfo);
+static bool export_keep_text(struct export_record *const record,
+                             const struct export_buffer *const buffer);
+static bool export_render_records(struct export_state *const state);
+static bool export_reserve(struct export_buffer *const buffer, size_t length);
+static bool export_append(struct export_buffer *const buffer,
+                          const char *const data,
+                          size_t length);
+static bool export_append_json_string(struct export_buffer *const buffer,
+                                      const char *const string,
+                                      size_t length);
+static bool export_append_csv_field(struct export_buffer *const buffer,
+                                    const char *const field,
+                                    size_t length);
+static int export_append_scalar(struct export_buffer *const buffer,
+                                const MMDB_entry_data_s *const entry_data,
+                                bool json);
+static MMDB_entry_data_list_s *
+export_json_value(MMDB_entry_data_list_s *entry_data_list,
+                  struct export_buffer *const buffer,
+                  int *const status);
+static MMDB_entry_data_list_s *
+export_csv_value(MMDB_entry_data_list_s *entry_data_list,
+                 struct export_flat *const flat,
+                 int *const status);
+static bool export_append_path_key(struct export_buffer *const path,
+                                   const char *const key,
+                                   size_t length);
+static int export_keep_fields(struct export_thread_info *const tinfo,
+                              const struct export_flat *const flat,
+                              struct export_record *const record,
+                              size_t index);
+static bool export_csv_row(const struct export_columns *const columns,
+                           const size_t *const column_map,
+                           struct export_record *const record,
+                           const struct export_field **const row,
+                           struct export_buffer *const buffer);
+static size_t export_hash_column(const char *const name, size_t length);
+static size_t *export_column_slot(const struct export_columns *const columns,
+                                  const char *const name,
+                                  size_t length);
+static bool export_index_columns(struct export_columns *const columns,
+                                 size_t table_size);
+static struct export_column *
+export_add_column(struct export_columns *const columns,
+                  const char *const name,
+                  size_t length);
+static void export_free_columns(struct export_columns *const columns);
+static int export_compare_columns(const void *a, const void *b);
+static bool export_csv_columns(struct export_state *const state,
+                               struct export_thread_info *const tinfo,
+                               int thread_count);
+static bool export_csv_rows(struct export_state *const state,
+                            const struct export_thread_info *const tinfo,
+                            int thread_count);
+static bool export_write_networks(struct export_state *const state);
+static bool export_write_network(const struct export_state *const state,
+                                 const MMDB_network_s *const network);
 
 #ifndef _WIN32
 // These aren't with the automatically generated prototypes as we'd lose the
@@ -61,6 +145,7 @@ static bool start_threaded_benchmark(MMDB_s *const mmdb,
                                      int const iterations);
 static long double get_time(void);
 static void *thread(void *arg);
+static void *export_thread(void *arg);
 #endif
 
 #ifdef _WIN32
@@ -105,6 +190,7 @@ int main(int argc, char **argv) {
     int lookup_path_length = 0;
     int thread_count = 0;
     char *ip_file = NULL;
+    char *export_format = NULL;
 
     const char **lookup_path = get_options(argc,
                                            argv,
@@ -114,7 +200,8 @@ int main(int argc, char **argv) {
                                            &iterations,
                                            &lookup_path_length,
                                            &thread_count,
-                                           &ip_file);
+                                           &ip_file,
+                                           &export_format);
 
     MMDB_s mmdb = open_or_die(mmdb_file);
 
@@ -138,6 +225,14 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+    if (export_format) {
+        free((void *)lookup_path);
+        bool const exported =
+            export_database(&mmdb, export_format, thread_count, ip_address);
+        MMDB_close(&mmdb);
+        return exported ? 0 : 1;
+    }
+
     if (0 == iterations) {
         exit(lookup_and_print(
             &mmdb, ip_address, lookup_path, lookup_path_length, verbose));
@@ -174,7 +269,19 @@ static void usage(char *program, int exit_code, const char *error) {
         "\n"
         "      --file (-f)     The path to the MMDB file. Required.\n"
         "\n"
-        "      --ip (-i)       The IP address to look up. Required.\n"
+        "      --ip (-i)       The IP address to look up. Required unless "
+        "--export\n"
+        "                      is given.\n"
+        "\n"
+        "      --export (-e)   Write every network in the database and its "
+        "data to\n"
+        "                      stdout instead of looking up an IP address. "
+        "The format\n"
+        "                      is either jsonl or csv. If --ip is also given, "
+        "it may\n"
+        "                      be a network such as 1.2.0.0/16 and only the "
+        "networks\n"
+        "                      that overlap it are written.\n"
         "\n"
         "      --verbose (-v)  Turns on verbose output. Specifically, this "
         "causes this\n"
@@ -225,7 +332,8 @@ static const char **get_options(int argc,
                                 int *iterations,
                                 int *lookup_path_length,
                                 int *const thread_count,
-                                char **const ip_file) {
+                                char **const ip_file,
+                                char **const export_format) {
     static int help = 0;
     static int version = 0;
 
@@ -248,15 +356,16 @@ static const char **get_options(int argc,
             {"threads", required_argument, 0, 't'},
 #endif
             {"ip-file", required_argument, 0, 'I'},
+            {"export", required_argument, 0, 'e'},
             {"help", no_argument, 0, 'h'},
             {"?", no_argument, 0, 1},
             {0, 0, 0, 0}};
 
         int opt_index;
 #ifdef _WIN32
-        char const *const optstring = "f:i:b:I:vnh?";
+        char const *const optstring = "f:i:b:I:e:vnh?";
 #else
-        char const *const optstring = "f:i:b:t:I:vnh?";
+        char const *const optstring = "f:i:b:t:I:e:vnh?";
 #endif
         int opt_char = getopt_long(argc, argv, optstring, options, &opt_index);
 
@@ -288,6 +397,8 @@ static const char **get_options(int argc,
             *thread_count = (int)i;
         } else if (opt_char == 'I') {
             *ip_file = optarg;
+        } else if (opt_char == 'e') {
+            *export_format = optarg;
         }
     }
 
@@ -304,7 +415,13 @@ static const char **get_options(int argc,
         usage(program, 1, "You must provide a filename with --file");
     }
 
-    if (*ip_address == NULL && *iterations == 0 && !*ip_file) {
+    if (*export_format && strcmp(*export_format, "jsonl") != 0 &&
+        strcmp(*export_format, "csv") != 0) {
+        usage(program, 1, "The --export format must be jsonl or csv");
+    }
+
+    if (*ip_address == NULL && *iterations == 0 && !*ip_file &&
+        !*export_format) {
         usage(program, 1, "You must provide an IP address with --ip");
     }
 
@@ -650,6 +767,1230 @@ static void random_ipv4(char *ip) {
              *(bytes + 3));
 }
 
+// The export mode writes every network in the database along with its record
+// to stdout, either as one JSON object per line or as CSV with the record
+// flattened into columns. Most networks share their record with many other
+// networks, so we first walk the networks to collect the distinct data section
+// offsets, then decode and render each of those records exactly once, spread
+// over several threads, and keep the rendered text. A second walk writes the
+// networks in order along with the text of their record.
+//
+// The CSV header needs the columns of every record before the first row can
+// be written. Each thread flattens its records, keeps their values and
+// collects their columns. Once the threads finish, their columns are merged
+// and sorted and the row of each record is put together from the values it
+// kept, without decoding the record again.
+
+struct export_buffer {
+    char *data;
+    size_t length;
+    size_t size;
+};
+
+// A value of a flattened record. The column is an index into the columns of
+// the thread that flattened the record and the value is its CSV field, as an
+// offset into the text of the record.
+struct export_field {
+    size_t column;
+    size_t value;
+    size_t length;
+};
+
+// A distinct record of the export. The text is its JSON or its CSV row. For
+// CSV, the text holds the values of the fields until the row is put together.
+struct export_record {
+    uint32_t offset;
+    char *text;
+    size_t length;
+    struct export_field *fields;
+    size_t field_count;
+};
+
+// A value of a flattened record. The name is the path to the value and the
+// value is its CSV field, both as offsets into the buffers of the export_flat
+// holding the pair.
+struct export_pair {
+    size_t name;
+    size_t name_length;
+    size_t value;
+    size_t value_length;
+};
+
+// A record flattened into pairs. The path is the path to the value being
+// flattened.
+struct export_flat {
+    struct export_buffer path;
+    struct export_buffer names;
+    struct export_buffer values;
+    struct export_pair *pairs;
+    size_t pair_count;
+    size_t pairs_size;
+};
+
+struct export_column {
+    char *name;
+    size_t length;
+    // The index plus one of the last record with this column, to find a record
+    // that has the same column twice.
+    size_t last_record;
+};
+
+// A set of columns. The table is an open addressing hash table of the
+// columns. Each slot holds an index into columns plus one, so zero is an empty
+// slot.
+struct export_columns {
+    struct export_column *columns;
+    size_t count;
+    size_t size;
+    size_t *table;
+    size_t table_size;
+};
+
+struct export_state {
+    MMDB_s *mmdb;
+    bool csv;
+    int thread_count;
+    MMDB_network_subtree_s subtree;
+    // The distinct records of the export.
+    struct export_record *records;
+    size_t record_count;
+    size_t records_size;
+    // An open addressing hash table keyed on the data section offset. Each
+    // slot holds an index into records plus one, so zero is an empty slot.
+    size_t *record_index;
+    size_t record_index_size;
+    // The CSV columns, sorted by name.
+    struct export_columns columns;
+};
+
+struct export_thread_info {
+#ifndef _WIN32
+    pthread_t id;
+#endif
+    struct export_state *state;
+    size_t first;
+    size_t step;
+    int status;
+    // The columns of the records this thread flattened, and the index of each
+    // of them in the sorted CSV columns.
+    struct export_columns columns;
+    size_t *column_map;
+    // The name of a column that a record had twice along with the data
+    // section offset of the record.
+    const char *duplicate;
+    uint32_t duplicate_offset;
+};
+
+static bool export_database(MMDB_s *const mmdb,
+                            const char *const format,
+                            int thread_count,
+                            const char *const network) {
+    struct export_state state = {
+        .mmdb = mmdb,
+        .csv = strcmp(format, "csv") == 0,
+        .subtree = {.mmdb = mmdb, .depth = 0, .record = 0},
+    };
+    bool ok = false;
+
+    if (network && !export_find_subtree(&state, network)) {
+        goto end;
+    }
+
+    if (thread_count <= 0) {
+        thread_count = 1;
+#if !defined(_WIN32) && defined(_SC_NPROCESSORS_ONLN)
+        long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 1) {
+            thread_count = cpus > INT_MAX ? INT_MAX : (int)cpus;
+        }
+#endif
+    }
+    state.thread_count = thread_count;
+
+    ok = export_collect_records(&state) && export_render_records(&state) &&
+         export_write_networks(&state);
+
+end:
+    export_free_records(&state);
+    export_free_columns(&state.columns);
+    return ok;
+}
+
+// Limits the export to the networks that overlap network, which is an address
+// with an optional prefix length such as 1.2.0.0/16.
+static bool export_find_subtree(struct export_state *const state,
+                                const char *const network) {
+    char address[INET6_ADDRSTRLEN + 1];
+    const char *const slash = strchr(network, '/');
+    size_t const length = slash ? (size_t)(slash - network) : strlen(network);
+    if (length == 0 || length >= sizeof(address)) {
+        fprintf(stderr, "Invalid network: %s\n", network);
+        return false;
+    }
+    memcpy(address, network, length);
+    address[length] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                             .ai_flags = AI_NUMERICHOST,
+                             .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addresses = NULL;
+    if (getaddrinfo(address, NULL, &hints, &addresses) != 0) {
+        fprintf(stderr, "Invalid network: %s\n", network);
+        return false;
+    }
+
+    long netmask = addresses->ai_family == AF_INET ? 32 : 128;
+    if (slash) {
+        char *end;
+        errno = 0;
+        netmask = strtol(slash + 1, &end, 10);
+        if (errno != 0 || end == slash + 1 || *end != '\0' || netmask < 0 ||
+            netmask > (addresses->ai_family == AF_INET ? 32 : 128)) {
+            fprintf(stderr, "Invalid network: %s\n", network);
+            freeaddrinfo(addresses);
+            return false;
+        }
+    }
+
+    int const status = MMDB_lookup_network_subtree(
+        state->mmdb, addresses->ai_addr, (uint16_t)netmask, &state->subtree);
+    freeaddrinfo(addresses);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_lookup_network_subtree(): %s: %s\n",
+                network,
+                MMDB_strerror(status));
+        return false;
+    }
+    return true;
+}
+
+static size_t export_hash_offset(uint32_t offset) {
+    return (size_t)(offset * UINT32_C(2654435761));
+}
+
+static struct export_record *
+export_find_record(const struct export_state *const state, uint32_t offset) {
+    size_t const mask = state->record_index_size - 1;
+    for (size_t i = export_hash_offset(offset) & mask;
+         state->record_index[i] != 0;
+         i = (i + 1) & mask) {
+        struct export_record *const record =
+            &state->records[state->record_index[i] - 1];
+        if (record->offset == offset) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+static bool export_add_record(struct export_state *const state,
+                              uint32_t offset) {
+    if (state->record_index_size != 0 &&
+        export_find_record(state, offset) != NULL) {
+        return true;
+    }
+
+    if (state->record_count == state->records_size) {
+        size_t const size =
+            state->records_size == 0 ? 1024 : state->records_size * 2;
+        struct export_record *const records =
+            realloc(state->records, size * sizeof(struct export_record));
+        if (!records) {
+            fprintf(stderr, "realloc(): %s\n", strerror(errno));
+            return false;
+        }
+        state->records = records;
+        state->records_size = size;
+    }
+    state->records[state->record_count] =
+        (struct export_record){.offset = offset};
+    state->record_count++;
+
+    // Keep the table at most half full. Growing it means rebuilding it from
+    // the records array.
+    size_t index_size = state->record_index_size;
+    if (state->record_count * 2 > index_size) {
+        index_size = index_size == 0 ? 2048 : index_size * 2;
+        size_t *const record_index = calloc(index_size, sizeof(size_t));
+        if (!record_index) {
+            fprintf(stderr, "calloc(): %s\n", strerror(errno));
+            return false;
+        }
+        free(state->record_index);
+        state->record_index = record_index;
+        state->record_index_size = index_size;
+    } else {
+        index_size = 0;
+    }
+
+    size_t const mask = state->record_index_size - 1;
+    size_t const first = index_size != 0 ? 0 : state->record_count - 1;
+    for (size_t n = first; n < state->record_count; n++) {
+        size_t i = export_hash_offset(state->records[n].offset) & mask;
+        while (state->record_index[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        state->record_index[i] = n + 1;
+    }
+
+    return true;
+}
+
+static void export_free_records(struct export_state *const state) {
+    for (size_t i = 0; i < state->record_count; i++) {
+        free(state->records[i].text);
+        free(state->records[i].fields);
+    }
+    free(state->records);
+    free(state->record_index);
+}
+
+// Collects the distinct records of the export.
+static bool export_collect_records(struct export_state *const state) {
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init_subtree(
+        &state->subtree, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_network_iterator_init_subtree(): %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        if (network.found_entry &&
+            !export_add_record(state, network.entry.offset)) {
+            return false;
+        }
+    }
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_network_iterator_next(): %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+
+    return true;
+}
+
+// Renders every step-th record starting at first. For CSV, each record is
+// instead flattened and keeps its values while its columns are added to the
+// thread's columns. This is what each of the export threads runs.
+static int export_render_range(struct export_thread_info *const tinfo) {
+    struct export_state *const state = tinfo->state;
+    struct export_buffer buffer = {0};
+    struct export_flat flat = {0};
+    int status = MMDB_SUCCESS;
+
+    for (size_t i = tinfo->first; i < state->record_count; i += tinfo->step) {
+        struct export_record *const record = &state->records[i];
+        MMDB_entry_s entry = {.mmdb = state->mmdb, .offset = record->offset};
+        MMDB_entry_data_list_s *entry_data_list = NULL;
+        status = MMDB_get_entry_data_list(&entry, &entry_data_list);
+        if (status == MMDB_SUCCESS && entry_data_list == NULL) {
+            status = MMDB_INVALID_DATA_ERROR;
+        }
+        if (status == MMDB_SUCCESS) {
+            if (state->csv) {
+                flat.path.length = 0;
+                flat.names.length = 0;
+                flat.values.length = 0;
+                flat.pair_count = 0;
+                export_csv_value(entry_data_list, &flat, &status);
+            } else {
+                buffer.length = 0;
+                export_json_value(entry_data_list, &buffer, &status);
+            }
+        }
+        MMDB_free_entry_data_list(entry_data_list);
+        if (status == MMDB_SUCCESS) {
+            if (state->csv) {
+                status = export_keep_fields(tinfo, &flat, record, i);
+            } else if (!export_keep_text(record, &buffer)) {
+                status = MMDB_OUT_OF_MEMORY_ERROR;
+            }
+        }
+        if (status != MMDB_SUCCESS) {
+            break;
+        }
+    }
+
+    free(buffer.data);
+    free(flat.path.data);
+    free(flat.names.data);
+    free(flat.values.data);
+    free(flat.pairs);
+    return status;
+}
+
+// Sets the text of the record to a copy of the buffer.
+static bool export_keep_text(struct export_record *const record,
+                             const struct export_buffer *const buffer) {
+    char *const text = malloc(buffer->length + 1);
+    if (!text) {
+        return false;
+    }
+    if (buffer->length != 0) {
+        memcpy(text, buffer->data, buffer->length);
+    }
+    text[buffer->length] = '\0';
+    record->text = text;
+    record->length = buffer->length;
+    return true;
+}
+
+// Renders all of the records, starting the threads once. For CSV, the rows are
+// put together once the threads have collected the columns.
+static bool export_render_records(struct export_state *const state) {
+    int thread_count = state->thread_count;
+#ifdef _WIN32
+    thread_count = 1;
+#else
+    if ((size_t)thread_count > state->record_count) {
+        thread_count = state->record_count == 0 ? 1 : (int)state->record_count;
+    }
+#endif
+    struct export_thread_info *const tinfo =
+        calloc((size_t)thread_count, sizeof(struct export_thread_info));
+    if (!tinfo) {
+        fprintf(stderr, "calloc(): %s\n", strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    int started = 0;
+#ifdef _WIN32
+    tinfo[0].state = state;
+    tinfo[0].first = 0;
+    tinfo[0].step = 1;
+    tinfo[0].status = export_render_range(&tinfo[0]);
+    started = 1;
+#else
+    for (; started < thread_count; started++) {
+        tinfo[started].state = state;
+        tinfo[started].first = (size_t)started;
+        tinfo[started].step = (size_t)thread_count;
+        if (pthread_create(&tinfo[started].id,
+                           NULL,
+                           &export_thread,
+                           &tinfo[started]) != 0) {
+            fprintf(stderr, "pthread_create() failed\n");
+            ok = false;
+            break;
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        if (pthread_join(tinfo[i].id, NULL) != 0) {
+            fprintf(stderr, "pthread_join() failed\n");
+            ok = false;
+        }
+    }
+#endif
+
+    for (int i = 0; ok && i < started; i++) {
+        const struct export_thread_info *const info = &tinfo[i];
+        if (info->status == MMDB_SUCCESS) {
+            continue;
+        }
+        if (info->duplicate) {
+            fprintf(stderr,
+                    "The record at data section offset %" PRIu32
+                    " has the column %s more than once\n",
+                    info->duplicate_offset,
+                    info->duplicate);
+        } else {
+            fprintf(stderr,
+                    "Got an error rendering the entry data - %s\n",
+                    MMDB_strerror(info->status));
+        }
+        ok = false;
+    }
+
+    if (ok && state->csv) {
+        ok = export_csv_columns(state, tinfo, started) &&
+             export_csv_rows(state, tinfo, started);
+    }
+
+    for (int i = 0; i < started; i++) {
+        export_free_columns(&tinfo[i].columns);
+        free(tinfo[i].column_map);
+    }
+    free(tinfo);
+    return ok;
+}
+
+static bool export_reserve(struct export_buffer *const buffer, size_t length) {
+    if (buffer->size - buffer->length > length) {
+        return true;
+    }
+    size_t size = buffer->size == 0 ? 256 : buffer->size;
+    while (size - buffer->length <= length) {
+        size *= 2;
+    }
+    char *const data = realloc(buffer->data, size);
+    if (!data) {
+        return false;
+    }
+    buffer->data = data;
+    buffer->size = size;
+    return true;
+}
+
+static bool export_append(struct export_buffer *const buffer,
+                          const char *const data,
+                          size_t length) {
+    if (!export_reserve(buffer, length)) {
+        return false;
+    }
+    if (length != 0) {
+        memcpy(buffer->data + buffer->length, data, length);
+    }
+    buffer->length += length;
+    return true;
+}
+
+static bool export_append_json_string(struct export_buffer *const buffer,
+                                      const char *const string,
+                                      size_t length) {
+    // The worst case is every byte becoming a \u00XX escape.
+    if (!export_reserve(buffer, length * 6 + 2)) {
+        return false;
+    }
+    char *out = buffer->data + buffer->length;
+    *out++ = '"';
+    for (size_t i = 0; i < length; i++) {
+        unsigned char const c = (unsigned char)string[i];
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = (char)c;
+        } else if (c == '\n') {
+            *out++ = '\\';
+            *out++ = 'n';
+        } else if (c == '\r') {
+            *out++ = '\\';
+            *out++ = 'r';
+        } else if (c == '\t') {
+            *out++ = '\\';
+            *out++ = 't';
+        } else if (c < 0x20) {
+            out += sprintf(out, "\\u%04x", c);
+        } else {
+            *out++ = (char)c;
+        }
+    }
+    *out++ = '"';
+    buffer->length = (size_t)(out - buffer->data);
+    return true;
+}
+
+static bool export_append_csv_field(struct export_buffer *const buffer,
+                                    const char *const field,
+                                    size_t length) {
+    bool quote = false;
+    for (size_t i = 0; i < length; i++) {
+        if (field[i] == '"' || field[i] == ',' || field[i] == '\n' ||
+            field[i] == '\r') {
+            quote = true;
+            break;
+        }
+    }
+    if (!quote) {
+        return export_append(buffer, field, length);
+    }
+
+    if (!export_reserve(buffer, length * 2 + 2)) {
+        return false;
+    }
+    char *out = buffer->data + buffer->length;
+    *out++ = '"';
+    for (size_t i = 0; i < length; i++) {
+        if (field[i] == '"') {
+            *out++ = '"';
+        }
+        *out++ = field[i];
+    }
+    *out++ = '"';
+    buffer->length = (size_t)(out - buffer->data);
+    return true;
+}
+
+// Appends the text for a value that is neither a map, an array nor a UTF-8
+// string. Bytes and 128-bit integers are written as hex digits, which the
+// caller needs to quote when writing JSON.
+static int export_append_scalar(struct export_buffer *const buffer,
+                                const MMDB_entry_data_s *const entry_data,
+                                bool json) {
+    char text[64];
+    int length = 0;
+
+    switch (entry_data->type) {
+        case MMDB_DATA_TYPE_BYTES:
+            if (!export_reserve(buffer, (size_t)entry_data->data_size * 2)) {
+                return MMDB_OUT_OF_MEMORY_ERROR;
+            }
+            for (uint32_t i = 0; i < entry_data->data_size; i++) {
+                buffer->length += (size_t)sprintf(buffer->data + buffer->length,
+                                                  "%02X",
+                                                  entry_data->bytes[i]);
+            }
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_DOUBLE:
+            // Use the shorter precision when it reads back as the same value.
+            if (isfinite(entry_data->double_value)) {
+                length = snprintf(
+                    text, sizeof(text), "%.15g", entry_data->double_value);
+                if (strtod(text, NULL) != entry_data->double_value) {
+                    length = snprintf(
+                        text, sizeof(text), "%.17g", entry_data->double_value);
+                }
+            } else if (json) {
+                length = snprintf(text, sizeof(text), "null");
+            }
+            break;
+        case MMDB_DATA_TYPE_FLOAT:
+            if (isfinite(entry_data->float_value)) {
+                length = snprintf(text,
+                                  sizeof(text),
+                                  "%.6g",
+                                  (double)entry_data->float_value);
+                if ((float)strtod(text, NULL) != entry_data->float_value) {
+                    length = snprintf(text,
+                                      sizeof(text),
+                                      "%.9g",
+                                      (double)entry_data->float_value);
+                }
+            } else if (json) {
+                length = snprintf(text, sizeof(text), "null");
+            }
+            break;
+        case MMDB_DATA_TYPE_UINT16:
+            length = snprintf(text, sizeof(text), "%u", entry_data->uint16);
+            break;
+        case MMDB_DATA_TYPE_UINT32:
+            length =
+                snprintf(text, sizeof(text), "%" PRIu32, entry_data->uint32);
+            break;
+        case MMDB_DATA_TYPE_INT32:
+            length =
+                snprintf(text, sizeof(text), "%" PRId32, entry_data->int32);
+            break;
+        case MMDB_DATA_TYPE_UINT64:
+            length =
+                snprintf(text, sizeof(text), "%" PRIu64, entry_data->uint64);
+            break;
+        case MMDB_DATA_TYPE_UINT128:
+#if MMDB_UINT128_IS_BYTE_ARRAY
+            for (int i = 0; i < 16; i++) {
+                length += snprintf(text + length,
+                                   sizeof(text) - (size_t)length,
+                                   "%02X",
+                                   entry_data->uint128[i]);
+            }
+#else
+            length = snprintf(text,
+                              sizeof(text),
+                              "%016" PRIX64 "%016" PRIX64,
+                              (uint64_t)(entry_data->uint128 >> 64),
+                              (uint64_t)entry_data->uint128);
+#endif
+            break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            length = snprintf(text,
+                              sizeof(text),
+                              "%s",
+                              entry_data->boolean ? "true" : "false");
+            break;
+        default:
+            return MMDB_INVALID_DATA_ERROR;
+    }
+
+    if (!export_append(buffer, text, (size_t)length)) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    return MMDB_SUCCESS;
+}
+
+static MMDB_entry_data_list_s *
+export_json_value(MMDB_entry_data_list_s *entry_data_list,
+                  struct export_buffer *const buffer,
+                  int *const status) {
+    const MMDB_entry_data_s *const entry_data = &entry_data_list->entry_data;
+
+    switch (entry_data->type) {
+        case MMDB_DATA_TYPE_MAP: {
+            if (!export_append(buffer, "{", 1)) {
+                goto out_of_memory;
+            }
+            uint32_t size = entry_data->data_size;
+            for (entry_data_list = entry_data_list->next;
+                 size && entry_data_list;
+                 size--) {
+                const MMDB_entry_data_s *const key =
+                    &entry_data_list->entry_data;
+                if (MMDB_DATA_TYPE_UTF8_STRING != key->type) {
+                    *status = MMDB_INVALID_DATA_ERROR;
+                    return NULL;
+                }
+                if ((size != entry_data->data_size &&
+                     !export_append(buffer, ",", 1)) ||
+                    !export_append_json_string(
+                        buffer, key->utf8_string, key->data_size) ||
+                    !export_append(buffer, ":", 1)) {
+                    goto out_of_memory;
+                }
+
+                entry_data_list = export_json_value(
+                    entry_data_list->next, buffer, status);
+                if (MMDB_SUCCESS != *status) {
+                    return NULL;
+                }
+            }
+            if (!export_append(buffer, "}", 1)) {
+                goto out_of_memory;
+            }
+        } break;
+        case MMDB_DATA_TYPE_ARRAY: {
+            if (!export_append(buffer, "[", 1)) {
+                goto out_of_memory;
+            }
+            uint32_t size = entry_data->data_size;
+            for (entry_data_list = entry_data_list->next;
+                 size && entry_data_list;
+                 size--) {
+                if (size != entry_data->data_size &&
+                    !export_append(buffer, ",", 1)) {
+                    goto out_of_memory;
+                }
+                entry_data_list =
+                    export_json_value(entry_data_list, buffer, status);
+                if (MMDB_SUCCESS != *status) {
+                    return NULL;
+                }
+            }
+            if (!export_append(buffer, "]", 1)) {
+                goto out_of_memory;
+            }
+        } break;
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            if (!export_append_json_string(
+                    buffer, entry_data->utf8_string, entry_data->data_size)) {
+                goto out_of_memory;
+            }
+            entry_data_list = entry_data_list->next;
+            break;
+        case MMDB_DATA_TYPE_BYTES:
+        case MMDB_DATA_TYPE_UINT128:
+            if (!export_append(buffer, "\"", 1)) {
+                goto out_of_memory;
+            }
+            *status = export_append_scalar(buffer, entry_data, true);
+            if (MMDB_SUCCESS != *status) {
+                return NULL;
+            }
+            if (!export_append(buffer, "\"", 1)) {
+                goto out_of_memory;
+            }
+            entry_data_list = entry_data_list->next;
+            break;
+        default:
+            *status = export_append_scalar(buffer, entry_data, true);
+            if (MMDB_SUCCESS != *status) {
+                return NULL;
+            }
+            entry_data_list = entry_data_list->next;
+            break;
+    }
+
+    *status = MMDB_SUCCESS;
+    return entry_data_list;
+
+out_of_memory:
+    *status = MMDB_OUT_OF_MEMORY_ERROR;
+    return NULL;
+}
+
+// Flattens a value into pairs, where the name of each pair is the path to the
+// value with the map keys and array indexes joined by dots. A dot or a
+// backslash in a map key is escaped with a backslash, so a key containing a
+// dot can't give the same name as a nested map.
+static MMDB_entry_data_list_s *
+export_csv_value(MMDB_entry_data_list_s *entry_data_list,
+                 struct export_flat *const flat,
+                 int *const status) {
+    const MMDB_entry_data_s *const entry_data = &entry_data_list->entry_data;
+    struct export_buffer *const path = &flat->path;
+    size_t const path_length = path->length;
+
+    switch (entry_data->type) {
+        case MMDB_DATA_TYPE_MAP: {
+            uint32_t size = entry_data->data_size;
+            for (entry_data_list = entry_data_list->next;
+                 size && entry_data_list;
+                 size--) {
+                const MMDB_entry_data_s *const map_key =
+                    &entry_data_list->entry_data;
+                if (MMDB_DATA_TYPE_UTF8_STRING != map_key->type) {
+                    *status = MMDB_INVALID_DATA_ERROR;
+                    return NULL;
+                }
+                path->length = path_length;
+                if ((path_length != 0 && !export_append(path, ".", 1)) ||
+                    !export_append_path_key(
+                        path, map_key->utf8_string, map_key->data_size)) {
+                    goto out_of_memory;
+                }
+
+                entry_data_list =
+                    export_csv_value(entry_data_list->next, flat, status);
+                if (MMDB_SUCCESS != *status) {
+                    return NULL;
+                }
+            }
+        } break;
+        case MMDB_DATA_TYPE_ARRAY: {
+            uint32_t i = 0;
+            for (entry_data_list = entry_data_list->next;
+                 i < entry_data->data_size && entry_data_list;
+                 i++) {
+                char index[16];
+                int const index_length = snprintf(index,
+                                                  sizeof(index),
+                                                  "%s%" PRIu32,
+                                                  path_length != 0 ? "." : "",
+                                                  i);
+                path->length = path_length;
+                if (!export_append(path, index, (size_t)index_length)) {
+                    goto out_of_memory;
+                }
+
+                entry_data_list =
+                    export_csv_value(entry_data_list, flat, status);
+                if (MMDB_SUCCESS != *status) {
+                    return NULL;
+                }
+            }
+        } break;
+        default: {
+            if (flat->pair_count == flat->pairs_size) {
+                size_t const size =
+                    flat->pairs_size == 0 ? 16 : flat->pairs_size * 2;
+                struct export_pair *const pairs =
+                    realloc(flat->pairs, size * sizeof(struct export_pair));
+                if (!pairs) {
+                    goto out_of_memory;
+                }
+                flat->pairs = pairs;
+                flat->pairs_size = size;
+            }
+            struct export_pair *const pair = &flat->pairs[flat->pair_count];
+
+            // A record that is not a map or an array gets a single column.
+            pair->name = flat->names.length;
+            pair->name_length = path_length != 0 ? path_length : 4;
+            if (!export_append(&flat->names,
+                               path_length != 0 ? path->data : "data",
+                               pair->name_length)) {
+                goto out_of_memory;
+            }
+
+            pair->value = flat->values.length;
+            if (MMDB_DATA_TYPE_UTF8_STRING == entry_data->type) {
+                if (!export_append_csv_field(&flat->values,
+                                             entry_data->utf8_string,
+                                             entry_data->data_size)) {
+                    goto out_of_memory;
+                }
+            } else {
+                *status =
+                    export_append_scalar(&flat->values, entry_data, false);
+                if (MMDB_SUCCESS != *status) {
+                    return NULL;
+                }
+            }
+            pair->value_length = flat->values.length - pair->value;
+            flat->pair_count++;
+            entry_data_list = entry_data_list->next;
+        } break;
+    }
+
+    path->length = path_length;
+    *status = MMDB_SUCCESS;
+    return entry_data_list;
+
+out_of_memory:
+    *status = MMDB_OUT_OF_MEMORY_ERROR;
+    return NULL;
+}
+
+static bool export_append_path_key(struct export_buffer *const path,
+                                   const char *const key,
+                                   size_t length) {
+    if (!export_reserve(path, length * 2)) {
+        return false;
+    }
+    char *out = path->data + path->length;
+    for (size_t i = 0; i < length; i++) {
+        if (key[i] == '.' || key[i] == '\\') {
+            *out++ = '\\';
+        }
+        *out++ = key[i];
+    }
+    path->length = (size_t)(out - path->data);
+    return true;
+}
+
+// Keeps the values of a flattened record as its text along with a field for
+// each value, and adds the columns of the fields to the thread's columns. A
+// record with the same column twice, such as a map with a repeated key, can't
+// be written as a CSV row.
+static int export_keep_fields(struct export_thread_info *const tinfo,
+                              const struct export_flat *const flat,
+                              struct export_record *const record,
+                              size_t index) {
+    if (flat->pair_count != 0) {
+        record->fields = malloc(flat->pair_count * sizeof(struct export_field));
+        if (!record->fields) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+    }
+
+    for (size_t i = 0; i < flat->pair_count; i++) {
+        const struct export_pair *const pair = &flat->pairs[i];
+        struct export_column *const column =
+            export_add_column(&tinfo->columns,
+                              flat->names.data + pair->name,
+                              pair->name_length);
+        if (!column) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        if (column->last_record == index + 1) {
+            tinfo->duplicate = column->name;
+            tinfo->duplicate_offset = record->offset;
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        column->last_record = index + 1;
+        record->fields[i] = (struct export_field){
+            .column = (size_t)(column - tinfo->columns.columns),
+            .value = pair->value,
+            .length = pair->value_length,
+        };
+    }
+    record->field_count = flat->pair_count;
+
+    return export_keep_text(record, &flat->values) ? MMDB_SUCCESS
+                                                   : MMDB_OUT_OF_MEMORY_ERROR;
+}
+
+// Puts together the CSV row of a record from the fields it kept, with an empty
+// field for each column the record doesn't have, and replaces the record's
+// text with the row.
+static bool export_csv_row(const struct export_columns *const columns,
+                           const size_t *const column_map,
+                           struct export_record *const record,
+                           const struct export_field **const row,
+                           struct export_buffer *const buffer) {
+    memset(row, 0, columns->count * sizeof(struct export_field *));
+    for (size_t i = 0; i < record->field_count; i++) {
+        row[column_map[record->fields[i].column]] = &record->fields[i];
+    }
+
+    buffer->length = 0;
+    for (size_t c = 0; c < columns->count; c++) {
+        if ((c != 0 && !export_append(buffer, ",", 1)) ||
+            (row[c] != NULL && !export_append(buffer,
+                                              record->text + row[c]->value,
+                                              row[c]->length))) {
+            return false;
+        }
+    }
+
+    char *const values = record->text;
+    if (!export_keep_text(record, buffer)) {
+        return false;
+    }
+    free(values);
+    free(record->fields);
+    record->fields = NULL;
+    record->field_count = 0;
+    return true;
+}
+
+static size_t export_hash_column(const char *const name, size_t length) {
+    // FNV-1a
+    uint32_t hash = UINT32_C(2166136261);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= UINT32_C(16777619);
+    }
+    return hash;
+}
+
+// Returns the slot for the column in the table, which is either the slot
+// holding the column's index plus one or the empty slot where it belongs.
+static size_t *export_column_slot(const struct export_columns *const columns,
+                                  const char *const name,
+                                  size_t length) {
+    size_t const mask = columns->table_size - 1;
+    size_t i = export_hash_column(name, length) & mask;
+    while (columns->table[i] != 0) {
+        const struct export_column *const column =
+            &columns->columns[columns->table[i] - 1];
+        if (column->length == length &&
+            memcmp(column->name, name, length) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &columns->table[i];
+}
+
+// Rebuilds the table of the columns with table_size slots.
+static bool export_index_columns(struct export_columns *const columns,
+                                 size_t table_size) {
+    size_t *const table = calloc(table_size, sizeof(size_t));
+    if (!table) {
+        return false;
+    }
+    free(columns->table);
+    columns->table = table;
+    columns->table_size = table_size;
+    for (size_t c = 0; c < columns->count; c++) {
+        *export_column_slot(
+            columns, columns->columns[c].name, columns->columns[c].length) =
+            c + 1;
+    }
+    return true;
+}
+
+// Returns the column with the name, adding it to the columns if it isn't
+// there yet, or NULL if we run out of memory.
+static struct export_column *
+export_add_column(struct export_columns *const columns,
+                  const char *const name,
+                  size_t length) {
+    if (columns->table_size == 0 && !export_index_columns(columns, 1024)) {
+        return NULL;
+    }
+    size_t *const slot = export_column_slot(columns, name, length);
+    if (*slot != 0) {
+        return &columns->columns[*slot - 1];
+    }
+
+    if (columns->count == columns->size) {
+        size_t const size = columns->size == 0 ? 64 : columns->size * 2;
+        struct export_column *const array =
+            realloc(columns->columns, size * sizeof(struct export_column));
+        if (!array) {
+            return NULL;
+        }
+        columns->columns = array;
+        columns->size = size;
+    }
+    struct export_column *const column = &columns->columns[columns->count];
+    column->name = malloc(length + 1);
+    if (!column->name) {
+        return NULL;
+    }
+    memcpy(column->name, name, length);
+    column->name[length] = '\0';
+    column->length = length;
+    column->last_record = 0;
+    columns->count++;
+    *slot = columns->count;
+
+    // Keep the table at most half full.
+    if (columns->count * 2 > columns->table_size &&
+        !export_index_columns(columns, columns->table_size * 2)) {
+        return NULL;
+    }
+    return column;
+}
+
+static void export_free_columns(struct export_columns *const columns) {
+    for (size_t c = 0; c < columns->count; c++) {
+        free(columns->columns[c].name);
+    }
+    free(columns->columns);
+    free(columns->table);
+    *columns = (struct export_columns){0};
+}
+
+static int export_compare_columns(const void *a, const void *b) {
+    const struct export_column *const column_a = a;
+    const struct export_column *const column_b = b;
+    size_t const length = column_a->length < column_b->length
+                              ? column_a->length
+                              : column_b->length;
+    int const cmp = memcmp(column_a->name, column_b->name, length);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return column_a->length < column_b->length
+               ? -1
+               : column_a->length > column_b->length;
+}
+
+// Merges the columns found by the threads into the CSV columns, sorted by name,
+// and maps each thread's columns to their index in the CSV columns.
+static bool export_csv_columns(struct export_state *const state,
+                               struct export_thread_info *const tinfo,
+                               int thread_count) {
+    struct export_columns *const columns = &state->columns;
+    for (int t = 0; t < thread_count; t++) {
+        const struct export_columns *const found = &tinfo[t].columns;
+        for (size_t c = 0; c < found->count; c++) {
+            if (!export_add_column(columns,
+                                   found->columns[c].name,
+                                   found->columns[c].length)) {
+                goto out_of_memory;
+            }
+        }
+    }
+
+    if (columns->count > 1) {
+        qsort(columns->columns,
+              columns->count,
+              sizeof(struct export_column),
+              export_compare_columns);
+    }
+    if (!export_index_columns(columns,
+                              columns->table_size == 0 ? 1024
+                                                       : columns->table_size)) {
+        goto out_of_memory;
+    }
+
+    for (int t = 0; t < thread_count; t++) {
+        const struct export_columns *const found = &tinfo[t].columns;
+        if (found->count == 0) {
+            continue;
+        }
+        tinfo[t].column_map = malloc(found->count * sizeof(size_t));
+        if (!tinfo[t].column_map) {
+            goto out_of_memory;
+        }
+        for (size_t c = 0; c < found->count; c++) {
+            size_t const *const slot = export_column_slot(
+                columns, found->columns[c].name, found->columns[c].length);
+            tinfo[t].column_map[c] = *slot - 1;
+        }
+    }
+    return true;
+
+out_of_memory:
+    fprintf(stderr, "Could not allocate memory for the CSV columns\n");
+    return false;
+}
+
+// Puts together the CSV row of every record. Record i was flattened by thread
+// i % thread_count, so that thread's columns are the ones its fields refer to.
+static bool export_csv_rows(struct export_state *const state,
+                            const struct export_thread_info *const tinfo,
+                            int thread_count) {
+    struct export_buffer buffer = {0};
+    const struct export_field **const row =
+        calloc(state->columns.count + 1, sizeof(struct export_field *));
+    bool ok = row != NULL;
+    for (size_t i = 0; ok && i < state->record_count; i++) {
+        ok = export_csv_row(&state->columns,
+                            tinfo[i % (size_t)thread_count].column_map,
+                            &state->records[i],
+                            row,
+                            &buffer);
+    }
+    free(buffer.data);
+    free(row);
+    if (!ok) {
+        fprintf(stderr, "Could not allocate memory for the CSV rows\n");
+    }
+    return ok;
+}
+
+static bool export_write_networks(struct export_state *const state) {
+    if (state->csv) {
+        struct export_buffer header = {0};
+        bool ok = export_append(&header, "network", 7);
+        for (size_t c = 0; ok && c < state->columns.count; c++) {
+            ok = export_append(&header, ",", 1) &&
+                 export_append_csv_field(&header,
+                                         state->columns.columns[c].name,
+                                         state->columns.columns[c].length);
+        }
+        if (ok) {
+            fwrite(header.data, 1, header.length, stdout);
+            fputc('\n', stdout);
+        }
+        free(header.data);
+        if (!ok) {
+            fprintf(stderr, "Could not allocate memory for the CSV header\n");
+            return false;
+        }
+    }
+
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init_subtree(
+        &state->subtree, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_network_iterator_init_subtree(): %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        if (network.found_entry && !export_write_network(state, &network)) {
+            return false;
+        }
+    }
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_network_iterator_next(): %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        fprintf(stderr, "Error writing the export: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Writes a network along with the rendered text of its record.
+static bool export_write_network(const struct export_state *const state,
+                                 const MMDB_network_s *const network) {
+    const struct export_record *const record =
+        export_find_record(state, network->entry.offset);
+    if (!record) {
+        fprintf(stderr, "No record found for data section offset\n");
+        return false;
+    }
+
+    char address[INET6_ADDRSTRLEN];
+    if (!inet_ntop(network->ip_version == 4 ? AF_INET : AF_INET6,
+                   network->address,
+                   address,
+                   sizeof(address))) {
+        fprintf(stderr, "inet_ntop(): %s\n", strerror(errno));
+        return false;
+    }
+
+    if (state->csv) {
+        fprintf(stdout, "%s/%d,", address, network->netmask);
+    } else {
+        fprintf(stdout,
+                "{\"network\":\"%s/%d\",\"data\":",
+                address,
+                network->netmask);
+    }
+    fwrite(record->text, 1, record->length, stdout);
+    fputs(state->csv ? "\n" : "}\n", stdout);
+    return true;
+}
+
 #ifndef _WIN32
 struct thread_info {
     pthread_t id;
@@ -787,4 +2128,10 @@ static void *thread(void *arg) {
 
     return NULL;
 }
+
+static void *export_thread(void *arg) {
+    struct export_thread_info *const tinfo = arg;
+    tinfo->status = export_render_range(tinfo);
+    return NULL;
+}
 #endif
@@ -0,0 +1,309 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include "maxminddb_writer.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <libgen.h>
+#endif
+
+#define CACHE_LINE_SIZE (64)
+#define PAGE_SIZE (4096)
+
+struct options {
+    const char *file;
+    const char *output;
+    int layout;
+    bool quiet;
+};
+
+struct path_costs {
+    unsigned long long networks;
+    unsigned long long cache_lines;
+    unsigned long long pages;
+};
+
+static void usage(char *program, int exit_code, const char *error);
+static void get_options(int argc, char **argv, struct options *const options);
+static bool optimize(const struct options *const options);
+static bool measure_paths(const MMDB_s *const mmdb,
+                          struct path_costs *const costs);
+static void print_costs(const char *const name,
+                        unsigned long long before,
+                        unsigned long long after,
+                        unsigned long long networks);
+
+int main(int argc, char **argv) {
+    struct options options = {
+        .layout = MMDB_WRITER_LAYOUT_VAN_EMDE_BOAS,
+    };
+
+    get_options(argc, argv, &options);
+
+    return optimize(&options) ? 0 : 1;
+}
+
+static void usage(char *program, int exit_code, const char *error) {
+    if (NULL != error) {
+        fprintf(stderr, "\n  *ERROR: %s\n", error);
+    }
+
+    char *usage =
+        "\n"
+        "  %s --file /path/to/file.mmdb --output /path/to/optimized.mmdb\n"
+        "\n"
+        "  This application accepts the following options:\n"
+        "\n"
+        "      --file (-f)     The path to the MMDB file to optimize. "
+        "Required.\n"
+        "\n"
+        "      --output (-o)   The path of the MMDB file to write. Required.\n"
+        "\n"
+        "      --layout        How to lay out the search tree: "
+        "van-emde-boas,\n"
+        "                      blocked or depth-first. Defaults to "
+        "van-emde-boas.\n"
+        "\n"
+        "      --quiet (-q)    Don't print how many cache lines and pages a "
+        "lookup\n"
+        "                      touches before and after.\n"
+        "\n"
+        "      --version       Print the program's version number and exit.\n"
+        "\n"
+        "      --help (-h -?)  Show usage information.\n"
+        "\n";
+
+    fprintf(stdout, usage, program);
+    exit(exit_code);
+}
+
+static void get_options(int argc, char **argv, struct options *const options) {
+    static int help = 0;
+    static int version = 0;
+
+    enum {
+        OPTION_LAYOUT = 256,
+        OPTION_VERSION,
+    };
+
+#ifdef _WIN32
+    char *program = alloca(strlen(argv[0]) + 1);
+    _splitpath(argv[0], NULL, NULL, program, NULL);
+    _splitpath(argv[0], NULL, NULL, NULL, program + strlen(program));
+#else
+    char *program = basename(argv[0]);
+#endif
+
+    while (1) {
+        static struct option long_options[] = {
+            {"file", required_argument, 0, 'f'},
+            {"output", required_argument, 0, 'o'},
+            {"layout", required_argument, 0, OPTION_LAYOUT},
+            {"quiet", no_argument, 0, 'q'},
+            {"version", no_argument, 0, OPTION_VERSION},
+            {"help", no_argument, 0, 'h'},
+            {"?", no_argument, 0, 1},
+            {0, 0, 0, 0}};
+
+        int opt_index;
+        int opt_char =
+            getopt_long(argc, argv, "f:o:qh?", long_options, &opt_index);
+
+        if (-1 == opt_char) {
+            break;
+        }
+
+        if ('f' == opt_char) {
+            options->file = optarg;
+        } else if ('o' == opt_char) {
+            options->output = optarg;
+        } else if (OPTION_LAYOUT == opt_char) {
+            if (strcmp(optarg, "van-emde-boas") == 0) {
+                options->layout = MMDB_WRITER_LAYOUT_VAN_EMDE_BOAS;
+            } else if (strcmp(optarg, "blocked") == 0) {
+                options->layout = MMDB_WRITER_LAYOUT_BLOCKED;
+            } else if (strcmp(optarg, "depth-first") == 0) {
+                options->layout = MMDB_WRITER_LAYOUT_DEPTH_FIRST;
+            } else {
+                usage(program,
+                      1,
+                      "The --layout must be van-emde-boas, blocked or "
+                      "depth-first");
+            }
+        } else if ('q' == opt_char) {
+            options->quiet = true;
+        } else if (OPTION_VERSION == opt_char) {
+            version = 1;
+        } else if ('h' == opt_char || '?' == opt_char) {
+            help = 1;
+        }
+    }
+
+    if (help) {
+        usage(program, 0, NULL);
+    }
+
+    if (version) {
+        fprintf(stdout, "\n  %s version %s\n\n", program, PACKAGE_VERSION);
+        exit(0);
+    }
+
+    if (NULL == options->file) {
+        usage(program, 1, "You must provide a filename with --file");
+    }
+
+    if (NULL == options->output) {
+        usage(program, 1, "You must provide a filename with --output");
+    }
+}
+
+static bool optimize(const struct options *const options) {
+    MMDB_s mmdb;
+    int status = MMDB_open(options->file, MMDB_MODE_MMAP, &mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                options->file,
+                MMDB_strerror(status));
+        return false;
+    }
+
+    status = MMDB_writer_relayout(&mmdb, options->output, options->layout);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_writer_relayout(): %s: %s\n",
+                options->output,
+                MMDB_strerror(status));
+        MMDB_close(&mmdb);
+        return false;
+    }
+
+    if (options->quiet) {
+        MMDB_close(&mmdb);
+        return true;
+    }
+
+    MMDB_s optimized;
+    status = MMDB_open(options->output, MMDB_MODE_MMAP, &optimized);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                options->output,
+                MMDB_strerror(status));
+        MMDB_close(&mmdb);
+        return false;
+    }
+
+    struct path_costs before = {0};
+    struct path_costs after = {0};
+    bool const ok =
+        measure_paths(&mmdb, &before) && measure_paths(&optimized, &after);
+    if (ok) {
+        fprintf(stdout,
+                "\n  Looking up each of the %llu networks touches on average:\n"
+                "\n",
+                before.networks);
+        print_costs("cache lines",
+                    before.cache_lines,
+                    after.cache_lines,
+                    before.networks);
+        print_costs("pages", before.pages, after.pages, before.networks);
+        fprintf(stdout, "\n");
+    }
+
+    MMDB_close(&optimized);
+    MMDB_close(&mmdb);
+    return ok;
+}
+
+// Counts how many different cache lines and pages of the search tree the
+// lookup of each network with data reads.
+static bool measure_paths(const MMDB_s *const mmdb,
+                          struct path_costs *const costs) {
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init(
+        mmdb, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_network_iterator_init(): %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        uint8_t address[16] = {0};
+        uint16_t depth = network.netmask;
+        if (network.ip_version == 4 && mmdb->metadata.ip_version == 6) {
+            memcpy(address + 12, network.address, 4);
+            depth += 96;
+        } else {
+            memcpy(address, network.address, sizeof(address));
+        }
+
+        // A lookup rarely comes back to a line or page it has left, so
+        // counting the changes is close enough to counting distinct ones.
+        uint64_t line = UINT64_MAX;
+        uint64_t page = UINT64_MAX;
+        uint32_t node = 0;
+        for (uint16_t bit = 0; bit < depth; bit++) {
+            uint64_t const offset =
+                (uint64_t)node * mmdb->full_record_byte_size;
+            if (offset / CACHE_LINE_SIZE != line) {
+                line = offset / CACHE_LINE_SIZE;
+                costs->cache_lines++;
+            }
+            if (offset / PAGE_SIZE != page) {
+                page = offset / PAGE_SIZE;
+                costs->pages++;
+            }
+
+            MMDB_search_node_s search_node;
+            status = MMDB_read_node(mmdb, node, &search_node);
+            if (status != MMDB_SUCCESS) {
+                break;
+            }
+            uint64_t const record = (address[bit >> 3] >> (7 - bit % 8)) & 1
+                                        ? search_node.right_record
+                                        : search_node.left_record;
+            if (record >= mmdb->metadata.node_count) {
+                break;
+            }
+            node = (uint32_t)record;
+        }
+        costs->networks++;
+    }
+
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "Error reading the search tree: %s\n",
+                MMDB_strerror(status));
+        return false;
+    }
+    return true;
+}
+
+static void print_costs(const char *const name,
+                        unsigned long long before,
+                        unsigned long long after,
+                        unsigned long long networks) {
+    double const divisor = networks > 0 ? (double)networks : 1.0;
+
+    fprintf(stdout,
+            "    %-12s %6.2f before, %6.2f after\n",
+            name,
+            (double)before / divisor,
+            (double)after / divisor);
+}
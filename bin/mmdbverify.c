@@ -0,0 +1,330 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include <errno.h>
+#include <getopt.h>
+#ifndef _WIN32
+    #include <pthread.h>
+#endif
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <arpa/inet.h>
+    #include <libgen.h>
+    #include <unistd.h>
+#endif
+
+// Each thread verifies every thread_count'th subtree of the search tree at
+// this depth, which gives a few hundred subtrees for both IPv4 and IPv6
+// databases.
+#define SUBTREE_NETMASK (8)
+
+struct options {
+    const char *mmdb_file;
+    int thread_count;
+};
+
+struct verify_state {
+    const MMDB_network_subtree_s *subtrees;
+    size_t subtree_count;
+    // The status of each subtree, so that the invalid ones can be reported
+    // in address order.
+    int *statuses;
+};
+
+#ifndef _WIN32
+struct verify_thread_info {
+    pthread_t id;
+    struct verify_state *state;
+    size_t first;
+    size_t step;
+};
+#endif
+
+static void usage(char *program, int exit_code, const char *error);
+static void get_options(int argc, char **argv, struct options *const options);
+static bool verify_subtrees(struct verify_state *const state, int thread_count);
+static void verify_range(struct verify_state *const state,
+                         size_t first,
+                         size_t step);
+#ifndef _WIN32
+static void *verify_thread(void *arg);
+#endif
+static void print_subtree(const MMDB_network_subtree_s *const subtree);
+
+int main(int argc, char **argv) {
+    struct options options = {0};
+
+    get_options(argc, argv, &options);
+
+    MMDB_s mmdb;
+    int status = MMDB_open(options.mmdb_file, MMDB_MODE_MMAP, &mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                options.mmdb_file,
+                MMDB_strerror(status));
+        exit(1);
+    }
+
+    int exit_code = 1;
+    MMDB_network_subtree_s *subtrees = NULL;
+    struct verify_state state = {0};
+
+    status = MMDB_verify_metadata(&mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "%s: invalid metadata: %s\n",
+                options.mmdb_file,
+                MMDB_strerror(status));
+        goto end;
+    }
+
+    // This walks the top of the search tree, so it is also the first part
+    // of verifying it.
+    size_t count;
+    status = MMDB_get_network_subtrees(
+        &mmdb, SUBTREE_NETMASK, 0, &subtrees, &count);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "%s: invalid search tree: %s\n",
+                options.mmdb_file,
+                MMDB_strerror(status));
+        goto end;
+    }
+
+    state.subtrees = subtrees;
+    state.subtree_count = count;
+    state.statuses = calloc(count == 0 ? 1 : count, sizeof(int));
+    if (!state.statuses) {
+        fprintf(stderr, "calloc(): %s\n", strerror(errno));
+        goto end;
+    }
+    if (!verify_subtrees(&state, options.thread_count)) {
+        goto end;
+    }
+
+    exit_code = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (state.statuses[i] != MMDB_SUCCESS) {
+            fprintf(stderr, "%s: ", options.mmdb_file);
+            print_subtree(&subtrees[i]);
+            fprintf(stderr, ": %s\n", MMDB_strerror(state.statuses[i]));
+            exit_code = 1;
+        }
+    }
+
+end:
+    free(state.statuses);
+    MMDB_free_network_subtrees(subtrees);
+    MMDB_close(&mmdb);
+    return exit_code;
+}
+
+static void usage(char *program, int exit_code, const char *error) {
+    if (NULL != error) {
+        fprintf(stderr, "\n  *ERROR: %s\n", error);
+    }
+
+    char *usage =
+        "\n"
+        "  %s [options] /path/to/db.mmdb\n"
+        "\n"
+        "  This application checks the whole of a database: its metadata, "
+        "every\n"
+        "  node of the search tree, and all of the data that the search tree "
+        "points\n"
+        "  to. It prints the networks with invalid nodes or data and exits "
+        "with 1\n"
+        "  if any are found.\n"
+        "\n"
+        "  This application accepts the following options:\n"
+        "\n"
+        "      --threads (-t) [number]\n"
+        "                      The number of threads to verify the database "
+        "with.\n"
+        "                      The default is one for each CPU.\n"
+        "\n"
+        "      --version       Print the program's version number and exit.\n"
+        "\n"
+        "      --help (-h -?)  Show usage information.\n"
+        "\n";
+
+    fprintf(stdout, usage, program);
+    exit(exit_code);
+}
+
+static void get_options(int argc, char **argv, struct options *const options) {
+    static int help = 0;
+    static int version = 0;
+
+    enum {
+        OPTION_VERSION = 256,
+    };
+
+#ifdef _WIN32
+    char *program = alloca(strlen(argv[0]) + 1);
+    _splitpath(argv[0], NULL, NULL, program, NULL);
+    _splitpath(argv[0], NULL, NULL, NULL, program + strlen(program));
+#else
+    char *program = basename(argv[0]);
+#endif
+
+    while (1) {
+        static struct option long_options[] = {
+            {"threads", required_argument, 0, 't'},
+            {"version", no_argument, 0, OPTION_VERSION},
+            {"help", no_argument, 0, 'h'},
+            {"?", no_argument, 0, 1},
+            {0, 0, 0, 0}};
+
+        int opt_index;
+        int opt_char =
+            getopt_long(argc, argv, "t:h?", long_options, &opt_index);
+
+        if (-1 == opt_char) {
+            break;
+        }
+
+        if ('t' == opt_char) {
+            char *end;
+            errno = 0;
+            long const threads = strtol(optarg, &end, 10);
+            if (errno != 0 || *end != '\0' || threads < 1 ||
+                threads > INT_MAX) {
+                usage(program, 1, "The number of threads must be positive");
+            }
+            options->thread_count = (int)threads;
+        } else if (OPTION_VERSION == opt_char) {
+            version = 1;
+        } else if ('h' == opt_char || '?' == opt_char) {
+            help = 1;
+        }
+    }
+
+    if (help) {
+        usage(program, 0, NULL);
+    }
+
+    if (version) {
+        fprintf(stdout, "\n  %s version %s\n\n", program, PACKAGE_VERSION);
+        exit(0);
+    }
+
+    if (argc - optind != 1) {
+        usage(program, 1, "You must provide one database to verify");
+    }
+
+    options->mmdb_file = argv[optind];
+}
+
+static bool verify_subtrees(struct verify_state *const state,
+                            int thread_count) {
+#ifdef _WIN32
+    (void)thread_count;
+    verify_range(state, 0, 1);
+#else
+    if (thread_count <= 0) {
+        thread_count = 1;
+    #if defined(_SC_NPROCESSORS_ONLN)
+        long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 1) {
+            thread_count = cpus > INT_MAX ? INT_MAX : (int)cpus;
+        }
+    #endif
+    }
+    if ((size_t)thread_count > state->subtree_count) {
+        thread_count =
+            state->subtree_count == 0 ? 1 : (int)state->subtree_count;
+    }
+
+    struct verify_thread_info *const tinfo =
+        calloc((size_t)thread_count, sizeof(struct verify_thread_info));
+    if (!tinfo) {
+        fprintf(stderr, "calloc(): %s\n", strerror(errno));
+        return false;
+    }
+
+    int started = 0;
+    for (; started < thread_count; started++) {
+        tinfo[started].state = state;
+        tinfo[started].first = (size_t)started;
+        tinfo[started].step = (size_t)thread_count;
+        if (pthread_create(&tinfo[started].id,
+                           NULL,
+                           &verify_thread,
+                           &tinfo[started]) != 0) {
+            fprintf(stderr, "pthread_create() failed\n");
+            break;
+        }
+    }
+
+    bool joined = true;
+    for (int i = 0; i < started; i++) {
+        if (pthread_join(tinfo[i].id, NULL) != 0) {
+            fprintf(stderr, "pthread_join() failed\n");
+            joined = false;
+        }
+    }
+    free(tinfo);
+
+    if (started != thread_count || !joined) {
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+static void verify_range(struct verify_state *const state,
+                         size_t first,
+                         size_t step) {
+    for (size_t i = first; i < state->subtree_count; i += step) {
+        state->statuses[i] = MMDB_verify_subtree(&state->subtrees[i]);
+    }
+}
+
+#ifndef _WIN32
+static void *verify_thread(void *arg) {
+    struct verify_thread_info *const info = arg;
+    verify_range(info->state, info->first, info->step);
+    return NULL;
+}
+#endif
+
+static void print_subtree(const MMDB_network_subtree_s *const subtree) {
+    const MMDB_s *const mmdb = subtree->mmdb;
+    char address[INET6_ADDRSTRLEN];
+    const uint8_t *bytes = subtree->address;
+    int family = AF_INET6;
+    uint16_t netmask = subtree->depth;
+
+    if (mmdb->metadata.ip_version == 4) {
+        family = AF_INET;
+    } else if (netmask >= 96) {
+        // The IPv4 networks of an IPv6 database are under ::/96.
+        static const uint8_t zeros[12] = {0};
+        if (memcmp(bytes, zeros, sizeof(zeros)) == 0) {
+            family = AF_INET;
+            bytes += 12;
+            netmask -= 96;
+        }
+    }
+
+    if (!inet_ntop(family, bytes, address, sizeof(address))) {
+        fprintf(stderr, "inet_ntop(): %s", strerror(errno));
+        return;
+    }
+    fprintf(stderr, "%s/%d", address, netmask);
+}
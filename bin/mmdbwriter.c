@@ -0,0 +1,876 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include "maxminddb_writer.h"
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <malloc.h>
+#else
+    #include <libgen.h>
+#endif
+
+#define MAXIMUM_JSON_DEPTH (512)
+
+struct options {
+    const char *input;
+    const char *output;
+    uint16_t ip_version;
+    const char *database_type;
+    uint16_t record_size;
+    uint32_t flags;
+    int policy;
+    const char **languages;
+    size_t language_count;
+    const char **descriptions;
+    size_t description_count;
+};
+
+struct json_parser {
+    MMDB_writer_s *writer;
+    const char *p;
+    const char *end;
+    const char *error;
+    int depth;
+    char *string;
+    size_t string_length;
+    size_t string_size;
+};
+
+static void usage(char *program, int exit_code, const char *error);
+static void get_options(int argc, char **argv, struct options *const options);
+static bool add_option(const char ***const list,
+                       size_t *const count,
+                       const char *const value);
+static bool build_database(const struct options *const options);
+static bool set_metadata(MMDB_writer_s *const writer,
+                         const struct options *const options);
+static char *read_line(FILE *const fh, char **const line, size_t *const size);
+static bool insert_line(MMDB_writer_s *const writer,
+                        struct json_parser *const parser,
+                        const char *const line,
+                        int policy);
+static void skip_whitespace(struct json_parser *const parser);
+static bool expect(struct json_parser *const parser, char c);
+static bool append_string(struct json_parser *const parser,
+                          const char *const data,
+                          size_t length);
+static bool append_code_point(struct json_parser *const parser,
+                              uint32_t code_point);
+static bool parse_hex4(struct json_parser *const parser,
+                       uint32_t *const value);
+static bool parse_string(struct json_parser *const parser,
+                         size_t *const start);
+static MMDB_writer_value_s *parse_number(struct json_parser *const parser);
+static MMDB_writer_value_s *parse_value(struct json_parser *const parser);
+
+int main(int argc, char **argv) {
+    struct options options = {
+        .ip_version = 6,
+        .policy = MMDB_WRITER_INSERT_REPLACE,
+    };
+
+    get_options(argc, argv, &options);
+
+    bool const built = build_database(&options);
+    free(options.languages);
+    free(options.descriptions);
+    return built ? 0 : 1;
+}
+
+static void usage(char *program, int exit_code, const char *error) {
+    if (NULL != error) {
+        fprintf(stderr, "\n  *ERROR: %s\n", error);
+    }
+
+    char *usage =
+        "\n"
+        "  %s --output /path/to/file.mmdb --database-type Type < input.jsonl\n"
+        "\n"
+        "  This application accepts the following options:\n"
+        "\n"
+        "      --output (-o)        The path of the MMDB file to write. "
+        "Required.\n"
+        "\n"
+        "      --input (-i)         The JSON lines file to read the networks "
+        "from.\n"
+        "                           Defaults to stdin.\n"
+        "\n"
+        "      --database-type (-d) The database type to store in the "
+        "metadata.\n"
+        "                           Required.\n"
+        "\n"
+        "      --ip-version         Either 4 or 6. Defaults to 6.\n"
+        "\n"
+        "      --language (-l)      A language the database has data for. "
+        "May be\n"
+        "                           given more than once.\n"
+        "\n"
+        "      --description LANG=TEXT\n"
+        "                           A description of the database in the "
+        "given\n"
+        "                           language. May be given more than once.\n"
+        "\n"
+        "      --record-size        24, 28 or 32. Defaults to the smallest "
+        "record\n"
+        "                           size that fits the database.\n"
+        "\n"
+        "      --alias-ipv4         Make ::ffff:0:0/96, 2001::/32 and "
+        "2002::/16 point\n"
+        "                           to the IPv4 networks.\n"
+        "\n"
+        "      --insert-policy      What to do with networks that already "
+        "have data:\n"
+        "                           replace, keep or merge. Defaults to "
+        "replace.\n"
+        "\n"
+        "      --version            Print the program's version number and "
+        "exit.\n"
+        "\n"
+        "      --help (-h -?)       Show usage information.\n"
+        "\n"
+        "  Each line of the input is a JSON object with the network and its "
+        "data, as\n"
+        "  written by mmdblookup --export jsonl:\n"
+        "\n"
+        "    {\"network\":\"1.2.3.0/24\",\"data\":{\"names\":{\"en\":"
+        "\"Germany\"}}}\n"
+        "\n";
+
+    fprintf(stdout, usage, program);
+    exit(exit_code);
+}
+
+static void get_options(int argc, char **argv, struct options *const options) {
+    static int help = 0;
+    static int version = 0;
+
+    enum {
+        OPTION_IP_VERSION = 256,
+        OPTION_DESCRIPTION,
+        OPTION_RECORD_SIZE,
+        OPTION_ALIAS_IPV4,
+        OPTION_INSERT_POLICY,
+        OPTION_VERSION,
+    };
+
+#ifdef _WIN32
+    char *program = alloca(strlen(argv[0]) + 1);
+    _splitpath(argv[0], NULL, NULL, program, NULL);
+    _splitpath(argv[0], NULL, NULL, NULL, program + strlen(program));
+#else
+    char *program = basename(argv[0]);
+#endif
+
+    while (1) {
+        static struct option long_options[] = {
+            {"input", required_argument, 0, 'i'},
+            {"output", required_argument, 0, 'o'},
+            {"database-type", required_argument, 0, 'd'},
+            {"ip-version", required_argument, 0, OPTION_IP_VERSION},
+            {"language", required_argument, 0, 'l'},
+            {"description", required_argument, 0, OPTION_DESCRIPTION},
+            {"record-size", required_argument, 0, OPTION_RECORD_SIZE},
+            {"alias-ipv4", no_argument, 0, OPTION_ALIAS_IPV4},
+            {"insert-policy", required_argument, 0, OPTION_INSERT_POLICY},
+            {"version", no_argument, 0, OPTION_VERSION},
+            {"help", no_argument, 0, 'h'},
+            {"?", no_argument, 0, 1},
+            {0, 0, 0, 0}};
+
+        int opt_index;
+        int opt_char =
+            getopt_long(argc, argv, "i:o:d:l:h?", long_options, &opt_index);
+
+        if (-1 == opt_char) {
+            break;
+        }
+
+        if ('i' == opt_char) {
+            options->input = optarg;
+        } else if ('o' == opt_char) {
+            options->output = optarg;
+        } else if ('d' == opt_char) {
+            options->database_type = optarg;
+        } else if (OPTION_IP_VERSION == opt_char) {
+            if (strcmp(optarg, "4") == 0) {
+                options->ip_version = 4;
+            } else if (strcmp(optarg, "6") == 0) {
+                options->ip_version = 6;
+            } else {
+                usage(program, 1, "The --ip-version must be 4 or 6");
+            }
+        } else if ('l' == opt_char) {
+            if (!add_option(&options->languages,
+                            &options->language_count,
+                            optarg)) {
+                fprintf(stderr, "realloc(): %s\n", strerror(errno));
+                exit(1);
+            }
+        } else if (OPTION_DESCRIPTION == opt_char) {
+            if (strchr(optarg, '=') == NULL) {
+                usage(program, 1, "The --description must be LANG=TEXT");
+            }
+            if (!add_option(&options->descriptions,
+                            &options->description_count,
+                            optarg)) {
+                fprintf(stderr, "realloc(): %s\n", strerror(errno));
+                exit(1);
+            }
+        } else if (OPTION_RECORD_SIZE == opt_char) {
+            long const i = strtol(optarg, NULL, 10);
+            if (i != 24 && i != 28 && i != 32) {
+                usage(program, 1, "The --record-size must be 24, 28 or 32");
+            }
+            options->record_size = (uint16_t)i;
+        } else if (OPTION_ALIAS_IPV4 == opt_char) {
+            options->flags |= MMDB_WRITER_ALIAS_IPV4;
+        } else if (OPTION_INSERT_POLICY == opt_char) {
+            if (strcmp(optarg, "replace") == 0) {
+                options->policy = MMDB_WRITER_INSERT_REPLACE;
+            } else if (strcmp(optarg, "keep") == 0) {
+                options->policy = MMDB_WRITER_INSERT_KEEP;
+            } else if (strcmp(optarg, "merge") == 0) {
+                options->policy = MMDB_WRITER_INSERT_MERGE;
+            } else {
+                usage(program,
+                      1,
+                      "The --insert-policy must be replace, keep or merge");
+            }
+        } else if (OPTION_VERSION == opt_char) {
+            version = 1;
+        } else if ('h' == opt_char || '?' == opt_char) {
+            help = 1;
+        }
+    }
+
+    if (help) {
+        usage(program, 0, NULL);
+    }
+
+    if (version) {
+        fprintf(stdout, "\n  %s version %s\n\n", program, PACKAGE_VERSION);
+        exit(0);
+    }
+
+    if (NULL == options->output) {
+        usage(program, 1, "You must provide a filename with --output");
+    }
+
+    if (NULL == options->database_type) {
+        usage(program, 1, "You must provide a --database-type");
+    }
+}
+
+static bool add_option(const char ***const list,
+                       size_t *const count,
+                       const char *const value) {
+    const char **const values =
+        realloc((void *)*list, (*count + 1) * sizeof(const char *));
+    if (!values) {
+        return false;
+    }
+    values[(*count)++] = value;
+    *list = values;
+    return true;
+}
+
+static bool build_database(const struct options *const options) {
+    MMDB_writer_s *writer;
+    int status = MMDB_writer_new(
+        options->ip_version, options->database_type, options->flags, &writer);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr, "MMDB_writer_new(): %s\n", MMDB_strerror(status));
+        return false;
+    }
+
+    FILE *fh = stdin;
+    char *line = NULL;
+    size_t line_size = 0;
+    struct json_parser parser = {.writer = writer};
+    bool ok = false;
+
+    if (!set_metadata(writer, options)) {
+        goto end;
+    }
+
+    if (options->input) {
+        fh = fopen(options->input, "r");
+        if (!fh) {
+            fprintf(
+                stderr, "fopen(): %s: %s\n", options->input, strerror(errno));
+            goto end;
+        }
+    }
+
+    // I'd normally use uint64_t, but support for it is optional in C99.
+    unsigned long long line_number = 0;
+    while (read_line(fh, &line, &line_size)) {
+        line_number++;
+        if (!insert_line(writer, &parser, line, options->policy)) {
+            fprintf(stderr,
+                    "Line %llu: %s\n",
+                    line_number,
+                    parser.error ? parser.error : "Invalid line");
+            goto end;
+        }
+    }
+    if (ferror(fh)) {
+        fprintf(stderr, "Error reading the input: %s\n", strerror(errno));
+        goto end;
+    }
+
+    status = MMDB_writer_write(writer, options->output);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_writer_write(): %s: %s\n",
+                options->output,
+                MMDB_strerror(status));
+        goto end;
+    }
+    ok = true;
+
+end:
+    if (fh && fh != stdin) {
+        fclose(fh);
+    }
+    free(line);
+    free(parser.string);
+    MMDB_writer_free(writer);
+    return ok;
+}
+
+static bool set_metadata(MMDB_writer_s *const writer,
+                         const struct options *const options) {
+    int status;
+    if (options->record_size) {
+        status = MMDB_writer_set_record_size(writer, options->record_size);
+        if (status != MMDB_SUCCESS) {
+            fprintf(stderr,
+                    "MMDB_writer_set_record_size(): %s\n",
+                    MMDB_strerror(status));
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < options->language_count; i++) {
+        status = MMDB_writer_add_language(writer, options->languages[i]);
+        if (status != MMDB_SUCCESS) {
+            fprintf(stderr,
+                    "MMDB_writer_add_language(): %s\n",
+                    MMDB_strerror(status));
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < options->description_count; i++) {
+        const char *const description = options->descriptions[i];
+        const char *const separator = strchr(description, '=');
+        size_t const length = (size_t)(separator - description);
+        char *const language = malloc(length + 1);
+        if (!language) {
+            fprintf(stderr, "malloc(): %s\n", strerror(errno));
+            return false;
+        }
+        memcpy(language, description, length);
+        language[length] = '\0';
+
+        status =
+            MMDB_writer_add_description(writer, language, separator + 1);
+        free(language);
+        if (status != MMDB_SUCCESS) {
+            fprintf(stderr,
+                    "MMDB_writer_add_description(): %s\n",
+                    MMDB_strerror(status));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Reads a line of any length, without the trailing newline.
+static char *read_line(FILE *const fh, char **const line, size_t *const size) {
+    size_t length = 0;
+    while (1) {
+        if (*size - length < 2) {
+            size_t const new_size = *size ? *size * 2 : 4096;
+            char *const new_line = realloc(*line, new_size);
+            if (!new_line) {
+                fprintf(stderr, "realloc(): %s\n", strerror(errno));
+                return NULL;
+            }
+            *line = new_line;
+            *size = new_size;
+        }
+
+        if (!fgets(*line + length, (int)(*size - length), fh)) {
+            if (length == 0) {
+                return NULL;
+            }
+            break;
+        }
+        length += strlen(*line + length);
+        if (length > 0 && (*line)[length - 1] == '\n') {
+            (*line)[--length] = '\0';
+            break;
+        }
+    }
+
+    if (length > 0 && (*line)[length - 1] == '\r') {
+        (*line)[--length] = '\0';
+    }
+    return *line;
+}
+
+static bool insert_line(MMDB_writer_s *const writer,
+                        struct json_parser *const parser,
+                        const char *const line,
+                        int policy) {
+    parser->p = line;
+    parser->end = line + strlen(line);
+    parser->error = NULL;
+    parser->depth = 0;
+
+    skip_whitespace(parser);
+    if (parser->p == parser->end) {
+        return true;
+    }
+
+    char *network = NULL;
+    MMDB_writer_value_s *data = NULL;
+    bool ok = false;
+
+    if (!expect(parser, '{')) {
+        goto end;
+    }
+    skip_whitespace(parser);
+    if (parser->p < parser->end && *parser->p == '}') {
+        parser->p++;
+    } else {
+        while (1) {
+            size_t key;
+            parser->string_length = 0;
+            if (!parse_string(parser, &key) || !expect(parser, ':')) {
+                goto end;
+            }
+            if (strcmp(parser->string, "network") == 0) {
+                size_t start;
+                parser->string_length = 0;
+                if (!parse_string(parser, &start)) {
+                    goto end;
+                }
+                free(network);
+                network = malloc(parser->string_length + 1);
+                if (!network) {
+                    parser->error = "Could not allocate memory";
+                    goto end;
+                }
+                memcpy(network, parser->string, parser->string_length + 1);
+            } else if (strcmp(parser->string, "data") == 0) {
+                data = parse_value(parser);
+                if (!data) {
+                    goto end;
+                }
+            } else if (!parse_value(parser)) {
+                goto end;
+            }
+
+            skip_whitespace(parser);
+            if (parser->p < parser->end && *parser->p == ',') {
+                parser->p++;
+                continue;
+            }
+            if (!expect(parser, '}')) {
+                goto end;
+            }
+            break;
+        }
+    }
+    skip_whitespace(parser);
+    if (parser->p != parser->end) {
+        parser->error = "Unexpected data after the JSON object";
+        goto end;
+    }
+
+    if (!network || !data) {
+        parser->error = "Each line must have a network and data";
+        goto end;
+    }
+
+    int const status =
+        MMDB_writer_insert_network(writer, network, data, policy);
+    if (status == MMDB_INVALID_NETWORK_ADDRESS_ERROR) {
+        parser->error = "Invalid network";
+        goto end;
+    }
+    if (status != MMDB_SUCCESS) {
+        parser->error = MMDB_strerror(status);
+        goto end;
+    }
+    ok = true;
+
+end:
+    free(network);
+    return ok;
+}
+
+static void skip_whitespace(struct json_parser *const parser) {
+    while (parser->p < parser->end &&
+           (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' ||
+            *parser->p == '\r')) {
+        parser->p++;
+    }
+}
+
+static bool expect(struct json_parser *const parser, char c) {
+    skip_whitespace(parser);
+    if (parser->p >= parser->end || *parser->p != c) {
+        parser->error = "Invalid JSON";
+        return false;
+    }
+    parser->p++;
+    return true;
+}
+
+static bool append_string(struct json_parser *const parser,
+                          const char *const data,
+                          size_t length) {
+    if (parser->string_size - parser->string_length <= length) {
+        size_t size = parser->string_size ? parser->string_size : 256;
+        while (size - parser->string_length <= length) {
+            size *= 2;
+        }
+        char *const string = realloc(parser->string, size);
+        if (!string) {
+            parser->error = "Could not allocate memory";
+            return false;
+        }
+        parser->string = string;
+        parser->string_size = size;
+    }
+    memcpy(parser->string + parser->string_length, data, length);
+    parser->string_length += length;
+    parser->string[parser->string_length] = '\0';
+    return true;
+}
+
+static bool append_code_point(struct json_parser *const parser,
+                              uint32_t code_point) {
+    char utf8[4];
+    size_t length;
+    if (code_point < 0x80) {
+        utf8[0] = (char)code_point;
+        length = 1;
+    } else if (code_point < 0x800) {
+        utf8[0] = (char)(0xC0 | (code_point >> 6));
+        utf8[1] = (char)(0x80 | (code_point & 0x3F));
+        length = 2;
+    } else if (code_point < 0x10000) {
+        utf8[0] = (char)(0xE0 | (code_point >> 12));
+        utf8[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (code_point & 0x3F));
+        length = 3;
+    } else {
+        utf8[0] = (char)(0xF0 | (code_point >> 18));
+        utf8[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (code_point & 0x3F));
+        length = 4;
+    }
+    return append_string(parser, utf8, length);
+}
+
+static bool parse_hex4(struct json_parser *const parser,
+                       uint32_t *const value) {
+    if (parser->end - parser->p < 4) {
+        parser->error = "Invalid \\u escape in string";
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char const c = *parser->p++;
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = (uint32_t)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (uint32_t)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (uint32_t)(c - 'A' + 10);
+        } else {
+            parser->error = "Invalid \\u escape in string";
+            return false;
+        }
+        *value = *value << 4 | digit;
+    }
+    return true;
+}
+
+// Appends a JSON string to parser->string. The string starts at start and
+// runs to the end of the buffer.
+static bool parse_string(struct json_parser *const parser,
+                         size_t *const start) {
+    *start = parser->string_length;
+    if (!expect(parser, '"') || !append_string(parser, "", 0)) {
+        return false;
+    }
+
+    while (parser->p < parser->end) {
+        const char *const run = parser->p;
+        while (parser->p < parser->end && *parser->p != '"' &&
+               *parser->p != '\\') {
+            parser->p++;
+        }
+        if (!append_string(parser, run, (size_t)(parser->p - run))) {
+            return false;
+        }
+        if (parser->p == parser->end) {
+            break;
+        }
+        if (*parser->p++ == '"') {
+            return true;
+        }
+        if (parser->p == parser->end) {
+            break;
+        }
+
+        char const escape = *parser->p++;
+        char c;
+        switch (escape) {
+            case '"':
+            case '\\':
+            case '/':
+                c = escape;
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'u': {
+                uint32_t code_point;
+                if (!parse_hex4(parser, &code_point)) {
+                    return false;
+                }
+                if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                    uint32_t low;
+                    if (parser->end - parser->p < 2 || parser->p[0] != '\\' ||
+                        parser->p[1] != 'u') {
+                        parser->error = "Unpaired surrogate in string";
+                        return false;
+                    }
+                    parser->p += 2;
+                    if (!parse_hex4(parser, &low)) {
+                        return false;
+                    }
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        parser->error = "Unpaired surrogate in string";
+                        return false;
+                    }
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) +
+                                 (low - 0xDC00);
+                } else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+                    parser->error = "Unpaired surrogate in string";
+                    return false;
+                }
+                if (!append_code_point(parser, code_point)) {
+                    return false;
+                }
+                continue;
+            }
+            default:
+                parser->error = "Invalid escape in string";
+                return false;
+        }
+        if (!append_string(parser, &c, 1)) {
+            return false;
+        }
+    }
+
+    parser->error = "Unterminated string";
+    return false;
+}
+
+// Integers are stored as uint32 if they fit, then as uint64. Negative integers
+// are stored as int32 and everything else as a double.
+static MMDB_writer_value_s *parse_number(struct json_parser *const parser) {
+    const char *const start = parser->p;
+    bool is_integer = true;
+    while (parser->p < parser->end &&
+           strchr("+-0123456789.eE", *parser->p) != NULL) {
+        if (strchr(".eE", *parser->p) != NULL) {
+            is_integer = false;
+        }
+        parser->p++;
+    }
+
+    char number[64];
+    size_t const length = (size_t)(parser->p - start);
+    if (length == 0 || length >= sizeof(number)) {
+        parser->error = "Invalid number";
+        return NULL;
+    }
+    memcpy(number, start, length);
+    number[length] = '\0';
+
+    char *end;
+    errno = 0;
+    MMDB_writer_value_s *value = NULL;
+    if (is_integer && number[0] == '-') {
+        long long const i = strtoll(number, &end, 10);
+        if (*end != '\0' || errno != 0 || i < INT32_MIN) {
+            parser->error = "Negative integers must fit in an int32";
+            return NULL;
+        }
+        value = MMDB_writer_int32(parser->writer, (int32_t)i);
+    } else if (is_integer) {
+        unsigned long long const i = strtoull(number, &end, 10);
+        if (*end != '\0' || errno != 0 || i > UINT64_MAX) {
+            parser->error = "Integers must fit in a uint64";
+            return NULL;
+        }
+        value = i <= UINT32_MAX
+                    ? MMDB_writer_uint32(parser->writer, (uint32_t)i)
+                    : MMDB_writer_uint64(parser->writer, (uint64_t)i);
+    } else {
+        double const d = strtod(number, &end);
+        if (*end != '\0' || errno != 0) {
+            parser->error = "Invalid number";
+            return NULL;
+        }
+        value = MMDB_writer_double(parser->writer, d);
+    }
+
+    if (!value) {
+        parser->error = "Could not allocate memory";
+    }
+    return value;
+}
+
+static MMDB_writer_value_s *parse_value(struct json_parser *const parser) {
+    skip_whitespace(parser);
+    if (parser->p >= parser->end) {
+        parser->error = "Invalid JSON";
+        return NULL;
+    }
+    if (parser->depth >= MAXIMUM_JSON_DEPTH) {
+        parser->error = "The data is nested too deeply";
+        return NULL;
+    }
+
+    MMDB_writer_value_s *value = NULL;
+    char const c = *parser->p;
+    if (c == '{' || c == '[') {
+        bool const is_map = c == '{';
+        value = is_map ? MMDB_writer_map(parser->writer)
+                       : MMDB_writer_array(parser->writer);
+        if (!value) {
+            parser->error = "Could not allocate memory";
+            return NULL;
+        }
+        parser->p++;
+        skip_whitespace(parser);
+        if (parser->p < parser->end && *parser->p == (is_map ? '}' : ']')) {
+            parser->p++;
+            return value;
+        }
+
+        parser->depth++;
+        while (1) {
+            // Keys stay in the parser's string buffer while their value is
+            // parsed, which appends after them.
+            size_t key = 0;
+            if (is_map &&
+                (!parse_string(parser, &key) || !expect(parser, ':'))) {
+                return NULL;
+            }
+
+            MMDB_writer_value_s *const entry = parse_value(parser);
+            if (!entry) {
+                return NULL;
+            }
+
+            int status;
+            if (is_map) {
+                status = MMDB_writer_map_add(parser->writer,
+                                             value,
+                                             parser->string + key,
+                                             parser->string_length - key,
+                                             entry);
+                parser->string_length = key;
+            } else {
+                status =
+                    MMDB_writer_array_append(parser->writer, value, entry);
+            }
+            if (status != MMDB_SUCCESS) {
+                parser->error = MMDB_strerror(status);
+                return NULL;
+            }
+
+            skip_whitespace(parser);
+            if (parser->p < parser->end && *parser->p == ',') {
+                parser->p++;
+                continue;
+            }
+            if (!expect(parser, is_map ? '}' : ']')) {
+                return NULL;
+            }
+            break;
+        }
+        parser->depth--;
+        return value;
+    }
+
+    if (c == '"') {
+        size_t start;
+        if (!parse_string(parser, &start)) {
+            return NULL;
+        }
+        value = MMDB_writer_utf8_string(parser->writer,
+                                        parser->string + start,
+                                        parser->string_length - start);
+        parser->string_length = start;
+    } else if (c == 't' || c == 'f') {
+        const char *const literal = c == 't' ? "true" : "false";
+        size_t const length = strlen(literal);
+        if ((size_t)(parser->end - parser->p) < length ||
+            strncmp(parser->p, literal, length) != 0) {
+            parser->error = "Invalid JSON";
+            return NULL;
+        }
+        parser->p += length;
+        value = MMDB_writer_boolean(parser->writer, c == 't');
+    } else if (c == 'n') {
+        parser->error = "null cannot be stored in a MaxMind DB";
+        return NULL;
+    } else {
+        return parse_number(parser);
+    }
+
+    if (!value) {
+        parser->error = "Could not allocate memory";
+    }
+    return value;
+}
@@ -25,9 +25,18 @@ sub main {
     }
 
     _make_man( $translator, $target, 'libmaxminddb', 3 );
-    _make_lib_man_links($target);
-
-    _make_man( $translator, $target, 'mmdblookup', 1 );
+    _make_lib_man_links( $target, 'libmaxminddb', 'maxminddb.h' );
+
+    _make_man( $translator, $target, 'libmaxminddb_writer', 3 );
+    _make_lib_man_links( $target, 'libmaxminddb_writer', 'maxminddb_writer.h' );
+
+    _make_man( $translator, $target, 'mmdblookup',  1 );
+    _make_man( $translator, $target, 'mmdbwriter', 1 );
+    _make_man( $translator, $target, 'mmdboptimize', 1 );
+    _make_man( $translator, $target, 'mmdbcompact', 1 );
+    _make_man( $translator, $target, 'mmdbdiff', 1 );
+    _make_man( $translator, $target, 'mmdbindex', 1 );
+    _make_man( $translator, $target, 'mmdbverify', 1 );
 }
 
 sub _which {
@@ -78,8 +87,10 @@ sub _make_man {
 
 sub _make_lib_man_links {
     my $target = shift;
+    my $name   = shift;
+    my $file   = shift;
 
-    open my $header_fh, '<', "$Bin/../include/maxminddb.h"
+    open my $header_fh, '<', "$Bin/../include/$file"
         or die "Failed to open header file: $!";
     my $header = do { local $/; <$header_fh> };
 
@@ -90,7 +101,7 @@ sub _make_lib_man_links {
     for my $proto ( $header =~ /^ *extern.+?(MMDB_\w+)\(/gsm ) {
         open my $fh, '>', "$target/man/man3/$proto.3"
             or die "Failed to open file: $!";
-        print {$fh} ".so man3/libmaxminddb.3\n"
+        print {$fh} ".so man3/$name.3\n"
             or die "Failed to write to file: $!";
         close $fh or die "Failed to close file: $!";
     }
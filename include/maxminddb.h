@@ -72,6 +72,11 @@ extern "C" {
     /* flags for open */
     #define MMDB_MODE_MMAP (1)
     #define MMDB_MODE_MASK (7)
+    /* Defer work that MMDB_open() does not need to the first lookup */
+    #define MMDB_MODE_LAZY (8)
+    /* Verify the whole database when opening it and skip the bounds checks
+     * that this makes unnecessary when reading it */
+    #define MMDB_MODE_VERIFY (16)
 
     /* error codes */
     #define MMDB_SUCCESS (0)
@@ -87,6 +92,7 @@ extern "C" {
     #define MMDB_INVALID_NODE_NUMBER_ERROR (10)
     #define MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR (11)
     #define MMDB_INVALID_NETWORK_ADDRESS_ERROR (12)
+    #define MMDB_WOULD_BLOCK_ERROR (13)
 
     #if !(MMDB_UINT128_IS_BYTE_ARRAY)
         #if MMDB_UINT128_USING_MODE
@@ -203,6 +209,8 @@ typedef struct MMDB_s {
     uint32_t metadata_section_size;
     uint16_t full_record_byte_size;
     uint16_t depth;
+    /* With MMDB_MODE_LAZY this is unspecified until a lookup or iterator
+     * needs it. Read it with MMDB_get_ipv4_start_node() instead. */
     MMDB_ipv4_start_node_s ipv4_start_node;
     MMDB_metadata_s metadata;
     /* See above warning before adding fields */
@@ -217,6 +225,181 @@ typedef struct MMDB_search_node_s {
     MMDB_entry_s right_record_entry;
 } MMDB_search_node_s;
 
+    /* flags for MMDB_network_iterator_init() */
+    #define MMDB_ITERATOR_SKIP_EMPTY_NETWORKS (1)
+    #define MMDB_ITERATOR_INCLUDE_ALIASED_NETWORKS (2)
+
+/* A network in the search tree along with the record for it. IPv4 networks
+ * only use the first four bytes of address. */
+typedef struct MMDB_network_s {
+    uint8_t address[16];
+    uint16_t ip_version;
+    uint16_t netmask;
+    bool found_entry;
+    MMDB_entry_s entry;
+} MMDB_network_s;
+
+/* A subtree of the search tree that can be iterated over independently of
+ * the rest of the tree. The address and depth are in terms of the search
+ * tree, so IPv4 subtrees of an IPv6 database are under ::/96. */
+typedef struct MMDB_network_subtree_s {
+    const MMDB_s *mmdb;
+    uint8_t address[16];
+    uint16_t depth;
+    uint32_t record;
+} MMDB_network_subtree_s;
+
+/* The fields in this struct are for internal use only. It is allocated by the
+ * caller so that iteration does not need to allocate any memory. The stack
+ * holds at most one pending record per level of the search tree plus the
+ * record being visited. */
+typedef struct MMDB_network_iterator_s {
+    const MMDB_s *mmdb;
+    uint32_t flags;
+    uint32_t stack_size;
+    uint8_t address[16];
+    struct {
+        uint32_t record;
+        uint16_t depth;
+        uint8_t bit;
+    } stack[129];
+} MMDB_network_iterator_s;
+
+/* A network whose data differs between two databases. A found_entry of false
+ * means that the network has no data in that database. */
+typedef struct MMDB_network_diff_s {
+    uint8_t address[16];
+    uint16_t ip_version;
+    uint16_t netmask;
+    bool old_found_entry;
+    MMDB_entry_s old_entry;
+    bool new_found_entry;
+    MMDB_entry_s new_entry;
+} MMDB_network_diff_s;
+
+/* The fields in this struct are for internal use only. Like the network
+ * iterator, it is allocated by the caller. The cache holds the results of
+ * recent comparisons of data records, as a few records are usually shared by
+ * most of the networks. */
+typedef struct MMDB_diff_iterator_s {
+    const MMDB_s *old_mmdb;
+    const MMDB_s *new_mmdb;
+    uint32_t flags;
+    uint32_t stack_size;
+    uint8_t address[16];
+    struct {
+        uint32_t old_record;
+        uint32_t new_record;
+        uint16_t depth;
+        uint8_t bit;
+    } stack[129];
+    struct {
+        uint32_t old_offset;
+        uint32_t new_offset;
+        uint8_t state;
+    } cache[256];
+} MMDB_diff_iterator_s;
+
+/* A reverse index from the data records of a database, or from the values at
+ * a path in them, to the networks that point to them. It is built with
+ * MMDB_index_build() and memory mapped by MMDB_index_open(). The fields in
+ * this struct are for internal use only. */
+typedef struct MMDB_index_s {
+    const MMDB_s *mmdb;
+    const uint8_t *file_content;
+    ssize_t file_size;
+    uint32_t path_count;
+    const uint8_t *path;
+    uint32_t key_count;
+    const uint8_t *keys;
+    uint32_t network_count;
+    const uint8_t *networks;
+    uint32_t strings_size;
+    const uint8_t *strings;
+} MMDB_index_s;
+
+/* The fields in this struct are for internal use only. */
+typedef struct MMDB_index_iterator_s {
+    const MMDB_index_s *index;
+    uint32_t next;
+    uint32_t end;
+} MMDB_index_iterator_s;
+
+/* A set of databases opened together by MMDB_multi_open() so that one address
+ * can be looked up in all of them at once, or in them as layers of an overlay
+ * with the first on top. databases holds count handles in the order of the
+ * filenames they were opened from. */
+typedef struct MMDB_multi_s {
+    size_t count;
+    MMDB_s *databases;
+} MMDB_multi_s;
+
+/* A database opened by MMDB_cache_open(), which reads the file into a cache
+ * of limited size rather than mapping it. */
+typedef struct MMDB_cache_s MMDB_cache_s;
+
+/* A lookup in an MMDB_cache_s started by MMDB_cache_lookup_start() and done in
+ * steps by MMDB_cache_lookup_step(). It is allocated by the caller. When a
+ * step returns MMDB_WOULD_BLOCK_ERROR, the lookup waits for the pending_size
+ * bytes at pending_offset in the file to be put in the cache. The other fields
+ * are for internal use only. */
+typedef struct MMDB_lookup_state_s {
+    uint64_t pending_offset;
+    size_t pending_size;
+    MMDB_cache_s *cache;
+    uint8_t address[16];
+    uint32_t value;
+    uint16_t current_bit;
+    uint8_t node[8];
+    uint8_t node_read;
+    uint32_t data_loads;
+} MMDB_lookup_state_s;
+
+/* Caller provided memory for MMDB_get_entry_data_list_in_arena(). Lists are
+ * allocated one after another from used up to size. The fields in this struct
+ * are for internal use only. */
+typedef struct MMDB_entry_data_arena_s {
+    void *memory;
+    size_t size;
+    size_t used;
+} MMDB_entry_data_arena_s;
+
+/* A string in the data section. It is not NUL terminated. */
+typedef struct MMDB_string_view_s {
+    const char *data;
+    uint32_t length;
+} MMDB_string_view_s;
+
+/* A field of a schema for MMDB_schema_decode(): the value at path is stored at
+ * offset in the output struct as the C type for the MMDB_DATA_TYPE_* type. */
+typedef struct MMDB_schema_field_s {
+    const char *const *path;
+    uint32_t type;
+    size_t offset;
+} MMDB_schema_field_s;
+
+typedef struct MMDB_schema_s MMDB_schema_s;
+
+/* Called by a callback sink with each chunk of dump output. It returns 0 on
+ * success, and any other value stops the dump with MMDB_IO_ERROR. */
+typedef int (*MMDB_dump_write_fn)(void *const context,
+                                  const char *const data,
+                                  size_t size);
+
+/* Where MMDB_dump_entry_data_list_to_sink() writes its output. It is set up by
+ * one of the MMDB_dump_sink_init_*() functions. For buffer sinks, buffer holds
+ * the NUL terminated output. length is the size of all of the output written
+ * so far, which is more than fits in a fixed buffer if it was truncated. The
+ * other fields are for internal use only. */
+typedef struct MMDB_dump_sink_s {
+    char *buffer;
+    size_t size;
+    size_t length;
+    MMDB_dump_write_fn write;
+    void *context;
+    bool growable;
+} MMDB_dump_sink_s;
+
 extern int
 MMDB_open(const char *const filename, uint32_t flags, MMDB_s *const mmdb);
 extern MMDB_lookup_result_s MMDB_lookup_string(const MMDB_s *const mmdb,
@@ -230,6 +413,111 @@ MMDB_lookup_sockaddr(const MMDB_s *const mmdb,
 extern int MMDB_read_node(const MMDB_s *const mmdb,
                           uint32_t node_number,
                           MMDB_search_node_s *const node);
+extern int MMDB_get_ipv4_start_node(const MMDB_s *const mmdb,
+                                    MMDB_ipv4_start_node_s *const start_node);
+extern int MMDB_multi_open(const char *const *const filenames,
+                           size_t count,
+                           uint32_t flags,
+                           MMDB_multi_s *const multi);
+extern void MMDB_multi_lookup_string(const MMDB_multi_s *const multi,
+                                     const char *const ipstr,
+                                     int *const gai_error,
+                                     MMDB_lookup_result_s *const results,
+                                     int *const mmdb_errors);
+extern void MMDB_multi_lookup_sockaddr(const MMDB_multi_s *const multi,
+                                       const struct sockaddr *const sockaddr,
+                                       MMDB_lookup_result_s *const results,
+                                       int *const mmdb_errors);
+extern MMDB_lookup_result_s
+MMDB_overlay_lookup_string(const MMDB_multi_s *const multi,
+                           const char *const ipstr,
+                           int *const gai_error,
+                           int *const mmdb_error);
+extern MMDB_lookup_result_s
+MMDB_overlay_lookup_sockaddr(const MMDB_multi_s *const multi,
+                             const struct sockaddr *const sockaddr,
+                             int *const mmdb_error);
+extern void MMDB_multi_close(MMDB_multi_s *const multi);
+extern int MMDB_cache_open(const char *const filename,
+                           size_t memory_budget,
+                           MMDB_cache_s **const cache);
+extern const MMDB_metadata_s *
+MMDB_cache_metadata(const MMDB_cache_s *const cache);
+extern MMDB_lookup_result_s
+MMDB_cache_lookup_string(MMDB_cache_s *const cache,
+                         const char *const ipstr,
+                         int *const gai_error,
+                         int *const mmdb_error);
+extern MMDB_lookup_result_s
+MMDB_cache_lookup_sockaddr(MMDB_cache_s *const cache,
+                           const struct sockaddr *const sockaddr,
+                           int *const mmdb_error);
+extern int
+MMDB_cache_get_entry_data_list(MMDB_cache_s *const cache,
+                               const MMDB_entry_s *const start,
+                               MMDB_entry_data_list_s **const entry_data_list);
+extern int MMDB_cache_lookup_start(MMDB_cache_s *const cache,
+                                   const struct sockaddr *const sockaddr,
+                                   MMDB_lookup_state_s *const state);
+extern int MMDB_cache_lookup_step(MMDB_lookup_state_s *const state,
+                                  MMDB_lookup_result_s *const result);
+extern int MMDB_cache_lookup_load(const MMDB_lookup_state_s *const state);
+extern int MMDB_cache_fill_block(MMDB_cache_s *const cache,
+                                 uint64_t offset,
+                                 const void *const data,
+                                 size_t size);
+extern void MMDB_cache_close(MMDB_cache_s *const cache);
+extern int
+MMDB_network_iterator_init(const MMDB_s *const mmdb,
+                           uint32_t flags,
+                           MMDB_network_iterator_s *const iterator);
+extern int MMDB_network_iterator_init_subtree(
+    const MMDB_network_subtree_s *const subtree,
+    uint32_t flags,
+    MMDB_network_iterator_s *const iterator);
+extern bool
+MMDB_network_iterator_next(MMDB_network_iterator_s *const iterator,
+                           MMDB_network_s *const network,
+                           int *const mmdb_error);
+extern int MMDB_get_network_subtrees(const MMDB_s *const mmdb,
+                                     uint16_t netmask,
+                                     uint32_t flags,
+                                     MMDB_network_subtree_s **const subtrees,
+                                     size_t *const count);
+extern void
+MMDB_free_network_subtrees(MMDB_network_subtree_s *const subtrees);
+extern int
+MMDB_lookup_network_subtree(const MMDB_s *const mmdb,
+                            const struct sockaddr *const sockaddr,
+                            uint16_t netmask,
+                            MMDB_network_subtree_s *const subtree);
+extern int MMDB_verify(const MMDB_s *const mmdb);
+extern int MMDB_verify_metadata(const MMDB_s *const mmdb);
+extern int MMDB_verify_subtree(const MMDB_network_subtree_s *const subtree);
+extern int MMDB_diff_iterator_init(const MMDB_s *const old_mmdb,
+                                   const MMDB_s *const new_mmdb,
+                                   uint32_t flags,
+                                   MMDB_diff_iterator_s *const iterator);
+extern bool MMDB_diff_iterator_next(MMDB_diff_iterator_s *const iterator,
+                                    MMDB_network_diff_s *const diff,
+                                    int *const mmdb_error);
+extern int MMDB_index_build(const MMDB_s *const mmdb,
+                            const char *const *const path,
+                            const char *const filename);
+extern int MMDB_index_open(const char *const filename,
+                           const MMDB_s *const mmdb,
+                           MMDB_index_s *const index);
+extern void MMDB_index_close(MMDB_index_s *const index);
+extern int MMDB_index_iterator_init(const MMDB_index_s *const index,
+                                    const char *const key,
+                                    MMDB_index_iterator_s *const iterator);
+extern int
+MMDB_index_iterator_init_entry(const MMDB_index_s *const index,
+                               MMDB_entry_s *const entry,
+                               MMDB_index_iterator_s *const iterator);
+extern bool MMDB_index_iterator_next(MMDB_index_iterator_s *const iterator,
+                                     MMDB_network_s *const network,
+                                     int *const mmdb_error);
 extern int MMDB_get_value(MMDB_entry_s *const start,
                           MMDB_entry_data_s *const entry_data,
                           ...);
@@ -239,11 +527,42 @@ extern int MMDB_vget_value(MMDB_entry_s *const start,
 extern int MMDB_aget_value(MMDB_entry_s *const start,
                            MMDB_entry_data_s *const entry_data,
                            const char *const *const path);
+extern int MMDB_get_utf8(const MMDB_entry_s *const start,
+                         const char *const *const path,
+                         const char **const value,
+                         uint32_t *const length);
+extern int MMDB_get_double(const MMDB_entry_s *const start,
+                           const char *const *const path,
+                           double *const value);
+extern int MMDB_get_uint32(const MMDB_entry_s *const start,
+                           const char *const *const path,
+                           uint32_t *const value);
+extern int MMDB_get_uint64(const MMDB_entry_s *const start,
+                           const char *const *const path,
+                           uint64_t *const value);
+extern int MMDB_get_bool(const MMDB_entry_s *const start,
+                         const char *const *const path,
+                         bool *const value);
+extern int MMDB_schema_new(const MMDB_schema_field_s *const fields,
+                           size_t field_count,
+                           MMDB_schema_s **const schema);
+extern void MMDB_schema_free(MMDB_schema_s *const schema);
+extern int MMDB_schema_decode(const MMDB_schema_s *const schema,
+                              const MMDB_entry_s *const entry,
+                              void *const output);
 extern int MMDB_get_metadata_as_entry_data_list(
     const MMDB_s *const mmdb, MMDB_entry_data_list_s **const entry_data_list);
 extern int
 MMDB_get_entry_data_list(MMDB_entry_s *start,
                          MMDB_entry_data_list_s **const entry_data_list);
+extern void MMDB_entry_data_arena_init(MMDB_entry_data_arena_s *const arena,
+                                       void *const memory,
+                                       size_t size);
+extern void MMDB_entry_data_arena_reset(MMDB_entry_data_arena_s *const arena);
+extern int MMDB_get_entry_data_list_in_arena(
+    MMDB_entry_s *start,
+    MMDB_entry_data_arena_s *const arena,
+    MMDB_entry_data_list_s **const entry_data_list);
 extern void
 MMDB_free_entry_data_list(MMDB_entry_data_list_s *const entry_data_list);
 extern void MMDB_close(MMDB_s *const mmdb);
@@ -252,6 +571,19 @@ extern int
 MMDB_dump_entry_data_list(FILE *const stream,
                           MMDB_entry_data_list_s *const entry_data_list,
                           int indent);
+extern void MMDB_dump_sink_init_buffer(MMDB_dump_sink_s *const sink,
+                                      char *const buffer,
+                                      size_t size);
+extern void MMDB_dump_sink_init_growable(MMDB_dump_sink_s *const sink);
+extern void MMDB_dump_sink_init_callback(MMDB_dump_sink_s *const sink,
+                                        MMDB_dump_write_fn callback,
+                                        void *const context);
+extern void MMDB_dump_sink_reset(MMDB_dump_sink_s *const sink);
+extern void MMDB_dump_sink_free(MMDB_dump_sink_s *const sink);
+extern int MMDB_dump_entry_data_list_to_sink(
+    MMDB_dump_sink_s *const sink,
+    MMDB_entry_data_list_s *const entry_data_list,
+    int indent);
 extern const char *MMDB_strerror(int error_code);
 
 #endif /* MAXMINDDB_H */
@@ -0,0 +1,118 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef MAXMINDDB_WRITER_H
+    #define MAXMINDDB_WRITER_H
+
+    #include "maxminddb.h"
+    #include <stdbool.h>
+    #include <stdint.h>
+
+    /* flags for MMDB_writer_new() */
+    #define MMDB_WRITER_ALIAS_IPV4_MAPPED (1)
+    #define MMDB_WRITER_ALIAS_TEREDO (2)
+    #define MMDB_WRITER_ALIAS_6TO4 (4)
+    #define MMDB_WRITER_ALIAS_IPV4                                             \
+        (MMDB_WRITER_ALIAS_IPV4_MAPPED | MMDB_WRITER_ALIAS_TEREDO |            \
+         MMDB_WRITER_ALIAS_6TO4)
+    #define MMDB_WRITER_SORT_MAP_KEYS (8)
+
+    /* policies for MMDB_writer_insert() */
+    #define MMDB_WRITER_INSERT_REPLACE (0)
+    #define MMDB_WRITER_INSERT_KEEP (1)
+    #define MMDB_WRITER_INSERT_MERGE (2)
+
+    /* search tree layouts for MMDB_writer_set_tree_layout() and
+     * MMDB_writer_relayout() */
+    #define MMDB_WRITER_LAYOUT_DEPTH_FIRST (0)
+    #define MMDB_WRITER_LAYOUT_BLOCKED (1)
+    #define MMDB_WRITER_LAYOUT_VAN_EMDE_BOAS (2)
+
+/* Both structs are opaque. Values are owned by the writer they were created
+ * with and are freed along with it. Scalars may be used any number of times,
+ * but a map or an array may only be added to one map or array or inserted
+ * once. After that the writer may reuse its memory. The canonical values
+ * returned by MMDB_writer_intern() may be used any number of times. */
+typedef struct MMDB_writer_s MMDB_writer_s;
+typedef struct MMDB_writer_value_s MMDB_writer_value_s;
+
+extern int MMDB_writer_new(uint16_t ip_version,
+                           const char *const database_type,
+                           uint32_t flags,
+                           MMDB_writer_s **const writer);
+extern void MMDB_writer_free(MMDB_writer_s *const writer);
+extern int MMDB_writer_add_language(MMDB_writer_s *const writer,
+                                    const char *const language);
+extern int MMDB_writer_add_description(MMDB_writer_s *const writer,
+                                       const char *const language,
+                                       const char *const description);
+extern void MMDB_writer_set_build_epoch(MMDB_writer_s *const writer,
+                                        uint64_t build_epoch);
+extern int MMDB_writer_set_record_size(MMDB_writer_s *const writer,
+                                       uint16_t record_size);
+extern int MMDB_writer_set_tree_layout(MMDB_writer_s *const writer,
+                                       int layout);
+
+extern MMDB_writer_value_s *
+MMDB_writer_utf8_string(MMDB_writer_s *const writer,
+                        const char *const string,
+                        size_t length);
+extern MMDB_writer_value_s *MMDB_writer_bytes(MMDB_writer_s *const writer,
+                                              const uint8_t *const bytes,
+                                              size_t length);
+extern MMDB_writer_value_s *MMDB_writer_double(MMDB_writer_s *const writer,
+                                               double value);
+extern MMDB_writer_value_s *MMDB_writer_float(MMDB_writer_s *const writer,
+                                              float value);
+extern MMDB_writer_value_s *MMDB_writer_uint16(MMDB_writer_s *const writer,
+                                               uint16_t value);
+extern MMDB_writer_value_s *MMDB_writer_uint32(MMDB_writer_s *const writer,
+                                               uint32_t value);
+extern MMDB_writer_value_s *MMDB_writer_int32(MMDB_writer_s *const writer,
+                                              int32_t value);
+extern MMDB_writer_value_s *MMDB_writer_uint64(MMDB_writer_s *const writer,
+                                               uint64_t value);
+extern MMDB_writer_value_s *MMDB_writer_uint128(MMDB_writer_s *const writer,
+                                                const uint8_t value[16]);
+extern MMDB_writer_value_s *MMDB_writer_boolean(MMDB_writer_s *const writer,
+                                                bool value);
+extern MMDB_writer_value_s *MMDB_writer_map(MMDB_writer_s *const writer);
+extern MMDB_writer_value_s *MMDB_writer_array(MMDB_writer_s *const writer);
+extern int MMDB_writer_map_add(MMDB_writer_s *const writer,
+                               MMDB_writer_value_s *const map,
+                               const char *const key,
+                               size_t key_length,
+                               MMDB_writer_value_s *const value);
+extern int MMDB_writer_array_append(MMDB_writer_s *const writer,
+                                    MMDB_writer_value_s *const array,
+                                    MMDB_writer_value_s *const value);
+extern int MMDB_writer_value_from_entry_data_list(
+    MMDB_writer_s *const writer,
+    MMDB_entry_data_list_s *const entry_data_list,
+    MMDB_writer_value_s **const value);
+
+extern int MMDB_writer_intern(MMDB_writer_s *const writer,
+                              MMDB_writer_value_s *const value,
+                              MMDB_writer_value_s **const canonical);
+extern int MMDB_writer_insert(MMDB_writer_s *const writer,
+                              const uint8_t *const address,
+                              uint16_t ip_version,
+                              uint16_t netmask,
+                              MMDB_writer_value_s *const value,
+                              int policy);
+extern int MMDB_writer_insert_network(MMDB_writer_s *const writer,
+                                      const char *const network,
+                                      MMDB_writer_value_s *const value,
+                                      int policy);
+extern int MMDB_writer_write(MMDB_writer_s *const writer,
+                             const char *const filename);
+extern int MMDB_writer_relayout(const MMDB_s *const mmdb,
+                                const char *const filename,
+                                int layout);
+
+#endif /* MAXMINDDB_WRITER_H */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,410 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#if HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "block-cache.h"
+#include "maxminddb.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lookups of blocks in different shards don't wait for each other. More
+// shards than threads that read at once don't help much.
+#define BLOCK_CACHE_MAX_SHARDS 16
+
+// The slot of a block that isn't in the cache.
+#define NO_SLOT UINT32_MAX
+
+// Reading a shard's slots is quick, so a thread waiting for the lock of one
+// spins rather than sleeping. Without atomic operations there is no lock and
+// the cache may only be used by one thread at a time.
+#if defined(__GNUC__) || defined(__clang__)
+typedef long shard_lock_t;
+static inline void lock_shard_lock(shard_lock_t *lock) {
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+static inline void unlock_shard_lock(shard_lock_t *lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+#elif defined(_MSC_VER)
+    #include <intrin.h>
+typedef volatile long shard_lock_t;
+static inline void lock_shard_lock(shard_lock_t *lock) {
+    while (_InterlockedExchange(lock, 1)) {
+        while (*lock) {
+        }
+    }
+}
+static inline void unlock_shard_lock(shard_lock_t *lock) {
+    _InterlockedExchange(lock, 0);
+}
+#else
+typedef long shard_lock_t;
+static inline void lock_shard_lock(shard_lock_t *lock) { (void)lock; }
+static inline void unlock_shard_lock(shard_lock_t *lock) { (void)lock; }
+#endif
+
+// A place for a block in a shard. referenced is set whenever the block is
+// read, and cleared as the clock hand passes over it. A block that hasn't
+// been read since the hand last passed is the next one to go.
+typedef struct block_slot_s {
+    uint64_t block;
+    uint8_t *data;
+    bool referenced;
+} block_slot_s;
+
+typedef struct block_shard_s {
+    shard_lock_t lock;
+    uint32_t hand;
+    uint32_t slot_count;
+    block_slot_s *slots;
+} block_shard_s;
+
+struct block_cache_s {
+    opened_file_s file;
+    uint64_t block_count;
+    // The slot of each block of the file in its shard, or NO_SLOT. The entry
+    // for a block is only used with the lock of its shard held.
+    uint32_t *block_slots;
+    uint32_t shard_count;
+    block_shard_s shards[BLOCK_CACHE_MAX_SHARDS];
+};
+
+static int read_blocks(block_cache_s *const cache,
+                       uint64_t offset,
+                       size_t size,
+                       uint8_t *const buffer,
+                       bool read_file_blocks,
+                       size_t *const copied);
+static int read_from_block(block_cache_s *const cache,
+                           uint64_t block,
+                           size_t start,
+                           size_t size,
+                           uint8_t *const buffer,
+                           bool read_file_blocks);
+static bool find_block(block_cache_s *const cache,
+                       uint64_t block,
+                       size_t start,
+                       size_t size,
+                       uint8_t *const buffer);
+static int load_block(block_cache_s *const cache,
+                      uint64_t block,
+                      uint8_t **const data);
+static void add_block(block_cache_s *const cache,
+                      uint64_t block,
+                      uint8_t *const data);
+static uint8_t *insert_block(block_cache_s *const cache,
+                             block_shard_s *const shard,
+                             uint64_t block,
+                             uint8_t *const data);
+
+int block_cache_new(opened_file_s *const file,
+                    size_t budget,
+                    block_cache_s **const cache) {
+    *cache = NULL;
+    block_cache_s *const new_cache = calloc(1, sizeof(block_cache_s));
+    if (!new_cache) {
+        close_file(file);
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    new_cache->file = *file;
+    new_cache->block_count =
+        (file->size + BLOCK_CACHE_BLOCK_SIZE - 1) / BLOCK_CACHE_BLOCK_SIZE;
+    if (new_cache->block_count > SIZE_MAX / sizeof(uint32_t)) {
+        block_cache_free(new_cache);
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    // There is no point in having room for more blocks than the file has.
+    uint64_t blocks = budget / BLOCK_CACHE_BLOCK_SIZE;
+    if (blocks > new_cache->block_count) {
+        blocks = new_cache->block_count;
+    }
+    if (blocks == 0) {
+        blocks = 1;
+    }
+    new_cache->shard_count =
+        blocks < BLOCK_CACHE_MAX_SHARDS ? (uint32_t)blocks
+                                        : BLOCK_CACHE_MAX_SHARDS;
+    uint64_t slot_count = blocks / new_cache->shard_count;
+    if (slot_count >= NO_SLOT) {
+        slot_count = NO_SLOT - 1;
+    }
+
+    new_cache->block_slots = malloc(
+        (size_t)(new_cache->block_count ? new_cache->block_count : 1) *
+        sizeof(uint32_t));
+    if (!new_cache->block_slots) {
+        block_cache_free(new_cache);
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    for (uint64_t i = 0; i < new_cache->block_count; i++) {
+        new_cache->block_slots[i] = NO_SLOT;
+    }
+
+    for (uint32_t i = 0; i < new_cache->shard_count; i++) {
+        block_shard_s *const shard = &new_cache->shards[i];
+        shard->slots = calloc((size_t)slot_count, sizeof(block_slot_s));
+        if (!shard->slots) {
+            block_cache_free(new_cache);
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        shard->slot_count = (uint32_t)slot_count;
+    }
+
+    *cache = new_cache;
+    return MMDB_SUCCESS;
+}
+
+size_t block_cache_capacity(const block_cache_s *const cache) {
+    size_t capacity = 0;
+    for (uint32_t i = 0; i < cache->shard_count; i++) {
+        capacity +=
+            (size_t)cache->shards[i].slot_count * BLOCK_CACHE_BLOCK_SIZE;
+    }
+    return capacity;
+}
+
+int block_cache_read(block_cache_s *const cache,
+                     uint64_t offset,
+                     size_t size,
+                     uint8_t *const buffer) {
+    size_t copied;
+    return read_blocks(cache, offset, size, buffer, true, &copied);
+}
+
+int block_cache_read_cached(block_cache_s *const cache,
+                            uint64_t offset,
+                            size_t size,
+                            uint8_t *const buffer,
+                            size_t *const copied) {
+    return read_blocks(cache, offset, size, buffer, false, copied);
+}
+
+size_t block_cache_block_size(const block_cache_s *const cache,
+                              uint64_t offset) {
+    if (offset >= cache->file.size) {
+        return 0;
+    }
+    uint64_t const size = cache->file.size - offset;
+    return size > BLOCK_CACHE_BLOCK_SIZE ? BLOCK_CACHE_BLOCK_SIZE
+                                         : (size_t)size;
+}
+
+int block_cache_load(block_cache_s *const cache, uint64_t offset) {
+    if (offset % BLOCK_CACHE_BLOCK_SIZE || offset >= cache->file.size) {
+        return MMDB_IO_ERROR;
+    }
+    uint64_t const block = offset / BLOCK_CACHE_BLOCK_SIZE;
+    if (find_block(cache, block, 0, 0, NULL)) {
+        return MMDB_SUCCESS;
+    }
+    uint8_t *data;
+    int const status = load_block(cache, block, &data);
+    if (MMDB_SUCCESS == status) {
+        add_block(cache, block, data);
+    }
+    return status;
+}
+
+int block_cache_fill(block_cache_s *const cache,
+                     uint64_t offset,
+                     const uint8_t *const data,
+                     size_t size) {
+    if (offset % BLOCK_CACHE_BLOCK_SIZE || offset >= cache->file.size ||
+        size != block_cache_block_size(cache, offset)) {
+        return MMDB_IO_ERROR;
+    }
+    uint8_t *const copy = malloc(BLOCK_CACHE_BLOCK_SIZE);
+    if (!copy) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    memcpy(copy, data, size);
+    add_block(cache, offset / BLOCK_CACHE_BLOCK_SIZE, copy);
+    return MMDB_SUCCESS;
+}
+
+/* Copies size bytes at offset in the file to buffer a block at a time. A
+ * block that isn't in the cache is read from the file if read_file_blocks is
+ * set, and otherwise stops the copy with MMDB_WOULD_BLOCK_ERROR. copied is
+ * set to the number of bytes copied. */
+static int read_blocks(block_cache_s *const cache,
+                       uint64_t offset,
+                       size_t size,
+                       uint8_t *const buffer,
+                       bool read_file_blocks,
+                       size_t *const copied) {
+    *copied = 0;
+    if (offset > cache->file.size || size > cache->file.size - offset) {
+        return MMDB_IO_ERROR;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        uint64_t const position = offset + done;
+        uint64_t const block = position / BLOCK_CACHE_BLOCK_SIZE;
+        size_t const start = (size_t)(position % BLOCK_CACHE_BLOCK_SIZE);
+        size_t length = BLOCK_CACHE_BLOCK_SIZE - start;
+        if (length > size - done) {
+            length = size - done;
+        }
+        int const status = read_from_block(cache,
+                                           block,
+                                           start,
+                                           length,
+                                           buffer ? buffer + done : NULL,
+                                           read_file_blocks);
+        if (MMDB_SUCCESS != status) {
+            *copied = done;
+            return status;
+        }
+        done += length;
+    }
+    *copied = done;
+    return MMDB_SUCCESS;
+}
+
+/* Copies size bytes at start in the block to buffer. A block that isn't in
+ * the cache is read with the shard unlocked, into memory of its own, and then
+ * takes the place of the block that the clock hand picks. */
+static int read_from_block(block_cache_s *const cache,
+                           uint64_t block,
+                           size_t start,
+                           size_t size,
+                           uint8_t *const buffer,
+                           bool read_file_blocks) {
+    if (find_block(cache, block, start, size, buffer)) {
+        return MMDB_SUCCESS;
+    }
+    if (!read_file_blocks) {
+        return MMDB_WOULD_BLOCK_ERROR;
+    }
+
+    uint8_t *data;
+    int const status = load_block(cache, block, &data);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (buffer) {
+        memcpy(buffer, data + start, size);
+    }
+    add_block(cache, block, data);
+    return MMDB_SUCCESS;
+}
+
+/* Copies size bytes at start in the block to buffer, unless buffer is NULL,
+ * and returns true if the block is in the cache. */
+static bool find_block(block_cache_s *const cache,
+                       uint64_t block,
+                       size_t start,
+                       size_t size,
+                       uint8_t *const buffer) {
+    block_shard_s *const shard = &cache->shards[block % cache->shard_count];
+
+    lock_shard_lock(&shard->lock);
+    uint32_t const slot = cache->block_slots[block];
+    if (NO_SLOT == slot) {
+        unlock_shard_lock(&shard->lock);
+        return false;
+    }
+    shard->slots[slot].referenced = true;
+    if (buffer) {
+        memcpy(buffer, shard->slots[slot].data + start, size);
+    }
+    unlock_shard_lock(&shard->lock);
+    return true;
+}
+
+/* Reads the block from the file into memory of its own. */
+static int load_block(block_cache_s *const cache,
+                      uint64_t block,
+                      uint8_t **const data) {
+    uint64_t const block_offset = block * BLOCK_CACHE_BLOCK_SIZE;
+    *data = malloc(BLOCK_CACHE_BLOCK_SIZE);
+    if (!*data) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    int const status =
+        read_file(&cache->file,
+                  block_offset,
+                  block_cache_block_size(cache, block_offset),
+                  *data);
+    if (MMDB_SUCCESS != status) {
+        free(*data);
+        *data = NULL;
+    }
+    return status;
+}
+
+/* Puts the block's memory in the cache. Whichever memory is left over, the
+ * evicted block's or this one's if another thread read the block first, is
+ * freed once the shard is unlocked again. */
+static void add_block(block_cache_s *const cache,
+                      uint64_t block,
+                      uint8_t *const data) {
+    block_shard_s *const shard = &cache->shards[block % cache->shard_count];
+    lock_shard_lock(&shard->lock);
+    uint8_t *const unused = insert_block(cache, shard, block, data);
+    unlock_shard_lock(&shard->lock);
+    free(unused);
+}
+
+/* Puts the block in the slot that the clock hand stops at, passing over the
+ * blocks that were read since it last passed them, and returns the memory
+ * that is no longer used. New blocks start out not referenced, so a block
+ * that is only read once, such as during a scan, is the first to go again. */
+static uint8_t *insert_block(block_cache_s *const cache,
+                             block_shard_s *const shard,
+                             uint64_t block,
+                             uint8_t *const data) {
+    if (NO_SLOT != cache->block_slots[block]) {
+        return data;
+    }
+
+    block_slot_s *slot;
+    uint32_t index;
+    for (;;) {
+        index = shard->hand;
+        slot = &shard->slots[index];
+        shard->hand = (shard->hand + 1) % shard->slot_count;
+        if (!slot->referenced) {
+            break;
+        }
+        slot->referenced = false;
+    }
+
+    uint8_t *const evicted = slot->data;
+    if (evicted) {
+        cache->block_slots[slot->block] = NO_SLOT;
+    }
+    slot->block = block;
+    slot->data = data;
+    cache->block_slots[block] = index;
+    return evicted;
+}
+
+void block_cache_free(block_cache_s *const cache) {
+    if (!cache) {
+        return;
+    }
+    for (uint32_t i = 0; i < cache->shard_count; i++) {
+        block_shard_s *const shard = &cache->shards[i];
+        if (!shard->slots) {
+            continue;
+        }
+        for (uint32_t j = 0; j < shard->slot_count; j++) {
+            free(shard->slots[j].data);
+        }
+        free(shard->slots);
+    }
+    free(cache->block_slots);
+    close_file(&cache->file);
+    free(cache);
+}
@@ -0,0 +1,70 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "map-file.h"
+#include "maxminddb.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Files are read into the cache this many bytes at a time, from offsets that
+// are a multiple of it.
+#define BLOCK_CACHE_BLOCK_SIZE 65536
+
+// A cache of the blocks of a file, for reading a database without mapping
+// it. The blocks are split between shards by block number, each with its own
+// lock, and a shard that is full evicts the blocks it holds with the CLOCK
+// algorithm. Files are read with the shard unlocked, so a thread waiting for
+// the disk doesn't hold up lookups of blocks that are already in memory.
+typedef struct block_cache_s block_cache_s;
+
+// Creates a cache for the file that holds at most budget bytes of blocks,
+// but always at least one block. It takes over the file, which is closed by
+// block_cache_free(). This returns an MMDB status code.
+int block_cache_new(opened_file_s *const file,
+                    size_t budget,
+                    block_cache_s **const cache);
+
+// The number of bytes of blocks that the cache holds once it is full.
+size_t block_cache_capacity(const block_cache_s *const cache);
+
+// Copies size bytes at offset in the file to buffer, reading the blocks they
+// are in if they aren't in the cache. This may be called by several threads
+// at once where the library has atomic operations, and by one thread at a
+// time otherwise. This returns an MMDB status code.
+int block_cache_read(block_cache_s *const cache,
+                     uint64_t offset,
+                     size_t size,
+                     uint8_t *const buffer);
+
+// Like block_cache_read(), but never reads the file. If a block isn't in the
+// cache, this returns MMDB_WOULD_BLOCK_ERROR and sets *copied to the number of
+// bytes before that block, which have been copied to buffer. When buffer is
+// NULL, the blocks are only checked.
+int block_cache_read_cached(block_cache_s *const cache,
+                            uint64_t offset,
+                            size_t size,
+                            uint8_t *const buffer,
+                            size_t *const copied);
+
+// The size of the block that starts at offset in the file. Only the last
+// block of the file is smaller than BLOCK_CACHE_BLOCK_SIZE.
+size_t block_cache_block_size(const block_cache_s *const cache,
+                              uint64_t offset);
+
+// Reads the block that starts at offset in the file into the cache, unless it
+// is there already. This returns an MMDB status code.
+int block_cache_load(block_cache_s *const cache, uint64_t offset);
+
+// Puts a copy of the block that starts at offset in the cache, for a caller
+// that read the file itself. size must be the size of the block. This returns
+// an MMDB status code.
+int block_cache_fill(block_cache_s *const cache,
+                     uint64_t offset,
+                     const uint8_t *const data,
+                     size_t size);
+
+// Frees the cache and its blocks and closes the file.
+void block_cache_free(block_cache_s *const cache);
+
+#endif
@@ -59,6 +59,12 @@ void data_pool_destroy(MMDB_data_pool_s *const pool) {
         free(pool->blocks[i]);
     }
 
+    while (pool->bytes) {
+        data_pool_bytes_s *const next = pool->bytes->next;
+        free(pool->bytes);
+        pool->bytes = next;
+    }
+
     free(pool);
 }
 
@@ -110,6 +116,37 @@ MMDB_entry_data_list_s *data_pool_alloc(MMDB_data_pool_s *const pool) {
     return element;
 }
 
+// Claim size bytes from the pool, which live as long as the pool does. They
+// come from the newest chunk if it has room, and otherwise from a new chunk.
+uint8_t *data_pool_alloc_bytes(MMDB_data_pool_s *const pool,
+                               size_t const size) {
+    if (!pool) {
+        return NULL;
+    }
+
+    data_pool_bytes_s *chunk = pool->bytes;
+    if (chunk && chunk->size - chunk->used >= size) {
+        uint8_t *const bytes = chunk->data + chunk->used;
+        chunk->used += size;
+        return bytes;
+    }
+
+    size_t const chunk_size =
+        size > DATA_POOL_BYTES_CHUNK_SIZE ? size : DATA_POOL_BYTES_CHUNK_SIZE;
+    if (chunk_size > SIZE_MAX - sizeof(data_pool_bytes_s)) {
+        return NULL;
+    }
+    chunk = malloc(sizeof(data_pool_bytes_s) + chunk_size);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = pool->bytes;
+    chunk->size = chunk_size;
+    chunk->used = size;
+    pool->bytes = chunk;
+    return chunk->data;
+}
+
 // Turn the structs in the array-like pool into a linked list.
 //
 // Before calling this function, the list isn't linked up.
@@ -5,6 +5,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // This should be large enough that we never need to grow the array of pointers
 // to blocks. 32 is enough. Even starting out of with size 1 (1 struct), the
@@ -14,6 +15,17 @@
 // would rarely be hit and likely not be well tested.
 #define DATA_POOL_NUM_BLOCKS 32
 
+// Bytes are allocated in chunks of at least this size.
+#define DATA_POOL_BYTES_CHUNK_SIZE 4096
+
+// A chunk of memory for data_pool_alloc_bytes().
+typedef struct data_pool_bytes_s {
+    struct data_pool_bytes_s *next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+} data_pool_bytes_s;
+
 // A pool of memory for MMDB_entry_data_list_s structs. This is so we can
 // allocate multiple up front rather than one at a time for performance
 // reasons.
@@ -42,12 +54,17 @@ typedef struct MMDB_data_pool_s {
     // An array of pointers to blocks of memory holding space for list
     // elements.
     MMDB_entry_data_list_s *blocks[DATA_POOL_NUM_BLOCKS];
+
+    // The chunks that the strings and bytes of values are copied to when
+    // they can't point into the database, newest first.
+    data_pool_bytes_s *bytes;
 } MMDB_data_pool_s;
 
 bool can_multiply(size_t const, size_t const, size_t const);
 MMDB_data_pool_s *data_pool_new(size_t const);
 void data_pool_destroy(MMDB_data_pool_s *const);
 MMDB_entry_data_list_s *data_pool_alloc(MMDB_data_pool_s *const);
+uint8_t *data_pool_alloc_bytes(MMDB_data_pool_s *const, size_t const);
 MMDB_entry_data_list_s *data_pool_to_list(MMDB_data_pool_s *const);
 
 #endif
@@ -0,0 +1,310 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#if HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "map-file.h"
+#include "maxminddb.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #ifndef UNICODE
+        #define UNICODE
+    #endif
+    #include <windows.h>
+    #ifndef SSIZE_MAX
+        #define SSIZE_MAX INTPTR_MAX
+    #endif
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+static LPWSTR utf8_to_utf16(const char *utf8_str) {
+    int wide_chars = MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, NULL, 0);
+    wchar_t *utf16_str = (wchar_t *)calloc(wide_chars, sizeof(wchar_t));
+    if (!utf16_str) {
+        return NULL;
+    }
+
+    if (MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, utf16_str, wide_chars) <
+        1) {
+        free(utf16_str);
+        return NULL;
+    }
+
+    return utf16_str;
+}
+
+int map_file(const char *const filename,
+             const uint8_t **const content,
+             ssize_t *const content_size) {
+    ssize_t size;
+    int status = MMDB_SUCCESS;
+    HANDLE mmh = NULL;
+    HANDLE fd = INVALID_HANDLE_VALUE;
+    LPWSTR utf16_filename = utf8_to_utf16(filename);
+    if (!utf16_filename) {
+        status = MMDB_FILE_OPEN_ERROR;
+        goto cleanup;
+    }
+    fd = CreateFileW(utf16_filename,
+                     GENERIC_READ,
+                     FILE_SHARE_READ,
+                     NULL,
+                     OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL,
+                     NULL);
+    if (fd == INVALID_HANDLE_VALUE) {
+        status = MMDB_FILE_OPEN_ERROR;
+        goto cleanup;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(fd, &file_size)) {
+        status = MMDB_IO_ERROR;
+        goto cleanup;
+    }
+    if (file_size.QuadPart < 0 || file_size.QuadPart > SSIZE_MAX) {
+        status = MMDB_IO_ERROR;
+        goto cleanup;
+    }
+    size = (ssize_t)file_size.QuadPart;
+    mmh = CreateFileMapping(fd, NULL, PAGE_READONLY, 0, 0, NULL);
+    /* Microsoft documentation for CreateFileMapping indicates this returns
+        NULL not INVALID_HANDLE_VALUE on error */
+    if (NULL == mmh) {
+        status = MMDB_IO_ERROR;
+        goto cleanup;
+    }
+    uint8_t *file_content =
+        (uint8_t *)MapViewOfFile(mmh, FILE_MAP_READ, 0, 0, 0);
+    if (file_content == NULL) {
+        status = MMDB_IO_ERROR;
+        goto cleanup;
+    }
+
+    *content_size = size;
+    *content = file_content;
+
+cleanup:;
+    int saved_errno = errno;
+    if (INVALID_HANDLE_VALUE != fd) {
+        CloseHandle(fd);
+    }
+    if (NULL != mmh) {
+        CloseHandle(mmh);
+    }
+    errno = saved_errno;
+    free(utf16_filename);
+
+    return status;
+}
+
+int open_file(const char *const filename, opened_file_s *const file) {
+    LPWSTR utf16_filename = utf8_to_utf16(filename);
+    if (!utf16_filename) {
+        return MMDB_FILE_OPEN_ERROR;
+    }
+    HANDLE fd = CreateFileW(utf16_filename,
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL);
+    free(utf16_filename);
+    if (fd == INVALID_HANDLE_VALUE) {
+        return MMDB_FILE_OPEN_ERROR;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(fd, &file_size) || file_size.QuadPart < 0) {
+        CloseHandle(fd);
+        return MMDB_IO_ERROR;
+    }
+
+    file->handle = fd;
+    file->size = (uint64_t)file_size.QuadPart;
+    return MMDB_SUCCESS;
+}
+
+int read_file(const opened_file_s *const file,
+              uint64_t offset,
+              size_t size,
+              uint8_t *const buffer) {
+    if (offset > file->size || size > file->size - offset) {
+        return MMDB_IO_ERROR;
+    }
+    size_t done = 0;
+    while (done < size) {
+        size_t const left = size - done;
+        DWORD const chunk = left > MAXDWORD ? MAXDWORD : (DWORD)left;
+        uint64_t const position = offset + done;
+        OVERLAPPED overlapped = {.Offset = (DWORD)position,
+                                 .OffsetHigh = (DWORD)(position >> 32)};
+        DWORD bytes_read = 0;
+        if (!ReadFile((HANDLE)file->handle,
+                      buffer + done,
+                      chunk,
+                      &bytes_read,
+                      &overlapped) ||
+            0 == bytes_read) {
+            return MMDB_IO_ERROR;
+        }
+        done += bytes_read;
+    }
+    return MMDB_SUCCESS;
+}
+
+void close_file(opened_file_s *const file) {
+    CloseHandle((HANDLE)file->handle);
+    file->handle = INVALID_HANDLE_VALUE;
+}
+
+#else // _WIN32
+
+int map_file(const char *const filename,
+             const uint8_t **const content,
+             ssize_t *const content_size) {
+    int status = MMDB_SUCCESS;
+
+    int o_flags = O_RDONLY;
+    #ifdef O_CLOEXEC
+    o_flags |= O_CLOEXEC;
+    #endif
+    int fd = open(filename, o_flags);
+    if (fd < 0) {
+        status = MMDB_FILE_OPEN_ERROR;
+        goto cleanup;
+    }
+
+    #if defined(FD_CLOEXEC) && !defined(O_CLOEXEC)
+    int fd_flags = fcntl(fd, F_GETFD);
+    if (fd_flags >= 0) {
+        fcntl(fd, F_SETFD, fd_flags | FD_CLOEXEC);
+    }
+    #endif
+
+    struct stat s;
+    if (fstat(fd, &s)) {
+        status = MMDB_FILE_OPEN_ERROR;
+        goto cleanup;
+    }
+
+    off_t size = s.st_size;
+    if (size < 0 || size > SSIZE_MAX) {
+        status = MMDB_OUT_OF_MEMORY_ERROR;
+        goto cleanup;
+    }
+
+    uint8_t *file_content =
+        (uint8_t *)mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == file_content) {
+        if (ENOMEM == errno) {
+            status = MMDB_OUT_OF_MEMORY_ERROR;
+        } else {
+            status = MMDB_IO_ERROR;
+        }
+        goto cleanup;
+    }
+
+    *content_size = (ssize_t)size;
+    *content = file_content;
+
+cleanup:;
+    int saved_errno = errno;
+    if (fd >= 0) {
+        close(fd);
+    }
+    errno = saved_errno;
+
+    return status;
+}
+
+int open_file(const char *const filename, opened_file_s *const file) {
+    int o_flags = O_RDONLY;
+    #ifdef O_CLOEXEC
+    o_flags |= O_CLOEXEC;
+    #endif
+    int fd = open(filename, o_flags);
+    if (fd < 0) {
+        return MMDB_FILE_OPEN_ERROR;
+    }
+
+    #if defined(FD_CLOEXEC) && !defined(O_CLOEXEC)
+    int fd_flags = fcntl(fd, F_GETFD);
+    if (fd_flags >= 0) {
+        fcntl(fd, F_SETFD, fd_flags | FD_CLOEXEC);
+    }
+    #endif
+
+    struct stat s;
+    if (fstat(fd, &s) || s.st_size < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return MMDB_FILE_OPEN_ERROR;
+    }
+
+    file->fd = fd;
+    file->size = (uint64_t)s.st_size;
+    return MMDB_SUCCESS;
+}
+
+int read_file(const opened_file_s *const file,
+              uint64_t offset,
+              size_t size,
+              uint8_t *const buffer) {
+    if (offset > file->size || size > file->size - offset) {
+        return MMDB_IO_ERROR;
+    }
+    size_t done = 0;
+    while (done < size) {
+        off_t const position = (off_t)(offset + done);
+        if (position < 0 || (uint64_t)position != offset + done) {
+            return MMDB_IO_ERROR;
+        }
+        ssize_t const bytes_read =
+            pread(file->fd, buffer + done, size - done, position);
+        if (bytes_read < 0 && EINTR == errno) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return MMDB_IO_ERROR;
+        }
+        done += (size_t)bytes_read;
+    }
+    return MMDB_SUCCESS;
+}
+
+void close_file(opened_file_s *const file) {
+    close(file->fd);
+    file->fd = -1;
+}
+
+#endif // _WIN32
+
+void unmap_file(const uint8_t *const content, ssize_t content_size) {
+#ifdef _WIN32
+    (void)content_size;
+    UnmapViewOfFile(content);
+#else
+    #if defined(__clang__)
+    // The mapping is only const to the rest of the library.
+        #pragma clang diagnostic push
+        #pragma clang diagnostic ignored "-Wcast-qual"
+    #endif
+    munmap((void *)content, (size_t)content_size);
+    #if defined(__clang__)
+        #pragma clang diagnostic pop
+    #endif
+#endif
+}
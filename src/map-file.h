@@ -0,0 +1,44 @@
+#ifndef MAP_FILE_H
+#define MAP_FILE_H
+
+#include "maxminddb.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maps the whole of filename into memory read-only, setting content and
+// content_size on success. This returns an MMDB status code.
+int map_file(const char *const filename,
+             const uint8_t **const content,
+             ssize_t *const content_size);
+
+// Unmaps the content of a file mapped by map_file().
+void unmap_file(const uint8_t *const content, ssize_t content_size);
+
+// A file that is read a piece at a time rather than mapped.
+typedef struct opened_file_s {
+#ifdef _WIN32
+    void *handle;
+#else
+    int fd;
+#endif
+    uint64_t size;
+} opened_file_s;
+
+// Opens filename read-only and sets the size of the file. This returns an
+// MMDB status code.
+int open_file(const char *const filename, opened_file_s *const file);
+
+// Reads size bytes at offset in the file into buffer. Reads don't move a file
+// position, so a file may be read by several threads at once. This returns
+// an MMDB status code, and reading past the end of the file is an
+// MMDB_IO_ERROR.
+int read_file(const opened_file_s *const file,
+              uint64_t offset,
+              size_t size,
+              uint8_t *const buffer);
+
+// Closes a file opened by open_file().
+void close_file(opened_file_s *const file);
+
+#endif
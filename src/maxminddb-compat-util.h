@@ -3,8 +3,8 @@
 
 /* *INDENT-OFF* */
 
-/* The memmem, strdup, and strndup functions were all copied from the
- * FreeBSD source, along with the relevant copyright notice.
+/* The strdup and strndup functions were both copied from the FreeBSD source,
+ * along with the relevant copyright notice.
  *
  * It'd be nicer to simply use the functions available on the system if they
  * exist, but there doesn't seem to be a good way to detect them without also
@@ -14,62 +14,6 @@
  *
  * C is fun! */
 
-/* Applies to memmem implementation */
-/*-
- * Copyright (c) 2005 Pascal Gloor <pascal.gloor@spale.com>
- *
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions
- * are met:
- * 1. Redistributions of source code must retain the above copyright
- *    notice, this list of conditions and the following disclaimer.
- * 2. Redistributions in binary form must reproduce the above copyright
- *    notice, this list of conditions and the following disclaimer in the
- *    documentation and/or other materials provided with the distribution.
- * 3. The name of the author may not be used to endorse or promote
- *    products derived from this software without specific prior written
- *    permission.
- *
- * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
- * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
- * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
- * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
- * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
- * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
- * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
- * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
- * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
- * SUCH DAMAGE.
- */
-static const void *
-mmdb_memmem(const void *l, size_t l_len, const void *s, size_t s_len) {
-    const char *cur, *last;
-    const char *cl = (const char *)l;
-    const char *cs = (const char *)s;
-
-    /* we need something to compare */
-    if (l_len == 0 || s_len == 0)
-        return NULL;
-
-    /* "s" must be smaller or equal to "l" */
-    if (l_len < s_len)
-        return NULL;
-
-    /* special case where s_len == 1 */
-    if (s_len == 1)
-        return memchr(l, (int)*cs, l_len);
-
-    /* the last position where its possible to find "s" in "l" */
-    last = cl + l_len - s_len;
-
-    for (cur = cl; cur <= last; cur++)
-        if (cur[0] == cs[0] && memcmp(cur, cs, s_len) == 0)
-            return cur;
-
-    return NULL;
-}
-
 /* Applies to strnlen implementation */
 /*-
  * Copyright (c) 2009 David Schultz <das@FreeBSD.org>
@@ -96,7 +40,7 @@ mmdb_memmem(const void *l, size_t l_len, const void *s, size_t s_len) {
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
-static size_t mmdb_strnlen(const char *s, size_t maxlen) {
+static inline size_t mmdb_strnlen(const char *s, size_t maxlen) {
     size_t len;
 
     for (len = 0; len < maxlen; len++, s++) {
@@ -135,7 +79,7 @@ static size_t mmdb_strnlen(const char *s, size_t maxlen) {
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
-static char *mmdb_strdup(const char *str) {
+static inline char *mmdb_strdup(const char *str) {
     size_t len;
     char *copy;
 
@@ -146,7 +90,7 @@ static char *mmdb_strdup(const char *str) {
     return (copy);
 }
 
-static char *mmdb_strndup(const char *str, size_t n) {
+static inline char *mmdb_strndup(const char *str, size_t n) {
     size_t len;
     char *copy;
 
@@ -0,0 +1,907 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#if HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "map-file.h"
+#include "maxminddb.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* An index file starts with a header of INDEX_HEADER_SIZE bytes:
+ *
+ *   magic                "MMDB-IDX"
+ *   format version       u32
+ *   ip_version          u32 \
+ *   record_size         u32  |
+ *   node_count          u32  | of the database the index was built from
+ *   data_section_size   u32  |
+ *   build_epoch         u64 /
+ *   path_count          u32
+ *   path_size           u32
+ *   key_count           u32
+ *   network_count       u32
+ *   strings_size        u32
+ *
+ * It is followed by the path, as path_count NUL terminated strings padded
+ * with NULs to a multiple of four bytes, the keys, the networks and the
+ * strings of the keys. The keys are sorted by their strings and each one is
+ * a u32 string offset, string length, first network and network count. The
+ * networks of a key are next to each other in address order, and each one is
+ * 16 address bytes, a u16 ip_version, a u16 netmask and the u32 offset of its
+ * data. All of the numbers are big endian. */
+#define INDEX_MAGIC "MMDB-IDX"
+#define INDEX_MAGIC_LENGTH (8)
+#define INDEX_FORMAT_VERSION (1)
+#define INDEX_HEADER_SIZE (56)
+#define INDEX_KEY_SIZE (16)
+#define INDEX_NETWORK_SIZE (24)
+
+/* The most path elements an index can be built on. */
+#define MAXIMUM_PATH_COUNT (32)
+
+/* Enough for any number formatted as a key. */
+#define NUMBER_KEY_SIZE (64)
+
+/* Marks an empty slot in the hash tables of the builder, and a record whose
+ * data has no value that can be indexed. */
+#define NO_KEY UINT32_MAX
+
+typedef struct index_network_s {
+    uint8_t address[16];
+    uint16_t ip_version;
+    uint16_t netmask;
+    uint32_t offset;
+    uint32_t key;
+} index_network_s;
+
+typedef struct index_key_s {
+    size_t string_offset;
+    uint32_t string_length;
+    uint32_t network_count;
+} index_key_s;
+
+typedef struct record_slot_s {
+    uint32_t offset;
+    uint32_t key;
+} record_slot_s;
+
+typedef struct sorted_key_s {
+    const char *string;
+    uint32_t length;
+    uint32_t key;
+} sorted_key_s;
+
+/* The keys are interned in a hash table of key numbers, and the key of each
+ * data record is cached in another one as most networks share their data
+ * with many others. Both tables are kept at most half full. */
+typedef struct index_builder_s {
+    const MMDB_s *mmdb;
+    const char *const *path;
+    index_network_s *networks;
+    size_t network_count;
+    size_t network_capacity;
+    index_key_s *keys;
+    size_t key_count;
+    size_t key_capacity;
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+    uint32_t *key_slots;
+    size_t key_slot_count;
+    record_slot_s *record_slots;
+    size_t record_slot_count;
+    size_t record_count;
+    char *buffer;
+    size_t buffer_size;
+} index_builder_s;
+
+static int grow(void **const array,
+                size_t *const capacity,
+                size_t needed,
+                size_t element_size);
+static uint32_t hash_bytes(const char *const bytes, size_t length);
+static int value_key(const MMDB_entry_data_s *const entry_data,
+                     char **const buffer,
+                     size_t *const buffer_size,
+                     const char **const key,
+                     size_t *const key_length);
+static int record_key(index_builder_s *const builder,
+                      MMDB_entry_s *const entry,
+                      uint32_t *const key);
+static int intern_key(index_builder_s *const builder,
+                      const char *const string,
+                      size_t length,
+                      uint32_t *const key);
+static int add_network(index_builder_s *const builder,
+                       const MMDB_network_s *const network);
+static int compare_sorted_keys(const void *a, const void *b);
+static int write_index(const index_builder_s *const builder,
+                       const char *const filename);
+static int write_header(const index_builder_s *const builder,
+                        FILE *const file,
+                        uint32_t path_count,
+                        uint32_t path_size);
+static void free_builder(index_builder_s *const builder);
+static int init_iterator(const MMDB_index_s *const index,
+                         const char *const key,
+                         size_t key_length,
+                         MMDB_index_iterator_s *const iterator);
+static void put_uint16(uint8_t *const p, uint16_t value);
+static void put_uint32(uint8_t *const p, uint32_t value);
+static uint16_t get_uint16(const uint8_t *const p);
+static uint32_t get_uint32(const uint8_t *const p);
+static uint64_t get_uint64(const uint8_t *const p);
+
+int MMDB_index_build(const MMDB_s *const mmdb,
+                     const char *const *const path,
+                     const char *const filename) {
+    index_builder_s builder = {.mmdb = mmdb, .path = path};
+    if (path != NULL && path[0] == NULL) {
+        builder.path = NULL;
+    }
+
+    size_t path_count = 0;
+    for (; builder.path != NULL && builder.path[path_count] != NULL;
+         path_count++) {
+        if (path_count == MAXIMUM_PATH_COUNT) {
+            return MMDB_INVALID_LOOKUP_PATH_ERROR;
+        }
+    }
+
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init(
+        mmdb, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        status = add_network(&builder, &network);
+        if (status != MMDB_SUCCESS) {
+            goto cleanup;
+        }
+    }
+    if (status != MMDB_SUCCESS) {
+        goto cleanup;
+    }
+
+    status = write_index(&builder, filename);
+
+cleanup:
+    free_builder(&builder);
+    return status;
+}
+
+static int grow(void **const array,
+                size_t *const capacity,
+                size_t needed,
+                size_t element_size) {
+    if (needed <= *capacity) {
+        return MMDB_SUCCESS;
+    }
+
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        if (new_capacity > SIZE_MAX / 2) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        new_capacity *= 2;
+    }
+    if (new_capacity > SIZE_MAX / element_size) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    void *new_array = realloc(*array, new_capacity * element_size);
+    if (new_array == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return MMDB_SUCCESS;
+}
+
+// FNV-1a
+static uint32_t hash_bytes(const char *const bytes, size_t length) {
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)bytes[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/* Sets key to the text form of a value, which is the same as
+ * MMDB_dump_entry_data_list() prints without the quotes or type, or to NULL
+ * for maps and arrays, which can't be indexed. Strings are returned as they
+ * are and everything else is formatted into buffer. */
+static int value_key(const MMDB_entry_data_s *const entry_data,
+                     char **const buffer,
+                     size_t *const buffer_size,
+                     const char **const key,
+                     size_t *const key_length) {
+    size_t needed = NUMBER_KEY_SIZE;
+    if (entry_data->type == MMDB_DATA_TYPE_BYTES) {
+        needed = (size_t)entry_data->data_size * 2 + 1;
+    }
+    int status = grow((void **)buffer, buffer_size, needed, 1);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    char *const text = *buffer;
+    int length = 0;
+    switch (entry_data->type) {
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            *key = entry_data->utf8_string;
+            *key_length = entry_data->data_size;
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_BYTES:
+            for (uint32_t i = 0; i < entry_data->data_size; i++) {
+                sprintf(text + 2 * i, "%02X", entry_data->bytes[i]);
+            }
+            length = (int)(entry_data->data_size * 2);
+            break;
+        case MMDB_DATA_TYPE_DOUBLE:
+            length = snprintf(
+                text, NUMBER_KEY_SIZE, "%f", entry_data->double_value);
+            break;
+        case MMDB_DATA_TYPE_FLOAT:
+            length = snprintf(
+                text, NUMBER_KEY_SIZE, "%f", (double)entry_data->float_value);
+            break;
+        case MMDB_DATA_TYPE_UINT16:
+            length = snprintf(
+                text, NUMBER_KEY_SIZE, "%" PRIu16, entry_data->uint16);
+            break;
+        case MMDB_DATA_TYPE_UINT32:
+            length = snprintf(
+                text, NUMBER_KEY_SIZE, "%" PRIu32, entry_data->uint32);
+            break;
+        case MMDB_DATA_TYPE_INT32:
+            length =
+                snprintf(text, NUMBER_KEY_SIZE, "%" PRId32, entry_data->int32);
+            break;
+        case MMDB_DATA_TYPE_UINT64:
+            length = snprintf(
+                text, NUMBER_KEY_SIZE, "%" PRIu64, entry_data->uint64);
+            break;
+        case MMDB_DATA_TYPE_UINT128:
+#if MMDB_UINT128_IS_BYTE_ARRAY
+            memcpy(text, "0x", 2);
+            for (int i = 0; i < 16; i++) {
+                sprintf(text + 2 + 2 * i, "%02X", entry_data->uint128[i]);
+            }
+            length = 34;
+#else
+            length = snprintf(text,
+                              NUMBER_KEY_SIZE,
+                              "0x%016" PRIX64 "%016" PRIX64,
+                              (uint64_t)(entry_data->uint128 >> 64),
+                              (uint64_t)entry_data->uint128);
+#endif
+            break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            length = snprintf(text,
+                              NUMBER_KEY_SIZE,
+                              "%s",
+                              entry_data->boolean ? "true" : "false");
+            break;
+        case MMDB_DATA_TYPE_MAP:
+        case MMDB_DATA_TYPE_ARRAY:
+            *key = NULL;
+            *key_length = 0;
+            return MMDB_SUCCESS;
+        default:
+            return MMDB_INVALID_DATA_ERROR;
+    }
+    if (length < 0) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    *key = text;
+    *key_length = (size_t)length;
+    return MMDB_SUCCESS;
+}
+
+/* Sets key to the number of the key for the data of a network, or to NO_KEY
+ * if the data has nothing to index. */
+static int record_key(index_builder_s *const builder,
+                      MMDB_entry_s *const entry,
+                      uint32_t *const key) {
+    if (builder->record_count * 2 >= builder->record_slot_count) {
+        size_t slot_count =
+            builder->record_slot_count ? builder->record_slot_count * 2 : 1024;
+        record_slot_s *slots = malloc(slot_count * sizeof(record_slot_s));
+        if (slots == NULL) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        for (size_t i = 0; i < slot_count; i++) {
+            slots[i].offset = NO_KEY;
+        }
+        for (size_t i = 0; i < builder->record_slot_count; i++) {
+            record_slot_s slot = builder->record_slots[i];
+            if (slot.offset == NO_KEY) {
+                continue;
+            }
+            size_t j = (slot.offset * 2654435761U) & (slot_count - 1);
+            while (slots[j].offset != NO_KEY) {
+                j = (j + 1) & (slot_count - 1);
+            }
+            slots[j] = slot;
+        }
+        free(builder->record_slots);
+        builder->record_slots = slots;
+        builder->record_slot_count = slot_count;
+    }
+
+    size_t mask = builder->record_slot_count - 1;
+    size_t i = (entry->offset * 2654435761U) & mask;
+    for (; builder->record_slots[i].offset != NO_KEY; i = (i + 1) & mask) {
+        if (builder->record_slots[i].offset == entry->offset) {
+            *key = builder->record_slots[i].key;
+            return MMDB_SUCCESS;
+        }
+    }
+
+    const char *string;
+    size_t length;
+    char offset_key[NUMBER_KEY_SIZE];
+    if (builder->path == NULL) {
+        int printed =
+            snprintf(offset_key, sizeof(offset_key), "%" PRIu32, entry->offset);
+        string = offset_key;
+        length = (size_t)printed;
+    } else {
+        MMDB_entry_data_s entry_data;
+        int status = MMDB_aget_value(entry, &entry_data, builder->path);
+        if (status == MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR ||
+            (status == MMDB_SUCCESS && !entry_data.has_data)) {
+            string = NULL;
+            length = 0;
+        } else if (status != MMDB_SUCCESS) {
+            return status;
+        } else {
+            status = value_key(&entry_data,
+                               &builder->buffer,
+                               &builder->buffer_size,
+                               &string,
+                               &length);
+            if (status != MMDB_SUCCESS) {
+                return status;
+            }
+        }
+    }
+
+    *key = NO_KEY;
+    if (string != NULL) {
+        int status = intern_key(builder, string, length, key);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+    }
+
+    builder->record_slots[i].offset = entry->offset;
+    builder->record_slots[i].key = *key;
+    builder->record_count++;
+    return MMDB_SUCCESS;
+}
+
+static int intern_key(index_builder_s *const builder,
+                      const char *const string,
+                      size_t length,
+                      uint32_t *const key) {
+    if (length > UINT32_MAX || builder->key_count >= NO_KEY) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    if (builder->key_count * 2 >= builder->key_slot_count) {
+        size_t slot_count =
+            builder->key_slot_count ? builder->key_slot_count * 2 : 1024;
+        uint32_t *slots = malloc(slot_count * sizeof(uint32_t));
+        if (slots == NULL) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        for (size_t i = 0; i < slot_count; i++) {
+            slots[i] = NO_KEY;
+        }
+        for (size_t i = 0; i < builder->key_count; i++) {
+            const index_key_s *k = &builder->keys[i];
+            size_t j = hash_bytes(builder->strings + k->string_offset,
+                                  k->string_length) &
+                       (slot_count - 1);
+            while (slots[j] != NO_KEY) {
+                j = (j + 1) & (slot_count - 1);
+            }
+            slots[j] = (uint32_t)i;
+        }
+        free(builder->key_slots);
+        builder->key_slots = slots;
+        builder->key_slot_count = slot_count;
+    }
+
+    size_t mask = builder->key_slot_count - 1;
+    size_t i = hash_bytes(string, length) & mask;
+    for (; builder->key_slots[i] != NO_KEY; i = (i + 1) & mask) {
+        const index_key_s *k = &builder->keys[builder->key_slots[i]];
+        if (k->string_length == length &&
+            memcmp(builder->strings + k->string_offset, string, length) == 0) {
+            *key = builder->key_slots[i];
+            return MMDB_SUCCESS;
+        }
+    }
+
+    int status = grow((void **)&builder->keys,
+                      &builder->key_capacity,
+                      builder->key_count + 1,
+                      sizeof(index_key_s));
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+    // The string may be in the buffer, which isn't touched here.
+    status = grow((void **)&builder->strings,
+                  &builder->strings_capacity,
+                  builder->strings_size + length,
+                  1);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    index_key_s *new_key = &builder->keys[builder->key_count];
+    new_key->string_offset = builder->strings_size;
+    new_key->string_length = (uint32_t)length;
+    new_key->network_count = 0;
+    memcpy(builder->strings + builder->strings_size, string, length);
+    builder->strings_size += length;
+
+    *key = (uint32_t)builder->key_count;
+    builder->key_slots[i] = *key;
+    builder->key_count++;
+    return MMDB_SUCCESS;
+}
+
+static int add_network(index_builder_s *const builder,
+                       const MMDB_network_s *const network) {
+    if (!network->found_entry) {
+        return MMDB_SUCCESS;
+    }
+
+    MMDB_entry_s entry = network->entry;
+    uint32_t key;
+    int status = record_key(builder, &entry, &key);
+    if (status != MMDB_SUCCESS || key == NO_KEY) {
+        return status;
+    }
+
+    if (builder->network_count >= UINT32_MAX) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    status = grow((void **)&builder->networks,
+                  &builder->network_capacity,
+                  builder->network_count + 1,
+                  sizeof(index_network_s));
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    index_network_s *n = &builder->networks[builder->network_count++];
+    memcpy(n->address, network->address, sizeof(n->address));
+    n->ip_version = network->ip_version;
+    n->netmask = network->netmask;
+    n->offset = entry.offset;
+    n->key = key;
+    builder->keys[key].network_count++;
+    return MMDB_SUCCESS;
+}
+
+static int compare_sorted_keys(const void *a, const void *b) {
+    const sorted_key_s *const key_a = a;
+    const sorted_key_s *const key_b = b;
+    uint32_t length =
+        key_a->length < key_b->length ? key_a->length : key_b->length;
+    int cmp = memcmp(key_a->string, key_b->string, length);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return key_a->length < key_b->length   ? -1
+           : key_a->length > key_b->length ? 1
+                                           : 0;
+}
+
+/* The networks are written grouped by key with a counting sort, which keeps
+ * the networks of each key in the order the search tree was iterated in. */
+static int write_index(const index_builder_s *const builder,
+                       const char *const filename) {
+    uint32_t path_count = 0;
+    size_t path_size = 0;
+    for (; builder->path != NULL && builder->path[path_count] != NULL;
+         path_count++) {
+        path_size += strlen(builder->path[path_count]) + 1;
+    }
+    if (path_size > UINT32_MAX - 3 || builder->strings_size > UINT32_MAX) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    int status = MMDB_SUCCESS;
+    FILE *file = NULL;
+    sorted_key_s *sorted = NULL;
+    uint32_t *next_network = NULL;
+    uint32_t *order = NULL;
+
+    size_t key_count = builder->key_count;
+    size_t network_count = builder->network_count;
+    sorted = calloc(key_count ? key_count : 1, sizeof(sorted_key_s));
+    next_network = calloc(key_count ? key_count : 1, sizeof(uint32_t));
+    order = calloc(network_count ? network_count : 1, sizeof(uint32_t));
+    if (sorted == NULL || next_network == NULL || order == NULL) {
+        status = MMDB_OUT_OF_MEMORY_ERROR;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < key_count; i++) {
+        sorted[i].string = builder->strings + builder->keys[i].string_offset;
+        sorted[i].length = builder->keys[i].string_length;
+        sorted[i].key = (uint32_t)i;
+    }
+    qsort(sorted, key_count, sizeof(sorted_key_s), compare_sorted_keys);
+
+    uint32_t first_network = 0;
+    for (size_t i = 0; i < key_count; i++) {
+        next_network[sorted[i].key] = first_network;
+        first_network += builder->keys[sorted[i].key].network_count;
+    }
+    for (size_t i = 0; i < network_count; i++) {
+        order[next_network[builder->networks[i].key]++] = (uint32_t)i;
+    }
+
+    file = fopen(filename, "wb");
+    if (file == NULL) {
+        status = MMDB_FILE_OPEN_ERROR;
+        goto cleanup;
+    }
+
+    status = write_header(builder, file, path_count, (uint32_t)path_size);
+    if (status != MMDB_SUCCESS) {
+        goto cleanup;
+    }
+
+    for (uint32_t i = 0; i < path_count; i++) {
+        size_t length = strlen(builder->path[i]) + 1;
+        if (fwrite(builder->path[i], 1, length, file) != length) {
+            status = MMDB_IO_ERROR;
+            goto cleanup;
+        }
+    }
+    const uint8_t padding[4] = {0};
+    size_t padding_size = (4 - path_size % 4) % 4;
+    if (fwrite(padding, 1, padding_size, file) != padding_size) {
+        status = MMDB_IO_ERROR;
+        goto cleanup;
+    }
+
+    // The strings are written in the same order as the keys, so a key's
+    // string offset is the total length of the strings before it.
+    uint32_t string_offset = 0;
+    first_network = 0;
+    for (size_t i = 0; i < key_count; i++) {
+        uint8_t record[INDEX_KEY_SIZE];
+        uint32_t count = builder->keys[sorted[i].key].network_count;
+        put_uint32(record, string_offset);
+        put_uint32(record + 4, sorted[i].length);
+        put_uint32(record + 8, first_network);
+        put_uint32(record + 12, count);
+        if (fwrite(record, 1, sizeof(record), file) != sizeof(record)) {
+            status = MMDB_IO_ERROR;
+            goto cleanup;
+        }
+        string_offset += sorted[i].length;
+        first_network += count;
+    }
+
+    for (size_t i = 0; i < network_count; i++) {
+        const index_network_s *n = &builder->networks[order[i]];
+        uint8_t record[INDEX_NETWORK_SIZE];
+        memcpy(record, n->address, 16);
+        put_uint16(record + 16, n->ip_version);
+        put_uint16(record + 18, n->netmask);
+        put_uint32(record + 20, n->offset);
+        if (fwrite(record, 1, sizeof(record), file) != sizeof(record)) {
+            status = MMDB_IO_ERROR;
+            goto cleanup;
+        }
+    }
+
+    for (size_t i = 0; i < key_count; i++) {
+        if (fwrite(sorted[i].string, 1, sorted[i].length, file) !=
+            sorted[i].length) {
+            status = MMDB_IO_ERROR;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (file != NULL && fclose(file) != 0 && status == MMDB_SUCCESS) {
+        status = MMDB_IO_ERROR;
+    }
+    free(sorted);
+    free(next_network);
+    free(order);
+    return status;
+}
+
+static int write_header(const index_builder_s *const builder,
+                        FILE *const file,
+                        uint32_t path_count,
+                        uint32_t path_size) {
+    const MMDB_s *const mmdb = builder->mmdb;
+    uint8_t header[INDEX_HEADER_SIZE];
+    memcpy(header, INDEX_MAGIC, INDEX_MAGIC_LENGTH);
+    put_uint32(header + 8, INDEX_FORMAT_VERSION);
+    put_uint32(header + 12, mmdb->metadata.ip_version);
+    put_uint32(header + 16, mmdb->metadata.record_size);
+    put_uint32(header + 20, mmdb->metadata.node_count);
+    put_uint32(header + 24, mmdb->data_section_size);
+    put_uint32(header + 28, (uint32_t)(mmdb->metadata.build_epoch >> 32));
+    put_uint32(header + 32, (uint32_t)mmdb->metadata.build_epoch);
+    put_uint32(header + 36, path_count);
+    put_uint32(header + 40, path_size);
+    put_uint32(header + 44, (uint32_t)builder->key_count);
+    put_uint32(header + 48, (uint32_t)builder->network_count);
+    put_uint32(header + 52, (uint32_t)builder->strings_size);
+
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        return MMDB_IO_ERROR;
+    }
+    return MMDB_SUCCESS;
+}
+
+static void free_builder(index_builder_s *const builder) {
+    free(builder->networks);
+    free(builder->keys);
+    free(builder->strings);
+    free(builder->key_slots);
+    free(builder->record_slots);
+    free(builder->buffer);
+}
+
+int MMDB_index_open(const char *const filename,
+                    const MMDB_s *const mmdb,
+                    MMDB_index_s *const index) {
+    memset(index, 0, sizeof(MMDB_index_s));
+
+    const uint8_t *content;
+    ssize_t size;
+    int status = map_file(filename, &content, &size);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    if (size < INDEX_HEADER_SIZE ||
+        memcmp(content, INDEX_MAGIC, INDEX_MAGIC_LENGTH) != 0 ||
+        get_uint32(content + 8) != INDEX_FORMAT_VERSION) {
+        status = MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+        goto cleanup;
+    }
+
+    if (get_uint32(content + 12) != mmdb->metadata.ip_version ||
+        get_uint32(content + 16) != mmdb->metadata.record_size ||
+        get_uint32(content + 20) != mmdb->metadata.node_count ||
+        get_uint32(content + 24) != mmdb->data_section_size ||
+        get_uint64(content + 28) != mmdb->metadata.build_epoch) {
+        status = MMDB_INVALID_METADATA_ERROR;
+        goto cleanup;
+    }
+
+    uint32_t path_count = get_uint32(content + 36);
+    uint32_t path_size = get_uint32(content + 40);
+    uint32_t key_count = get_uint32(content + 44);
+    uint32_t network_count = get_uint32(content + 48);
+    uint32_t strings_size = get_uint32(content + 52);
+
+    uint64_t padded_path_size = ((uint64_t)path_size + 3) & ~(uint64_t)3;
+    uint64_t keys_start = INDEX_HEADER_SIZE + padded_path_size;
+    uint64_t networks_start = keys_start + (uint64_t)key_count * INDEX_KEY_SIZE;
+    uint64_t strings_start =
+        networks_start + (uint64_t)network_count * INDEX_NETWORK_SIZE;
+    if (strings_start + strings_size != (uint64_t)size) {
+        status = MMDB_INVALID_DATA_ERROR;
+        goto cleanup;
+    }
+
+    // The path must be path_count NUL terminated strings.
+    const uint8_t *path = content + INDEX_HEADER_SIZE;
+    uint32_t nul_count = 0;
+    for (uint32_t i = 0; i < path_size; i++) {
+        nul_count += path[i] == '\0';
+    }
+    if (path_count > MAXIMUM_PATH_COUNT || nul_count != path_count ||
+        (path_size > 0 && path[path_size - 1] != '\0')) {
+        status = MMDB_INVALID_DATA_ERROR;
+        goto cleanup;
+    }
+
+    index->mmdb = mmdb;
+    index->file_content = content;
+    index->file_size = size;
+    index->path_count = path_count;
+    index->path = path;
+    index->key_count = key_count;
+    index->keys = content + keys_start;
+    index->network_count = network_count;
+    index->networks = content + networks_start;
+    index->strings_size = strings_size;
+    index->strings = content + strings_start;
+
+cleanup:
+    if (status != MMDB_SUCCESS) {
+        unmap_file(content, size);
+    }
+    return status;
+}
+
+void MMDB_index_close(MMDB_index_s *const index) {
+    if (index->file_content != NULL) {
+        unmap_file(index->file_content, index->file_size);
+    }
+    memset(index, 0, sizeof(MMDB_index_s));
+}
+
+int MMDB_index_iterator_init(const MMDB_index_s *const index,
+                             const char *const key,
+                             MMDB_index_iterator_s *const iterator) {
+    return init_iterator(index, key, strlen(key), iterator);
+}
+
+int MMDB_index_iterator_init_entry(const MMDB_index_s *const index,
+                                   MMDB_entry_s *const entry,
+                                   MMDB_index_iterator_s *const iterator) {
+    iterator->index = index;
+    iterator->next = 0;
+    iterator->end = 0;
+
+    if (index->path_count == 0) {
+        char key[NUMBER_KEY_SIZE];
+        int length = snprintf(key, sizeof(key), "%" PRIu32, entry->offset);
+        return init_iterator(index, key, (size_t)length, iterator);
+    }
+
+    const char *path[MAXIMUM_PATH_COUNT + 1];
+    const char *element = (const char *)index->path;
+    for (uint32_t i = 0; i < index->path_count; i++) {
+        path[i] = element;
+        element += strlen(element) + 1;
+    }
+    path[index->path_count] = NULL;
+
+    MMDB_entry_data_s entry_data;
+    int status = MMDB_aget_value(entry, &entry_data, path);
+    if (status == MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR ||
+        (status == MMDB_SUCCESS && !entry_data.has_data)) {
+        return MMDB_SUCCESS;
+    }
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    char *buffer = NULL;
+    size_t buffer_size = 0;
+    const char *key;
+    size_t length;
+    status = value_key(&entry_data, &buffer, &buffer_size, &key, &length);
+    if (status == MMDB_SUCCESS && key != NULL) {
+        status = init_iterator(index, key, length, iterator);
+    }
+    free(buffer);
+    return status;
+}
+
+/* Binary searches the sorted keys. Only the keys looked at are checked
+ * against the size of the index, so opening a large index is cheap. */
+static int init_iterator(const MMDB_index_s *const index,
+                         const char *const key,
+                         size_t key_length,
+                         MMDB_index_iterator_s *const iterator) {
+    iterator->index = index;
+    iterator->next = 0;
+    iterator->end = 0;
+
+    uint32_t low = 0;
+    uint32_t high = index->key_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const uint8_t *record = index->keys + (size_t)middle * INDEX_KEY_SIZE;
+        uint32_t string_offset = get_uint32(record);
+        uint32_t string_length = get_uint32(record + 4);
+        if ((uint64_t)string_offset + string_length > index->strings_size) {
+            return MMDB_INVALID_DATA_ERROR;
+        }
+
+        size_t length =
+            string_length < key_length ? string_length : key_length;
+        int cmp = memcmp(index->strings + string_offset, key, length);
+        if (cmp == 0 && string_length != key_length) {
+            cmp = string_length < key_length ? -1 : 1;
+        }
+
+        if (cmp < 0) {
+            low = middle + 1;
+        } else if (cmp > 0) {
+            high = middle;
+        } else {
+            uint32_t first_network = get_uint32(record + 8);
+            uint32_t network_count = get_uint32(record + 12);
+            if ((uint64_t)first_network + network_count >
+                index->network_count) {
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            iterator->next = first_network;
+            iterator->end = first_network + network_count;
+            return MMDB_SUCCESS;
+        }
+    }
+    return MMDB_SUCCESS;
+}
+
+bool MMDB_index_iterator_next(MMDB_index_iterator_s *const iterator,
+                              MMDB_network_s *const network,
+                              int *const mmdb_error) {
+    *mmdb_error = MMDB_SUCCESS;
+    if (iterator->next >= iterator->end) {
+        return false;
+    }
+
+    const MMDB_index_s *const index = iterator->index;
+    const uint8_t *record =
+        index->networks + (size_t)iterator->next * INDEX_NETWORK_SIZE;
+    uint16_t ip_version = get_uint16(record + 16);
+    uint16_t netmask = get_uint16(record + 18);
+    uint32_t offset = get_uint32(record + 20);
+    if ((ip_version != 4 && ip_version != 6) ||
+        netmask > (ip_version == 4 ? 32 : 128) ||
+        offset >= index->mmdb->data_section_size) {
+        *mmdb_error = MMDB_INVALID_DATA_ERROR;
+        iterator->next = iterator->end;
+        return false;
+    }
+
+    memcpy(network->address, record, sizeof(network->address));
+    network->ip_version = ip_version;
+    network->netmask = netmask;
+    network->found_entry = true;
+    network->entry.mmdb = index->mmdb;
+    network->entry.offset = offset;
+    iterator->next++;
+    return true;
+}
+
+static void put_uint16(uint8_t *const p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static void put_uint32(uint8_t *const p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static uint16_t get_uint16(const uint8_t *const p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_uint32(const uint8_t *const p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t get_uint64(const uint8_t *const p) {
+    return ((uint64_t)get_uint32(p) << 32) | get_uint32(p + 4);
+}
@@ -0,0 +1,2174 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#if HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include "maxminddb_writer.h"
+#include "tree-layout.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+    #include <netdb.h>
+    #include <sys/socket.h>
+#endif
+
+#define MMDB_DATA_SECTION_SEPARATOR (16)
+#define MAXIMUM_DATA_STRUCTURE_DEPTH (512)
+#define METADATA_MARKER "\xab\xcd\xefMaxMind.com"
+#define METADATA_MARKER_LENGTH (14)
+
+/* The largest size the control byte and its extra size bytes can encode. */
+#define MAXIMUM_DATA_SIZE (65821 + 0xFFFFFF)
+
+/* Values are allocated out of blocks of this many bytes. */
+#define WRITER_BLOCK_SIZE (1024 * 1024)
+
+/* The records of the in-memory search tree store their type in the low two
+ * bits and the index of a node or of an interned value in the rest. */
+#define RECORD_EMPTY (0)
+#define RECORD_NODE (1)
+#define RECORD_DATA (2)
+#define RECORD_TYPE(record) ((record) & 3)
+#define RECORD_INDEX(record) ((record) >> 2)
+#define MAKE_RECORD(type, index) (((uint32_t)(index) << 2) | (type))
+#define MAXIMUM_RECORD_INDEX (UINT32_MAX >> 2)
+
+#ifdef MMDB_DEBUG
+    #define DEBUG_MSG(msg) fprintf(stderr, msg "\n")
+    #define DEBUG_MSGF(fmt, ...) fprintf(stderr, fmt "\n", __VA_ARGS__)
+#else
+    #define DEBUG_MSG(...)
+    #define DEBUG_MSGF(...)
+#endif
+
+typedef struct writer_node_s {
+    uint32_t records[2];
+} writer_node_s;
+
+typedef struct writer_buffer_s {
+    uint8_t *data;
+    size_t length;
+    size_t size;
+} writer_buffer_s;
+
+typedef struct writer_block_s {
+    struct writer_block_s *next;
+    size_t used;
+    size_t size;
+} writer_block_s;
+
+struct MMDB_writer_value_s {
+    uint32_t type;
+    /* The length of a string or bytes, or the number of entries in a map or
+     * an array. */
+    uint32_t size;
+    union {
+        const uint8_t *bytes;
+        double double_value;
+        float float_value;
+        uint16_t uint16;
+        uint32_t uint32;
+        int32_t int32;
+        uint64_t uint64;
+        uint8_t uint128[16];
+        bool boolean;
+        /* Maps hold key, value pairs. The keys are UTF-8 string values. */
+        MMDB_writer_value_s **entries;
+    } u;
+    uint32_t capacity;
+    /* Set once the value is interned. Equal values share one canonical value,
+     * which is also what the search tree refers to by its id. */
+    MMDB_writer_value_s *canonical;
+    uint32_t id;
+    uint64_t hash;
+    /* The number of distinct containers the canonical value is part of. Only
+     * values used more than once are written on their own and pointed to. */
+    uint32_t references;
+    uint32_t offset;
+    uint32_t encoded_length;
+    bool frozen;
+    bool written;
+};
+
+struct MMDB_writer_s {
+    uint16_t ip_version;
+    uint16_t record_size;
+    int tree_layout;
+    uint32_t flags;
+    uint64_t build_epoch;
+    char *database_type;
+    char **languages;
+    size_t language_count;
+    char **description_languages;
+    char **descriptions;
+    size_t description_count;
+    writer_block_s *blocks;
+    /* Maps and arrays that turned out to be equal to an interned value are
+     * reused, as are their entries. The free entries are kept by the log2 of
+     * their number of pointers. */
+    MMDB_writer_value_s *free_values;
+    MMDB_writer_value_s **free_entries[32];
+    writer_node_s *nodes;
+    size_t node_count;
+    size_t nodes_size;
+    MMDB_writer_value_s **values;
+    size_t value_count;
+    size_t values_size;
+    MMDB_writer_value_s **intern_table;
+    size_t intern_table_size;
+    writer_buffer_s data;
+    writer_buffer_s scratch;
+};
+
+/* *INDENT-OFF* */
+/* --prototypes automatically generated by dev-bin/regen-prototypes.pl - don't remove this comment */
+static char *copy_string(const char *const string);
+static void *writer_alloc(MMDB_writer_s *const writer, size_t size);
+static MMDB_writer_value_s *new_value(MMDB_writer_s *const writer,
+                                      uint32_t type);
+static MMDB_writer_value_s *
+scalar_value(MMDB_writer_s *const writer, MMDB_writer_value_s *const scalar);
+static MMDB_writer_value_s *new_string_value(MMDB_writer_s *const writer,
+                                             uint32_t type,
+                                             const uint8_t *const bytes,
+                                             size_t length);
+static int add_entry(MMDB_writer_s *const writer,
+                     MMDB_writer_value_s *const container,
+                     MMDB_writer_value_s *const key,
+                     MMDB_writer_value_s *const value);
+static size_t entries_class(size_t count);
+static MMDB_writer_value_s **alloc_entries(MMDB_writer_s *const writer,
+                                           size_t count);
+static void free_entries(MMDB_writer_s *const writer,
+                         MMDB_writer_value_s **const entries,
+                         size_t count);
+static void free_container(MMDB_writer_s *const writer,
+                           MMDB_writer_value_s *const container);
+static MMDB_entry_data_list_s *
+value_from_entry_data_list(MMDB_writer_s *const writer,
+                           MMDB_entry_data_list_s *entry_data_list,
+                           MMDB_writer_value_s **const value,
+                           int depth,
+                           int *const status);
+static uint64_t
+hash_bytes(uint64_t hash, const void *const data, size_t length);
+static uint64_t hash_value(const MMDB_writer_value_s *const value);
+static bool values_equal(const MMDB_writer_value_s *const a,
+                         const MMDB_writer_value_s *const b);
+static int grow_intern_table(MMDB_writer_s *const writer);
+static MMDB_writer_value_s *find_value(const MMDB_writer_s *const writer,
+                                       const MMDB_writer_value_s *const value,
+                                       size_t *const slot);
+static int add_value(MMDB_writer_s *const writer,
+                     MMDB_writer_value_s *const value,
+                     size_t slot);
+static int compare_map_keys(const void *a, const void *b);
+static int intern_value(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const value,
+                        int depth,
+                        MMDB_writer_value_s **const canonical);
+static int merge_values(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const old_value,
+                        MMDB_writer_value_s *const new_value,
+                        int depth,
+                        MMDB_writer_value_s **const merged);
+static int new_node(MMDB_writer_s *const writer,
+                    uint32_t left,
+                    uint32_t right,
+                    uint32_t *const node);
+static int address_bit(const uint8_t *const address, uint16_t bit);
+static int apply_value(MMDB_writer_s *const writer,
+                       uint32_t record,
+                       MMDB_writer_value_s *const value,
+                       int policy,
+                       uint32_t *const new_record);
+static int insert_record(MMDB_writer_s *const writer,
+                         const uint8_t *const address,
+                         uint16_t depth,
+                         MMDB_writer_value_s *const value,
+                         int policy);
+static int node_for_network(MMDB_writer_s *const writer,
+                            const uint8_t *const address,
+                            uint16_t depth,
+                            uint32_t *const node);
+static int add_ipv4_aliases(MMDB_writer_s *const writer);
+static bool buffer_reserve(writer_buffer_s *const buffer, size_t length);
+static bool buffer_append(writer_buffer_s *const buffer,
+                          const void *const data,
+                          size_t length);
+static bool encode_control(writer_buffer_s *const buffer,
+                           uint32_t type,
+                           uint32_t size);
+static bool encode_uint(writer_buffer_s *const buffer,
+                        uint32_t type,
+                        const uint8_t *const bytes,
+                        size_t length);
+static bool encode_uint64(writer_buffer_s *const buffer,
+                          uint32_t type,
+                          uint64_t value);
+static bool encode_string(writer_buffer_s *const buffer,
+                          const char *const string);
+static size_t pointer_size(uint32_t offset);
+static bool encode_pointer(writer_buffer_s *const buffer, uint32_t offset);
+static bool worth_sharing(const MMDB_writer_value_s *const value);
+static int encode_value(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const value,
+                        int depth);
+static int encode_child(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const value,
+                        int depth);
+static int write_value(MMDB_writer_s *const writer,
+                       MMDB_writer_value_s *const value,
+                       int depth);
+static void writer_node_children(const void *const context,
+                                 uint32_t node,
+                                 uint32_t children[2]);
+static int number_nodes(MMDB_writer_s *const writer,
+                        uint32_t *const numbers,
+                        uint32_t *const order,
+                        uint32_t *const node_count);
+static uint16_t record_size_for(uint64_t max_record);
+static void encode_node(uint8_t *const p,
+                        const uint32_t values[2],
+                        uint16_t record_size);
+static void decode_node(const uint8_t *const p,
+                        uint32_t values[2],
+                        uint16_t record_size);
+static int write_tree(const MMDB_writer_s *const writer,
+                      FILE *const file,
+                      const uint32_t *const numbers,
+                      const uint32_t *const order,
+                      uint32_t node_count,
+                      uint16_t record_size);
+static void file_node_children(const void *const context,
+                               uint32_t node,
+                               uint32_t children[2]);
+static int encode_metadata(const MMDB_writer_s *const writer,
+                           writer_buffer_s *const buffer,
+                           uint32_t node_count,
+                           uint16_t record_size);
+/* --prototypes end - don't remove this comment-- */
+/* *INDENT-ON* */
+
+int MMDB_writer_new(uint16_t ip_version,
+                    const char *const database_type,
+                    uint32_t flags,
+                    MMDB_writer_s **const writer) {
+    *writer = NULL;
+    if ((ip_version != 4 && ip_version != 6) || database_type == NULL) {
+        return MMDB_INVALID_METADATA_ERROR;
+    }
+
+    MMDB_writer_s *const w = calloc(1, sizeof(MMDB_writer_s));
+    if (w == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    w->ip_version = ip_version;
+    w->flags = flags;
+    w->build_epoch = (uint64_t)time(NULL);
+    w->database_type = copy_string(database_type);
+    if (w->database_type == NULL) {
+        MMDB_writer_free(w);
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    // The root node always exists, even in an empty database.
+    uint32_t root;
+    int status = new_node(w, RECORD_EMPTY, RECORD_EMPTY, &root);
+    if (status != MMDB_SUCCESS) {
+        MMDB_writer_free(w);
+        return status;
+    }
+
+    *writer = w;
+    return MMDB_SUCCESS;
+}
+
+void MMDB_writer_free(MMDB_writer_s *const writer) {
+    if (writer == NULL) {
+        return;
+    }
+
+    free(writer->database_type);
+    for (size_t i = 0; i < writer->language_count; i++) {
+        free(writer->languages[i]);
+    }
+    free(writer->languages);
+    for (size_t i = 0; i < writer->description_count; i++) {
+        free(writer->description_languages[i]);
+        free(writer->descriptions[i]);
+    }
+    free(writer->description_languages);
+    free(writer->descriptions);
+
+    writer_block_s *block = writer->blocks;
+    while (block != NULL) {
+        writer_block_s *const next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(writer->nodes);
+    free(writer->values);
+    free(writer->intern_table);
+    free(writer->data.data);
+    free(writer->scratch.data);
+    free(writer);
+}
+
+int MMDB_writer_add_language(MMDB_writer_s *const writer,
+                             const char *const language) {
+    char **const languages = realloc(
+        writer->languages, (writer->language_count + 1) * sizeof(char *));
+    if (languages == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    writer->languages = languages;
+
+    languages[writer->language_count] = copy_string(language);
+    if (languages[writer->language_count] == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    writer->language_count++;
+    return MMDB_SUCCESS;
+}
+
+int MMDB_writer_add_description(MMDB_writer_s *const writer,
+                                const char *const language,
+                                const char *const description) {
+    size_t const count = writer->description_count + 1;
+    char **const languages =
+        realloc(writer->description_languages, count * sizeof(char *));
+    if (languages == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    writer->description_languages = languages;
+    char **const descriptions =
+        realloc(writer->descriptions, count * sizeof(char *));
+    if (descriptions == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    writer->descriptions = descriptions;
+
+    char *const language_copy = copy_string(language);
+    char *const description_copy = copy_string(description);
+    if (language_copy == NULL || description_copy == NULL) {
+        free(language_copy);
+        free(description_copy);
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    languages[writer->description_count] = language_copy;
+    descriptions[writer->description_count] = description_copy;
+    writer->description_count++;
+    return MMDB_SUCCESS;
+}
+
+void MMDB_writer_set_build_epoch(MMDB_writer_s *const writer,
+                                 uint64_t build_epoch) {
+    writer->build_epoch = build_epoch;
+}
+
+int MMDB_writer_set_record_size(MMDB_writer_s *const writer,
+                                uint16_t record_size) {
+    if (record_size != 0 && record_size != 24 && record_size != 28 &&
+        record_size != 32) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    }
+    writer->record_size = record_size;
+    return MMDB_SUCCESS;
+}
+
+int MMDB_writer_set_tree_layout(MMDB_writer_s *const writer, int layout) {
+    if (layout != MMDB_WRITER_LAYOUT_DEPTH_FIRST &&
+        layout != MMDB_WRITER_LAYOUT_BLOCKED &&
+        layout != MMDB_WRITER_LAYOUT_VAN_EMDE_BOAS) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    writer->tree_layout = layout;
+    return MMDB_SUCCESS;
+}
+
+static char *copy_string(const char *const string) {
+    size_t const length = strlen(string);
+    char *const copy = malloc(length + 1);
+    if (copy != NULL) {
+        memcpy(copy, string, length + 1);
+    }
+    return copy;
+}
+
+static void *writer_alloc(MMDB_writer_s *const writer, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+
+    writer_block_s *block = writer->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t const block_size =
+            size > WRITER_BLOCK_SIZE ? size : WRITER_BLOCK_SIZE;
+        block = malloc(sizeof(writer_block_s) + block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = writer->blocks;
+        block->used = 0;
+        block->size = block_size;
+        writer->blocks = block;
+    }
+
+    void *const memory = (uint8_t *)(block + 1) + block->used;
+    block->used += size;
+    return memory;
+}
+
+static MMDB_writer_value_s *new_value(MMDB_writer_s *const writer,
+                                      uint32_t type) {
+    MMDB_writer_value_s *value = writer->free_values;
+    if (value != NULL) {
+        writer->free_values = value->canonical;
+    } else {
+        value = writer_alloc(writer, sizeof(MMDB_writer_value_s));
+        if (value == NULL) {
+            return NULL;
+        }
+    }
+    memset(value, 0, sizeof(MMDB_writer_value_s));
+    value->type = type;
+    value->id = UINT32_MAX;
+    return value;
+}
+
+// Scalars can't change once they are created, so they are interned right
+// away. Creating a scalar equal to an existing one returns the existing one
+// without allocating anything.
+static MMDB_writer_value_s *
+scalar_value(MMDB_writer_s *const writer, MMDB_writer_value_s *const scalar) {
+    scalar->hash = hash_value(scalar);
+    size_t slot;
+    MMDB_writer_value_s *const existing = find_value(writer, scalar, &slot);
+    if (existing != NULL) {
+        return existing;
+    }
+
+    MMDB_writer_value_s *const value =
+        writer_alloc(writer, sizeof(MMDB_writer_value_s));
+    if (value == NULL) {
+        return NULL;
+    }
+    *value = *scalar;
+    if (scalar->type == MMDB_DATA_TYPE_UTF8_STRING ||
+        scalar->type == MMDB_DATA_TYPE_BYTES) {
+        uint8_t *const copy =
+            writer_alloc(writer, scalar->size == 0 ? 1 : scalar->size);
+        if (copy == NULL) {
+            return NULL;
+        }
+        if (scalar->size != 0) {
+            memcpy(copy, scalar->u.bytes, scalar->size);
+        }
+        value->u.bytes = copy;
+    }
+
+    if (add_value(writer, value, slot) != MMDB_SUCCESS) {
+        return NULL;
+    }
+    return value;
+}
+
+static MMDB_writer_value_s *new_string_value(MMDB_writer_s *const writer,
+                                             uint32_t type,
+                                             const uint8_t *const bytes,
+                                             size_t length) {
+    if (length > MAXIMUM_DATA_SIZE) {
+        DEBUG_MSGF("string of length %zu is too long", length);
+        return NULL;
+    }
+
+    MMDB_writer_value_s scalar = {
+        .type = type, .size = (uint32_t)length, .u.bytes = bytes};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_utf8_string(MMDB_writer_s *const writer,
+                                             const char *const string,
+                                             size_t length) {
+    return new_string_value(
+        writer, MMDB_DATA_TYPE_UTF8_STRING, (const uint8_t *)string, length);
+}
+
+MMDB_writer_value_s *MMDB_writer_bytes(MMDB_writer_s *const writer,
+                                       const uint8_t *const bytes,
+                                       size_t length) {
+    return new_string_value(writer, MMDB_DATA_TYPE_BYTES, bytes, length);
+}
+
+MMDB_writer_value_s *MMDB_writer_double(MMDB_writer_s *const writer,
+                                        double value) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_DOUBLE,
+                                  .u.double_value = value};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_float(MMDB_writer_s *const writer,
+                                       float value) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_FLOAT,
+                                  .u.float_value = value};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_uint16(MMDB_writer_s *const writer,
+                                        uint16_t value) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_UINT16,
+                                  .u.uint16 = value};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_uint32(MMDB_writer_s *const writer,
+                                        uint32_t value) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_UINT32,
+                                  .u.uint32 = value};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_int32(MMDB_writer_s *const writer,
+                                       int32_t value) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_INT32,
+                                  .u.int32 = value};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_uint64(MMDB_writer_s *const writer,
+                                        uint64_t value) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_UINT64,
+                                  .u.uint64 = value};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_uint128(MMDB_writer_s *const writer,
+                                         const uint8_t value[16]) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_UINT128};
+    memcpy(scalar.u.uint128, value, 16);
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_boolean(MMDB_writer_s *const writer,
+                                         bool value) {
+    MMDB_writer_value_s scalar = {.type = MMDB_DATA_TYPE_BOOLEAN,
+                                  .u.boolean = value};
+    return scalar_value(writer, &scalar);
+}
+
+MMDB_writer_value_s *MMDB_writer_map(MMDB_writer_s *const writer) {
+    return new_value(writer, MMDB_DATA_TYPE_MAP);
+}
+
+MMDB_writer_value_s *MMDB_writer_array(MMDB_writer_s *const writer) {
+    return new_value(writer, MMDB_DATA_TYPE_ARRAY);
+}
+
+int MMDB_writer_map_add(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const map,
+                        const char *const key,
+                        size_t key_length,
+                        MMDB_writer_value_s *const value) {
+    if (map == NULL || value == NULL || map->type != MMDB_DATA_TYPE_MAP ||
+        map->frozen) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    // A key that is already in the map has its value replaced.
+    for (uint32_t i = 0; i < map->size; i++) {
+        const MMDB_writer_value_s *const existing = map->u.entries[i * 2];
+        if (existing->size == key_length &&
+            memcmp(existing->u.bytes, key, key_length) == 0) {
+            map->u.entries[i * 2 + 1] = value;
+            return MMDB_SUCCESS;
+        }
+    }
+
+    MMDB_writer_value_s *const key_value =
+        MMDB_writer_utf8_string(writer, key, key_length);
+    if (key_value == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    return add_entry(writer, map, key_value, value);
+}
+
+int MMDB_writer_array_append(MMDB_writer_s *const writer,
+                             MMDB_writer_value_s *const array,
+                             MMDB_writer_value_s *const value) {
+    if (array == NULL || value == NULL ||
+        array->type != MMDB_DATA_TYPE_ARRAY || array->frozen) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    return add_entry(writer, array, NULL, value);
+}
+
+// Appends an entry to a map or, when key is NULL, to an array. The entries
+// are allocated from the writer's blocks, so growing them leaves the old
+// entries behind until the writer is freed.
+static int add_entry(MMDB_writer_s *const writer,
+                     MMDB_writer_value_s *const container,
+                     MMDB_writer_value_s *const key,
+                     MMDB_writer_value_s *const value) {
+    if (container->size >= MAXIMUM_DATA_SIZE) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    size_t const per_entry = key == NULL ? 1 : 2;
+    if (container->size == container->capacity) {
+        uint32_t const capacity =
+            container->capacity == 0 ? 4 : container->capacity * 2;
+        MMDB_writer_value_s **const entries =
+            alloc_entries(writer, capacity * per_entry);
+        if (entries == NULL) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        if (container->size != 0) {
+            memcpy(entries,
+                   container->u.entries,
+                   container->size * per_entry *
+                       sizeof(MMDB_writer_value_s *));
+            free_entries(writer,
+                         container->u.entries,
+                         container->capacity * per_entry);
+        }
+        container->u.entries = entries;
+        container->capacity = capacity;
+    }
+
+    if (key == NULL) {
+        container->u.entries[container->size] = value;
+    } else {
+        container->u.entries[container->size * 2] = key;
+        container->u.entries[container->size * 2 + 1] = value;
+    }
+    container->size++;
+    return MMDB_SUCCESS;
+}
+
+static size_t entries_class(size_t count) {
+    size_t class = 0;
+    while (((size_t)1 << class) < count) {
+        class++;
+    }
+    return class;
+}
+
+// The number of entries is always a power of two.
+static MMDB_writer_value_s **alloc_entries(MMDB_writer_s *const writer,
+                                           size_t count) {
+    size_t const class = entries_class(count);
+    MMDB_writer_value_s **const entries = writer->free_entries[class];
+    if (entries != NULL) {
+        writer->free_entries[class] = (MMDB_writer_value_s **)entries[0];
+        return entries;
+    }
+    return writer_alloc(writer, count * sizeof(MMDB_writer_value_s *));
+}
+
+static void free_entries(MMDB_writer_s *const writer,
+                         MMDB_writer_value_s **const entries,
+                         size_t count) {
+    size_t const class = entries_class(count);
+    entries[0] = (MMDB_writer_value_s *)writer->free_entries[class];
+    writer->free_entries[class] = entries;
+}
+
+static void free_container(MMDB_writer_s *const writer,
+                           MMDB_writer_value_s *const container) {
+    if (container->capacity != 0) {
+        free_entries(writer,
+                     container->u.entries,
+                     container->type == MMDB_DATA_TYPE_MAP
+                         ? container->capacity * 2
+                         : container->capacity);
+    }
+    container->canonical = writer->free_values;
+    writer->free_values = container;
+}
+
+int MMDB_writer_value_from_entry_data_list(
+    MMDB_writer_s *const writer,
+    MMDB_entry_data_list_s *const entry_data_list,
+    MMDB_writer_value_s **const value) {
+    int status;
+    *value = NULL;
+    value_from_entry_data_list(writer, entry_data_list, value, 0, &status);
+    return status;
+}
+
+static MMDB_entry_data_list_s *
+value_from_entry_data_list(MMDB_writer_s *const writer,
+                           MMDB_entry_data_list_s *entry_data_list,
+                           MMDB_writer_value_s **const value,
+                           int depth,
+                           int *const status) {
+    if (entry_data_list == NULL || depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        *status = MMDB_INVALID_DATA_ERROR;
+        return NULL;
+    }
+
+    const MMDB_entry_data_s *const entry_data = &entry_data_list->entry_data;
+    MMDB_writer_value_s *v = NULL;
+    switch (entry_data->type) {
+        case MMDB_DATA_TYPE_MAP: {
+            v = MMDB_writer_map(writer);
+            if (v == NULL) {
+                break;
+            }
+            uint32_t size = entry_data->data_size;
+            for (entry_data_list = entry_data_list->next;
+                 size && entry_data_list;
+                 size--) {
+                const MMDB_entry_data_s *const key =
+                    &entry_data_list->entry_data;
+                if (key->type != MMDB_DATA_TYPE_UTF8_STRING) {
+                    *status = MMDB_INVALID_DATA_ERROR;
+                    return NULL;
+                }
+                MMDB_writer_value_s *entry_value;
+                entry_data_list =
+                    value_from_entry_data_list(writer,
+                                               entry_data_list->next,
+                                               &entry_value,
+                                               depth + 1,
+                                               status);
+                if (*status != MMDB_SUCCESS) {
+                    return NULL;
+                }
+                *status = MMDB_writer_map_add(
+                    writer, v, key->utf8_string, key->data_size, entry_value);
+                if (*status != MMDB_SUCCESS) {
+                    return NULL;
+                }
+            }
+            *value = v;
+            *status = MMDB_SUCCESS;
+            return entry_data_list;
+        }
+        case MMDB_DATA_TYPE_ARRAY: {
+            v = MMDB_writer_array(writer);
+            if (v == NULL) {
+                break;
+            }
+            uint32_t size = entry_data->data_size;
+            for (entry_data_list = entry_data_list->next;
+                 size && entry_data_list;
+                 size--) {
+                MMDB_writer_value_s *entry_value;
+                entry_data_list = value_from_entry_data_list(
+                    writer, entry_data_list, &entry_value, depth + 1, status);
+                if (*status != MMDB_SUCCESS) {
+                    return NULL;
+                }
+                *status = MMDB_writer_array_append(writer, v, entry_value);
+                if (*status != MMDB_SUCCESS) {
+                    return NULL;
+                }
+            }
+            *value = v;
+            *status = MMDB_SUCCESS;
+            return entry_data_list;
+        }
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            v = MMDB_writer_utf8_string(
+                writer, entry_data->utf8_string, entry_data->data_size);
+            break;
+        case MMDB_DATA_TYPE_BYTES:
+            v = MMDB_writer_bytes(
+                writer, entry_data->bytes, entry_data->data_size);
+            break;
+        case MMDB_DATA_TYPE_DOUBLE:
+            v = MMDB_writer_double(writer, entry_data->double_value);
+            break;
+        case MMDB_DATA_TYPE_FLOAT:
+            v = MMDB_writer_float(writer, entry_data->float_value);
+            break;
+        case MMDB_DATA_TYPE_UINT16:
+            v = MMDB_writer_uint16(writer, entry_data->uint16);
+            break;
+        case MMDB_DATA_TYPE_UINT32:
+            v = MMDB_writer_uint32(writer, entry_data->uint32);
+            break;
+        case MMDB_DATA_TYPE_INT32:
+            v = MMDB_writer_int32(writer, entry_data->int32);
+            break;
+        case MMDB_DATA_TYPE_UINT64:
+            v = MMDB_writer_uint64(writer, entry_data->uint64);
+            break;
+        case MMDB_DATA_TYPE_UINT128: {
+            uint8_t bytes[16];
+#if MMDB_UINT128_IS_BYTE_ARRAY
+            memcpy(bytes, entry_data->uint128, 16);
+#else
+            for (int i = 0; i < 16; i++) {
+                bytes[i] = (uint8_t)(entry_data->uint128 >> (8 * (15 - i)));
+            }
+#endif
+            v = MMDB_writer_uint128(writer, bytes);
+        } break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            v = MMDB_writer_boolean(writer, entry_data->boolean);
+            break;
+        default:
+            *status = MMDB_INVALID_DATA_ERROR;
+            return NULL;
+    }
+
+    if (v == NULL) {
+        *status = MMDB_OUT_OF_MEMORY_ERROR;
+        return NULL;
+    }
+    *value = v;
+    *status = MMDB_SUCCESS;
+    return entry_data_list->next;
+}
+
+// FNV-1a
+static uint64_t
+hash_bytes(uint64_t hash, const void *const data, size_t length) {
+    const uint8_t *const bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+// The entries of a container are interned before the container itself, so
+// their ids identify their contents.
+static uint64_t hash_value(const MMDB_writer_value_s *const value) {
+    uint64_t hash = UINT64_C(14695981039346656037);
+    hash = hash_bytes(hash, &value->type, sizeof(value->type));
+    hash = hash_bytes(hash, &value->size, sizeof(value->size));
+
+    switch (value->type) {
+        case MMDB_DATA_TYPE_UTF8_STRING:
+        case MMDB_DATA_TYPE_BYTES:
+            return hash_bytes(hash, value->u.bytes, value->size);
+        case MMDB_DATA_TYPE_MAP:
+        case MMDB_DATA_TYPE_ARRAY: {
+            uint32_t const count = value->type == MMDB_DATA_TYPE_MAP
+                                       ? value->size * 2
+                                       : value->size;
+            for (uint32_t i = 0; i < count; i++) {
+                hash = hash_bytes(
+                    hash, &value->u.entries[i]->id, sizeof(uint32_t));
+            }
+            return hash;
+        }
+        case MMDB_DATA_TYPE_DOUBLE:
+            return hash_bytes(hash, &value->u.double_value, sizeof(double));
+        case MMDB_DATA_TYPE_FLOAT:
+            return hash_bytes(hash, &value->u.float_value, sizeof(float));
+        case MMDB_DATA_TYPE_UINT16:
+            return hash_bytes(hash, &value->u.uint16, sizeof(uint16_t));
+        case MMDB_DATA_TYPE_UINT32:
+            return hash_bytes(hash, &value->u.uint32, sizeof(uint32_t));
+        case MMDB_DATA_TYPE_INT32:
+            return hash_bytes(hash, &value->u.int32, sizeof(int32_t));
+        case MMDB_DATA_TYPE_UINT64:
+            return hash_bytes(hash, &value->u.uint64, sizeof(uint64_t));
+        case MMDB_DATA_TYPE_UINT128:
+            return hash_bytes(hash, value->u.uint128, 16);
+        case MMDB_DATA_TYPE_BOOLEAN:
+            return hash_bytes(hash, &value->u.boolean, sizeof(bool));
+        default:
+            return hash;
+    }
+}
+
+static bool values_equal(const MMDB_writer_value_s *const a,
+                         const MMDB_writer_value_s *const b) {
+    if (a->type != b->type || a->size != b->size || a->hash != b->hash) {
+        return false;
+    }
+
+    switch (a->type) {
+        case MMDB_DATA_TYPE_UTF8_STRING:
+        case MMDB_DATA_TYPE_BYTES:
+            return a->size == 0 || memcmp(a->u.bytes, b->u.bytes, a->size) == 0;
+        case MMDB_DATA_TYPE_MAP:
+        case MMDB_DATA_TYPE_ARRAY: {
+            uint32_t const count =
+                a->type == MMDB_DATA_TYPE_MAP ? a->size * 2 : a->size;
+            for (uint32_t i = 0; i < count; i++) {
+                if (a->u.entries[i] != b->u.entries[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case MMDB_DATA_TYPE_DOUBLE:
+            return memcmp(&a->u.double_value,
+                          &b->u.double_value,
+                          sizeof(double)) == 0;
+        case MMDB_DATA_TYPE_FLOAT:
+            return memcmp(&a->u.float_value,
+                          &b->u.float_value,
+                          sizeof(float)) == 0;
+        case MMDB_DATA_TYPE_UINT16:
+            return a->u.uint16 == b->u.uint16;
+        case MMDB_DATA_TYPE_UINT32:
+            return a->u.uint32 == b->u.uint32;
+        case MMDB_DATA_TYPE_INT32:
+            return a->u.int32 == b->u.int32;
+        case MMDB_DATA_TYPE_UINT64:
+            return a->u.uint64 == b->u.uint64;
+        case MMDB_DATA_TYPE_UINT128:
+            return memcmp(a->u.uint128, b->u.uint128, 16) == 0;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            return a->u.boolean == b->u.boolean;
+        default:
+            return false;
+    }
+}
+
+static int grow_intern_table(MMDB_writer_s *const writer) {
+    size_t const size =
+        writer->intern_table_size == 0 ? 1024 : writer->intern_table_size * 2;
+    MMDB_writer_value_s **const table =
+        calloc(size, sizeof(MMDB_writer_value_s *));
+    if (table == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    for (size_t i = 0; i < writer->value_count; i++) {
+        MMDB_writer_value_s *const value = writer->values[i];
+        size_t slot = (size_t)value->hash & (size - 1);
+        while (table[slot] != NULL) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = value;
+    }
+
+    free(writer->intern_table);
+    writer->intern_table = table;
+    writer->intern_table_size = size;
+    return MMDB_SUCCESS;
+}
+
+// Returns the interned value equal to value, whose hash must be set, or NULL
+// along with the slot to intern it in.
+static MMDB_writer_value_s *find_value(const MMDB_writer_s *const writer,
+                                       const MMDB_writer_value_s *const value,
+                                       size_t *const slot) {
+    *slot = 0;
+    if (writer->intern_table_size == 0) {
+        return NULL;
+    }
+
+    size_t const mask = writer->intern_table_size - 1;
+    for (*slot = (size_t)value->hash & mask;
+         writer->intern_table[*slot] != NULL;
+         *slot = (*slot + 1) & mask) {
+        if (values_equal(writer->intern_table[*slot], value)) {
+            return writer->intern_table[*slot];
+        }
+    }
+    return NULL;
+}
+
+static int add_value(MMDB_writer_s *const writer,
+                     MMDB_writer_value_s *const value,
+                     size_t slot) {
+    if (writer->value_count >= MAXIMUM_RECORD_INDEX) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    if (writer->value_count == writer->values_size) {
+        size_t const size =
+            writer->values_size == 0 ? 1024 : writer->values_size * 2;
+        MMDB_writer_value_s **const values =
+            realloc(writer->values, size * sizeof(MMDB_writer_value_s *));
+        if (values == NULL) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        writer->values = values;
+        writer->values_size = size;
+    }
+    value->id = (uint32_t)writer->value_count;
+    value->canonical = value;
+    value->frozen = true;
+    writer->values[writer->value_count++] = value;
+
+    // Keep the table at most half full.
+    if (writer->value_count * 2 > writer->intern_table_size) {
+        return grow_intern_table(writer);
+    }
+    writer->intern_table[slot] = value;
+    return MMDB_SUCCESS;
+}
+
+// Orders the key, value pairs of a map by their keys.
+static int compare_map_keys(const void *a, const void *b) {
+    const MMDB_writer_value_s *const key_a = *(MMDB_writer_value_s *const *)a;
+    const MMDB_writer_value_s *const key_b = *(MMDB_writer_value_s *const *)b;
+    size_t const length = key_a->size < key_b->size ? key_a->size : key_b->size;
+    if (length > 0) {
+        int const cmp = memcmp(key_a->u.bytes, key_b->u.bytes, length);
+        if (cmp != 0) {
+            return cmp;
+        }
+    }
+    return key_a->size < key_b->size ? -1 : key_a->size > key_b->size;
+}
+
+// Finds the canonical value equal to value, making value the canonical one if
+// there is none yet. The value and everything in it can no longer be changed
+// after this.
+static int intern_value(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const value,
+                        int depth,
+                        MMDB_writer_value_s **const canonical) {
+    if (value->canonical != NULL) {
+        *canonical = value->canonical;
+        return MMDB_SUCCESS;
+    }
+    if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    value->frozen = true;
+
+    bool const is_container = value->type == MMDB_DATA_TYPE_MAP ||
+                              value->type == MMDB_DATA_TYPE_ARRAY;
+    uint32_t const count = !is_container ? 0
+                           : value->type == MMDB_DATA_TYPE_MAP
+                               ? value->size * 2
+                               : value->size;
+    for (uint32_t i = 0; i < count; i++) {
+        int const status = intern_value(
+            writer, value->u.entries[i], depth + 1, &value->u.entries[i]);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+    }
+
+    if (value->type == MMDB_DATA_TYPE_MAP &&
+        (writer->flags & MMDB_WRITER_SORT_MAP_KEYS) && value->size > 1) {
+        qsort(value->u.entries,
+              value->size,
+              2 * sizeof(MMDB_writer_value_s *),
+              compare_map_keys);
+    }
+
+    value->hash = hash_value(value);
+    size_t slot;
+    MMDB_writer_value_s *const existing = find_value(writer, value, &slot);
+    if (existing != NULL) {
+        // Nothing else can refer to a map or an array that was just interned,
+        // so a duplicate one can be reused.
+        if (is_container) {
+            free_container(writer, value);
+        }
+        *canonical = existing;
+        return MMDB_SUCCESS;
+    }
+
+    int const status = add_value(writer, value, slot);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        value->u.entries[i]->references++;
+    }
+
+    *canonical = value;
+    return MMDB_SUCCESS;
+}
+
+// Merges two interned values. When both are maps, the keys of new_value are
+// added to those of old_value, merging the values of keys in both if they are
+// maps themselves. Otherwise new_value wins.
+static int merge_values(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const old_value,
+                        MMDB_writer_value_s *const new_value,
+                        int depth,
+                        MMDB_writer_value_s **const merged) {
+    if (old_value->type != MMDB_DATA_TYPE_MAP ||
+        new_value->type != MMDB_DATA_TYPE_MAP || old_value == new_value) {
+        *merged = new_value;
+        return MMDB_SUCCESS;
+    }
+    if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    MMDB_writer_value_s *const map = MMDB_writer_map(writer);
+    if (map == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    int status;
+    for (uint32_t i = 0; i < old_value->size; i++) {
+        status = add_entry(writer,
+                           map,
+                           old_value->u.entries[i * 2],
+                           old_value->u.entries[i * 2 + 1]);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+    }
+
+    // The keys are interned, so equal keys are the same value.
+    for (uint32_t i = 0; i < new_value->size; i++) {
+        MMDB_writer_value_s *const key = new_value->u.entries[i * 2];
+        MMDB_writer_value_s *value = new_value->u.entries[i * 2 + 1];
+        uint32_t j = 0;
+        while (j < map->size && map->u.entries[j * 2] != key) {
+            j++;
+        }
+        if (j == map->size) {
+            status = add_entry(writer, map, key, value);
+            if (status != MMDB_SUCCESS) {
+                return status;
+            }
+            continue;
+        }
+
+        status = merge_values(
+            writer, map->u.entries[j * 2 + 1], value, depth + 1, &value);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+        map->u.entries[j * 2 + 1] = value;
+    }
+
+    return intern_value(writer, map, depth, merged);
+}
+
+static int new_node(MMDB_writer_s *const writer,
+                    uint32_t left,
+                    uint32_t right,
+                    uint32_t *const node) {
+    if (writer->node_count >= MAXIMUM_RECORD_INDEX) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    if (writer->node_count == writer->nodes_size) {
+        size_t const size =
+            writer->nodes_size == 0 ? 1024 : writer->nodes_size * 2;
+        writer_node_s *const nodes =
+            realloc(writer->nodes, size * sizeof(writer_node_s));
+        if (nodes == NULL) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        writer->nodes = nodes;
+        writer->nodes_size = size;
+    }
+
+    *node = (uint32_t)writer->node_count++;
+    writer->nodes[*node].records[0] = left;
+    writer->nodes[*node].records[1] = right;
+    return MMDB_SUCCESS;
+}
+
+static int address_bit(const uint8_t *const address, uint16_t bit) {
+    return 1 & (address[bit >> 3] >> (7 - (bit % 8)));
+}
+
+int MMDB_writer_intern(MMDB_writer_s *const writer,
+                       MMDB_writer_value_s *const value,
+                       MMDB_writer_value_s **const canonical) {
+    *canonical = NULL;
+    if (value == NULL) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    return intern_value(writer, value, 0, canonical);
+}
+
+int MMDB_writer_insert(MMDB_writer_s *const writer,
+                       const uint8_t *const address,
+                       uint16_t ip_version,
+                       uint16_t netmask,
+                       MMDB_writer_value_s *const value,
+                       int policy) {
+    if (value == NULL || policy < MMDB_WRITER_INSERT_REPLACE ||
+        policy > MMDB_WRITER_INSERT_MERGE) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    uint8_t tree_address[16] = {0};
+    uint16_t depth;
+    if (ip_version == 4) {
+        if (netmask > 32) {
+            return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
+        }
+        // IPv4 networks live under ::/96 in an IPv6 tree.
+        if (writer->ip_version == 6) {
+            memcpy(tree_address + 12, address, 4);
+            depth = (uint16_t)(netmask + 96);
+        } else {
+            memcpy(tree_address, address, 4);
+            depth = netmask;
+        }
+    } else if (ip_version == 6) {
+        if (writer->ip_version == 4) {
+            return MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR;
+        }
+        if (netmask > 128) {
+            return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
+        }
+        memcpy(tree_address, address, 16);
+        depth = netmask;
+    } else {
+        return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
+    }
+
+    MMDB_writer_value_s *canonical;
+    int const status = intern_value(writer, value, 0, &canonical);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+    return insert_record(writer, tree_address, depth, canonical, policy);
+}
+
+int MMDB_writer_insert_network(MMDB_writer_s *const writer,
+                               const char *const network,
+                               MMDB_writer_value_s *const value,
+                               int policy) {
+    char address[INET6_ADDRSTRLEN + 1];
+    const char *const slash = strchr(network, '/');
+    size_t const length = slash ? (size_t)(slash - network) : strlen(network);
+    if (length == 0 || length >= sizeof(address)) {
+        return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
+    }
+    memcpy(address, network, length);
+    address[length] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                             .ai_flags = AI_NUMERICHOST,
+                             .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addresses = NULL;
+    if (getaddrinfo(address, NULL, &hints, &addresses) != 0) {
+        return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
+    }
+
+    uint8_t bytes[16];
+    uint16_t ip_version;
+    if (addresses->ai_family == AF_INET) {
+        memcpy(bytes,
+               &((struct sockaddr_in *)addresses->ai_addr)->sin_addr.s_addr,
+               4);
+        ip_version = 4;
+    } else {
+        memcpy(bytes,
+               ((struct sockaddr_in6 *)addresses->ai_addr)->sin6_addr.s6_addr,
+               16);
+        ip_version = 6;
+    }
+    freeaddrinfo(addresses);
+
+    long netmask = ip_version == 4 ? 32 : 128;
+    if (slash) {
+        char *end;
+        errno = 0;
+        netmask = strtol(slash + 1, &end, 10);
+        if (errno != 0 || end == slash + 1 || *end != '\0' || netmask < 0 ||
+            netmask > (ip_version == 4 ? 32 : 128)) {
+            return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
+        }
+    }
+
+    return MMDB_writer_insert(
+        writer, bytes, ip_version, (uint16_t)netmask, value, policy);
+}
+
+// Applies value to every network in the subtree starting at record and
+// returns the new record for the subtree.
+static int apply_value(MMDB_writer_s *const writer,
+                       uint32_t record,
+                       MMDB_writer_value_s *const value,
+                       int policy,
+                       uint32_t *const new_record) {
+    uint32_t const data = MAKE_RECORD(RECORD_DATA, value->id);
+
+    switch (RECORD_TYPE(record)) {
+        case RECORD_EMPTY:
+            *new_record = data;
+            return MMDB_SUCCESS;
+        case RECORD_DATA: {
+            if (policy == MMDB_WRITER_INSERT_REPLACE) {
+                *new_record = data;
+                return MMDB_SUCCESS;
+            }
+            if (policy == MMDB_WRITER_INSERT_KEEP) {
+                *new_record = record;
+                return MMDB_SUCCESS;
+            }
+            MMDB_writer_value_s *merged;
+            MMDB_writer_value_s *const old_value =
+                writer->values[RECORD_INDEX(record)];
+            int const status =
+                merge_values(writer, old_value, value, 0, &merged);
+            if (status != MMDB_SUCCESS) {
+                return status;
+            }
+            *new_record = MAKE_RECORD(RECORD_DATA, merged->id);
+            return MMDB_SUCCESS;
+        }
+        default:
+            break;
+    }
+
+    // A more specific network replaces everything in it unless we keep or
+    // merge with the existing data.
+    if (policy == MMDB_WRITER_INSERT_REPLACE) {
+        *new_record = data;
+        return MMDB_SUCCESS;
+    }
+
+    uint32_t const node = RECORD_INDEX(record);
+    for (int i = 0; i < 2; i++) {
+        uint32_t child;
+        int const status = apply_value(
+            writer, writer->nodes[node].records[i], value, policy, &child);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+        writer->nodes[node].records[i] = child;
+    }
+
+    const writer_node_s *const n = &writer->nodes[node];
+    if (n->records[0] == n->records[1] &&
+        RECORD_TYPE(n->records[0]) != RECORD_NODE) {
+        *new_record = n->records[0];
+    } else {
+        *new_record = record;
+    }
+    return MMDB_SUCCESS;
+}
+
+static int insert_record(MMDB_writer_s *const writer,
+                         const uint8_t *const address,
+                         uint16_t depth,
+                         MMDB_writer_value_s *const value,
+                         int policy) {
+    int status;
+    if (depth == 0) {
+        for (int i = 0; i < 2; i++) {
+            uint32_t record;
+            status = apply_value(
+                writer, writer->nodes[0].records[i], value, policy, &record);
+            if (status != MMDB_SUCCESS) {
+                return status;
+            }
+            writer->nodes[0].records[i] = record;
+        }
+        return MMDB_SUCCESS;
+    }
+
+    uint32_t path[128];
+    uint32_t node = 0;
+    for (uint16_t d = 0; d < depth - 1; d++) {
+        path[d] = node;
+        int const bit = address_bit(address, d);
+        uint32_t record = writer->nodes[node].records[bit];
+        if (RECORD_TYPE(record) != RECORD_NODE) {
+            // The whole network already has data.
+            if (policy == MMDB_WRITER_INSERT_KEEP &&
+                RECORD_TYPE(record) == RECORD_DATA) {
+                return MMDB_SUCCESS;
+            }
+            uint32_t child;
+            status = new_node(writer, record, record, &child);
+            if (status != MMDB_SUCCESS) {
+                return status;
+            }
+            record = MAKE_RECORD(RECORD_NODE, child);
+            writer->nodes[node].records[bit] = record;
+        }
+        node = RECORD_INDEX(record);
+    }
+    path[depth - 1] = node;
+
+    int const bit = address_bit(address, depth - 1);
+    uint32_t record;
+    status = apply_value(
+        writer, writer->nodes[node].records[bit], value, policy, &record);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+    writer->nodes[node].records[bit] = record;
+
+    // Nodes whose records are now the same are replaced by that record. The
+    // root is always kept.
+    for (uint16_t d = depth - 1; d > 0; d--) {
+        const writer_node_s *const n = &writer->nodes[path[d]];
+        if (n->records[0] != n->records[1] ||
+            RECORD_TYPE(n->records[0]) == RECORD_NODE) {
+            break;
+        }
+        writer->nodes[path[d - 1]].records[address_bit(address, d - 1)] =
+            n->records[0];
+    }
+
+    return MMDB_SUCCESS;
+}
+
+// Returns the node for the network, splitting records along the way into
+// nodes as needed.
+static int node_for_network(MMDB_writer_s *const writer,
+                            const uint8_t *const address,
+                            uint16_t depth,
+                            uint32_t *const node) {
+    uint32_t current = 0;
+    for (uint16_t d = 0; d < depth; d++) {
+        int const bit = address_bit(address, d);
+        uint32_t record = writer->nodes[current].records[bit];
+        if (RECORD_TYPE(record) != RECORD_NODE) {
+            uint32_t child;
+            int const status = new_node(writer, record, record, &child);
+            if (status != MMDB_SUCCESS) {
+                return status;
+            }
+            record = MAKE_RECORD(RECORD_NODE, child);
+            writer->nodes[current].records[bit] = record;
+        }
+        current = RECORD_INDEX(record);
+    }
+    *node = current;
+    return MMDB_SUCCESS;
+}
+
+// Points ::ffff:0:0/96, 2001::/32 and 2002::/16 at the IPv4 subtree under
+// ::/96, replacing anything inserted in those networks.
+static int add_ipv4_aliases(MMDB_writer_s *const writer) {
+    static const struct {
+        uint32_t flag;
+        uint8_t address[16];
+        uint16_t netmask;
+    } aliases[] = {
+        {MMDB_WRITER_ALIAS_IPV4_MAPPED,
+         {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0, 0},
+         96},
+        {MMDB_WRITER_ALIAS_TEREDO,
+         {0x20, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+         32},
+        {MMDB_WRITER_ALIAS_6TO4,
+         {0x20, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+         16},
+    };
+    const uint8_t ipv4[16] = {0};
+
+    uint32_t ipv4_node;
+    int status = node_for_network(writer, ipv4, 96, &ipv4_node);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    for (size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+        if (!(writer->flags & aliases[i].flag)) {
+            continue;
+        }
+        uint32_t parent;
+        status = node_for_network(
+            writer, aliases[i].address, aliases[i].netmask - 1, &parent);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+        int const bit =
+            address_bit(aliases[i].address, aliases[i].netmask - 1);
+        writer->nodes[parent].records[bit] =
+            MAKE_RECORD(RECORD_NODE, ipv4_node);
+    }
+    return MMDB_SUCCESS;
+}
+
+static bool buffer_reserve(writer_buffer_s *const buffer, size_t length) {
+    if (buffer->size - buffer->length >= length) {
+        return true;
+    }
+    size_t size = buffer->size == 0 ? 4096 : buffer->size;
+    while (size - buffer->length < length) {
+        size *= 2;
+    }
+    uint8_t *const data = realloc(buffer->data, size);
+    if (data == NULL) {
+        return false;
+    }
+    buffer->data = data;
+    buffer->size = size;
+    return true;
+}
+
+static bool buffer_append(writer_buffer_s *const buffer,
+                          const void *const data,
+                          size_t length) {
+    if (!buffer_reserve(buffer, length)) {
+        return false;
+    }
+    if (length != 0) {
+        memcpy(buffer->data + buffer->length, data, length);
+    }
+    buffer->length += length;
+    return true;
+}
+
+static bool encode_control(writer_buffer_s *const buffer,
+                           uint32_t type,
+                           uint32_t size) {
+    uint8_t bytes[5];
+    size_t length = 1;
+
+    bytes[0] = type <= 7 ? (uint8_t)(type << 5) : 0;
+    if (type > 7) {
+        bytes[length++] = (uint8_t)(type - 7);
+    }
+
+    if (size < 29) {
+        bytes[0] |= (uint8_t)size;
+    } else if (size < 285) {
+        bytes[0] |= 29;
+        bytes[length++] = (uint8_t)(size - 29);
+    } else if (size < 65821) {
+        bytes[0] |= 30;
+        bytes[length++] = (uint8_t)((size - 285) >> 8);
+        bytes[length++] = (uint8_t)(size - 285);
+    } else {
+        bytes[0] |= 31;
+        bytes[length++] = (uint8_t)((size - 65821) >> 16);
+        bytes[length++] = (uint8_t)((size - 65821) >> 8);
+        bytes[length++] = (uint8_t)(size - 65821);
+    }
+
+    return buffer_append(buffer, bytes, length);
+}
+
+// Writes an unsigned integer with its leading zero bytes removed.
+static bool encode_uint(writer_buffer_s *const buffer,
+                        uint32_t type,
+                        const uint8_t *const bytes,
+                        size_t length) {
+    size_t skip = 0;
+    while (skip < length && bytes[skip] == 0) {
+        skip++;
+    }
+    return encode_control(buffer, type, (uint32_t)(length - skip)) &&
+           buffer_append(buffer, bytes + skip, length - skip);
+}
+
+static bool encode_uint64(writer_buffer_s *const buffer,
+                          uint32_t type,
+                          uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * (7 - i)));
+    }
+    return encode_uint(buffer, type, bytes, 8);
+}
+
+static bool encode_string(writer_buffer_s *const buffer,
+                          const char *const string) {
+    size_t const length = strlen(string);
+    return length <= MAXIMUM_DATA_SIZE &&
+           encode_control(
+               buffer, MMDB_DATA_TYPE_UTF8_STRING, (uint32_t)length) &&
+           buffer_append(buffer, string, length);
+}
+
+static size_t pointer_size(uint32_t offset) {
+    if (offset < 2048) {
+        return 2;
+    }
+    if (offset < 526336) {
+        return 3;
+    }
+    if (offset < 134744064) {
+        return 4;
+    }
+    return 5;
+}
+
+static bool encode_pointer(writer_buffer_s *const buffer, uint32_t offset) {
+    uint8_t bytes[5];
+    size_t const length = pointer_size(offset);
+
+    if (length == 2) {
+        bytes[0] = (uint8_t)(0x20 | (offset >> 8));
+        bytes[1] = (uint8_t)offset;
+    } else if (length == 3) {
+        uint32_t const value = offset - 2048;
+        bytes[0] = (uint8_t)(0x28 | (value >> 16));
+        bytes[1] = (uint8_t)(value >> 8);
+        bytes[2] = (uint8_t)value;
+    } else if (length == 4) {
+        uint32_t const value = offset - 526336;
+        bytes[0] = (uint8_t)(0x30 | (value >> 24));
+        bytes[1] = (uint8_t)(value >> 16);
+        bytes[2] = (uint8_t)(value >> 8);
+        bytes[3] = (uint8_t)value;
+    } else {
+        bytes[0] = 0x38;
+        bytes[1] = (uint8_t)(offset >> 24);
+        bytes[2] = (uint8_t)(offset >> 16);
+        bytes[3] = (uint8_t)(offset >> 8);
+        bytes[4] = (uint8_t)offset;
+    }
+
+    return buffer_append(buffer, bytes, length);
+}
+
+// Values that are too small are never shorter as a pointer.
+static bool worth_sharing(const MMDB_writer_value_s *const value) {
+    switch (value->type) {
+        case MMDB_DATA_TYPE_MAP:
+        case MMDB_DATA_TYPE_ARRAY:
+            return value->size > 0;
+        case MMDB_DATA_TYPE_UTF8_STRING:
+        case MMDB_DATA_TYPE_BYTES:
+            return value->size >= 2;
+        case MMDB_DATA_TYPE_DOUBLE:
+        case MMDB_DATA_TYPE_UINT64:
+        case MMDB_DATA_TYPE_UINT128:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Appends the encoded value to the scratch buffer.
+static int encode_value(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const value,
+                        int depth) {
+    writer_buffer_s *const buffer = &writer->scratch;
+    bool ok = true;
+
+    switch (value->type) {
+        case MMDB_DATA_TYPE_MAP:
+        case MMDB_DATA_TYPE_ARRAY: {
+            if (!encode_control(buffer, value->type, value->size)) {
+                return MMDB_OUT_OF_MEMORY_ERROR;
+            }
+            uint32_t const count = value->type == MMDB_DATA_TYPE_MAP
+                                       ? value->size * 2
+                                       : value->size;
+            for (uint32_t i = 0; i < count; i++) {
+                int const status =
+                    encode_child(writer, value->u.entries[i], depth + 1);
+                if (status != MMDB_SUCCESS) {
+                    return status;
+                }
+            }
+        } break;
+        case MMDB_DATA_TYPE_UTF8_STRING:
+        case MMDB_DATA_TYPE_BYTES:
+            ok = encode_control(buffer, value->type, value->size) &&
+                 buffer_append(buffer, value->u.bytes, value->size);
+            break;
+        case MMDB_DATA_TYPE_DOUBLE: {
+            uint64_t bits;
+            memcpy(&bits, &value->u.double_value, sizeof(bits));
+            uint8_t bytes[8];
+            for (int i = 0; i < 8; i++) {
+                bytes[i] = (uint8_t)(bits >> (8 * (7 - i)));
+            }
+            ok = encode_control(buffer, value->type, 8) &&
+                 buffer_append(buffer, bytes, 8);
+        } break;
+        case MMDB_DATA_TYPE_FLOAT: {
+            uint32_t bits;
+            memcpy(&bits, &value->u.float_value, sizeof(bits));
+            uint8_t bytes[4];
+            for (int i = 0; i < 4; i++) {
+                bytes[i] = (uint8_t)(bits >> (8 * (3 - i)));
+            }
+            ok = encode_control(buffer, value->type, 4) &&
+                 buffer_append(buffer, bytes, 4);
+        } break;
+        case MMDB_DATA_TYPE_UINT16:
+            ok = encode_uint64(buffer, value->type, value->u.uint16);
+            break;
+        case MMDB_DATA_TYPE_UINT32:
+            ok = encode_uint64(buffer, value->type, value->u.uint32);
+            break;
+        case MMDB_DATA_TYPE_UINT64:
+            ok = encode_uint64(buffer, value->type, value->u.uint64);
+            break;
+        case MMDB_DATA_TYPE_INT32:
+            // The reader does not sign extend, so negative values need all
+            // four bytes.
+            if (value->u.int32 < 0) {
+                uint32_t const bits = (uint32_t)value->u.int32;
+                uint8_t const bytes[4] = {(uint8_t)(bits >> 24),
+                                          (uint8_t)(bits >> 16),
+                                          (uint8_t)(bits >> 8),
+                                          (uint8_t)bits};
+                ok = encode_control(buffer, value->type, 4) &&
+                     buffer_append(buffer, bytes, 4);
+            } else {
+                ok = encode_uint64(
+                    buffer, value->type, (uint64_t)value->u.int32);
+            }
+            break;
+        case MMDB_DATA_TYPE_UINT128:
+            ok = encode_uint(buffer, value->type, value->u.uint128, 16);
+            break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            ok = encode_control(buffer, value->type, value->u.boolean ? 1 : 0);
+            break;
+        default:
+            return MMDB_INVALID_DATA_ERROR;
+    }
+
+    return ok ? MMDB_SUCCESS : MMDB_OUT_OF_MEMORY_ERROR;
+}
+
+// Encodes a value inside a map or an array, as a pointer if it is shared with
+// other containers and the pointer is shorter than the value.
+static int encode_child(MMDB_writer_s *const writer,
+                        MMDB_writer_value_s *const value,
+                        int depth) {
+    if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    if (!value->written && value->references > 1 && worth_sharing(value)) {
+        int const status = write_value(writer, value, depth);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+    }
+
+    if (value->written && pointer_size(value->offset) < value->encoded_length) {
+        return encode_pointer(&writer->scratch, value->offset)
+                   ? MMDB_SUCCESS
+                   : MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    return encode_value(writer, value, depth);
+}
+
+// Writes the value to the data section unless it is already there. Shared
+// values inside the value are written before it, which is why the value is
+// encoded in the scratch buffer first.
+static int write_value(MMDB_writer_s *const writer,
+                       MMDB_writer_value_s *const value,
+                       int depth) {
+    if (value->written) {
+        return MMDB_SUCCESS;
+    }
+
+    size_t const start = writer->scratch.length;
+    int const status = encode_value(writer, value, depth);
+    if (status != MMDB_SUCCESS) {
+        writer->scratch.length = start;
+        return status;
+    }
+
+    size_t const length = writer->scratch.length - start;
+    if (writer->data.length > UINT32_MAX - length) {
+        DEBUG_MSG("the data section is too large");
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    value->offset = (uint32_t)writer->data.length;
+    value->encoded_length = (uint32_t)length;
+    if (!buffer_append(
+            &writer->data, writer->scratch.data + start, length)) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    writer->scratch.length = start;
+    value->written = true;
+    return MMDB_SUCCESS;
+}
+
+static void writer_node_children(const void *const context,
+                                 uint32_t node,
+                                 uint32_t children[2]) {
+    const MMDB_writer_s *const writer = context;
+    for (int i = 0; i < 2; i++) {
+        uint32_t const record = writer->nodes[node].records[i];
+        children[i] = RECORD_TYPE(record) == RECORD_NODE ? RECORD_INDEX(record)
+                                                         : TREE_LAYOUT_NO_NODE;
+    }
+}
+
+// Numbers the nodes reachable from the root in depth first order and writes
+// the data they point to in the same order, so that the data for nearby
+// networks ends up close together.
+static int number_nodes(MMDB_writer_s *const writer,
+                        uint32_t *const numbers,
+                        uint32_t *const order,
+                        uint32_t *const node_count) {
+    tree_layout_s const tree = {
+        .node_count = (uint32_t)writer->node_count,
+        .depth = writer->ip_version == 6 ? 128 : 32,
+        .node_size = 6,
+        .children = writer_node_children,
+        .context = writer,
+    };
+    int status = layout_tree(
+        &tree, MMDB_WRITER_LAYOUT_DEPTH_FIRST, numbers, order, node_count);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    for (uint32_t i = 0; i < *node_count; i++) {
+        for (int j = 0; j < 2; j++) {
+            uint32_t const record = writer->nodes[order[i]].records[j];
+            if (RECORD_TYPE(record) == RECORD_DATA) {
+                status = write_value(
+                    writer, writer->values[RECORD_INDEX(record)], 0);
+                if (status != MMDB_SUCCESS) {
+                    return status;
+                }
+            }
+        }
+    }
+    return MMDB_SUCCESS;
+}
+
+static uint16_t record_size_for(uint64_t max_record) {
+    if (max_record < (UINT64_C(1) << 24)) {
+        return 24;
+    }
+    if (max_record < (UINT64_C(1) << 28)) {
+        return 28;
+    }
+    if (max_record < (UINT64_C(1) << 32)) {
+        return 32;
+    }
+    return 0;
+}
+
+static void encode_node(uint8_t *const p,
+                        const uint32_t values[2],
+                        uint16_t record_size) {
+    if (record_size == 24) {
+        p[0] = (uint8_t)(values[0] >> 16);
+        p[1] = (uint8_t)(values[0] >> 8);
+        p[2] = (uint8_t)values[0];
+        p[3] = (uint8_t)(values[1] >> 16);
+        p[4] = (uint8_t)(values[1] >> 8);
+        p[5] = (uint8_t)values[1];
+    } else if (record_size == 28) {
+        p[0] = (uint8_t)(values[0] >> 16);
+        p[1] = (uint8_t)(values[0] >> 8);
+        p[2] = (uint8_t)values[0];
+        p[3] = (uint8_t)(((values[0] >> 20) & 0xF0) |
+                         ((values[1] >> 24) & 0x0F));
+        p[4] = (uint8_t)(values[1] >> 16);
+        p[5] = (uint8_t)(values[1] >> 8);
+        p[6] = (uint8_t)values[1];
+    } else {
+        for (int j = 0; j < 2; j++) {
+            p[j * 4] = (uint8_t)(values[j] >> 24);
+            p[j * 4 + 1] = (uint8_t)(values[j] >> 16);
+            p[j * 4 + 2] = (uint8_t)(values[j] >> 8);
+            p[j * 4 + 3] = (uint8_t)values[j];
+        }
+    }
+}
+
+static void decode_node(const uint8_t *const p,
+                        uint32_t values[2],
+                        uint16_t record_size) {
+    if (record_size == 24) {
+        values[0] = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        values[1] = ((uint32_t)p[3] << 16) | ((uint32_t)p[4] << 8) | p[5];
+    } else if (record_size == 28) {
+        values[0] = ((uint32_t)(p[3] & 0xF0) << 20) | ((uint32_t)p[0] << 16) |
+                    ((uint32_t)p[1] << 8) | p[2];
+        values[1] = ((uint32_t)(p[3] & 0x0F) << 24) | ((uint32_t)p[4] << 16) |
+                    ((uint32_t)p[5] << 8) | p[6];
+    } else {
+        for (int j = 0; j < 2; j++) {
+            values[j] = ((uint32_t)p[j * 4] << 24) |
+                        ((uint32_t)p[j * 4 + 1] << 16) |
+                        ((uint32_t)p[j * 4 + 2] << 8) | p[j * 4 + 3];
+        }
+    }
+}
+
+static int write_tree(const MMDB_writer_s *const writer,
+                      FILE *const file,
+                      const uint32_t *const numbers,
+                      const uint32_t *const order,
+                      uint32_t node_count,
+                      uint16_t record_size) {
+    uint8_t buffer[64 * 1024];
+    size_t const node_size = (size_t)record_size / 4;
+    size_t length = 0;
+
+    for (uint32_t i = 0; i < node_count; i++) {
+        uint32_t values[2];
+        for (int j = 0; j < 2; j++) {
+            uint32_t const record = writer->nodes[order[i]].records[j];
+            switch (RECORD_TYPE(record)) {
+                case RECORD_NODE:
+                    values[j] = numbers[RECORD_INDEX(record)];
+                    break;
+                case RECORD_DATA:
+                    values[j] =
+                        node_count + MMDB_DATA_SECTION_SEPARATOR +
+                        writer->values[RECORD_INDEX(record)]->offset;
+                    break;
+                default:
+                    values[j] = node_count;
+                    break;
+            }
+        }
+
+        encode_node(buffer + length, values, record_size);
+        length += node_size;
+
+        if (sizeof(buffer) - length < node_size || i == node_count - 1) {
+            if (fwrite(buffer, 1, length, file) != length) {
+                return MMDB_IO_ERROR;
+            }
+            length = 0;
+        }
+    }
+
+    return MMDB_SUCCESS;
+}
+
+static int encode_metadata(const MMDB_writer_s *const writer,
+                           writer_buffer_s *const buffer,
+                           uint32_t node_count,
+                           uint16_t record_size) {
+    bool ok =
+        encode_control(buffer, MMDB_DATA_TYPE_MAP, 9) &&
+        encode_string(buffer, "binary_format_major_version") &&
+        encode_uint64(buffer, MMDB_DATA_TYPE_UINT16, 2) &&
+        encode_string(buffer, "binary_format_minor_version") &&
+        encode_uint64(buffer, MMDB_DATA_TYPE_UINT16, 0) &&
+        encode_string(buffer, "build_epoch") &&
+        encode_uint64(buffer, MMDB_DATA_TYPE_UINT64, writer->build_epoch) &&
+        encode_string(buffer, "database_type") &&
+        encode_string(buffer, writer->database_type) &&
+        encode_string(buffer, "description") &&
+        encode_control(
+            buffer, MMDB_DATA_TYPE_MAP, (uint32_t)writer->description_count);
+    for (size_t i = 0; ok && i < writer->description_count; i++) {
+        ok = encode_string(buffer, writer->description_languages[i]) &&
+             encode_string(buffer, writer->descriptions[i]);
+    }
+    ok = ok && encode_string(buffer, "ip_version") &&
+         encode_uint64(buffer, MMDB_DATA_TYPE_UINT16, writer->ip_version) &&
+         encode_string(buffer, "languages") &&
+         encode_control(
+             buffer, MMDB_DATA_TYPE_ARRAY, (uint32_t)writer->language_count);
+    for (size_t i = 0; ok && i < writer->language_count; i++) {
+        ok = encode_string(buffer, writer->languages[i]);
+    }
+    ok = ok && encode_string(buffer, "node_count") &&
+         encode_uint64(buffer, MMDB_DATA_TYPE_UINT32, node_count) &&
+         encode_string(buffer, "record_size") &&
+         encode_uint64(buffer, MMDB_DATA_TYPE_UINT16, record_size);
+
+    return ok ? MMDB_SUCCESS : MMDB_OUT_OF_MEMORY_ERROR;
+}
+
+int MMDB_writer_write(MMDB_writer_s *const writer,
+                      const char *const filename) {
+    int status;
+    if (writer->ip_version == 6 && (writer->flags & MMDB_WRITER_ALIAS_IPV4)) {
+        status = add_ipv4_aliases(writer);
+        if (status != MMDB_SUCCESS) {
+            return status;
+        }
+    }
+
+    // The data section is rebuilt from scratch each time we write.
+    writer->data.length = 0;
+    writer->scratch.length = 0;
+    for (size_t i = 0; i < writer->value_count; i++) {
+        writer->values[i]->written = false;
+    }
+
+    uint32_t *const numbers = malloc(writer->node_count * sizeof(uint32_t));
+    uint32_t *const order = malloc(writer->node_count * sizeof(uint32_t));
+    writer_buffer_s metadata = {0};
+    FILE *file = NULL;
+    if (numbers == NULL || order == NULL) {
+        status = MMDB_OUT_OF_MEMORY_ERROR;
+        goto cleanup;
+    }
+    memset(numbers, 0xFF, writer->node_count * sizeof(uint32_t));
+
+    uint32_t node_count;
+    status = number_nodes(writer, numbers, order, &node_count);
+    if (status != MMDB_SUCCESS) {
+        goto cleanup;
+    }
+
+    uint64_t const max_record = (uint64_t)node_count +
+                                MMDB_DATA_SECTION_SEPARATOR +
+                                writer->data.length;
+    uint16_t record_size = record_size_for(max_record);
+    if (record_size == 0 ||
+        (writer->record_size != 0 && writer->record_size < record_size)) {
+        DEBUG_MSGF("%" PRIu64 " does not fit in the record size", max_record);
+        status = MMDB_INVALID_DATA_ERROR;
+        goto cleanup;
+    }
+    if (writer->record_size != 0) {
+        record_size = writer->record_size;
+    }
+
+    if (writer->tree_layout != MMDB_WRITER_LAYOUT_DEPTH_FIRST) {
+        tree_layout_s const tree = {
+            .node_count = (uint32_t)writer->node_count,
+            .depth = writer->ip_version == 6 ? 128 : 32,
+            .node_size = (size_t)record_size / 4,
+            .children = writer_node_children,
+            .context = writer,
+        };
+        memset(numbers, 0xFF, writer->node_count * sizeof(uint32_t));
+        status = layout_tree(
+            &tree, writer->tree_layout, numbers, order, &node_count);
+        if (status != MMDB_SUCCESS) {
+            goto cleanup;
+        }
+    }
+
+    status = encode_metadata(writer, &metadata, node_count, record_size);
+    if (status != MMDB_SUCCESS) {
+        goto cleanup;
+    }
+
+    file = fopen(filename, "wb");
+    if (file == NULL) {
+        status = MMDB_FILE_OPEN_ERROR;
+        goto cleanup;
+    }
+
+    status = write_tree(writer, file, numbers, order, node_count, record_size);
+    if (status != MMDB_SUCCESS) {
+        goto cleanup;
+    }
+
+    const uint8_t separator[MMDB_DATA_SECTION_SEPARATOR] = {0};
+    if (fwrite(separator, 1, sizeof(separator), file) != sizeof(separator) ||
+        fwrite(writer->data.data, 1, writer->data.length, file) !=
+            writer->data.length ||
+        fwrite(METADATA_MARKER, 1, METADATA_MARKER_LENGTH, file) !=
+            METADATA_MARKER_LENGTH ||
+        fwrite(metadata.data, 1, metadata.length, file) != metadata.length) {
+        status = MMDB_IO_ERROR;
+        goto cleanup;
+    }
+
+cleanup:
+    if (file != NULL && fclose(file) != 0 && status == MMDB_SUCCESS) {
+        status = MMDB_IO_ERROR;
+    }
+    free(numbers);
+    free(order);
+    free(metadata.data);
+    return status;
+}
+
+static void file_node_children(const void *const context,
+                               uint32_t node,
+                               uint32_t children[2]) {
+    const MMDB_s *const mmdb = context;
+    uint32_t values[2];
+    decode_node(mmdb->file_content +
+                    (uint64_t)node * mmdb->full_record_byte_size,
+                values,
+                mmdb->metadata.record_size);
+    for (int i = 0; i < 2; i++) {
+        children[i] = values[i] < mmdb->metadata.node_count
+                          ? values[i]
+                          : TREE_LAYOUT_NO_NODE;
+    }
+}
+
+int MMDB_writer_relayout(const MMDB_s *const mmdb,
+                         const char *const filename,
+                         int layout) {
+    uint32_t const node_count = mmdb->metadata.node_count;
+    uint16_t const record_size = mmdb->metadata.record_size;
+    size_t const node_size = mmdb->full_record_byte_size;
+    uint64_t const tree_size = (uint64_t)node_count * node_size;
+    if ((record_size != 24 && record_size != 28 && record_size != 32) ||
+        node_count == 0 || mmdb->file_size < 0 ||
+        tree_size > (uint64_t)mmdb->file_size) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    }
+
+    uint32_t *const numbers = malloc(node_count * sizeof(uint32_t));
+    uint32_t *const order = malloc(node_count * sizeof(uint32_t));
+    FILE *file = NULL;
+    int status;
+    if (numbers == NULL || order == NULL) {
+        status = MMDB_OUT_OF_MEMORY_ERROR;
+        goto cleanup;
+    }
+    memset(numbers, 0xFF, node_count * sizeof(uint32_t));
+
+    tree_layout_s const tree = {
+        .node_count = node_count,
+        .depth = mmdb->depth,
+        .node_size = node_size,
+        .children = file_node_children,
+        .context = mmdb,
+    };
+    uint32_t count;
+    status = layout_tree(&tree, layout, numbers, order, &count);
+    if (status != MMDB_SUCCESS) {
+        goto cleanup;
+    }
+    // Nodes that can't be reached from the root go at the end in their
+    // original order. This keeps the node count, and with it every data
+    // record and the metadata, the same.
+    for (uint32_t node = 0; node < node_count; node++) {
+        if (numbers[node] == TREE_LAYOUT_NO_NODE) {
+            numbers[node] = count;
+            order[count++] = node;
+        }
+    }
+
+    file = fopen(filename, "wb");
+    if (file == NULL) {
+        status = MMDB_FILE_OPEN_ERROR;
+        goto cleanup;
+    }
+
+    uint8_t buffer[64 * 1024];
+    size_t length = 0;
+    for (uint32_t i = 0; i < node_count; i++) {
+        uint32_t values[2];
+        decode_node(mmdb->file_content + (uint64_t)order[i] * node_size,
+                    values,
+                    record_size);
+        for (int j = 0; j < 2; j++) {
+            if (values[j] < node_count) {
+                values[j] = numbers[values[j]];
+            }
+        }
+        encode_node(buffer + length, values, record_size);
+        length += node_size;
+
+        if (sizeof(buffer) - length < node_size || i == node_count - 1) {
+            if (fwrite(buffer, 1, length, file) != length) {
+                status = MMDB_IO_ERROR;
+                goto cleanup;
+            }
+            length = 0;
+        }
+    }
+
+    // The data section and the metadata don't refer to the search tree, so
+    // they are copied as they are.
+    size_t const rest = (size_t)((uint64_t)mmdb->file_size - tree_size);
+    if (fwrite(mmdb->file_content + tree_size, 1, rest, file) != rest) {
+        status = MMDB_IO_ERROR;
+    }
+
+cleanup:
+    if (file != NULL && fclose(file) != 0 && status == MMDB_SUCCESS) {
+        status = MMDB_IO_ERROR;
+    }
+    free(numbers);
+    free(order);
+    return status;
+}
@@ -5,17 +5,18 @@
 #if HAVE_CONFIG_H
     #include <config.h>
 #endif
+#include "block-cache.h"
 #include "data-pool.h"
+#include "map-file.h"
 #include "maxminddb-compat-util.h"
 #include "maxminddb.h"
 #include <errno.h>
-#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 
 #ifdef _WIN32
     #ifndef UNICODE
@@ -29,12 +30,15 @@
 typedef ADDRESS_FAMILY sa_family_t;
 #else
     #include <arpa/inet.h>
-    #include <sys/mman.h>
     #include <unistd.h>
 #endif
 
 #define MMDB_DATA_SECTION_SEPARATOR (16)
 #define MAXIMUM_DATA_STRUCTURE_DEPTH (512)
+/* The most bytes a value's header can take in the data section, which is a
+ * control byte, an extended type and three bytes of size, or a control byte
+ * and four bytes of a pointer. */
+#define MAXIMUM_HEADER_SIZE (5)
 
 #ifdef MMDB_DEBUG
     #define DEBUG_MSG(msg) fprintf(stderr, msg "\n")
@@ -124,6 +128,228 @@ char *type_num_to_name(uint8_t num) {
     #define MAYBE_CHECK_SIZE_OVERFLOW(...)
 #endif
 
+/* The functions that take a check_bounds argument are inlined into callers
+ * that pass a constant, so the variant used for a database opened with
+ * MMDB_MODE_VERIFY has no bounds checks left in it. */
+#if defined(__GNUC__) || defined(__clang__)
+    #define ALWAYS_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+    #define ALWAYS_INLINE __forceinline
+#else
+    #define ALWAYS_INLINE inline
+#endif
+
+/* For functions off the hot path that would otherwise be inlined into it and
+ * make it too large to be inlined itself. */
+#if defined(__GNUC__) || defined(__clang__)
+    #define NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+    #define NOINLINE __declspec(noinline)
+#else
+    #define NOINLINE
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define PREFETCH(address) __builtin_prefetch(address)
+#else
+    #define PREFETCH(address)
+#endif
+
+/* How far from the value being decoded a pointer's target has to be for
+ * prefetch_next_sibling() to prefetch it, a few cache lines. */
+#define PREFETCH_MIN_DISTANCE (256)
+
+/* The type and size of a value in the data section and where it is, as read
+ * by decode_header(). For pointers, the payload is the offset pointed to and
+ * for booleans the size is the value. */
+typedef struct value_header_s {
+    uint32_t type;
+    uint32_t size;
+    uint32_t payload;
+    uint32_t next;
+} value_header_s;
+
+/* The keys of the metadata map that read_metadata() reads, in the order in
+ * which their values are checked. */
+typedef enum {
+    METADATA_NODE_COUNT,
+    METADATA_RECORD_SIZE,
+    METADATA_IP_VERSION,
+    METADATA_DATABASE_TYPE,
+    METADATA_LANGUAGES,
+    METADATA_BINARY_FORMAT_MAJOR_VERSION,
+    METADATA_BINARY_FORMAT_MINOR_VERSION,
+    METADATA_BUILD_EPOCH,
+    METADATA_DESCRIPTION,
+    METADATA_KEY_COUNT
+} metadata_key_e;
+
+static const char *const metadata_keys[METADATA_KEY_COUNT] = {
+    "node_count",
+    "record_size",
+    "ip_version",
+    "database_type",
+    "languages",
+    "binary_format_major_version",
+    "binary_format_minor_version",
+    "build_epoch",
+    "description",
+};
+
+/* Where the values of the metadata keys are in the metadata section, as found
+ * by a single pass over the metadata map. If the pass failed, status is why,
+ * and it is the error for the keys that weren't found before that. */
+typedef struct metadata_values_s {
+    const MMDB_s *metadata_db;
+    uint32_t offsets[METADATA_KEY_COUNT];
+    bool found[METADATA_KEY_COUNT];
+    int status;
+} metadata_values_s;
+
+/* A value that a record or pointer points to and that MMDB_verify() has
+ * checked, with the number of levels of maps and arrays below it. */
+typedef struct verified_value_s {
+    uint32_t offset;
+    uint32_t height;
+} verified_value_s;
+
+/* The offset of an unused slot of the verified values. No value can be there,
+ * as the data section is smaller than 4 GiB. */
+#define NO_VERIFIED_VALUE UINT32_MAX
+
+/* The state of one MMDB_verify() or MMDB_verify_subtree() call. Records and
+ * pointers often point to the same values, so each value they point to is
+ * checked once and its offset and height are kept in an open addressing hash
+ * table. The budget is the number of values left to check in the call. */
+typedef struct verify_state_s {
+    const MMDB_s *mmdb;
+    /* NULL when every value is checked each time it is pointed to. */
+    verified_value_s *verified;
+    size_t verified_count;
+    /* A power of two that is at least twice verified_count. */
+    size_t verified_capacity;
+    uint64_t budget;
+} verify_state_s;
+
+/* MMDB_s has no room for what the library keeps for an open database, so it
+ * is allocated together with the copy of the file name at the end of it. See
+ * new_filename() and database_internal(). */
+typedef struct database_internal_s {
+    /* For MMDB_MODE_VERIFY, a bit for each offset in the data section that is
+     * set if MMDB_verify() checked the value there, and NULL otherwise. */
+    uint8_t *verified_offsets;
+    char filename[];
+} database_internal_s;
+
+/* A node in the tree of paths of a compiled schema. Node 0 is the record
+ * itself and the children of a node are the path elements that follow it.
+ * Nodes with is_field set are the last element of a field's path. */
+typedef struct schema_node_s {
+    const char *key;
+    uint32_t key_length;
+    /* Set when the key can also be used as an array index. */
+    bool has_index;
+    long index;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t child_count;
+    bool is_field;
+    uint32_t type;
+    size_t offset;
+} schema_node_s;
+
+struct MMDB_schema_s {
+    uint32_t node_count;
+    schema_node_s nodes[];
+};
+
+/* Where a lookup is after following the first bits of the address from a
+ * node, as in the top levels of the search tree that an MMDB_cache_s keeps.
+ * bit is less than the number of bits followed when the path ends early. */
+typedef struct cache_top_s {
+    uint32_t value;
+    uint16_t bit;
+} cache_top_s;
+
+/* The top levels of the search tree take at most this many bits of the
+ * address, and less when the memory budget is small. */
+#define CACHE_TOP_MAX_BITS 16
+
+/* The largest header of a value is a control byte, an extended type and three
+ * bytes of size, and the largest scalar that follows it is a uint128. */
+#define CACHE_SCALAR_MAX_SIZE (5 + 16)
+
+struct MMDB_cache_s {
+    /* The metadata and the sizes of the sections. There is no file content,
+     * so the library only uses this for the values it decodes itself. */
+    MMDB_s mmdb;
+    /* What the entries of lookup results point to. Its data section is
+     * empty, so that the functions for an MMDB_s fail on these entries with
+     * MMDB_INVALID_DATA_ERROR rather than reading memory that isn't there. */
+    MMDB_s entries;
+    uint64_t data_section_offset;
+    block_cache_s *blocks;
+    uint16_t top_bits;
+    /* Indexed by the first top_bits bits of an address, and for IPv4
+     * addresses in an IPv6 database by the bits after the first 96. */
+    cache_top_s *top;
+    cache_top_s *ipv4_top;
+};
+
+/* A map or array that get_entry_data_list() is in the middle of. remaining
+ * counts both the keys and the values of a map. When the map or array was
+ * reached through a pointer, the value after it starts at pointer_next rather
+ * than where the map or array ends. */
+typedef struct entry_data_frame_s {
+    MMDB_entry_data_list_s *container;
+    uint32_t remaining;
+    uint32_t offset;
+    uint32_t pointer_next;
+    bool via_pointer;
+    int depth;
+} entry_data_frame_s;
+
+/* The number of frames get_entry_data_list() keeps on the C stack. Deeper
+ * frames are put at the top of the arena, or on the heap when the list is
+ * allocated from a data pool. */
+#define ENTRY_DATA_INLINE_FRAMES (16)
+
+/* List elements and frames in an arena are aligned to this, which is enough
+ * for any of their members. */
+#define ENTRY_DATA_ARENA_ALIGN (16)
+
+/* The state of one get_entry_data_list() call. The list is allocated either
+ * from a data pool or from a caller's arena. */
+typedef struct entry_data_builder_s {
+    const MMDB_s *mmdb;
+    /* Set when the values are read through the cache of an MMDB_cache_s,
+     * which is only done for lists in a data pool. */
+    MMDB_cache_s *cache;
+    MMDB_data_pool_s *pool;
+    MMDB_entry_data_arena_s *arena;
+    /* Where the frames that don't fit inline end in the arena. The frames
+     * grow down from here, and list elements may only use the arena up to
+     * spilled_capacity frames below it. */
+    size_t frames_end;
+    size_t frame_count;
+    entry_data_frame_s *heap_frames;
+    size_t spilled_capacity;
+    entry_data_frame_s inline_frames[ENTRY_DATA_INLINE_FRAMES];
+} entry_data_builder_s;
+
+/* Callback sinks are written to in chunks of this size. */
+#define DUMP_STAGING_SIZE (512)
+
+/* The state of one MMDB_dump_entry_data_list_to_sink() call. Output for a
+ * callback sink is staged on the stack so that the callback isn't called for
+ * every key and value. */
+typedef struct dump_writer_s {
+    MMDB_dump_sink_s *sink;
+    int status;
+    size_t staged;
+    char staging[DUMP_STAGING_SIZE];
+} dump_writer_s;
+
 typedef struct record_info_s {
     uint16_t record_length;
     uint32_t (*left_record_getter)(const uint8_t *);
@@ -131,6 +357,19 @@ typedef struct record_info_s {
     uint8_t right_record_offset;
 } record_info_s;
 
+/* The state of the lookup in one database of an MMDB_multi_s. */
+typedef struct multi_walk_s {
+    record_info_s record_info;
+    uint8_t mapped_address[16];
+    uint8_t const *address;
+    uint64_t value;
+    uint16_t current_bit;
+} multi_walk_s;
+
+// MMDB_multi_lookup_sockaddr() walks the trees of this many databases at a
+// time, which keeps their state on the stack.
+#define MULTI_LOOKUP_BATCH 16
+
 #define METADATA_MARKER "\xab\xcd\xefMaxMind.com"
 /* This is 128kb */
 #define METADATA_BLOCK_MAX_SIZE 131072
@@ -138,62 +377,300 @@ typedef struct record_info_s {
 // 64 leads us to allocating 4 KiB on a 64bit system.
 #define MMDB_POOL_INIT_SIZE 64
 
-static int map_file(MMDB_s *const mmdb);
+// With MMDB_MODE_LAZY, the netmask of the IPv4 start node is one of these
+// until the start node has been found. Real netmasks are at most 96.
+#define IPV4_START_NODE_PENDING UINT16_MAX
+#define IPV4_START_NODE_BUSY (UINT16_MAX - 1)
+
+// MMDB_MODE_LAZY needs atomic operations on the netmask. Without them
+// MMDB_open() finds the IPv4 start node as it always has.
+#if defined(__GNUC__) || defined(__clang__)
+    #define LAZY_OPEN_SUPPORTED 1
+static inline uint16_t load_netmask(const uint16_t *netmask) {
+    return __atomic_load_n(netmask, __ATOMIC_ACQUIRE);
+}
+static inline bool claim_netmask(uint16_t *netmask) {
+    uint16_t expected = IPV4_START_NODE_PENDING;
+    return __atomic_compare_exchange_n(netmask,
+                                       &expected,
+                                       IPV4_START_NODE_BUSY,
+                                       false,
+                                       __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED);
+}
+static inline void publish_netmask(uint16_t *netmask, uint16_t value) {
+    __atomic_store_n(netmask, value, __ATOMIC_RELEASE);
+}
+#elif defined(_MSC_VER)
+    #include <intrin.h>
+    #define LAZY_OPEN_SUPPORTED 1
+static inline uint16_t load_netmask(const uint16_t *netmask) {
+    return (uint16_t)_InterlockedOr16((volatile short *)netmask, 0);
+}
+static inline bool claim_netmask(uint16_t *netmask) {
+    return _InterlockedCompareExchange16((volatile short *)netmask,
+                                         (short)IPV4_START_NODE_BUSY,
+                                         (short)IPV4_START_NODE_PENDING) ==
+           (short)IPV4_START_NODE_PENDING;
+}
+static inline void publish_netmask(uint16_t *netmask, uint16_t value) {
+    _InterlockedExchange16((volatile short *)netmask, (short)value);
+}
+#else
+    #define LAZY_OPEN_SUPPORTED 0
+static inline uint16_t load_netmask(const uint16_t *netmask) {
+    return *netmask;
+}
+static inline bool claim_netmask(uint16_t *netmask) {
+    (void)netmask;
+    return false;
+}
+static inline void publish_netmask(uint16_t *netmask, uint16_t value) {
+    *netmask = value;
+}
+#endif
+
 static const uint8_t *find_metadata(const uint8_t *file_content,
                                     ssize_t file_size,
                                     uint32_t *metadata_size);
 static int read_metadata(MMDB_s *mmdb);
+static int check_data_section(MMDB_s *const mmdb,
+                              uint64_t file_size,
+                              uint64_t *const search_tree_size);
 static MMDB_s make_fake_metadata_db(const MMDB_s *const mmdb);
-static int
-value_for_key_as_uint16(MMDB_entry_s *start, char *key, uint16_t *value);
-static int
-value_for_key_as_uint32(MMDB_entry_s *start, char *key, uint32_t *value);
-static int
-value_for_key_as_uint64(MMDB_entry_s *start, char *key, uint64_t *value);
-static int
-value_for_key_as_string(MMDB_entry_s *start, char *key, char const **value);
-static int populate_languages_metadata(MMDB_s *mmdb,
-                                       MMDB_s *metadata_db,
-                                       MMDB_entry_s *metadata_start);
-static int populate_description_metadata(MMDB_s *mmdb,
-                                         MMDB_s *metadata_db,
-                                         MMDB_entry_s *metadata_start);
+static int find_metadata_values(metadata_values_s *const values);
+static int metadata_value(const metadata_values_s *const values,
+                          metadata_key_e key,
+                          uint32_t type,
+                          MMDB_entry_data_s *const entry_data);
+static int value_for_key_as_uint16(const metadata_values_s *const values,
+                                   metadata_key_e key,
+                                   uint16_t *value);
+static int value_for_key_as_uint32(const metadata_values_s *const values,
+                                   metadata_key_e key,
+                                   uint32_t *value);
+static int value_for_key_as_uint64(const metadata_values_s *const values,
+                                   metadata_key_e key,
+                                   uint64_t *value);
+static int metadata_strings(const metadata_values_s *const values,
+                            metadata_key_e key,
+                            uint32_t type,
+                            MMDB_entry_data_s *const entry_data,
+                            size_t *const size);
+static int copy_metadata_strings(MMDB_s *const mmdb,
+                                 const MMDB_s *const metadata_db,
+                                 const MMDB_entry_data_s *const database_type,
+                                 const MMDB_entry_data_s *const languages,
+                                 const MMDB_entry_data_s *const description,
+                                 size_t size);
+static int next_metadata_string(const MMDB_s *const metadata_db,
+                                uint32_t *const offset,
+                                MMDB_entry_data_s *const entry_data);
+static const char *copy_metadata_string(char **const strings,
+                                        const MMDB_entry_data_s *const string);
 static int resolve_any_address(const char *ipstr, struct addrinfo **addresses);
+static int address_for_sockaddr(const MMDB_s *const mmdb,
+                                const struct sockaddr *const sockaddr,
+                                uint8_t *const mapped_address,
+                                uint8_t const **const address);
 static int find_address_in_search_tree(const MMDB_s *const mmdb,
                                        uint8_t const *address,
                                        sa_family_t address_family,
                                        MMDB_lookup_result_s *result);
+static int start_search(const MMDB_s *const mmdb,
+                        sa_family_t address_family,
+                        record_info_s *const record_info,
+                        uint64_t *const value,
+                        uint16_t *const current_bit);
+static int search_result(const MMDB_s *const mmdb,
+                         uint64_t value,
+                         uint16_t current_bit,
+                         MMDB_lookup_result_s *const result);
+static void multi_lookup_batch(const MMDB_multi_s *const multi,
+                               size_t first,
+                               size_t count,
+                               const struct sockaddr *const sockaddr,
+                               MMDB_lookup_result_s *const results,
+                               int *const mmdb_errors);
+static ALWAYS_INLINE int
+walk_search_tree(const MMDB_s *const mmdb,
+                 const record_info_s *const record_info,
+                 uint8_t const *address,
+                 uint16_t depth,
+                 uint64_t *const value,
+                 uint16_t *const current_bit);
+static ALWAYS_INLINE int
+walk_search_tree_bounds(const MMDB_s *const mmdb,
+                        const record_info_s *const record_info,
+                        uint8_t const *address,
+                        uint16_t depth,
+                        bool check_bounds,
+                        uint64_t *const value,
+                        uint16_t *const current_bit);
 static record_info_s record_info_for_database(const MMDB_s *const mmdb);
-static int find_ipv4_start_node(MMDB_s *const mmdb);
+static int ipv4_start_node(const MMDB_s *const mmdb,
+                           MMDB_ipv4_start_node_s *const start_node);
+static int find_ipv4_start_node(const MMDB_s *const mmdb,
+                                MMDB_ipv4_start_node_s *const start_node);
 static uint8_t record_type(const MMDB_s *const mmdb, uint64_t record);
 static uint32_t get_left_28_bit_record(const uint8_t *record);
 static uint32_t get_right_28_bit_record(const uint8_t *record);
 static uint32_t data_section_offset_for_record(const MMDB_s *const mmdb,
                                                uint64_t record);
+static bool next_network_record(MMDB_network_iterator_s *const iterator,
+                                int split_netmask,
+                                uint32_t *const record_out,
+                                uint16_t *const depth_out,
+                                int *const mmdb_error);
+static void push_network_record(MMDB_network_iterator_s *const iterator,
+                                uint32_t record,
+                                uint16_t depth,
+                                uint8_t bit);
+static bool is_aliased_ipv4_subtree(const MMDB_s *const mmdb,
+                                    const uint8_t *address,
+                                    uint32_t record,
+                                    uint16_t depth);
+static uint16_t
+split_depth_for_network(const MMDB_network_iterator_s *const iterator,
+                        uint16_t netmask,
+                        uint16_t depth);
+static bool is_zero_prefix(const uint8_t *address, uint16_t bits);
+static void set_network(const MMDB_s *const mmdb,
+                        const uint8_t *address,
+                        uint16_t depth,
+                        MMDB_network_s *const network);
+static bool next_diff_record(MMDB_diff_iterator_s *const iterator,
+                             uint32_t *const old_record_out,
+                             uint32_t *const new_record_out,
+                             uint16_t *const depth_out,
+                             int *const mmdb_error);
+static int read_child_records(const MMDB_s *const mmdb,
+                              uint32_t record,
+                              uint32_t *const left,
+                              uint32_t *const right);
+static void push_diff_record(MMDB_diff_iterator_s *const iterator,
+                             uint32_t old_record,
+                             uint32_t new_record,
+                             uint16_t depth,
+                             uint8_t bit);
+static int records_equal(MMDB_diff_iterator_s *const iterator,
+                         uint32_t old_record,
+                         uint32_t new_record,
+                         bool *const equal);
+static int entries_equal(const MMDB_s *const old_mmdb,
+                         uint32_t old_offset,
+                         const MMDB_s *const new_mmdb,
+                         uint32_t new_offset,
+                         int depth,
+                         bool *const equal);
+static int maps_equal(const MMDB_s *const old_mmdb,
+                      const MMDB_entry_data_s *const old_map,
+                      const MMDB_s *const new_mmdb,
+                      const MMDB_entry_data_s *const new_map,
+                      int depth,
+                      bool *const equal);
+static int verify_database(const MMDB_s *const mmdb,
+                           verify_state_s *const state);
+static int keep_verified_offsets(MMDB_s *const mmdb);
+static bool is_verified_offset(const MMDB_s *const mmdb, uint32_t offset);
+static const MMDB_s *entry_database(const MMDB_entry_s *const entry,
+                                    MMDB_s *const checked);
+static int init_verify_state(verify_state_s *const state,
+                             const MMDB_s *const mmdb);
+static int verify_subtree(const MMDB_network_subtree_s *const subtree,
+                          verify_state_s *const state);
+static verified_value_s *find_verified_value(const verify_state_s *const state,
+                                             uint32_t offset);
+static int add_verified_value(verify_state_s *const state,
+                              uint32_t offset,
+                              uint32_t height);
+static int verify_target(verify_state_s *const state,
+                         uint32_t offset,
+                         int depth,
+                         int *const height);
+static int verify_value(verify_state_s *const state,
+                        uint32_t offset,
+                        int depth,
+                        uint32_t *const next_offset,
+                        int *const height);
+static bool is_valid_utf8(const uint8_t *string, uint32_t size);
 static size_t path_length(va_list va_path);
+static int schema_add_field(MMDB_schema_s *const schema,
+                            const MMDB_schema_field_s *const field,
+                            char **const strings);
+static bool schema_type_is_supported(uint32_t type);
+static int schema_decode_node(const MMDB_s *const mmdb,
+                              const MMDB_schema_s *const schema,
+                              const schema_node_s *const node,
+                              uint32_t offset,
+                              int depth,
+                              bool need_next,
+                              uint32_t *const next_offset,
+                              void *const output);
+static const schema_node_s *
+schema_find_key(const MMDB_schema_s *const schema,
+                const schema_node_s *const node,
+                const MMDB_s *const mmdb,
+                const value_header_s *const key);
+static const schema_node_s *
+schema_find_index(const MMDB_schema_s *const schema,
+                  const schema_node_s *const node,
+                  uint32_t index,
+                  uint32_t size);
+static int schema_store_value(const MMDB_s *const mmdb,
+                              const schema_node_s *const node,
+                              const value_header_s *const value,
+                              void *const output);
+static int lookup_path(const MMDB_s *const mmdb,
+                       uint32_t offset,
+                       const char *const *const path,
+                       uint32_t *const value_offset,
+                       value_header_s *const value);
 static int lookup_path_in_array(const char *path_elem,
                                 const MMDB_s *const mmdb,
-                                MMDB_entry_data_s *entry_data);
+                                uint32_t *const offset,
+                                value_header_s *const value);
 static int lookup_path_in_map(const char *path_elem,
                               const MMDB_s *const mmdb,
-                              MMDB_entry_data_s *entry_data);
-static int skip_map_or_array(const MMDB_s *const mmdb,
-                             MMDB_entry_data_s *entry_data,
-                             int depth);
+                              uint32_t *const offset,
+                              value_header_s *const value);
+static int skip_value(const MMDB_s *const mmdb,
+                      uint32_t offset,
+                      int depth,
+                      uint32_t *const next_offset);
+static int decode_header_follow(const MMDB_s *const mmdb,
+                                uint32_t offset,
+                                value_header_s *const header);
 static int decode_one_follow(const MMDB_s *const mmdb,
                              uint32_t offset,
                              MMDB_entry_data_s *entry_data);
 static int decode_one(const MMDB_s *const mmdb,
                       uint32_t offset,
                       MMDB_entry_data_s *entry_data);
+static int decode_header(const MMDB_s *const mmdb,
+                         uint32_t offset,
+                         value_header_s *const header);
+static ALWAYS_INLINE int decode_header_bounds(const MMDB_s *const mmdb,
+                                              uint32_t offset,
+                                              bool check_bounds,
+                                              value_header_s *const header);
 static int get_ext_type(int raw_ext_type);
 static uint32_t
 get_ptr_from(uint8_t ctrl, uint8_t const *const ptr, int ptr_size);
-static int get_entry_data_list(const MMDB_s *const mmdb,
-                               uint32_t offset,
-                               MMDB_entry_data_list_s *const entry_data_list,
-                               MMDB_data_pool_s *const pool,
-                               int depth);
+static int get_entry_data_list(entry_data_builder_s *const builder,
+                               uint32_t offset);
+static int entry_data_list_start_value(entry_data_builder_s *const builder,
+                                       uint32_t offset,
+                                       int depth,
+                                       uint32_t *const next_offset);
+static MMDB_entry_data_list_s *
+entry_data_list_alloc(entry_data_builder_s *const builder);
+static entry_data_frame_s *entry_data_frame_at(entry_data_builder_s *builder,
+                                               size_t index);
+static entry_data_frame_s *
+entry_data_frame_push(entry_data_builder_s *const builder);
+static void prefetch_next_sibling(entry_data_builder_s *const builder,
+                                  size_t parent_index);
 static float get_ieee754_float(const uint8_t *restrict p);
 static double get_ieee754_double(const uint8_t *restrict p);
 static uint32_t get_uint32(const uint8_t *p);
@@ -201,16 +678,71 @@ static uint32_t get_uint24(const uint8_t *p);
 static uint32_t get_uint16(const uint8_t *p);
 static uint64_t get_uintX(const uint8_t *p, int length);
 static int32_t get_sintX(const uint8_t *p, int length);
+static char *new_filename(const char *const filename);
+static database_internal_s *database_internal(const MMDB_s *const mmdb);
 static void free_mmdb_struct(MMDB_s *const mmdb);
-static void free_languages_metadata(MMDB_s *mmdb);
-static void free_descriptions_metadata(MMDB_s *mmdb);
+static void free_metadata(MMDB_s *mmdb);
+static int cache_open(MMDB_cache_s *const cache,
+                      const char *const filename,
+                      size_t memory_budget);
+static int cache_read_metadata(MMDB_cache_s *const cache,
+                               const opened_file_s *const file);
+static int cache_read_node(MMDB_cache_s *const cache,
+                           const record_info_s *const record_info,
+                           uint32_t node,
+                           uint32_t *const left,
+                           uint32_t *const right);
+static int cache_build_top(MMDB_cache_s *const cache,
+                           const record_info_s *const record_info,
+                           uint32_t value,
+                           uint16_t bit,
+                           cache_top_s **const top);
+static int cache_find_address(MMDB_cache_s *const cache,
+                              uint8_t const *address,
+                              sa_family_t address_family,
+                              MMDB_lookup_result_s *const result);
+static cache_top_s cache_top_for_address(const MMDB_cache_s *const cache,
+                                         uint8_t const *address,
+                                         sa_family_t address_family);
+static int lookup_pending(MMDB_lookup_state_s *const state,
+                          uint64_t offset,
+                          int status);
+static int lookup_cached_value(MMDB_lookup_state_s *const state,
+                               uint32_t offset,
+                               int depth,
+                               uint32_t *const next_offset);
+static int lookup_cached_header(MMDB_lookup_state_s *const state,
+                                uint32_t offset,
+                                value_header_s *const header);
+static int lookup_cached_bytes(MMDB_lookup_state_s *const state,
+                               uint32_t offset,
+                               uint32_t size);
+static NOINLINE int cache_decode_one(MMDB_cache_s *const cache,
+                                     MMDB_data_pool_s *const pool,
+                                     uint32_t offset,
+                                     MMDB_entry_data_s *const entry_data);
+static int builder_decode_one(const entry_data_builder_s *const builder,
+                              uint32_t offset,
+                              MMDB_entry_data_s *const entry_data);
+static int
+pool_entry_data_list(const MMDB_s *const mmdb,
+                     MMDB_cache_s *const cache,
+                     uint32_t offset,
+                     MMDB_entry_data_list_s **const entry_data_list);
+static int dump_to_stream(void *const context,
+                          const char *const data,
+                          size_t size);
 static MMDB_entry_data_list_s *
-dump_entry_data_list(FILE *stream,
+dump_entry_data_list(dump_writer_s *writer,
                      MMDB_entry_data_list_s *entry_data_list,
-                     int indent,
-                     int *status);
-static void print_indentation(FILE *stream, int i);
-static char *bytes_to_hex(uint8_t const *bytes, uint32_t size);
+                     int indent);
+static void dump_write(dump_writer_s *writer, const char *data, size_t size);
+static void dump_flush(dump_writer_s *writer);
+static bool dump_reserve(MMDB_dump_sink_s *sink, size_t size);
+static void dump_indentation(dump_writer_s *writer, int i);
+static void dump_string(dump_writer_s *writer, const char *string, size_t size);
+static void dump_hex(dump_writer_s *writer, const uint8_t *bytes, size_t size);
+static void dump_format(dump_writer_s *writer, const char *format, ...);
 
 #define CHECKED_DECODE_ONE(mmdb, offset, entry_data)                           \
     do {                                                                       \
@@ -251,8 +783,9 @@ int MMDB_open(const char *const filename, uint32_t flags, MMDB_s *const mmdb) {
     mmdb->metadata.languages.count = 0;
     mmdb->metadata.languages.names = NULL;
     mmdb->metadata.description.count = 0;
+    mmdb->metadata.description.descriptions = NULL;
 
-    mmdb->filename = mmdb_strdup(filename);
+    mmdb->filename = new_filename(filename);
     if (NULL == mmdb->filename) {
         status = MMDB_OUT_OF_MEMORY_ERROR;
         goto cleanup;
@@ -261,9 +794,11 @@ int MMDB_open(const char *const filename, uint32_t flags, MMDB_s *const mmdb) {
     if ((flags & MMDB_MODE_MASK) == 0) {
         flags |= MMDB_MODE_MMAP;
     }
-    mmdb->flags = flags;
+    // The bounds checks may only be skipped once the database is verified.
+    mmdb->flags = flags & ~(uint32_t)MMDB_MODE_VERIFY;
 
-    if (MMDB_SUCCESS != (status = map_file(mmdb))) {
+    status = map_file(mmdb->filename, &mmdb->file_content, &mmdb->file_size);
+    if (MMDB_SUCCESS != status) {
         goto cleanup;
     }
 
@@ -288,55 +823,37 @@ int MMDB_open(const char *const filename, uint32_t flags, MMDB_s *const mmdb) {
         goto cleanup;
     }
 
-    if (mmdb->metadata.binary_format_major_version != 2) {
-        status = MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
-        goto cleanup;
-    }
-
-    if (!can_multiply(SSIZE_MAX,
-                      mmdb->metadata.node_count,
-                      mmdb->full_record_byte_size)) {
-        status = MMDB_INVALID_METADATA_ERROR;
-        goto cleanup;
-    }
-    ssize_t search_tree_size = (ssize_t)mmdb->metadata.node_count *
-                               (ssize_t)mmdb->full_record_byte_size;
-
-    mmdb->data_section =
-        mmdb->file_content + search_tree_size + MMDB_DATA_SECTION_SEPARATOR;
-    if (mmdb->file_size < MMDB_DATA_SECTION_SEPARATOR ||
-        search_tree_size > mmdb->file_size - MMDB_DATA_SECTION_SEPARATOR) {
-        status = MMDB_INVALID_METADATA_ERROR;
-        goto cleanup;
-    }
-    ssize_t data_section_size =
-        mmdb->file_size - search_tree_size - MMDB_DATA_SECTION_SEPARATOR;
-    if (data_section_size > UINT32_MAX || data_section_size <= 0) {
-        status = MMDB_INVALID_METADATA_ERROR;
-        goto cleanup;
-    }
-    mmdb->data_section_size = (uint32_t)data_section_size;
-
-    // Although it is likely not possible to construct a database with valid
-    // valid metadata, as parsed above, and a data_section_size less than 3,
-    // we do this check as later we assume it is at least three when doing
-    // bound checks.
-    if (mmdb->data_section_size < 3) {
-        status = MMDB_INVALID_DATA_ERROR;
+    uint64_t search_tree_size;
+    status = check_data_section(
+        mmdb, (uint64_t)mmdb->file_size, &search_tree_size);
+    if (MMDB_SUCCESS != status) {
         goto cleanup;
     }
+    mmdb->data_section = mmdb->file_content + (size_t)search_tree_size +
+                         MMDB_DATA_SECTION_SEPARATOR;
 
     mmdb->metadata_section = metadata;
     mmdb->ipv4_start_node.node_value = 0;
     mmdb->ipv4_start_node.netmask = 0;
 
-    // We do this immediately as otherwise there is a race to set
-    // ipv4_start_node.node_value and ipv4_start_node.netmask.
     if (mmdb->metadata.ip_version == 6) {
-        status = find_ipv4_start_node(mmdb);
+        if (LAZY_OPEN_SUPPORTED && (flags & MMDB_MODE_LAZY)) {
+            // Found on first use. See ipv4_start_node().
+            mmdb->ipv4_start_node.netmask = IPV4_START_NODE_PENDING;
+        } else {
+            status = find_ipv4_start_node(mmdb, &mmdb->ipv4_start_node);
+            if (status != MMDB_SUCCESS) {
+                goto cleanup;
+            }
+        }
+    }
+
+    if (flags & MMDB_MODE_VERIFY) {
+        status = keep_verified_offsets(mmdb);
         if (status != MMDB_SUCCESS) {
             goto cleanup;
         }
+        mmdb->flags = flags;
     }
 
 cleanup:
@@ -348,183 +865,77 @@ cleanup:
     return status;
 }
 
-#ifdef _WIN32
-
-static LPWSTR utf8_to_utf16(const char *utf8_str) {
-    int wide_chars = MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, NULL, 0);
-    wchar_t *utf16_str = (wchar_t *)calloc(wide_chars, sizeof(wchar_t));
-    if (!utf16_str) {
-        return NULL;
-    }
-
-    if (MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, utf16_str, wide_chars) <
-        1) {
-        free(utf16_str);
-        return NULL;
-    }
-
-    return utf16_str;
-}
-
-static int map_file(MMDB_s *const mmdb) {
-    ssize_t size;
-    int status = MMDB_SUCCESS;
-    HANDLE mmh = NULL;
-    HANDLE fd = INVALID_HANDLE_VALUE;
-    LPWSTR utf16_filename = utf8_to_utf16(mmdb->filename);
-    if (!utf16_filename) {
-        status = MMDB_FILE_OPEN_ERROR;
-        goto cleanup;
-    }
-    fd = CreateFileW(utf16_filename,
-                     GENERIC_READ,
-                     FILE_SHARE_READ,
-                     NULL,
-                     OPEN_EXISTING,
-                     FILE_ATTRIBUTE_NORMAL,
-                     NULL);
-    if (fd == INVALID_HANDLE_VALUE) {
-        status = MMDB_FILE_OPEN_ERROR;
-        goto cleanup;
-    }
-    LARGE_INTEGER file_size;
-    if (!GetFileSizeEx(fd, &file_size)) {
-        status = MMDB_IO_ERROR;
-        goto cleanup;
-    }
-    if (file_size.QuadPart < 0 || file_size.QuadPart > SSIZE_MAX) {
-        status = MMDB_IO_ERROR;
-        goto cleanup;
-    }
-    size = (ssize_t)file_size.QuadPart;
-    mmh = CreateFileMapping(fd, NULL, PAGE_READONLY, 0, 0, NULL);
-    /* Microsoft documentation for CreateFileMapping indicates this returns
-        NULL not INVALID_HANDLE_VALUE on error */
-    if (NULL == mmh) {
-        status = MMDB_IO_ERROR;
-        goto cleanup;
-    }
-    uint8_t *file_content =
-        (uint8_t *)MapViewOfFile(mmh, FILE_MAP_READ, 0, 0, 0);
-    if (file_content == NULL) {
-        status = MMDB_IO_ERROR;
-        goto cleanup;
-    }
-
-    mmdb->file_size = size;
-    mmdb->file_content = file_content;
-
-cleanup:;
-    int saved_errno = errno;
-    if (INVALID_HANDLE_VALUE != fd) {
-        CloseHandle(fd);
-    }
-    if (NULL != mmh) {
-        CloseHandle(mmh);
-    }
-    errno = saved_errno;
-    free(utf16_filename);
-
-    return status;
-}
-
-#else // _WIN32
-
-static int map_file(MMDB_s *const mmdb) {
-    int status = MMDB_SUCCESS;
-
-    int o_flags = O_RDONLY;
-    #ifdef O_CLOEXEC
-    o_flags |= O_CLOEXEC;
-    #endif
-    int fd = open(mmdb->filename, o_flags);
-    if (fd < 0) {
-        status = MMDB_FILE_OPEN_ERROR;
-        goto cleanup;
-    }
-
-    #if defined(FD_CLOEXEC) && !defined(O_CLOEXEC)
-    int fd_flags = fcntl(fd, F_GETFD);
-    if (fd_flags >= 0) {
-        fcntl(fd, F_SETFD, fd_flags | FD_CLOEXEC);
-    }
-    #endif
-
-    struct stat s;
-    if (fstat(fd, &s)) {
-        status = MMDB_FILE_OPEN_ERROR;
-        goto cleanup;
+/* Checks the format of the database and that the search tree and the data
+ * section that the metadata describes fit in a file of file_size bytes. This
+ * sets the size of the data section and of the search tree before it. */
+static int check_data_section(MMDB_s *const mmdb,
+                              uint64_t file_size,
+                              uint64_t *const search_tree_size) {
+    if (mmdb->metadata.binary_format_major_version != 2) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
     }
 
-    off_t size = s.st_size;
-    if (size < 0 || size > SSIZE_MAX) {
-        status = MMDB_OUT_OF_MEMORY_ERROR;
-        goto cleanup;
+    // The node count is 32 bits and a node at most 8 bytes, so this doesn't
+    // overflow.
+    uint64_t const tree_size =
+        (uint64_t)mmdb->metadata.node_count * mmdb->full_record_byte_size;
+    if (file_size < MMDB_DATA_SECTION_SEPARATOR ||
+        tree_size > file_size - MMDB_DATA_SECTION_SEPARATOR) {
+        return MMDB_INVALID_METADATA_ERROR;
     }
-
-    uint8_t *file_content =
-        (uint8_t *)mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
-    if (MAP_FAILED == file_content) {
-        if (ENOMEM == errno) {
-            status = MMDB_OUT_OF_MEMORY_ERROR;
-        } else {
-            status = MMDB_IO_ERROR;
-        }
-        goto cleanup;
+    uint64_t const data_section_size =
+        file_size - tree_size - MMDB_DATA_SECTION_SEPARATOR;
+    if (data_section_size > UINT32_MAX || data_section_size == 0) {
+        return MMDB_INVALID_METADATA_ERROR;
     }
+    mmdb->data_section_size = (uint32_t)data_section_size;
 
-    mmdb->file_size = (ssize_t)size;
-    mmdb->file_content = file_content;
-
-cleanup:;
-    int saved_errno = errno;
-    if (fd >= 0) {
-        close(fd);
+    // Although it is likely not possible to construct a database with valid
+    // valid metadata, as parsed above, and a data_section_size less than 3,
+    // we do this check as later we assume it is at least three when doing
+    // bound checks.
+    if (mmdb->data_section_size < 3) {
+        return MMDB_INVALID_DATA_ERROR;
     }
-    errno = saved_errno;
 
-    return status;
+    *search_tree_size = tree_size;
+    return MMDB_SUCCESS;
 }
 
-#endif // _WIN32
-
+/* Finds the metadata after the last metadata marker in the last
+ * METADATA_BLOCK_MAX_SIZE bytes of the file. The search goes backwards from
+ * the end of the file. The metadata is small, so usually only the last page
+ * or two of the file are read. */
 static const uint8_t *find_metadata(const uint8_t *file_content,
                                     ssize_t file_size,
                                     uint32_t *metadata_size) {
-    const ssize_t marker_len = sizeof(METADATA_MARKER) - 1;
-    ssize_t max_size = file_size > METADATA_BLOCK_MAX_SIZE
-                           ? METADATA_BLOCK_MAX_SIZE
-                           : file_size;
-    if (max_size < 0) {
+    const size_t marker_len = sizeof(METADATA_MARKER) - 1;
+    if (file_size < (ssize_t)marker_len) {
         return NULL;
     }
-
-    uint8_t const *search_area = (file_content + (file_size - max_size));
-    uint8_t const *start = search_area;
-    uint8_t const *tmp;
-    do {
-        tmp = mmdb_memmem(
-            search_area, (size_t)max_size, METADATA_MARKER, marker_len);
-
-        if (NULL != tmp) {
-            max_size -= tmp - search_area;
-            search_area = tmp;
-
-            /* Continue searching just after the marker we just read, in case
-             * there are multiple markers in the same file. This would be odd
-             * but is certainly not impossible. */
-            max_size -= marker_len;
-            search_area += marker_len;
+    size_t const max_size = file_size > METADATA_BLOCK_MAX_SIZE
+                                ? METADATA_BLOCK_MAX_SIZE
+                                : (size_t)file_size;
+    uint8_t const *const search_area =
+        file_content + ((size_t)file_size - max_size);
+    uint8_t const first = (uint8_t)METADATA_MARKER[0];
+
+    for (size_t i = max_size - marker_len + 1; i-- > 0;) {
+        if (search_area[i] != first ||
+            memcmp(search_area + i, METADATA_MARKER, marker_len) != 0) {
+            continue;
         }
-    } while (NULL != tmp);
 
-    if (search_area == start || max_size <= 0) {
-        return NULL;
+        // A marker at the very end of the file has no metadata after it.
+        size_t const size = max_size - i - marker_len;
+        if (0 == size) {
+            return NULL;
+        }
+        *metadata_size = (uint32_t)size;
+        return search_area + i + marker_len;
     }
 
-    *metadata_size = (uint32_t)max_size;
-
-    return search_area;
+    return NULL;
 }
 
 static int read_metadata(MMDB_s *mmdb) {
@@ -534,10 +945,11 @@ static int read_metadata(MMDB_s *mmdb) {
        metadata values. */
     MMDB_s metadata_db = make_fake_metadata_db(mmdb);
 
-    MMDB_entry_s metadata_start = {.mmdb = &metadata_db, .offset = 0};
+    metadata_values_s values = {.metadata_db = &metadata_db};
+    values.status = find_metadata_values(&values);
 
     int status = value_for_key_as_uint32(
-        &metadata_start, "node_count", &mmdb->metadata.node_count);
+        &values, METADATA_NODE_COUNT, &mmdb->metadata.node_count);
     if (MMDB_SUCCESS != status) {
         return status;
     }
@@ -547,7 +959,7 @@ static int read_metadata(MMDB_s *mmdb) {
     }
 
     status = value_for_key_as_uint16(
-        &metadata_start, "record_size", &mmdb->metadata.record_size);
+        &values, METADATA_RECORD_SIZE, &mmdb->metadata.record_size);
     if (MMDB_SUCCESS != status) {
         return status;
     }
@@ -564,7 +976,7 @@ static int read_metadata(MMDB_s *mmdb) {
     }
 
     status = value_for_key_as_uint16(
-        &metadata_start, "ip_version", &mmdb->metadata.ip_version);
+        &values, METADATA_IP_VERSION, &mmdb->metadata.ip_version);
     if (MMDB_SUCCESS != status) {
         return status;
     }
@@ -578,23 +990,34 @@ static int read_metadata(MMDB_s *mmdb) {
         return MMDB_INVALID_METADATA_ERROR;
     }
 
-    status = value_for_key_as_string(
-        &metadata_start, "database_type", &mmdb->metadata.database_type);
+    // The strings are checked and their sizes added up here, but they are
+    // only copied once all of the metadata has been read.
+    MMDB_entry_data_s database_type;
+    status = metadata_value(&values,
+                            METADATA_DATABASE_TYPE,
+                            MMDB_DATA_TYPE_UTF8_STRING,
+                            &database_type);
     if (MMDB_SUCCESS != status) {
         DEBUG_MSG("error finding database_type value in metadata");
         return status;
     }
+    size_t strings_size = database_type.data_size + 1;
 
-    status = populate_languages_metadata(mmdb, &metadata_db, &metadata_start);
+    MMDB_entry_data_s languages;
+    status = metadata_strings(&values,
+                              METADATA_LANGUAGES,
+                              MMDB_DATA_TYPE_ARRAY,
+                              &languages,
+                              &strings_size);
     if (MMDB_SUCCESS != status) {
         DEBUG_MSG("could not populate languages from metadata");
         return status;
     }
 
-    status =
-        value_for_key_as_uint16(&metadata_start,
-                                "binary_format_major_version",
-                                &mmdb->metadata.binary_format_major_version);
+    status = value_for_key_as_uint16(
+        &values,
+        METADATA_BINARY_FORMAT_MAJOR_VERSION,
+        &mmdb->metadata.binary_format_major_version);
     if (MMDB_SUCCESS != status) {
         return status;
     }
@@ -604,16 +1027,16 @@ static int read_metadata(MMDB_s *mmdb) {
         return MMDB_INVALID_METADATA_ERROR;
     }
 
-    status =
-        value_for_key_as_uint16(&metadata_start,
-                                "binary_format_minor_version",
-                                &mmdb->metadata.binary_format_minor_version);
+    status = value_for_key_as_uint16(
+        &values,
+        METADATA_BINARY_FORMAT_MINOR_VERSION,
+        &mmdb->metadata.binary_format_minor_version);
     if (MMDB_SUCCESS != status) {
         return status;
     }
 
     status = value_for_key_as_uint64(
-        &metadata_start, "build_epoch", &mmdb->metadata.build_epoch);
+        &values, METADATA_BUILD_EPOCH, &mmdb->metadata.build_epoch);
     if (MMDB_SUCCESS != status) {
         return status;
     }
@@ -622,12 +1045,27 @@ static int read_metadata(MMDB_s *mmdb) {
         return MMDB_INVALID_METADATA_ERROR;
     }
 
-    status = populate_description_metadata(mmdb, &metadata_db, &metadata_start);
+    MMDB_entry_data_s description;
+    status = metadata_strings(&values,
+                              METADATA_DESCRIPTION,
+                              MMDB_DATA_TYPE_MAP,
+                              &description,
+                              &strings_size);
     if (MMDB_SUCCESS != status) {
         DEBUG_MSG("could not populate description from metadata");
         return status;
     }
 
+    status = copy_metadata_strings(mmdb,
+                                   &metadata_db,
+                                   &database_type,
+                                   &languages,
+                                   &description,
+                                   strings_size);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
     mmdb->full_record_byte_size = mmdb->metadata.record_size * 2 / 8U;
 
     mmdb->depth = mmdb->metadata.ip_version == 4 ? 32 : 128;
@@ -643,255 +1081,389 @@ static MMDB_s make_fake_metadata_db(const MMDB_s *const mmdb) {
     return fake_metadata_db;
 }
 
-static int
-value_for_key_as_uint16(MMDB_entry_s *start, char *key, uint16_t *value) {
-    MMDB_entry_data_s entry_data;
-    const char *path[] = {key, NULL};
-    int status = MMDB_aget_value(start, &entry_data, path);
+/* Finds the values of all of the metadata keys in one pass over the metadata
+ * map. Only the keys are read. The pass stops once every key has been found,
+ * and the first value of a key that is in the map twice is used. This way the
+ * metadata is read as if each key were looked up on its own, and a database
+ * with bad metadata fails to open with the same error as before. */
+static int find_metadata_values(metadata_values_s *const values) {
+    const MMDB_s *const metadata_db = values->metadata_db;
+    value_header_s map;
+    int status = decode_header_follow(metadata_db, 0, &map);
     if (MMDB_SUCCESS != status) {
         return status;
     }
-    if (MMDB_DATA_TYPE_UINT16 != entry_data.type) {
-        DEBUG_MSGF("expect uint16 for %s but received %s",
-                   key,
-                   type_num_to_name(entry_data.type));
-        return MMDB_INVALID_METADATA_ERROR;
+    if (MMDB_DATA_TYPE_MAP != map.type) {
+        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
     }
-    *value = entry_data.uint16;
+
+    int missing = METADATA_KEY_COUNT;
+    uint32_t next = map.next;
+    for (uint32_t i = 0; i < map.size && missing > 0; i++) {
+        value_header_s key;
+        status = decode_header_follow(metadata_db, next, &key);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+        if (MMDB_DATA_TYPE_UTF8_STRING != key.type) {
+            return MMDB_INVALID_DATA_ERROR;
+        }
+
+        const char *const name =
+            (const char *)&metadata_db->data_section[key.payload];
+        for (int k = 0; k < METADATA_KEY_COUNT; k++) {
+            if (!values->found[k] && key.size == strlen(metadata_keys[k]) &&
+                !memcmp(name, metadata_keys[k], key.size)) {
+                values->found[k] = true;
+                values->offsets[k] = key.next;
+                missing--;
+                break;
+            }
+        }
+
+        status = skip_value(metadata_db, key.next, 0, &next);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
+
     return MMDB_SUCCESS;
 }
 
-static int
-value_for_key_as_uint32(MMDB_entry_s *start, char *key, uint32_t *value) {
-    MMDB_entry_data_s entry_data;
-    const char *path[] = {key, NULL};
-    int status = MMDB_aget_value(start, &entry_data, path);
+static int metadata_value(const metadata_values_s *const values,
+                          metadata_key_e key,
+                          uint32_t type,
+                          MMDB_entry_data_s *const entry_data) {
+    if (!values->found[key]) {
+        DEBUG_MSGF("could not find %s in metadata", metadata_keys[key]);
+        return MMDB_SUCCESS != values->status
+                   ? values->status
+                   : MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    }
+    int status = decode_one_follow(
+        values->metadata_db, values->offsets[key], entry_data);
     if (MMDB_SUCCESS != status) {
         return status;
     }
-    if (MMDB_DATA_TYPE_UINT32 != entry_data.type) {
-        DEBUG_MSGF("expect uint32 for %s but received %s",
-                   key,
-                   type_num_to_name(entry_data.type));
+    if (type != entry_data->type) {
+        DEBUG_MSGF("expect %s for %s but received %s",
+                   type_num_to_name(type),
+                   metadata_keys[key],
+                   type_num_to_name(entry_data->type));
         return MMDB_INVALID_METADATA_ERROR;
     }
-    *value = entry_data.uint32;
     return MMDB_SUCCESS;
 }
 
-static int
-value_for_key_as_uint64(MMDB_entry_s *start, char *key, uint64_t *value) {
+static int value_for_key_as_uint16(const metadata_values_s *const values,
+                                   metadata_key_e key,
+                                   uint16_t *value) {
     MMDB_entry_data_s entry_data;
-    const char *path[] = {key, NULL};
-    int status = MMDB_aget_value(start, &entry_data, path);
+    int status =
+        metadata_value(values, key, MMDB_DATA_TYPE_UINT16, &entry_data);
     if (MMDB_SUCCESS != status) {
         return status;
     }
-    if (MMDB_DATA_TYPE_UINT64 != entry_data.type) {
-        DEBUG_MSGF("expect uint64 for %s but received %s",
-                   key,
-                   type_num_to_name(entry_data.type));
-        return MMDB_INVALID_METADATA_ERROR;
-    }
-    *value = entry_data.uint64;
+    *value = entry_data.uint16;
     return MMDB_SUCCESS;
 }
 
-static int
-value_for_key_as_string(MMDB_entry_s *start, char *key, char const **value) {
+static int value_for_key_as_uint32(const metadata_values_s *const values,
+                                   metadata_key_e key,
+                                   uint32_t *value) {
     MMDB_entry_data_s entry_data;
-    const char *path[] = {key, NULL};
-    int status = MMDB_aget_value(start, &entry_data, path);
+    int status =
+        metadata_value(values, key, MMDB_DATA_TYPE_UINT32, &entry_data);
     if (MMDB_SUCCESS != status) {
         return status;
     }
-    if (MMDB_DATA_TYPE_UTF8_STRING != entry_data.type) {
-        DEBUG_MSGF("expect string for %s but received %s",
-                   key,
-                   type_num_to_name(entry_data.type));
-        return MMDB_INVALID_METADATA_ERROR;
-    }
-    *value = mmdb_strndup(entry_data.utf8_string, entry_data.data_size);
-    if (NULL == *value) {
-        return MMDB_OUT_OF_MEMORY_ERROR;
-    }
+    *value = entry_data.uint32;
     return MMDB_SUCCESS;
 }
 
-static int populate_languages_metadata(MMDB_s *mmdb,
-                                       MMDB_s *metadata_db,
-                                       MMDB_entry_s *metadata_start) {
+static int value_for_key_as_uint64(const metadata_values_s *const values,
+                                   metadata_key_e key,
+                                   uint64_t *value) {
     MMDB_entry_data_s entry_data;
-
-    const char *path[] = {"languages", NULL};
-    int status = MMDB_aget_value(metadata_start, &entry_data, path);
+    int status =
+        metadata_value(values, key, MMDB_DATA_TYPE_UINT64, &entry_data);
     if (MMDB_SUCCESS != status) {
         return status;
     }
-    if (MMDB_DATA_TYPE_ARRAY != entry_data.type) {
-        return MMDB_INVALID_METADATA_ERROR;
-    }
-
-    MMDB_entry_s array_start = {.mmdb = metadata_db,
-                                .offset = entry_data.offset};
+    *value = entry_data.uint64;
+    return MMDB_SUCCESS;
+}
 
-    MMDB_entry_data_list_s *member;
-    status = MMDB_get_entry_data_list(&array_start, &member);
+/* Checks that the array or map of the key holds only strings and adds the
+ * space needed to copy them to size. */
+static int metadata_strings(const metadata_values_s *const values,
+                            metadata_key_e key,
+                            uint32_t type,
+                            MMDB_entry_data_s *const entry_data,
+                            size_t *const size) {
+    int status = metadata_value(values, key, type, entry_data);
     if (MMDB_SUCCESS != status) {
         return status;
     }
 
-    MMDB_entry_data_list_s *first_member = member;
-
-    uint32_t array_size = member->entry_data.data_size;
-    MAYBE_CHECK_SIZE_OVERFLOW(
-        array_size, SIZE_MAX / sizeof(char *), MMDB_INVALID_METADATA_ERROR);
-
-    mmdb->metadata.languages.count = 0;
-    mmdb->metadata.languages.names = calloc(array_size, sizeof(char *));
-    if (NULL == mmdb->metadata.languages.names) {
-        MMDB_free_entry_data_list(first_member);
-        return MMDB_OUT_OF_MEMORY_ERROR;
+    const MMDB_s *const metadata_db = values->metadata_db;
+    uint32_t offset = entry_data->offset_to_next;
+    uint64_t count = entry_data->data_size;
+    // A map has a key and a value for each of its entries, and each of those
+    // needs at least a byte.
+    if (MMDB_DATA_TYPE_MAP == type) {
+        count *= 2;
+    }
+    if (offset > metadata_db->data_section_size ||
+        count > metadata_db->data_section_size - offset) {
+        DEBUG_MSG("metadata array or map is larger than the metadata");
+        return MMDB_INVALID_DATA_ERROR;
     }
 
-    for (uint32_t i = 0; i < array_size; i++) {
-        member = member->next;
-        if (MMDB_DATA_TYPE_UTF8_STRING != member->entry_data.type) {
-            MMDB_free_entry_data_list(first_member);
+    for (uint64_t i = 0; i < count; i++) {
+        MMDB_entry_data_s string;
+        status = next_metadata_string(metadata_db, &offset, &string);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+        // Pointers let many strings share the same bytes, so the total is
+        // only bounded by the number of strings.
+        if (string.data_size >= SIZE_MAX - *size) {
             return MMDB_INVALID_METADATA_ERROR;
         }
+        *size += string.data_size + 1;
+    }
+    return MMDB_SUCCESS;
+}
 
-        mmdb->metadata.languages.names[i] = mmdb_strndup(
-            member->entry_data.utf8_string, member->entry_data.data_size);
+/* Sets the database type, languages and descriptions in the metadata. They
+ * are copied to a single allocation, since the strings in the metadata section
+ * aren't NUL terminated. It starts with the array of language names, followed
+ * by the array of description pointers, the descriptions and then the
+ * strings. languages.names always points to it, even when there are no
+ * languages, and free_metadata() frees it. */
+static int copy_metadata_strings(MMDB_s *const mmdb,
+                                 const MMDB_s *const metadata_db,
+                                 const MMDB_entry_data_s *const database_type,
+                                 const MMDB_entry_data_s *const languages,
+                                 const MMDB_entry_data_s *const description,
+                                 size_t size) {
+    uint32_t const language_count = languages->data_size;
+    uint32_t const description_count = description->data_size;
+    MAYBE_CHECK_SIZE_OVERFLOW(language_count,
+                              SIZE_MAX / 4 / sizeof(char *),
+                              MMDB_INVALID_METADATA_ERROR);
+    MAYBE_CHECK_SIZE_OVERFLOW(description_count,
+                              SIZE_MAX / 4 / (sizeof(MMDB_description_s *) +
+                                              sizeof(MMDB_description_s)),
+                              MMDB_INVALID_METADATA_ERROR);
+    size_t const pointers_size =
+        language_count * sizeof(char *) +
+        description_count *
+            (sizeof(MMDB_description_s *) + sizeof(MMDB_description_s));
+    if (size > SIZE_MAX - pointers_size) {
+        return MMDB_INVALID_METADATA_ERROR;
+    }
 
-        if (NULL == mmdb->metadata.languages.names[i]) {
-            MMDB_free_entry_data_list(first_member);
-            return MMDB_OUT_OF_MEMORY_ERROR;
+    char *const block = malloc(pointers_size + size);
+    if (NULL == block) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    MMDB_metadata_s *const metadata = &mmdb->metadata;
+    metadata->languages.names = (const char **)block;
+    metadata->description.descriptions =
+        (MMDB_description_s **)(metadata->languages.names + language_count);
+    MMDB_description_s *const descriptions =
+        (MMDB_description_s *)(metadata->description.descriptions +
+                               description_count);
+    char *strings = block + pointers_size;
+
+    metadata->database_type = copy_metadata_string(&strings, database_type);
+
+    // The strings were all checked when their sizes were added up, so these
+    // calls only find them again.
+    MMDB_entry_data_s string;
+    uint32_t offset = languages->offset_to_next;
+    for (uint32_t i = 0; i < language_count; i++) {
+        int status = next_metadata_string(metadata_db, &offset, &string);
+        if (MMDB_SUCCESS != status) {
+            return status;
         }
-        // We assign this as we go so that if we fail a calloc and need to
-        // free it, the count is right.
-        mmdb->metadata.languages.count = i + 1;
+        metadata->languages.names[i] = copy_metadata_string(&strings, &string);
+        metadata->languages.count = i + 1;
     }
 
-    MMDB_free_entry_data_list(first_member);
+    offset = description->offset_to_next;
+    for (uint32_t i = 0; i < description_count; i++) {
+        MMDB_entry_data_s language;
+        int status = next_metadata_string(metadata_db, &offset, &language);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+        status = next_metadata_string(metadata_db, &offset, &string);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+        descriptions[i].language = copy_metadata_string(&strings, &language);
+        descriptions[i].description = copy_metadata_string(&strings, &string);
+        metadata->description.descriptions[i] = &descriptions[i];
+        metadata->description.count = i + 1;
+    }
 
     return MMDB_SUCCESS;
 }
 
-static int populate_description_metadata(MMDB_s *mmdb,
-                                         MMDB_s *metadata_db,
-                                         MMDB_entry_s *metadata_start) {
-    MMDB_entry_data_s entry_data;
-
-    const char *path[] = {"description", NULL};
-    int status = MMDB_aget_value(metadata_start, &entry_data, path);
+/* Decodes the string at offset and moves offset to the value after it. */
+static int next_metadata_string(const MMDB_s *const metadata_db,
+                                uint32_t *const offset,
+                                MMDB_entry_data_s *const entry_data) {
+    int status = decode_one_follow(metadata_db, *offset, entry_data);
     if (MMDB_SUCCESS != status) {
         return status;
     }
-
-    if (MMDB_DATA_TYPE_MAP != entry_data.type) {
-        DEBUG_MSGF("Unexpected entry_data type: %d", entry_data.type);
+    if (MMDB_DATA_TYPE_UTF8_STRING != entry_data->type) {
+        DEBUG_MSGF("expect string in metadata but received %s",
+                   type_num_to_name(entry_data->type));
         return MMDB_INVALID_METADATA_ERROR;
     }
+    *offset = entry_data->offset_to_next;
+    return MMDB_SUCCESS;
+}
 
-    MMDB_entry_s map_start = {.mmdb = metadata_db, .offset = entry_data.offset};
-
-    MMDB_entry_data_list_s *member;
-    status = MMDB_get_entry_data_list(&map_start, &member);
-    if (MMDB_SUCCESS != status) {
-        DEBUG_MSGF(
-            "MMDB_get_entry_data_list failed while populating description."
-            " status = %d (%s)",
-            status,
-            MMDB_strerror(status));
-        return status;
+static const char *copy_metadata_string(char **const strings,
+                                        const MMDB_entry_data_s *const string) {
+    char *const copy = *strings;
+    if (string->data_size > 0) {
+        memcpy(copy, string->utf8_string, string->data_size);
     }
+    copy[string->data_size] = '\0';
+    *strings += string->data_size + 1;
+    return copy;
+}
 
-    MMDB_entry_data_list_s *first_member = member;
+MMDB_lookup_result_s MMDB_lookup_string(const MMDB_s *const mmdb,
+                                        const char *const ipstr,
+                                        int *const gai_error,
+                                        int *const mmdb_error) {
+    MMDB_lookup_result_s result = {.found_entry = false,
+                                   .netmask = 0,
+                                   .entry = {.mmdb = mmdb, .offset = 0}};
 
-    uint32_t map_size = member->entry_data.data_size;
-    mmdb->metadata.description.count = 0;
-    if (0 == map_size) {
-        mmdb->metadata.description.descriptions = NULL;
-        goto cleanup;
-    }
-    MAYBE_CHECK_SIZE_OVERFLOW(map_size,
-                              SIZE_MAX / sizeof(MMDB_description_s *),
-                              MMDB_INVALID_METADATA_ERROR);
+    struct addrinfo *addresses = NULL;
+    *gai_error = resolve_any_address(ipstr, &addresses);
 
-    mmdb->metadata.description.descriptions =
-        calloc(map_size, sizeof(MMDB_description_s *));
-    if (NULL == mmdb->metadata.description.descriptions) {
-        status = MMDB_OUT_OF_MEMORY_ERROR;
-        goto cleanup;
+    if (!*gai_error) {
+        result = MMDB_lookup_sockaddr(mmdb, addresses->ai_addr, mmdb_error);
+    } else {
+        /* No MMDB error occurred; the GAI failure is reported via
+         * *gai_error. Set *mmdb_error to a defined value so callers
+         * don't read indeterminate memory. */
+        *mmdb_error = MMDB_SUCCESS;
     }
 
-    for (uint32_t i = 0; i < map_size; i++) {
-        mmdb->metadata.description.descriptions[i] =
-            calloc(1, sizeof(MMDB_description_s));
-        if (NULL == mmdb->metadata.description.descriptions[i]) {
-            status = MMDB_OUT_OF_MEMORY_ERROR;
-            goto cleanup;
-        }
+    if (NULL != addresses) {
+        freeaddrinfo(addresses);
+    }
 
-        mmdb->metadata.description.count = i + 1;
-        mmdb->metadata.description.descriptions[i]->language = NULL;
-        mmdb->metadata.description.descriptions[i]->description = NULL;
+    return result;
+}
 
-        member = member->next;
+static int resolve_any_address(const char *ipstr, struct addrinfo **addresses) {
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_flags = AI_NUMERICHOST,
+        // We set ai_socktype so that we only get one result back
+        .ai_socktype = SOCK_STREAM};
 
-        if (MMDB_DATA_TYPE_UTF8_STRING != member->entry_data.type) {
-            status = MMDB_INVALID_METADATA_ERROR;
-            goto cleanup;
-        }
+    int gai_status = getaddrinfo(ipstr, NULL, &hints, addresses);
+    if (gai_status) {
+        return gai_status;
+    }
 
-        mmdb->metadata.description.descriptions[i]->language = mmdb_strndup(
-            member->entry_data.utf8_string, member->entry_data.data_size);
+    return 0;
+}
 
-        if (NULL == mmdb->metadata.description.descriptions[i]->language) {
-            status = MMDB_OUT_OF_MEMORY_ERROR;
-            goto cleanup;
-        }
+MMDB_lookup_result_s MMDB_lookup_sockaddr(const MMDB_s *const mmdb,
+                                          const struct sockaddr *const sockaddr,
+                                          int *const mmdb_error) {
+    MMDB_lookup_result_s result = {.found_entry = false,
+                                   .netmask = 0,
+                                   .entry = {.mmdb = mmdb, .offset = 0}};
 
-        member = member->next;
+    uint8_t mapped_address[16];
+    uint8_t const *address;
+    *mmdb_error =
+        address_for_sockaddr(mmdb, sockaddr, mapped_address, &address);
+    if (MMDB_SUCCESS != *mmdb_error) {
+        return result;
+    }
 
-        if (MMDB_DATA_TYPE_UTF8_STRING != member->entry_data.type) {
-            status = MMDB_INVALID_METADATA_ERROR;
-            goto cleanup;
-        }
+    *mmdb_error = find_address_in_search_tree(
+        mmdb, address, sockaddr->sa_family, &result);
 
-        mmdb->metadata.description.descriptions[i]->description = mmdb_strndup(
-            member->entry_data.utf8_string, member->entry_data.data_size);
+    return result;
+}
 
-        if (NULL == mmdb->metadata.description.descriptions[i]->description) {
-            status = MMDB_OUT_OF_MEMORY_ERROR;
-            goto cleanup;
+void MMDB_multi_lookup_string(const MMDB_multi_s *const multi,
+                              const char *const ipstr,
+                              int *const gai_error,
+                              MMDB_lookup_result_s *const results,
+                              int *const mmdb_errors) {
+    struct addrinfo *addresses = NULL;
+    *gai_error = resolve_any_address(ipstr, &addresses);
+
+    if (!*gai_error) {
+        MMDB_multi_lookup_sockaddr(
+            multi, addresses->ai_addr, results, mmdb_errors);
+    } else {
+        // As with MMDB_lookup_string(), the GAI failure is reported via
+        // *gai_error and the results are left as not found.
+        for (size_t i = 0; i < multi->count; i++) {
+            results[i] = (MMDB_lookup_result_s){
+                .found_entry = false,
+                .netmask = 0,
+                .entry = {.mmdb = &multi->databases[i], .offset = 0}};
+            mmdb_errors[i] = MMDB_SUCCESS;
         }
     }
 
-cleanup:
-    MMDB_free_entry_data_list(first_member);
+    if (NULL != addresses) {
+        freeaddrinfo(addresses);
+    }
+}
 
-    return status;
+void MMDB_multi_lookup_sockaddr(const MMDB_multi_s *const multi,
+                                const struct sockaddr *const sockaddr,
+                                MMDB_lookup_result_s *const results,
+                                int *const mmdb_errors) {
+    for (size_t first = 0; first < multi->count; first += MULTI_LOOKUP_BATCH) {
+        size_t count = multi->count - first;
+        if (count > MULTI_LOOKUP_BATCH) {
+            count = MULTI_LOOKUP_BATCH;
+        }
+        multi_lookup_batch(
+            multi, first, count, sockaddr, results, mmdb_errors);
+    }
 }
 
-MMDB_lookup_result_s MMDB_lookup_string(const MMDB_s *const mmdb,
-                                        const char *const ipstr,
-                                        int *const gai_error,
-                                        int *const mmdb_error) {
-    MMDB_lookup_result_s result = {.found_entry = false,
-                                   .netmask = 0,
-                                   .entry = {.mmdb = mmdb, .offset = 0}};
+MMDB_lookup_result_s
+MMDB_overlay_lookup_string(const MMDB_multi_s *const multi,
+                           const char *const ipstr,
+                           int *const gai_error,
+                           int *const mmdb_error) {
+    MMDB_lookup_result_s result = {
+        .found_entry = false,
+        .netmask = 0,
+        .entry = {.mmdb = multi->count > 0 ? &multi->databases[0] : NULL,
+                  .offset = 0}};
 
     struct addrinfo *addresses = NULL;
     *gai_error = resolve_any_address(ipstr, &addresses);
 
     if (!*gai_error) {
-        result = MMDB_lookup_sockaddr(mmdb, addresses->ai_addr, mmdb_error);
+        result =
+            MMDB_overlay_lookup_sockaddr(multi, addresses->ai_addr, mmdb_error);
     } else {
-        /* No MMDB error occurred; the GAI failure is reported via
-         * *gai_error. Set *mmdb_error to a defined value so callers
-         * don't read indeterminate memory. */
         *mmdb_error = MMDB_SUCCESS;
     }
 
@@ -902,102 +1474,290 @@ MMDB_lookup_result_s MMDB_lookup_string(const MMDB_s *const mmdb,
     return result;
 }
 
-static int resolve_any_address(const char *ipstr, struct addrinfo **addresses) {
-    struct addrinfo hints = {
-        .ai_family = AF_UNSPEC,
-        .ai_flags = AI_NUMERICHOST,
-        // We set ai_socktype so that we only get one result back
-        .ai_socktype = SOCK_STREAM};
+/* Looks the address up in each layer in turn and stops at the first with
+ * data for it, so the layers below a layer that has the address are never
+ * walked. The netmask is the longest of the netmasks of the layers looked at,
+ * counted as in an IPv6 tree while they are compared, since the answer only
+ * holds where none of the layers above it has data. Layers that can't hold
+ * the address, such as IPv4 layers for an IPv6 address, are skipped. */
+MMDB_lookup_result_s
+MMDB_overlay_lookup_sockaddr(const MMDB_multi_s *const multi,
+                             const struct sockaddr *const sockaddr,
+                             int *const mmdb_error) {
+    MMDB_lookup_result_s result = {
+        .found_entry = false,
+        .netmask = 0,
+        .entry = {.mmdb = multi->count > 0 ? &multi->databases[0] : NULL,
+                  .offset = 0}};
+    *mmdb_error = MMDB_SUCCESS;
+
+    bool looked_up = false;
+    uint16_t netmask = 0;
+    for (size_t i = 0; i < multi->count; i++) {
+        const MMDB_s *const mmdb = &multi->databases[i];
+        int status;
+        MMDB_lookup_result_s layer =
+            MMDB_lookup_sockaddr(mmdb, sockaddr, &status);
+        if (MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR == status) {
+            if (!looked_up) {
+                *mmdb_error = status;
+            }
+            continue;
+        }
+        *mmdb_error = status;
+        if (MMDB_SUCCESS != status) {
+            return layer;
+        }
 
-    int gai_status = getaddrinfo(ipstr, NULL, &hints, addresses);
-    if (gai_status) {
-        return gai_status;
+        uint16_t const layer_netmask =
+            mmdb->metadata.ip_version == 4 ? (uint16_t)(layer.netmask + 96)
+                                           : layer.netmask;
+        if (layer_netmask > netmask) {
+            netmask = layer_netmask;
+        }
+        looked_up = true;
+        result = layer;
+        if (layer.found_entry) {
+            break;
+        }
     }
 
-    return 0;
+    if (looked_up) {
+        result.netmask = result.entry.mmdb->metadata.ip_version == 4
+                             ? (uint16_t)(netmask - 96)
+                             : netmask;
+    }
+    return result;
 }
 
-MMDB_lookup_result_s MMDB_lookup_sockaddr(const MMDB_s *const mmdb,
-                                          const struct sockaddr *const sockaddr,
-                                          int *const mmdb_error) {
-    MMDB_lookup_result_s result = {.found_entry = false,
-                                   .netmask = 0,
-                                   .entry = {.mmdb = mmdb, .offset = 0}};
+/* Looks the address up in count databases starting at first. Rather than
+ * walking each tree in turn, this takes one step down each of the trees in
+ * each round and prefetches the node that the next round reads, so the cache
+ * misses of the different trees overlap. */
+static void multi_lookup_batch(const MMDB_multi_s *const multi,
+                               size_t first,
+                               size_t count,
+                               const struct sockaddr *const sockaddr,
+                               MMDB_lookup_result_s *const results,
+                               int *const mmdb_errors) {
+    multi_walk_s walks[MULTI_LOOKUP_BATCH];
+    size_t active[MULTI_LOOKUP_BATCH];
+    size_t active_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const MMDB_s *const mmdb = &multi->databases[first + i];
+        multi_walk_s *const walk = &walks[i];
+        results[first + i] = (MMDB_lookup_result_s){
+            .found_entry = false,
+            .netmask = 0,
+            .entry = {.mmdb = mmdb, .offset = 0}};
+
+        int status = address_for_sockaddr(
+            mmdb, sockaddr, walk->mapped_address, &walk->address);
+        if (MMDB_SUCCESS == status) {
+            status = start_search(mmdb,
+                                  sockaddr->sa_family,
+                                  &walk->record_info,
+                                  &walk->value,
+                                  &walk->current_bit);
+        }
+        mmdb_errors[first + i] = status;
+        if (MMDB_SUCCESS == status) {
+            PREFETCH(&mmdb->file_content[walk->value *
+                                         walk->record_info.record_length]);
+            active[active_count++] = i;
+        }
+    }
+
+    while (active_count > 0) {
+        for (size_t j = 0; j < active_count;) {
+            size_t const i = active[j];
+            const MMDB_s *const mmdb = &multi->databases[first + i];
+            multi_walk_s *const walk = &walks[i];
+
+            // A depth of one more than the current bit takes a single step.
+            int status = MMDB_SUCCESS;
+            if (walk->current_bit < mmdb->depth &&
+                walk->value < mmdb->metadata.node_count) {
+                status = walk_search_tree(mmdb,
+                                          &walk->record_info,
+                                          walk->address,
+                                          (uint16_t)(walk->current_bit + 1),
+                                          &walk->value,
+                                          &walk->current_bit);
+                if (MMDB_SUCCESS == status &&
+                    walk->current_bit < mmdb->depth &&
+                    walk->value < mmdb->metadata.node_count) {
+                    PREFETCH(
+                        &mmdb->file_content[walk->value *
+                                            walk->record_info.record_length]);
+                    j++;
+                    continue;
+                }
+            }
+
+            if (MMDB_SUCCESS == status) {
+                status = search_result(
+                    mmdb, walk->value, walk->current_bit, &results[first + i]);
+            }
+            mmdb_errors[first + i] = status;
+            active[j] = active[--active_count];
+        }
+    }
+}
+
+int MMDB_lookup_network_subtree(const MMDB_s *const mmdb,
+                                const struct sockaddr *const sockaddr,
+                                uint16_t netmask,
+                                MMDB_network_subtree_s *const subtree) {
+    record_info_s record_info = record_info_for_database(mmdb);
+    if (record_info.right_record_offset == 0) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    }
 
     uint8_t mapped_address[16];
     uint8_t const *address;
+    int status =
+        address_for_sockaddr(mmdb, sockaddr, mapped_address, &address);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (netmask > (sockaddr->sa_family == AF_INET ? 32 : 128)) {
+        return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
+    }
+
+    // This follows the same path as find_address_in_search_tree() but stops
+    // at the netmask, or at the record of a larger network which contains
+    // the whole prefix.
+    uint64_t value = 0;
+    uint16_t current_bit = 0;
+    uint16_t depth = netmask;
+    if (mmdb->metadata.ip_version == 6 && sockaddr->sa_family == AF_INET) {
+        MMDB_ipv4_start_node_s start_node;
+        status = ipv4_start_node(mmdb, &start_node);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+        value = start_node.node_value;
+        current_bit = start_node.netmask;
+        depth += 96;
+    }
+
+    status = walk_search_tree(
+        mmdb, &record_info, address, depth, &value, &current_bit);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    if (value >= mmdb->metadata.node_count &&
+        record_type(mmdb, value) == MMDB_RECORD_TYPE_INVALID) {
+        return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+    }
+
+    subtree->mmdb = mmdb;
+    subtree->depth = current_bit;
+    subtree->record = (uint32_t)value;
+    memset(subtree->address, 0, sizeof(subtree->address));
+    memcpy(subtree->address, address, (size_t)(current_bit + 7) / 8);
+    if (current_bit % 8) {
+        subtree->address[current_bit / 8] &=
+            (uint8_t)(0xFF << (8 - current_bit % 8));
+    }
+
+    return MMDB_SUCCESS;
+}
+
+/* Sets address to the bytes of the sockaddr's address. IPv4 addresses are
+ * mapped into ::/96 in an IPv6 database, using the caller's mapped_address,
+ * which must hold 16 bytes. */
+static int address_for_sockaddr(const MMDB_s *const mmdb,
+                                const struct sockaddr *const sockaddr,
+                                uint8_t *const mapped_address,
+                                uint8_t const **const address) {
     // Reject families other than AF_INET/AF_INET6 before casting to
     // sockaddr_in/sockaddr_in6, which would otherwise read past the
     // truncated struct sockaddr the caller passed in.
     if (mmdb->metadata.ip_version == 4) {
         if (sockaddr->sa_family == AF_INET6) {
-            *mmdb_error = MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR;
-            return result;
+            return MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR;
         }
         if (sockaddr->sa_family != AF_INET) {
-            *mmdb_error = MMDB_INVALID_NETWORK_ADDRESS_ERROR;
-            return result;
+            return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
         }
-        address = (uint8_t const *)&((struct sockaddr_in const *)sockaddr)
-                      ->sin_addr.s_addr;
+        *address = (uint8_t const *)&((struct sockaddr_in const *)sockaddr)
+                       ->sin_addr.s_addr;
     } else {
         if (sockaddr->sa_family == AF_INET6) {
-            address = (uint8_t const *)&((struct sockaddr_in6 const *)sockaddr)
-                          ->sin6_addr.s6_addr;
+            *address = (uint8_t const *)&((struct sockaddr_in6 const *)sockaddr)
+                           ->sin6_addr.s6_addr;
         } else if (sockaddr->sa_family == AF_INET) {
-            address = mapped_address;
+            *address = mapped_address;
             memset(mapped_address, 0, 12);
             memcpy(mapped_address + 12,
                    &((struct sockaddr_in const *)sockaddr)->sin_addr.s_addr,
                    4);
         } else {
-            *mmdb_error = MMDB_INVALID_NETWORK_ADDRESS_ERROR;
-            return result;
+            return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
         }
     }
 
-    *mmdb_error = find_address_in_search_tree(
-        mmdb, address, sockaddr->sa_family, &result);
-
-    return result;
+    return MMDB_SUCCESS;
 }
 
 static int find_address_in_search_tree(const MMDB_s *const mmdb,
                                        uint8_t const *address,
                                        sa_family_t address_family,
                                        MMDB_lookup_result_s *result) {
-    record_info_s record_info = record_info_for_database(mmdb);
-    if (record_info.right_record_offset == 0) {
-        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    record_info_s record_info;
+    uint64_t value;
+    uint16_t current_bit;
+    int status =
+        start_search(mmdb, address_family, &record_info, &value, &current_bit);
+    if (status != MMDB_SUCCESS) {
+        return status;
     }
 
-    uint64_t value = 0;
-    uint16_t current_bit = 0;
-    if (mmdb->metadata.ip_version == 6 && address_family == AF_INET) {
-        value = mmdb->ipv4_start_node.node_value;
-        current_bit = mmdb->ipv4_start_node.netmask;
+    status = walk_search_tree(
+        mmdb, &record_info, address, mmdb->depth, &value, &current_bit);
+    if (status != MMDB_SUCCESS) {
+        return status;
     }
 
-    uint32_t node_count = mmdb->metadata.node_count;
-    const uint8_t *search_tree = mmdb->file_content;
-    const uint8_t *record_pointer;
-    for (; current_bit < mmdb->depth && value < node_count; current_bit++) {
-        uint8_t bit =
-            1U & (address[current_bit >> 3] >> (7 - (current_bit % 8)));
+    return search_result(mmdb, value, current_bit, result);
+}
 
-        // Note that value*record_info.record_length can be larger than 2**32
-        record_pointer = &search_tree[value * record_info.record_length];
-        if (record_pointer + record_info.record_length > mmdb->data_section) {
-            return MMDB_CORRUPT_SEARCH_TREE_ERROR;
-        }
-        if (bit) {
-            record_pointer += record_info.right_record_offset;
-            value = record_info.right_record_getter(record_pointer);
-        } else {
-            value = record_info.left_record_getter(record_pointer);
+/* Sets the node and bit a lookup of an address of the family starts at,
+ * which for IPv4 addresses in an IPv6 database is the IPv4 start node. */
+static int start_search(const MMDB_s *const mmdb,
+                        sa_family_t address_family,
+                        record_info_s *const record_info,
+                        uint64_t *const value,
+                        uint16_t *const current_bit) {
+    *record_info = record_info_for_database(mmdb);
+    if (record_info->right_record_offset == 0) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    }
+
+    *value = 0;
+    *current_bit = 0;
+    if (mmdb->metadata.ip_version == 6 && address_family == AF_INET) {
+        MMDB_ipv4_start_node_s start_node;
+        int const status = ipv4_start_node(mmdb, &start_node);
+        if (status != MMDB_SUCCESS) {
+            return status;
         }
+        *value = start_node.node_value;
+        *current_bit = start_node.netmask;
     }
+    return MMDB_SUCCESS;
+}
 
+/* Fills in the result of a lookup that stopped at the record in value after
+ * current_bit bits of the address. */
+static int search_result(const MMDB_s *const mmdb,
+                         uint64_t value,
+                         uint16_t current_bit,
+                         MMDB_lookup_result_s *const result) {
     result->netmask = current_bit;
 
     uint8_t type = record_type(mmdb, value);
@@ -1016,6 +1776,65 @@ static int find_address_in_search_tree(const MMDB_s *const mmdb,
     return MMDB_SUCCESS;
 }
 
+/* Follows the bits of the address from the node in value and the bit in
+ * current_bit until it reaches depth or a record that isn't a node, and sets
+ * both to where it stopped.
+ *
+ * Leaving out the bounds check is safe from any node, not only those that
+ * MMDB_verify() reached: only nodes below node_count are read, and
+ * check_data_section() made sure that all of them are before the data
+ * section. */
+static ALWAYS_INLINE int
+walk_search_tree(const MMDB_s *const mmdb,
+                 const record_info_s *const record_info,
+                 uint8_t const *address,
+                 uint16_t depth,
+                 uint64_t *const value,
+                 uint16_t *const current_bit) {
+    if (mmdb->flags & MMDB_MODE_VERIFY) {
+        return walk_search_tree_bounds(
+            mmdb, record_info, address, depth, false, value, current_bit);
+    }
+    return walk_search_tree_bounds(
+        mmdb, record_info, address, depth, true, value, current_bit);
+}
+
+static ALWAYS_INLINE int
+walk_search_tree_bounds(const MMDB_s *const mmdb,
+                        const record_info_s *const record_info,
+                        uint8_t const *address,
+                        uint16_t depth,
+                        bool check_bounds,
+                        uint64_t *const value,
+                        uint16_t *const current_bit) {
+    uint32_t node_count = mmdb->metadata.node_count;
+    const uint8_t *search_tree = mmdb->file_content;
+    const uint8_t *record_pointer;
+    uint64_t node = *value;
+    uint16_t bit_number = *current_bit;
+    for (; bit_number < depth && node < node_count; bit_number++) {
+        uint8_t bit =
+            1U & (address[bit_number >> 3] >> (7 - (bit_number % 8)));
+
+        // Note that node*record_info->record_length can be larger than 2**32
+        record_pointer = &search_tree[node * record_info->record_length];
+        if (check_bounds && record_pointer + record_info->record_length >
+                                mmdb->data_section) {
+            return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+        }
+        if (bit) {
+            record_pointer += record_info->right_record_offset;
+            node = record_info->right_record_getter(record_pointer);
+        } else {
+            node = record_info->left_record_getter(record_pointer);
+        }
+    }
+
+    *value = node;
+    *current_bit = bit_number;
+    return MMDB_SUCCESS;
+}
+
 static record_info_s record_info_for_database(const MMDB_s *const mmdb) {
     record_info_s record_info = {.record_length = mmdb->full_record_byte_size,
                                  .right_record_offset = 0};
@@ -1040,14 +1859,49 @@ static record_info_s record_info_for_database(const MMDB_s *const mmdb) {
     return record_info;
 }
 
-static int find_ipv4_start_node(MMDB_s *const mmdb) {
-    /* In a pathological case of a database with a single node search tree,
-     * this check will be true even after we've found the IPv4 start node, but
-     * that doesn't seem worth trying to fix. */
-    if (mmdb->ipv4_start_node.node_value != 0) {
+/* Returns the node at ::/96 of an IPv6 database, or the node the path to it
+ * ends at if the IPv4 subtree is part of a larger network.
+ *
+ * With MMDB_MODE_LAZY, MMDB_open() leaves this to the first lookup that needs
+ * it. Lookups only have a const MMDB_s, which may be shared between threads,
+ * so the netmask also holds the state of the start node. The first thread to
+ * find the node claims the netmask, writes the node value, and then publishes
+ * the netmask with a release store. Threads that get here before then walk
+ * the 96 nodes themselves rather than waiting. */
+static int ipv4_start_node(const MMDB_s *const mmdb,
+                           MMDB_ipv4_start_node_s *const start_node) {
+    uint16_t const netmask = load_netmask(&mmdb->ipv4_start_node.netmask);
+    if (netmask < IPV4_START_NODE_BUSY) {
+        start_node->netmask = netmask;
+        start_node->node_value = mmdb->ipv4_start_node.node_value;
         return MMDB_SUCCESS;
     }
 
+    int const status = find_ipv4_start_node(mmdb, start_node);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+#if defined(__clang__)
+    // The MMDB_s is allocated by the caller and written by MMDB_open(), so it
+    // is never actually const.
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wcast-qual"
+#endif
+    MMDB_ipv4_start_node_s *const shared =
+        (MMDB_ipv4_start_node_s *)&mmdb->ipv4_start_node;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+    if (claim_netmask(&shared->netmask)) {
+        shared->node_value = start_node->node_value;
+        publish_netmask(&shared->netmask, start_node->netmask);
+    }
+    return MMDB_SUCCESS;
+}
+
+static int find_ipv4_start_node(const MMDB_s *const mmdb,
+                                MMDB_ipv4_start_node_s *const start_node) {
     record_info_s record_info = record_info_for_database(mmdb);
     if (record_info.right_record_offset == 0) {
         return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
@@ -1068,8 +1922,8 @@ static int find_ipv4_start_node(MMDB_s *const mmdb) {
         node_value = record_info.left_record_getter(record_pointer);
     }
 
-    mmdb->ipv4_start_node.node_value = node_value;
-    mmdb->ipv4_start_node.netmask = netmask;
+    start_node->node_value = node_value;
+    start_node->netmask = netmask;
 
     return MMDB_SUCCESS;
 }
@@ -1163,674 +2017,2772 @@ int MMDB_read_node(const MMDB_s *const mmdb,
     return MMDB_SUCCESS;
 }
 
+int MMDB_get_ipv4_start_node(const MMDB_s *const mmdb,
+                             MMDB_ipv4_start_node_s *const start_node) {
+    return ipv4_start_node(mmdb, start_node);
+}
+
 static uint32_t data_section_offset_for_record(const MMDB_s *const mmdb,
                                                uint64_t record) {
     return (uint32_t)record - mmdb->metadata.node_count -
            MMDB_DATA_SECTION_SEPARATOR;
 }
 
-int MMDB_get_value(MMDB_entry_s *const start,
-                   MMDB_entry_data_s *const entry_data,
-                   ...) {
-    va_list path;
-    va_start(path, entry_data);
-    int status = MMDB_vget_value(start, entry_data, path);
-    va_end(path);
-    return status;
-}
+int MMDB_network_iterator_init(const MMDB_s *const mmdb,
+                               uint32_t flags,
+                               MMDB_network_iterator_s *const iterator) {
+    MMDB_network_subtree_s root = {.mmdb = mmdb, .depth = 0, .record = 0};
+    memset(root.address, 0, sizeof(root.address));
 
-int MMDB_vget_value(MMDB_entry_s *const start,
-                    MMDB_entry_data_s *const entry_data,
-                    va_list va_path) {
-    size_t length = path_length(va_path);
-    const char *path_elem;
-    int i = 0;
+    // The root is the only place where a record value of 0 refers to a node
+    // rather than being invalid.
+    return MMDB_network_iterator_init_subtree(&root, flags, iterator);
+}
 
-    if (length == SIZE_MAX) {
-        return MMDB_INVALID_METADATA_ERROR;
+int MMDB_network_iterator_init_subtree(
+    const MMDB_network_subtree_s *const subtree,
+    uint32_t flags,
+    MMDB_network_iterator_s *const iterator) {
+    const MMDB_s *const mmdb = subtree->mmdb;
+    record_info_s record_info = record_info_for_database(mmdb);
+    if (record_info.right_record_offset == 0) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
     }
-
-    const char **path = calloc(length + 1, sizeof(const char *));
-    if (NULL == path) {
-        return MMDB_OUT_OF_MEMORY_ERROR;
+    if (subtree->depth > mmdb->depth) {
+        return MMDB_INVALID_NETWORK_ADDRESS_ERROR;
     }
-
-    while (NULL != (path_elem = va_arg(va_path, char *))) {
-        path[i] = path_elem;
-        i++;
+    if (mmdb->metadata.ip_version == 6) {
+        MMDB_ipv4_start_node_s start_node;
+        int const status = ipv4_start_node(mmdb, &start_node);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
     }
-    path[i] = NULL;
 
-    int status = MMDB_aget_value(start, entry_data, path);
+    iterator->mmdb = mmdb;
+    iterator->flags = flags;
+    iterator->stack_size = 0;
+    memcpy(iterator->address, subtree->address, sizeof(iterator->address));
 
-    free(path);
+    uint8_t bit = 0;
+    if (subtree->depth > 0) {
+        uint16_t bit_index = subtree->depth - 1;
+        bit = 1U & (subtree->address[bit_index >> 3] >> (7 - (bit_index % 8)));
+    }
+    push_network_record(iterator, subtree->record, subtree->depth, bit);
 
-    return status;
+    return MMDB_SUCCESS;
 }
 
-static size_t path_length(va_list va_path) {
-    size_t i = 0;
-    va_list path_copy;
-    va_copy(path_copy, va_path);
-
-    while (NULL != va_arg(path_copy, char *)) {
-        i++;
+bool MMDB_network_iterator_next(MMDB_network_iterator_s *const iterator,
+                                MMDB_network_s *const network,
+                                int *const mmdb_error) {
+    uint32_t record;
+    uint16_t depth;
+    if (!next_network_record(iterator, -1, &record, &depth, mmdb_error)) {
+        return false;
     }
 
-    va_end(path_copy);
-
-    return i;
+    set_network(iterator->mmdb, iterator->address, depth, network);
+    if (record_type(iterator->mmdb, record) == MMDB_RECORD_TYPE_DATA) {
+        network->found_entry = true;
+        network->entry.offset =
+            data_section_offset_for_record(iterator->mmdb, record);
+    } else {
+        network->found_entry = false;
+        network->entry.offset = 0;
+    }
+    return true;
 }
 
-int MMDB_aget_value(MMDB_entry_s *const start,
-                    MMDB_entry_data_s *const entry_data,
-                    const char *const *const path) {
-    const MMDB_s *const mmdb = start->mmdb;
-    uint32_t offset = start->offset;
+int MMDB_get_network_subtrees(const MMDB_s *const mmdb,
+                              uint16_t netmask,
+                              uint32_t flags,
+                              MMDB_network_subtree_s **const subtrees,
+                              size_t *const count) {
+    *subtrees = NULL;
+    *count = 0;
 
-    memset(entry_data, 0, sizeof(MMDB_entry_data_s));
-    DEBUG_NL;
-    DEBUG_MSG("looking up value by path");
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init(mmdb, flags, &iterator);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
 
-    CHECKED_DECODE_ONE_FOLLOW(mmdb, offset, entry_data);
+    size_t capacity = 0;
+    MMDB_network_subtree_s *list = NULL;
+    uint32_t record;
+    uint16_t depth;
+    while (
+        next_network_record(&iterator, netmask, &record, &depth, &status)) {
+        if (*count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 256;
+            MMDB_network_subtree_s *new_list =
+                realloc(list, new_capacity * sizeof(MMDB_network_subtree_s));
+            if (NULL == new_list) {
+                free(list);
+                *count = 0;
+                return MMDB_OUT_OF_MEMORY_ERROR;
+            }
+            list = new_list;
+            capacity = new_capacity;
+        }
 
-    DEBUG_NL;
-    DEBUG_MSGF("top level element is a %s", type_num_to_name(entry_data->type));
+        MMDB_network_subtree_s *subtree = &list[*count];
+        subtree->mmdb = mmdb;
+        subtree->depth = depth;
+        subtree->record = record;
+        memset(subtree->address, 0, sizeof(subtree->address));
+        memcpy(subtree->address, iterator.address, (size_t)(depth + 7) / 8);
+        if (depth % 8) {
+            subtree->address[depth / 8] &= (uint8_t)(0xFF << (8 - depth % 8));
+        }
+        (*count)++;
+    }
 
-    /* Can this happen? It'd probably represent a pathological case under
-     * normal use, but there's nothing preventing someone from passing an
-     * invalid MMDB_entry_s struct to this function */
-    if (!entry_data->has_data) {
-        return MMDB_INVALID_LOOKUP_PATH_ERROR;
+    if (MMDB_SUCCESS != status) {
+        free(list);
+        *count = 0;
+        return status;
     }
 
-    const char *path_elem;
-    int i = 0;
-    while (NULL != (path_elem = path[i++])) {
-        DEBUG_NL;
-        DEBUG_MSGF("path elem = %s", path_elem);
+    *subtrees = list;
+    return MMDB_SUCCESS;
+}
 
-        /* XXX - it'd be good to find a quicker way to skip through these
-           entries that doesn't involve decoding them
-           completely. Basically we need to just use the size from the
-           control byte to advance our pointer rather than calling
-           decode_one(). */
-        if (entry_data->type == MMDB_DATA_TYPE_ARRAY) {
-            int status = lookup_path_in_array(path_elem, mmdb, entry_data);
-            if (MMDB_SUCCESS != status) {
-                memset(entry_data, 0, sizeof(MMDB_entry_data_s));
-                return status;
+void MMDB_free_network_subtrees(MMDB_network_subtree_s *const subtrees) {
+    free(subtrees);
+}
+
+/* This does an iterative depth-first walk of the search tree and returns the
+ * next record that is not a search node. Left records are always visited
+ * before right records, so records are returned in ascending address order.
+ *
+ * Rather than storing a full address per stack entry, each entry stores the
+ * bit it adds to the address of its parent. When an entry is popped, every
+ * bit above its depth has already been set by its ancestors and has not been
+ * touched since, as the only records visited in between are in the left
+ * subtree of its parent.
+ *
+ * If split_netmask is not -1, search nodes at that netmask are returned
+ * instead of being descended into. See split_depth_for_network(). */
+static bool next_network_record(MMDB_network_iterator_s *const iterator,
+                                int split_netmask,
+                                uint32_t *const record_out,
+                                uint16_t *const depth_out,
+                                int *const mmdb_error) {
+    const MMDB_s *const mmdb = iterator->mmdb;
+    *mmdb_error = MMDB_SUCCESS;
+
+    record_info_s record_info = record_info_for_database(mmdb);
+    if (record_info.right_record_offset == 0) {
+        *mmdb_error = MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+        return false;
+    }
+
+    uint32_t node_count = mmdb->metadata.node_count;
+    const uint8_t *search_tree = mmdb->file_content;
+
+    while (iterator->stack_size > 0) {
+        iterator->stack_size--;
+        uint32_t record = iterator->stack[iterator->stack_size].record;
+        uint16_t depth = iterator->stack[iterator->stack_size].depth;
+
+        if (depth > 0) {
+            uint16_t bit_index = depth - 1;
+            uint8_t mask = (uint8_t)(1U << (7 - (bit_index % 8)));
+            if (iterator->stack[iterator->stack_size].bit) {
+                iterator->address[bit_index >> 3] |= mask;
+            } else {
+                iterator->address[bit_index >> 3] &= (uint8_t)~mask;
             }
-        } else if (entry_data->type == MMDB_DATA_TYPE_MAP) {
-            int status = lookup_path_in_map(path_elem, mmdb, entry_data);
-            if (MMDB_SUCCESS != status) {
-                memset(entry_data, 0, sizeof(MMDB_entry_data_s));
-                return status;
+        }
+
+        if (record < node_count && (record != 0 || depth == 0)) {
+            if (depth >= mmdb->depth) {
+                DEBUG_MSG("search tree is deeper than the address length");
+                *mmdb_error = MMDB_CORRUPT_SEARCH_TREE_ERROR;
+                return false;
             }
-        } else {
-            /* Once we make the code traverse maps & arrays without calling
-             * decode_one() we can get rid of this. */
-            memset(entry_data, 0, sizeof(MMDB_entry_data_s));
-            return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+
+            if (!(iterator->flags & MMDB_ITERATOR_INCLUDE_ALIASED_NETWORKS) &&
+                is_aliased_ipv4_subtree(
+                    mmdb, iterator->address, record, depth)) {
+                continue;
+            }
+
+            if (split_netmask >= 0 &&
+                depth >= split_depth_for_network(
+                             iterator, (uint16_t)split_netmask, depth)) {
+                *record_out = record;
+                *depth_out = depth;
+                return true;
+            }
+
+            const uint8_t *record_pointer =
+                &search_tree[(uint64_t)record * record_info.record_length];
+            if (record_pointer + record_info.record_length >
+                mmdb->data_section) {
+                *mmdb_error = MMDB_CORRUPT_SEARCH_TREE_ERROR;
+                return false;
+            }
+            uint32_t left = record_info.left_record_getter(record_pointer);
+            uint32_t right = record_info.right_record_getter(
+                record_pointer + record_info.right_record_offset);
+
+            // Push right first so that the left subtree is visited first.
+            push_network_record(iterator, right, depth + 1, 1);
+            push_network_record(iterator, left, depth + 1, 0);
+            continue;
+        }
+
+        uint8_t type = record_type(mmdb, record);
+        if (type == MMDB_RECORD_TYPE_EMPTY) {
+            if (iterator->flags & MMDB_ITERATOR_SKIP_EMPTY_NETWORKS) {
+                continue;
+            }
+        } else if (type != MMDB_RECORD_TYPE_DATA) {
+            *mmdb_error = MMDB_CORRUPT_SEARCH_TREE_ERROR;
+            return false;
         }
+
+        *record_out = record;
+        *depth_out = depth;
+        return true;
     }
 
-    return MMDB_SUCCESS;
+    return false;
 }
 
-static int lookup_path_in_array(const char *path_elem,
-                                const MMDB_s *const mmdb,
-                                MMDB_entry_data_s *entry_data) {
-    uint32_t size = entry_data->data_size;
-    char *first_invalid;
+static void push_network_record(MMDB_network_iterator_s *const iterator,
+                                uint32_t record,
+                                uint16_t depth,
+                                uint8_t bit) {
+    // The caller guarantees depth <= mmdb->depth, which bounds the stack at
+    // one pending right record per level plus the record being visited.
+    iterator->stack[iterator->stack_size].record = record;
+    iterator->stack[iterator->stack_size].depth = depth;
+    iterator->stack[iterator->stack_size].bit = bit;
+    iterator->stack_size++;
+}
 
-    int saved_errno = errno;
-    errno = 0;
-    long array_index = strtol(path_elem, &first_invalid, 10);
-    if (ERANGE == errno) {
-        errno = saved_errno;
-        return MMDB_INVALID_LOOKUP_PATH_ERROR;
-    }
-    errno = saved_errno;
+/* Databases with IPv4 aliasing have records such as ::ffff:0:0/96 and
+ * 2002::/16 pointing at the node for ::/96. Only the path of all zero bits is
+ * the canonical location of the IPv4 subtree. */
+static bool is_aliased_ipv4_subtree(const MMDB_s *const mmdb,
+                                    const uint8_t *address,
+                                    uint32_t record,
+                                    uint16_t depth) {
+    MMDB_ipv4_start_node_s start_node;
+    // The iterators find the start node when they are initialized, so this
+    // can't fail.
+    if (mmdb->metadata.ip_version != 6 ||
+        ipv4_start_node(mmdb, &start_node) != MMDB_SUCCESS ||
+        start_node.netmask != 96 || record != start_node.node_value) {
+        return false;
+    }
+
+    return !is_zero_prefix(address, depth);
+}
 
-    if (array_index < 0) {
-        array_index += size;
+/* Returns the depth at which a node at the given depth should be split off
+ * into its own subtree. The netmask is applied separately to the IPv4
+ * subtree of an IPv6 database, so splitting at /8 gives the IPv6 /8s as well
+ * as the IPv4 /8s. The nodes on the path to ::/96 are never split off, as
+ * the IPv4 subtree would otherwise end up as part of ::/8. */
+static uint16_t
+split_depth_for_network(const MMDB_network_iterator_s *const iterator,
+                        uint16_t netmask,
+                        uint16_t depth) {
+    const MMDB_s *const mmdb = iterator->mmdb;
+    uint16_t split_depth = netmask;
+    MMDB_ipv4_start_node_s start_node;
+
+    if (mmdb->metadata.ip_version == 6 &&
+        ipv4_start_node(mmdb, &start_node) == MMDB_SUCCESS &&
+        start_node.netmask == 96 &&
+        is_zero_prefix(iterator->address, depth < 96 ? depth : 96)) {
+        split_depth = depth < 96 ? 96 : (uint16_t)(96 + netmask);
+    }
+
+    return split_depth > mmdb->depth ? mmdb->depth : split_depth;
+}
 
-        if (array_index < 0) {
-            return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+static bool is_zero_prefix(const uint8_t *address, uint16_t bits) {
+    for (uint16_t i = 0; i < bits; i++) {
+        if (address[i >> 3] & (1U << (7 - (i % 8)))) {
+            return false;
         }
     }
+    return true;
+}
 
-    if (*first_invalid || (unsigned long)array_index >= size) {
-        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+static void set_network(const MMDB_s *const mmdb,
+                        const uint8_t *address,
+                        uint16_t depth,
+                        MMDB_network_s *const network) {
+    memset(network->address, 0, sizeof(network->address));
+    memcpy(network->address, address, (size_t)(depth + 7) / 8);
+    if (depth % 8) {
+        network->address[depth / 8] &= (uint8_t)(0xFF << (8 - depth % 8));
+    }
+
+    network->ip_version = mmdb->metadata.ip_version;
+    network->netmask = depth;
+    network->entry.mmdb = mmdb;
+
+    // IPv4 networks in an IPv6 database live in ::/96. We return them as
+    // IPv4 networks to match how they were looked up.
+    if (mmdb->metadata.ip_version == 6 && depth >= 96 &&
+        is_zero_prefix(network->address, 96)) {
+        memmove(network->address, network->address + 12, 4);
+        memset(network->address + 4, 0, 12);
+        network->ip_version = 4;
+        network->netmask = depth - 96;
     }
+}
 
-    for (long i = 0; i < array_index; i++) {
-        /* We don't want to follow a pointer here. If the next element is a
-         * pointer we simply skip it and keep going */
-        CHECKED_DECODE_ONE(mmdb, entry_data->offset_to_next, entry_data);
-        int status = skip_map_or_array(mmdb, entry_data, 0);
+#define DIFF_CACHE_UNKNOWN (0)
+#define DIFF_CACHE_EQUAL (1)
+#define DIFF_CACHE_DIFFERENT (2)
+
+int MMDB_diff_iterator_init(const MMDB_s *const old_mmdb,
+                            const MMDB_s *const new_mmdb,
+                            uint32_t flags,
+                            MMDB_diff_iterator_s *const iterator) {
+    if (record_info_for_database(old_mmdb).right_record_offset == 0 ||
+        record_info_for_database(new_mmdb).right_record_offset == 0) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    }
+    if (old_mmdb->metadata.ip_version != new_mmdb->metadata.ip_version ||
+        old_mmdb->depth != new_mmdb->depth) {
+        DEBUG_MSG("cannot diff databases with different IP versions");
+        return MMDB_INVALID_METADATA_ERROR;
+    }
+    if (old_mmdb->metadata.ip_version == 6) {
+        MMDB_ipv4_start_node_s start_node;
+        int status = ipv4_start_node(old_mmdb, &start_node);
+        if (MMDB_SUCCESS == status) {
+            status = ipv4_start_node(new_mmdb, &start_node);
+        }
         if (MMDB_SUCCESS != status) {
             return status;
         }
     }
 
-    MMDB_entry_data_s value;
-    CHECKED_DECODE_ONE_FOLLOW(mmdb, entry_data->offset_to_next, &value);
-    memcpy(entry_data, &value, sizeof(MMDB_entry_data_s));
+    iterator->old_mmdb = old_mmdb;
+    iterator->new_mmdb = new_mmdb;
+    iterator->flags = flags;
+    iterator->stack_size = 0;
+    memset(iterator->address, 0, sizeof(iterator->address));
+    memset(iterator->cache, 0, sizeof(iterator->cache));
+
+    push_diff_record(iterator, 0, 0, 0, 0);
 
     return MMDB_SUCCESS;
 }
 
-static int lookup_path_in_map(const char *path_elem,
-                              const MMDB_s *const mmdb,
-                              MMDB_entry_data_s *entry_data) {
-    uint32_t size = entry_data->data_size;
-    uint32_t offset = entry_data->offset_to_next;
-    size_t path_elem_len = strlen(path_elem);
-
-    while (size-- > 0) {
-        MMDB_entry_data_s key, value;
-        CHECKED_DECODE_ONE_FOLLOW(mmdb, offset, &key);
-
-        uint32_t offset_to_value = key.offset_to_next;
+bool MMDB_diff_iterator_next(MMDB_diff_iterator_s *const iterator,
+                             MMDB_network_diff_s *const diff,
+                             int *const mmdb_error) {
+    uint32_t old_record;
+    uint32_t new_record;
+    uint16_t depth;
+    if (!next_diff_record(
+            iterator, &old_record, &new_record, &depth, mmdb_error)) {
+        return false;
+    }
+
+    MMDB_network_s network;
+    set_network(iterator->old_mmdb, iterator->address, depth, &network);
+    memcpy(diff->address, network.address, sizeof(diff->address));
+    diff->ip_version = network.ip_version;
+    diff->netmask = network.netmask;
+
+    diff->old_found_entry = record_type(iterator->old_mmdb, old_record) ==
+                            MMDB_RECORD_TYPE_DATA;
+    diff->old_entry.mmdb = iterator->old_mmdb;
+    diff->old_entry.offset =
+        diff->old_found_entry
+            ? data_section_offset_for_record(iterator->old_mmdb, old_record)
+            : 0;
+
+    diff->new_found_entry = record_type(iterator->new_mmdb, new_record) ==
+                            MMDB_RECORD_TYPE_DATA;
+    diff->new_entry.mmdb = iterator->new_mmdb;
+    diff->new_entry.offset =
+        diff->new_found_entry
+            ? data_section_offset_for_record(iterator->new_mmdb, new_record)
+            : 0;
+
+    return true;
+}
 
-        if (MMDB_DATA_TYPE_UTF8_STRING != key.type) {
-            return MMDB_INVALID_DATA_ERROR;
+/* This walks both search trees at once in the same way as
+ * next_network_record() and returns the next pair of records that are not
+ * search nodes and whose data differs. Where only one of the trees has a
+ * search node, the record from the other tree is pushed for both of its
+ * children.
+ *
+ * Record values from two different files can't be compared directly, so a
+ * subtree is pruned once both sides reach a data record and the data is
+ * equal. Most networks share a few records, so the results of comparing the
+ * data are cached by their offsets. */
+static bool next_diff_record(MMDB_diff_iterator_s *const iterator,
+                             uint32_t *const old_record_out,
+                             uint32_t *const new_record_out,
+                             uint16_t *const depth_out,
+                             int *const mmdb_error) {
+    const MMDB_s *const old_mmdb = iterator->old_mmdb;
+    const MMDB_s *const new_mmdb = iterator->new_mmdb;
+    *mmdb_error = MMDB_SUCCESS;
+
+    while (iterator->stack_size > 0) {
+        iterator->stack_size--;
+        uint32_t old_record = iterator->stack[iterator->stack_size].old_record;
+        uint32_t new_record = iterator->stack[iterator->stack_size].new_record;
+        uint16_t depth = iterator->stack[iterator->stack_size].depth;
+
+        if (depth > 0) {
+            uint16_t bit_index = depth - 1;
+            uint8_t mask = (uint8_t)(1U << (7 - (bit_index % 8)));
+            if (iterator->stack[iterator->stack_size].bit) {
+                iterator->address[bit_index >> 3] |= mask;
+            } else {
+                iterator->address[bit_index >> 3] &= (uint8_t)~mask;
+            }
         }
 
-        if (key.data_size == path_elem_len &&
-            !memcmp(path_elem, key.utf8_string, path_elem_len)) {
+        bool old_is_node = old_record < old_mmdb->metadata.node_count &&
+                           (old_record != 0 || depth == 0);
+        bool new_is_node = new_record < new_mmdb->metadata.node_count &&
+                           (new_record != 0 || depth == 0);
 
-            DEBUG_MSG("found key matching path elem");
+        if (old_is_node || new_is_node) {
+            if (depth >= old_mmdb->depth) {
+                DEBUG_MSG("search tree is deeper than the address length");
+                *mmdb_error = MMDB_CORRUPT_SEARCH_TREE_ERROR;
+                return false;
+            }
 
-            CHECKED_DECODE_ONE_FOLLOW(mmdb, offset_to_value, &value);
-            memcpy(entry_data, &value, sizeof(MMDB_entry_data_s));
-            return MMDB_SUCCESS;
-        } else {
-            /* We don't want to follow a pointer here. If the next element is
-             * a pointer we simply skip it and keep going */
-            CHECKED_DECODE_ONE(mmdb, offset_to_value, &value);
-            int status = skip_map_or_array(mmdb, &value, 0);
+            if (!(iterator->flags & MMDB_ITERATOR_INCLUDE_ALIASED_NETWORKS) &&
+                ((old_is_node &&
+                  is_aliased_ipv4_subtree(
+                      old_mmdb, iterator->address, old_record, depth)) ||
+                 (new_is_node &&
+                  is_aliased_ipv4_subtree(
+                      new_mmdb, iterator->address, new_record, depth)))) {
+                continue;
+            }
+
+            uint32_t old_left = old_record;
+            uint32_t old_right = old_record;
+            uint32_t new_left = new_record;
+            uint32_t new_right = new_record;
+            int status = MMDB_SUCCESS;
+            if (old_is_node) {
+                status = read_child_records(
+                    old_mmdb, old_record, &old_left, &old_right);
+            }
+            if (MMDB_SUCCESS == status && new_is_node) {
+                status = read_child_records(
+                    new_mmdb, new_record, &new_left, &new_right);
+            }
             if (MMDB_SUCCESS != status) {
-                return status;
+                *mmdb_error = status;
+                return false;
             }
-            offset = value.offset_to_next;
+
+            // Push right first so that the left subtree is visited first.
+            push_diff_record(iterator, old_right, new_right, depth + 1, 1);
+            push_diff_record(iterator, old_left, new_left, depth + 1, 0);
+            continue;
+        }
+
+        bool equal;
+        int status = records_equal(iterator, old_record, new_record, &equal);
+        if (MMDB_SUCCESS != status) {
+            *mmdb_error = status;
+            return false;
+        }
+        if (equal) {
+            continue;
         }
+
+        *old_record_out = old_record;
+        *new_record_out = new_record;
+        *depth_out = depth;
+        return true;
     }
 
-    memset(entry_data, 0, sizeof(MMDB_entry_data_s));
-    return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    return false;
+}
+
+static int read_child_records(const MMDB_s *const mmdb,
+                              uint32_t record,
+                              uint32_t *const left,
+                              uint32_t *const right) {
+    record_info_s record_info = record_info_for_database(mmdb);
+    const uint8_t *record_pointer =
+        &mmdb->file_content[(uint64_t)record * record_info.record_length];
+    if (record_pointer + record_info.record_length > mmdb->data_section) {
+        return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+    }
+
+    *left = record_info.left_record_getter(record_pointer);
+    *right = record_info.right_record_getter(record_pointer +
+                                             record_info.right_record_offset);
+    return MMDB_SUCCESS;
+}
+
+static void push_diff_record(MMDB_diff_iterator_s *const iterator,
+                             uint32_t old_record,
+                             uint32_t new_record,
+                             uint16_t depth,
+                             uint8_t bit) {
+    // As with push_network_record(), depth <= mmdb->depth bounds the stack.
+    iterator->stack[iterator->stack_size].old_record = old_record;
+    iterator->stack[iterator->stack_size].new_record = new_record;
+    iterator->stack[iterator->stack_size].depth = depth;
+    iterator->stack[iterator->stack_size].bit = bit;
+    iterator->stack_size++;
+}
+
+static int records_equal(MMDB_diff_iterator_s *const iterator,
+                         uint32_t old_record,
+                         uint32_t new_record,
+                         bool *const equal) {
+    uint8_t old_type = record_type(iterator->old_mmdb, old_record);
+    uint8_t new_type = record_type(iterator->new_mmdb, new_record);
+    if (old_type == MMDB_RECORD_TYPE_INVALID ||
+        new_type == MMDB_RECORD_TYPE_INVALID) {
+        return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+    }
+
+    if (old_type == MMDB_RECORD_TYPE_EMPTY ||
+        new_type == MMDB_RECORD_TYPE_EMPTY) {
+        *equal = old_type == new_type;
+        return MMDB_SUCCESS;
+    }
+
+    uint32_t old_offset =
+        data_section_offset_for_record(iterator->old_mmdb, old_record);
+    uint32_t new_offset =
+        data_section_offset_for_record(iterator->new_mmdb, new_record);
+    size_t const slot =
+        ((old_offset * UINT32_C(2654435761)) ^ new_offset) %
+        (sizeof(iterator->cache) / sizeof(iterator->cache[0]));
+
+    if (iterator->cache[slot].state != DIFF_CACHE_UNKNOWN &&
+        iterator->cache[slot].old_offset == old_offset &&
+        iterator->cache[slot].new_offset == new_offset) {
+        *equal = iterator->cache[slot].state == DIFF_CACHE_EQUAL;
+        return MMDB_SUCCESS;
+    }
+
+    int status = entries_equal(iterator->old_mmdb,
+                               old_offset,
+                               iterator->new_mmdb,
+                               new_offset,
+                               0,
+                               equal);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    iterator->cache[slot].old_offset = old_offset;
+    iterator->cache[slot].new_offset = new_offset;
+    iterator->cache[slot].state =
+        *equal ? DIFF_CACHE_EQUAL : DIFF_CACHE_DIFFERENT;
+    return MMDB_SUCCESS;
 }
 
-static int skip_map_or_array(const MMDB_s *const mmdb,
-                             MMDB_entry_data_s *entry_data,
-                             int depth) {
+/* Compares the values at the given offsets by their contents, so it doesn't
+ * matter whether either database stores parts of them behind pointers. Maps
+ * are equal if they have the same keys with equal values in any order. */
+static int entries_equal(const MMDB_s *const old_mmdb,
+                         uint32_t old_offset,
+                         const MMDB_s *const new_mmdb,
+                         uint32_t new_offset,
+                         int depth,
+                         bool *const equal) {
     if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
         DEBUG_MSG("reached the maximum data structure depth");
         return MMDB_INVALID_DATA_ERROR;
     }
 
-    if (entry_data->type == MMDB_DATA_TYPE_MAP) {
-        uint32_t size = entry_data->data_size;
-        while (size-- > 0) {
-            CHECKED_DECODE_ONE(
-                mmdb, entry_data->offset_to_next, entry_data); // key
-            CHECKED_DECODE_ONE(
-                mmdb, entry_data->offset_to_next, entry_data); // value
-            int status = skip_map_or_array(mmdb, entry_data, depth + 1);
+    MMDB_entry_data_s old_data;
+    MMDB_entry_data_s new_data;
+    CHECKED_DECODE_ONE_FOLLOW(old_mmdb, old_offset, &old_data);
+    CHECKED_DECODE_ONE_FOLLOW(new_mmdb, new_offset, &new_data);
+
+    *equal = false;
+    if (old_data.type != new_data.type) {
+        return MMDB_SUCCESS;
+    }
+
+    switch (old_data.type) {
+        case MMDB_DATA_TYPE_MAP:
+            return maps_equal(
+                old_mmdb, &old_data, new_mmdb, &new_data, depth, equal);
+        case MMDB_DATA_TYPE_ARRAY: {
+            if (old_data.data_size != new_data.data_size) {
+                return MMDB_SUCCESS;
+            }
+            old_offset = old_data.offset_to_next;
+            new_offset = new_data.offset_to_next;
+            for (uint32_t i = 0; i < old_data.data_size; i++) {
+                int status = entries_equal(old_mmdb,
+                                           old_offset,
+                                           new_mmdb,
+                                           new_offset,
+                                           depth + 1,
+                                           equal);
+                if (MMDB_SUCCESS != status || !*equal) {
+                    return status;
+                }
+                status = skip_value(old_mmdb, old_offset, 0, &old_offset);
+                if (MMDB_SUCCESS != status) {
+                    return status;
+                }
+                status = skip_value(new_mmdb, new_offset, 0, &new_offset);
+                if (MMDB_SUCCESS != status) {
+                    return status;
+                }
+            }
+            *equal = true;
+            return MMDB_SUCCESS;
+        }
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            *equal = old_data.data_size == new_data.data_size &&
+                     !memcmp(old_data.utf8_string,
+                             new_data.utf8_string,
+                             old_data.data_size);
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_BYTES:
+            *equal = old_data.data_size == new_data.data_size &&
+                     !memcmp(old_data.bytes,
+                             new_data.bytes,
+                             old_data.data_size);
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_DOUBLE:
+            *equal = !memcmp(&old_data.double_value,
+                             &new_data.double_value,
+                             sizeof(old_data.double_value));
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_FLOAT:
+            *equal = !memcmp(&old_data.float_value,
+                             &new_data.float_value,
+                             sizeof(old_data.float_value));
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_UINT16:
+            *equal = old_data.uint16 == new_data.uint16;
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_UINT32:
+            *equal = old_data.uint32 == new_data.uint32;
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_INT32:
+            *equal = old_data.int32 == new_data.int32;
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_UINT64:
+            *equal = old_data.uint64 == new_data.uint64;
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_UINT128:
+            *equal = !memcmp(&old_data.uint128,
+                             &new_data.uint128,
+                             sizeof(old_data.uint128));
+            return MMDB_SUCCESS;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            *equal = old_data.boolean == new_data.boolean;
+            return MMDB_SUCCESS;
+        default:
+            DEBUG_MSGF("unexpected data type %d", old_data.type);
+            return MMDB_INVALID_DATA_ERROR;
+    }
+}
+
+/* For each key in the old map, the new map is searched starting after the
+ * last key that was found, so maps with their keys in the same order are
+ * compared in a single pass. */
+static int maps_equal(const MMDB_s *const old_mmdb,
+                      const MMDB_entry_data_s *const old_map,
+                      const MMDB_s *const new_mmdb,
+                      const MMDB_entry_data_s *const new_map,
+                      int depth,
+                      bool *const equal) {
+    *equal = false;
+    uint32_t size = old_map->data_size;
+    if (size != new_map->data_size) {
+        return MMDB_SUCCESS;
+    }
+
+    uint32_t old_offset = old_map->offset_to_next;
+    uint32_t new_offset = new_map->offset_to_next;
+    uint32_t new_index = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        MMDB_entry_data_s old_key;
+        CHECKED_DECODE_ONE_FOLLOW(old_mmdb, old_offset, &old_key);
+        if (MMDB_DATA_TYPE_UTF8_STRING != old_key.type) {
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        uint32_t old_value = old_key.offset_to_next;
+        int status = skip_value(old_mmdb, old_value, 0, &old_offset);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+
+        bool found = false;
+        for (uint32_t tries = 0; tries < size && !found; tries++) {
+            if (new_index == size) {
+                new_index = 0;
+                new_offset = new_map->offset_to_next;
+            }
+
+            MMDB_entry_data_s new_key;
+            status = decode_one_follow(new_mmdb, new_offset, &new_key);
             if (MMDB_SUCCESS != status) {
                 return status;
             }
-        }
-    } else if (entry_data->type == MMDB_DATA_TYPE_ARRAY) {
-        uint32_t size = entry_data->data_size;
-        while (size-- > 0) {
-            CHECKED_DECODE_ONE(
-                mmdb, entry_data->offset_to_next, entry_data); // value
-            int status = skip_map_or_array(mmdb, entry_data, depth + 1);
+            if (MMDB_DATA_TYPE_UTF8_STRING != new_key.type) {
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            uint32_t new_value = new_key.offset_to_next;
+            status = skip_value(new_mmdb, new_value, 0, &new_offset);
             if (MMDB_SUCCESS != status) {
                 return status;
             }
+            new_index++;
+
+            if (old_key.data_size == new_key.data_size &&
+                !memcmp(old_key.utf8_string,
+                        new_key.utf8_string,
+                        old_key.data_size)) {
+                found = true;
+                status = entries_equal(old_mmdb,
+                                       old_value,
+                                       new_mmdb,
+                                       new_value,
+                                       depth + 1,
+                                       equal);
+                if (MMDB_SUCCESS != status || !*equal) {
+                    return status;
+                }
+            }
+        }
+
+        if (!found) {
+            *equal = false;
+            return MMDB_SUCCESS;
         }
     }
 
+    *equal = true;
     return MMDB_SUCCESS;
 }
 
-static int decode_one_follow(const MMDB_s *const mmdb,
-                             uint32_t offset,
-                             MMDB_entry_data_s *entry_data) {
-    CHECKED_DECODE_ONE(mmdb, offset, entry_data);
-    if (entry_data->type == MMDB_DATA_TYPE_POINTER) {
-        uint32_t next = entry_data->offset_to_next;
-        CHECKED_DECODE_ONE(mmdb, entry_data->pointer, entry_data);
-        /* Pointers to pointers are illegal under the spec */
-        if (entry_data->type == MMDB_DATA_TYPE_POINTER) {
-            DEBUG_MSG("pointer points to another pointer");
-            return MMDB_INVALID_DATA_ERROR;
-        }
+int MMDB_verify(const MMDB_s *const mmdb) {
+    verify_state_s state;
+    int const status = verify_database(mmdb, &state);
+    free(state.verified);
+    return status;
+}
 
-        /* The pointer could point to any part of the data section but the
-         * next entry for this particular offset may be the one after the
-         * pointer, not the one after whatever the pointer points to. This
-         * depends on whether the pointer points to something that is a simple
-         * value or a compound value. For a compound value, the next one is
-         * the one after the pointer result, not the one after the pointer. */
-        if (entry_data->type != MMDB_DATA_TYPE_MAP &&
-            entry_data->type != MMDB_DATA_TYPE_ARRAY) {
+int MMDB_verify_metadata(const MMDB_s *const mmdb) {
+    if (mmdb->metadata.ip_version != 4 && mmdb->metadata.ip_version != 6) {
+        DEBUG_MSGF("unknown IP version %d", mmdb->metadata.ip_version);
+        return MMDB_INVALID_METADATA_ERROR;
+    }
+    if (record_info_for_database(mmdb).right_record_offset == 0) {
+        return MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    }
 
-            entry_data->offset_to_next = next;
+    for (int i = 1; i <= MMDB_DATA_SECTION_SEPARATOR; i++) {
+        if (mmdb->data_section[-i] != 0) {
+            DEBUG_MSG("data section separator is not all zeros");
+            return MMDB_INVALID_DATA_ERROR;
         }
     }
 
+    const MMDB_s metadata_db = make_fake_metadata_db(mmdb);
+    verify_state_s state = {.mmdb = &metadata_db,
+                            .verified = NULL,
+                            .verified_count = 0,
+                            .verified_capacity = 0,
+                            .budget = metadata_db.data_section_size};
+    uint32_t next;
+    int height;
+    if (verify_value(&state, 0, 0, &next, &height) != MMDB_SUCCESS) {
+        return MMDB_INVALID_METADATA_ERROR;
+    }
+
+    if (mmdb->metadata.ip_version == 6) {
+        MMDB_ipv4_start_node_s start_node;
+        return ipv4_start_node(mmdb, &start_node);
+    }
     return MMDB_SUCCESS;
 }
 
-#if !MMDB_UINT128_IS_BYTE_ARRAY
-static mmdb_uint128_t get_uint128(const uint8_t *p, int length) {
-    mmdb_uint128_t value = 0;
-    while (length-- > 0) {
-        value <<= 8;
-        value += *p++;
+int MMDB_verify_subtree(const MMDB_network_subtree_s *const subtree) {
+    verify_state_s state;
+    int status = init_verify_state(&state, subtree->mmdb);
+    if (MMDB_SUCCESS != status) {
+        return status;
     }
-    return value;
+    status = verify_subtree(subtree, &state);
+    free(state.verified);
+    return status;
 }
-#endif
-
-static int decode_one(const MMDB_s *const mmdb,
-                      uint32_t offset,
-                      MMDB_entry_data_s *entry_data) {
-    const uint8_t *mem = mmdb->data_section;
 
-    if (mmdb->data_section_size == 0) {
-        // decode_one is also called with a fake mmdb whose data_section
-        // points at the metadata; either way an empty section is invalid.
-        DEBUG_MSG("decode_one called with an empty section");
-        return MMDB_INVALID_DATA_ERROR;
+/* Checks the whole database for MMDB_verify(). The values that were checked
+ * are left in the state, which the caller frees. */
+static int verify_database(const MMDB_s *const mmdb,
+                           verify_state_s *const state) {
+    state->verified = NULL;
+    int status = MMDB_verify_metadata(mmdb);
+    if (MMDB_SUCCESS != status) {
+        return status;
     }
 
-    // We subtract rather than add as it possible that offset + 1
-    // could overflow for a corrupt database while an underflow
-    // from data_section_size - 1 should not be possible.
-    if (offset > mmdb->data_section_size - 1) {
-        DEBUG_MSGF("Offset (%d) past data section (%d)",
-                   offset,
-                   mmdb->data_section_size);
-        return MMDB_INVALID_DATA_ERROR;
+    status = init_verify_state(state, mmdb);
+    if (MMDB_SUCCESS != status) {
+        return status;
     }
+    MMDB_network_subtree_s root = {.mmdb = mmdb, .depth = 0, .record = 0};
+    memset(root.address, 0, sizeof(root.address));
+    return verify_subtree(&root, state);
+}
 
-    entry_data->offset = offset;
-    entry_data->has_data = true;
-
-    DEBUG_NL;
-    DEBUG_MSGF("Offset: %i", offset);
-
-    uint8_t ctrl = mem[offset++];
-    DEBUG_BINARY("Control byte: %s", ctrl);
-
-    int type = (ctrl >> 5) & 7;
-    DEBUG_MSGF("Type: %i (%s)", type, type_num_to_name(type));
-
-    if (type == MMDB_DATA_TYPE_EXTENDED) {
-        // Subtracting 1 to avoid possible overflow on offset + 1
-        if (offset > mmdb->data_section_size - 1) {
-            DEBUG_MSGF("Extended type offset (%d) past data section (%d)",
-                       offset,
-                       mmdb->data_section_size);
-            return MMDB_INVALID_DATA_ERROR;
-        }
-        type = get_ext_type(mem[offset++]);
-        DEBUG_MSGF("Extended type: %i (%s)", type, type_num_to_name(type));
-    }
-
-    entry_data->type = (uint32_t)type;
-
-    if (type == MMDB_DATA_TYPE_POINTER) {
-        uint8_t psize = ((ctrl >> 3) & 3) + 1;
-        DEBUG_MSGF("Pointer size: %i", psize);
-
-        // We check that the offset does not extend past the end of the
-        // database and that the subtraction of psize did not underflow.
-        if (offset > mmdb->data_section_size - psize ||
-            mmdb->data_section_size < psize) {
-            DEBUG_MSGF("Pointer offset (%d) past data section (%d)",
-                       offset + psize,
-                       mmdb->data_section_size);
-            return MMDB_INVALID_DATA_ERROR;
+/* Verifies a database opened with MMDB_MODE_VERIFY and keeps a bit for each
+ * value that a record or pointer points to, which is where a lookup's entry
+ * and every value in it start. */
+static int keep_verified_offsets(MMDB_s *const mmdb) {
+    verify_state_s state;
+    int status = verify_database(mmdb, &state);
+    if (MMDB_SUCCESS == status) {
+        uint8_t *const bits = calloc(mmdb->data_section_size / 8 + 1, 1);
+        if (NULL == bits) {
+            status = MMDB_OUT_OF_MEMORY_ERROR;
+        } else {
+            for (size_t i = 0; i < state.verified_capacity; i++) {
+                uint32_t const offset = state.verified[i].offset;
+                if (offset != NO_VERIFIED_VALUE) {
+                    bits[offset / 8] |= (uint8_t)(1U << (offset % 8));
+                }
+            }
+            database_internal(mmdb)->verified_offsets = bits;
         }
-        entry_data->pointer = get_ptr_from(ctrl, &mem[offset], psize);
-        DEBUG_MSGF("Pointer to: %i", entry_data->pointer);
-
-        entry_data->data_size = psize;
-        entry_data->offset_to_next = offset + psize;
-        return MMDB_SUCCESS;
     }
+    free(state.verified);
+    return status;
+}
 
-    uint32_t size = ctrl & 31;
-    switch (size) {
-        case 29:
-            // We subtract when checking offset to avoid possible overflow
-            if (offset > mmdb->data_section_size - 1) {
-                DEBUG_MSGF("String end (%d, case 29) past data section (%d)",
-                           offset,
-                           mmdb->data_section_size);
-                return MMDB_INVALID_DATA_ERROR;
-            }
-            size = 29 + mem[offset++];
-            break;
-        case 30:
-            // We subtract when checking offset to avoid possible overflow
-            if (offset > mmdb->data_section_size - 2) {
-                DEBUG_MSGF("String end (%d, case 30) past data section (%d)",
-                           offset,
-                           mmdb->data_section_size);
-                return MMDB_INVALID_DATA_ERROR;
-            }
-            size = 285 + get_uint16(&mem[offset]);
-            offset += 2;
-            break;
-        case 31:
-            // We subtract when checking offset to avoid possible overflow
-            if (offset > mmdb->data_section_size - 3) {
-                DEBUG_MSGF("String end (%d, case 31) past data section (%d)",
-                           offset,
-                           mmdb->data_section_size);
-                return MMDB_INVALID_DATA_ERROR;
-            }
-            size = 65821 + get_uint24(&mem[offset]);
-            offset += 3;
-            break;
-        default:
-            break;
+static bool is_verified_offset(const MMDB_s *const mmdb, uint32_t offset) {
+    if (NULL == mmdb->filename || offset >= mmdb->data_section_size) {
+        return false;
     }
+    const uint8_t *const bits = database_internal(mmdb)->verified_offsets;
+    return NULL != bits && ((bits[offset / 8] >> (offset % 8)) & 1U);
+}
 
-    DEBUG_MSGF("Size: %i", size);
+/* Returns the database to decode the entry's value with. The bounds checks
+ * are left out only where MMDB_verify() checked the value, as it did for
+ * every entry that a lookup finds. Any other entry, such as one that the
+ * caller made up or that is in a node the search tree doesn't reach, is
+ * decoded with the checks through a copy of the database in checked. */
+static const MMDB_s *entry_database(const MMDB_entry_s *const entry,
+                                    MMDB_s *const checked) {
+    const MMDB_s *const mmdb = entry->mmdb;
+    if (!(mmdb->flags & MMDB_MODE_VERIFY) ||
+        is_verified_offset(mmdb, entry->offset)) {
+        return mmdb;
+    }
+    *checked = *mmdb;
+    checked->flags &= ~(uint32_t)MMDB_MODE_VERIFY;
+    return checked;
+}
 
-    if (type == MMDB_DATA_TYPE_MAP || type == MMDB_DATA_TYPE_ARRAY) {
-        entry_data->data_size = size;
-        entry_data->offset_to_next = offset;
-        return MMDB_SUCCESS;
+/* Sets up the state to check the values that the search tree points to. Each
+ * value takes at least a byte, so the budget allows every value in the data
+ * section to be checked once. A value is only checked again where it is
+ * nested in more than one of the values that are pointed to. */
+static int init_verify_state(verify_state_s *const state,
+                             const MMDB_s *const mmdb) {
+    state->mmdb = mmdb;
+    state->verified_count = 0;
+    state->verified_capacity = 1024;
+    state->verified =
+        malloc(state->verified_capacity * sizeof(verified_value_s));
+    if (NULL == state->verified) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
     }
-
-    if (type == MMDB_DATA_TYPE_BOOLEAN) {
-        entry_data->boolean = size ? true : false;
-        entry_data->data_size = 0;
-        entry_data->offset_to_next = offset;
-        DEBUG_MSGF("boolean value: %s", entry_data->boolean ? "true" : "false");
-        return MMDB_SUCCESS;
+    for (size_t i = 0; i < state->verified_capacity; i++) {
+        state->verified[i].offset = NO_VERIFIED_VALUE;
     }
+    state->budget = mmdb->data_section_size;
+    return MMDB_SUCCESS;
+}
 
-    // Check that the data doesn't extend past the end of the memory
-    // buffer and that the calculation in doing this did not underflow.
-    if (offset > mmdb->data_section_size - size ||
-        mmdb->data_section_size < size) {
-        DEBUG_MSGF("Data end (%d) past data section (%d)",
-                   offset + size,
-                   mmdb->data_section_size);
-        return MMDB_INVALID_DATA_ERROR;
-    }
+/* Returns the slot of the verified value at offset, or the empty slot where
+ * it would go. */
+static verified_value_s *find_verified_value(const verify_state_s *const state,
+                                             uint32_t offset) {
+    size_t const mask = state->verified_capacity - 1;
+    size_t i = (offset * UINT32_C(2654435761)) & mask;
+    while (state->verified[i].offset != NO_VERIFIED_VALUE &&
+           state->verified[i].offset != offset) {
+        i = (i + 1) & mask;
+    }
+    return &state->verified[i];
+}
 
-    if (type == MMDB_DATA_TYPE_UINT16) {
-        if (size > 2) {
-            DEBUG_MSGF("uint16 of size %d", size);
-            return MMDB_INVALID_DATA_ERROR;
-        }
-        entry_data->uint16 = (uint16_t)get_uintX(&mem[offset], (int)size);
-        DEBUG_MSGF("uint16 value: %u", entry_data->uint16);
-    } else if (type == MMDB_DATA_TYPE_UINT32) {
-        if (size > 4) {
-            DEBUG_MSGF("uint32 of size %d", size);
-            return MMDB_INVALID_DATA_ERROR;
-        }
-        entry_data->uint32 = (uint32_t)get_uintX(&mem[offset], (int)size);
-        DEBUG_MSGF("uint32 value: %u", entry_data->uint32);
-    } else if (type == MMDB_DATA_TYPE_INT32) {
-        if (size > 4) {
-            DEBUG_MSGF("int32 of size %d", size);
-            return MMDB_INVALID_DATA_ERROR;
-        }
-        entry_data->int32 = get_sintX(&mem[offset], (int)size);
-        DEBUG_MSGF("int32 value: %i", entry_data->int32);
-    } else if (type == MMDB_DATA_TYPE_UINT64) {
-        if (size > 8) {
-            DEBUG_MSGF("uint64 of size %d", size);
-            return MMDB_INVALID_DATA_ERROR;
-        }
-        entry_data->uint64 = get_uintX(&mem[offset], (int)size);
-        DEBUG_MSGF("uint64 value: %" PRIu64, entry_data->uint64);
-    } else if (type == MMDB_DATA_TYPE_UINT128) {
-        if (size > 16) {
-            DEBUG_MSGF("uint128 of size %d", size);
-            return MMDB_INVALID_DATA_ERROR;
-        }
-#if MMDB_UINT128_IS_BYTE_ARRAY
-        memset(entry_data->uint128, 0, 16);
-        if (size > 0) {
-            memcpy(entry_data->uint128 + 16 - size, &mem[offset], size);
+/* Adds a value that has been checked, doubling the size of the table first
+ * when it is half full. */
+static int add_verified_value(verify_state_s *const state,
+                              uint32_t offset,
+                              uint32_t height) {
+    if (state->verified_count + 1 > state->verified_capacity / 2) {
+        verified_value_s *const old = state->verified;
+        size_t const old_capacity = state->verified_capacity;
+        if (old_capacity > SIZE_MAX / 2 / sizeof(verified_value_s)) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
         }
-#else
-        entry_data->uint128 = get_uint128(&mem[offset], (int)size);
-#endif
-    } else if (type == MMDB_DATA_TYPE_FLOAT) {
-        if (size != 4) {
-            DEBUG_MSGF("float of size %d", size);
-            return MMDB_INVALID_DATA_ERROR;
+        state->verified = malloc(old_capacity * 2 * sizeof(verified_value_s));
+        if (NULL == state->verified) {
+            state->verified = old;
+            return MMDB_OUT_OF_MEMORY_ERROR;
         }
-        size = 4;
-        entry_data->float_value = get_ieee754_float(&mem[offset]);
-        DEBUG_MSGF("float value: %f", entry_data->float_value);
-    } else if (type == MMDB_DATA_TYPE_DOUBLE) {
-        if (size != 8) {
-            DEBUG_MSGF("double of size %d", size);
-            return MMDB_INVALID_DATA_ERROR;
+        state->verified_capacity = old_capacity * 2;
+        for (size_t i = 0; i < state->verified_capacity; i++) {
+            state->verified[i].offset = NO_VERIFIED_VALUE;
         }
-        size = 8;
-        entry_data->double_value = get_ieee754_double(&mem[offset]);
-        DEBUG_MSGF("double value: %f", entry_data->double_value);
-    } else if (type == MMDB_DATA_TYPE_UTF8_STRING) {
-        entry_data->utf8_string = size == 0 ? "" : (char const *)&mem[offset];
-        entry_data->data_size = size;
-#ifdef MMDB_DEBUG
-        char *string =
-            mmdb_strndup(entry_data->utf8_string, size > 50 ? 50 : size);
-        if (NULL == string) {
-            abort();
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].offset != NO_VERIFIED_VALUE) {
+                *find_verified_value(state, old[i].offset) = old[i];
+            }
         }
-        DEBUG_MSGF("string value: %s", string);
-        free(string);
-#endif
-    } else if (type == MMDB_DATA_TYPE_BYTES) {
-        entry_data->bytes = &mem[offset];
-        entry_data->data_size = size;
+        free(old);
     }
 
-    entry_data->offset_to_next = offset + size;
-
+    verified_value_s *const slot = find_verified_value(state, offset);
+    slot->offset = offset;
+    slot->height = height;
+    state->verified_count++;
     return MMDB_SUCCESS;
 }
 
-static int get_ext_type(int raw_ext_type) { return 7 + raw_ext_type; }
-
-static uint32_t
-get_ptr_from(uint8_t ctrl, uint8_t const *const ptr, int ptr_size) {
-    uint32_t new_offset;
-    switch (ptr_size) {
-        case 1:
-            new_offset = (uint32_t)((ctrl & 7) << 8) + ptr[0];
-            break;
-        case 2:
-            new_offset = 2048 + (uint32_t)((ctrl & 7) << 16) +
-                         (uint32_t)(ptr[0] << 8) + ptr[1];
-            break;
-        case 3:
-            new_offset =
-                2048 + 524288 + (uint32_t)((ctrl & 7) << 24) + get_uint24(ptr);
-            break;
-        case 4:
-        default:
-            new_offset = get_uint32(ptr);
-            break;
+/* Walks every node under the subtree, which checks the records of each node
+ * and that no path is longer than the addresses of the database. That catches
+ * a node that points back at one of its ancestors. Nodes pointed to from more
+ * than one place, other than the IPv4 aliases, could still make the walk take
+ * exponential time, so it stops once it has seen more records than a tree
+ * with node_count nodes has. */
+static int verify_subtree(const MMDB_network_subtree_s *const subtree,
+                          verify_state_s *const state) {
+    const MMDB_s *const mmdb = subtree->mmdb;
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init_subtree(subtree, 0, &iterator);
+    if (MMDB_SUCCESS != status) {
+        return status;
     }
-    return new_offset;
-}
-
-int MMDB_get_metadata_as_entry_data_list(
-    const MMDB_s *const mmdb, MMDB_entry_data_list_s **const entry_data_list) {
-    MMDB_s metadata_db = make_fake_metadata_db(mmdb);
-
-    MMDB_entry_s metadata_start = {.mmdb = &metadata_db, .offset = 0};
-
-    return MMDB_get_entry_data_list(&metadata_start, entry_data_list);
-}
 
-int MMDB_get_entry_data_list(MMDB_entry_s *start,
-                             MMDB_entry_data_list_s **const entry_data_list) {
-    *entry_data_list = NULL;
+    uint32_t const node_count = mmdb->metadata.node_count;
+    uint64_t records_left = (uint64_t)node_count + 1;
+    uint32_t record;
+    uint16_t depth;
+    while (next_network_record(&iterator, -1, &record, &depth, &status)) {
+        if (0 == records_left--) {
+            DEBUG_MSG("search tree has more records than nodes");
+            return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+        }
+        if (record == node_count) {
+            continue;
+        }
 
-    MMDB_data_pool_s *const pool = data_pool_new(MMDB_POOL_INIT_SIZE);
-    if (!pool) {
-        return MMDB_OUT_OF_MEMORY_ERROR;
+        int height;
+        status = verify_target(state,
+                               data_section_offset_for_record(mmdb, record),
+                               0,
+                               &height);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
     }
+    return status;
+}
 
-    MMDB_entry_data_list_s *const list = data_pool_alloc(pool);
-    if (!list) {
-        data_pool_destroy(pool);
-        return MMDB_OUT_OF_MEMORY_ERROR;
+/* Checks the value at offset that a record or a pointer points to, unless it
+ * has been checked before and, with the levels below it, still fits under the
+ * maximum depth at this depth. height is set to the number of levels of maps
+ * and arrays below it. */
+static int verify_target(verify_state_s *const state,
+                         uint32_t offset,
+                         int depth,
+                         int *const height) {
+    verified_value_s *const verified =
+        NULL == state->verified ? NULL : find_verified_value(state, offset);
+    if (NULL != verified && verified->offset == offset) {
+        if ((uint64_t)depth + verified->height >=
+            MAXIMUM_DATA_STRUCTURE_DEPTH) {
+            DEBUG_MSG("reached the maximum data structure depth");
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        *height = (int)verified->height;
+        return MMDB_SUCCESS;
     }
 
-    int const status =
-        get_entry_data_list(start->mmdb, start->offset, list, pool, 0);
-    if (MMDB_SUCCESS != status) {
-        data_pool_destroy(pool);
+    uint32_t next;
+    int const status = verify_value(state, offset, depth, &next, height);
+    if (MMDB_SUCCESS != status || NULL == state->verified) {
         return status;
     }
-
-    *entry_data_list = data_pool_to_list(pool);
-    if (!*entry_data_list) {
-        data_pool_destroy(pool);
-        return MMDB_OUT_OF_MEMORY_ERROR;
-    }
-
-    return status;
+    return add_verified_value(state, offset, (uint32_t)*height);
 }
 
-static int get_entry_data_list(const MMDB_s *const mmdb,
-                               uint32_t offset,
-                               MMDB_entry_data_list_s *const entry_data_list,
-                               MMDB_data_pool_s *const pool,
-                               int depth) {
+/* Checks the value at offset and everything in it, following pointers.
+ * Beyond what decoding checks, strings must be valid UTF-8, map keys must be
+ * strings, booleans must be 0 or 1 and there must be no types that can't be
+ * stored in a database. height is set to the number of levels of maps and
+ * arrays below the value, counted as the depth is, and next_offset as for
+ * skip_value(). */
+static int verify_value(verify_state_s *const state,
+                        uint32_t offset,
+                        int depth,
+                        uint32_t *const next_offset,
+                        int *const height) {
+    const MMDB_s *const mmdb = state->mmdb;
     if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
         DEBUG_MSG("reached the maximum data structure depth");
         return MMDB_INVALID_DATA_ERROR;
     }
-    depth++;
-    CHECKED_DECODE_ONE(mmdb, offset, &entry_data_list->entry_data);
+    if (0 == state->budget) {
+        DEBUG_MSG("database contains more values than the data section");
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    state->budget--;
 
-    switch (entry_data_list->entry_data.type) {
-        case MMDB_DATA_TYPE_POINTER: {
-            uint32_t next_offset = entry_data_list->entry_data.offset_to_next;
-            uint32_t last_offset;
-            CHECKED_DECODE_ONE(mmdb,
-                               last_offset =
-                                   entry_data_list->entry_data.pointer,
-                               &entry_data_list->entry_data);
+    value_header_s value;
+    int status = decode_header(mmdb, offset, &value);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
 
+    uint32_t next = value.next;
+    int value_height = 0;
+    int child_height;
+    switch (value.type) {
+        case MMDB_DATA_TYPE_POINTER: {
+            value_header_s target;
+            status = decode_header(mmdb, value.payload, &target);
+            if (MMDB_SUCCESS != status) {
+                return status;
+            }
             /* Pointers to pointers are illegal under the spec */
-            if (entry_data_list->entry_data.type == MMDB_DATA_TYPE_POINTER) {
+            if (target.type == MMDB_DATA_TYPE_POINTER) {
                 DEBUG_MSG("pointer points to another pointer");
                 return MMDB_INVALID_DATA_ERROR;
             }
-
-            if (entry_data_list->entry_data.type == MMDB_DATA_TYPE_ARRAY ||
-                entry_data_list->entry_data.type == MMDB_DATA_TYPE_MAP) {
-
-                int status = get_entry_data_list(
-                    mmdb, last_offset, entry_data_list, pool, depth);
+            // As when decoding, a map or array behind a pointer counts as a
+            // level of its own.
+            bool const is_container = target.type == MMDB_DATA_TYPE_MAP ||
+                                      target.type == MMDB_DATA_TYPE_ARRAY;
+            int const levels = is_container ? 1 : 0;
+            status = verify_target(
+                state, value.payload, depth + levels, &child_height);
+            value_height = levels + child_height;
+            break;
+        }
+        case MMDB_DATA_TYPE_MAP:
+            /* Each map entry needs at least a key and a value. */
+            if (value.size > (mmdb->data_section_size - next) / 2) {
+                DEBUG_MSG("map size exceeds remaining data section");
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            for (uint32_t i = 0; i < value.size; i++) {
+                value_header_s key;
+                status = decode_header_follow(mmdb, next, &key);
+                if (MMDB_SUCCESS != status) {
+                    return status;
+                }
+                if (key.type != MMDB_DATA_TYPE_UTF8_STRING) {
+                    DEBUG_MSGF("map key of type %d", key.type);
+                    return MMDB_INVALID_DATA_ERROR;
+                }
+                // The key is a string, so only the value can have levels
+                // below it.
+                status = verify_value(
+                    state, next, depth + 1, &next, &child_height);
+                if (MMDB_SUCCESS != status) {
+                    return status;
+                }
+                status = verify_value(
+                    state, next, depth + 1, &next, &child_height);
                 if (MMDB_SUCCESS != status) {
-                    DEBUG_MSG("get_entry_data_list on pointer failed.");
                     return status;
                 }
+                if (1 + child_height > value_height) {
+                    value_height = 1 + child_height;
+                }
             }
-            entry_data_list->entry_data.offset_to_next = next_offset;
-        } break;
-        case MMDB_DATA_TYPE_ARRAY: {
-            uint32_t array_size = entry_data_list->entry_data.data_size;
-            uint32_t array_offset = entry_data_list->entry_data.offset_to_next;
+            break;
+        case MMDB_DATA_TYPE_ARRAY:
             /* Each array element needs at least 1 byte. */
-            if (array_offset > mmdb->data_section_size ||
-                array_size > mmdb->data_section_size - array_offset) {
+            if (value.size > mmdb->data_section_size - next) {
                 DEBUG_MSG("array size exceeds remaining data section");
                 return MMDB_INVALID_DATA_ERROR;
             }
-            while (array_size-- > 0) {
-                MMDB_entry_data_list_s *entry_data_list_to =
-                    data_pool_alloc(pool);
-                if (!entry_data_list_to) {
-                    return MMDB_OUT_OF_MEMORY_ERROR;
-                }
-
-                int status = get_entry_data_list(
-                    mmdb, array_offset, entry_data_list_to, pool, depth);
+            for (uint32_t i = 0; i < value.size; i++) {
+                status = verify_value(
+                    state, next, depth + 1, &next, &child_height);
                 if (MMDB_SUCCESS != status) {
-                    DEBUG_MSG("get_entry_data_list on array element failed.");
                     return status;
                 }
-
-                array_offset = entry_data_list_to->entry_data.offset_to_next;
+                if (1 + child_height > value_height) {
+                    value_height = 1 + child_height;
+                }
             }
-            entry_data_list->entry_data.offset_to_next = array_offset;
-
-        } break;
-        case MMDB_DATA_TYPE_MAP: {
-            uint32_t size = entry_data_list->entry_data.data_size;
-
-            offset = entry_data_list->entry_data.offset_to_next;
-            /* Each map entry needs at least a key and a value (1 byte each). */
-            if (offset > mmdb->data_section_size ||
-                size > (mmdb->data_section_size - offset) / 2) {
-                DEBUG_MSG("map size exceeds remaining data section");
+            break;
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            if (!is_valid_utf8(&mmdb->data_section[value.payload],
+                               value.size)) {
+                DEBUG_MSG("string is not valid UTF-8");
                 return MMDB_INVALID_DATA_ERROR;
             }
-            while (size-- > 0) {
-                MMDB_entry_data_list_s *list_key = data_pool_alloc(pool);
-                if (!list_key) {
-                    return MMDB_OUT_OF_MEMORY_ERROR;
-                }
+            break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            if (value.size > 1) {
+                DEBUG_MSGF("boolean of size %d", value.size);
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            break;
+        case MMDB_DATA_TYPE_DOUBLE:
+        case MMDB_DATA_TYPE_BYTES:
+        case MMDB_DATA_TYPE_UINT16:
+        case MMDB_DATA_TYPE_UINT32:
+        case MMDB_DATA_TYPE_INT32:
+        case MMDB_DATA_TYPE_UINT64:
+        case MMDB_DATA_TYPE_UINT128:
+        case MMDB_DATA_TYPE_FLOAT:
+            // decode_header() has checked their sizes.
+            break;
+        default:
+            DEBUG_MSGF("unexpected data type %d", value.type);
+            return MMDB_INVALID_DATA_ERROR;
+    }
 
-                int status =
-                    get_entry_data_list(mmdb, offset, list_key, pool, depth);
-                if (MMDB_SUCCESS != status) {
-                    DEBUG_MSG("get_entry_data_list on map key failed.");
-                    return status;
-                }
+    *next_offset = next;
+    *height = value_height;
+    return status;
+}
 
-                offset = list_key->entry_data.offset_to_next;
+/* Checks for well-formed UTF-8 as defined in RFC 3629, which rules out
+ * overlong encodings, surrogates and code points above U+10FFFF. */
+static bool is_valid_utf8(const uint8_t *string, uint32_t size) {
+    uint32_t i = 0;
+    while (i < size) {
+        uint8_t const c = string[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
 
-                MMDB_entry_data_list_s *list_value = data_pool_alloc(pool);
-                if (!list_value) {
-                    return MMDB_OUT_OF_MEMORY_ERROR;
-                }
+        uint32_t length;
+        uint8_t min = 0x80;
+        uint8_t max = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            length = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            length = 3;
+            if (c == 0xE0) {
+                min = 0xA0;
+            } else if (c == 0xED) {
+                max = 0x9F;
+            }
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            length = 4;
+            if (c == 0xF0) {
+                min = 0x90;
+            } else if (c == 0xF4) {
+                max = 0x8F;
+            }
+        } else {
+            return false;
+        }
 
-                status =
-                    get_entry_data_list(mmdb, offset, list_value, pool, depth);
-                if (MMDB_SUCCESS != status) {
-                    DEBUG_MSG("get_entry_data_list on map element failed.");
-                    return status;
-                }
-                offset = list_value->entry_data.offset_to_next;
+        if (length > size - i || string[i + 1] < min || string[i + 1] > max) {
+            return false;
+        }
+        for (uint32_t j = 2; j < length; j++) {
+            if ((string[i + j] & 0xC0) != 0x80) {
+                return false;
             }
-            entry_data_list->entry_data.offset_to_next = offset;
-        } break;
-        default:
-            break;
+        }
+        i += length;
     }
-
-    return MMDB_SUCCESS;
+    return true;
 }
 
-#ifndef __has_builtin
-    #define __has_builtin(x) 0
+int MMDB_get_value(MMDB_entry_s *const start,
+                   MMDB_entry_data_s *const entry_data,
+                   ...) {
+    va_list path;
+    va_start(path, entry_data);
+    int status = MMDB_vget_value(start, entry_data, path);
+    va_end(path);
+    return status;
+}
+
+int MMDB_vget_value(MMDB_entry_s *const start,
+                    MMDB_entry_data_s *const entry_data,
+                    va_list va_path) {
+    size_t length = path_length(va_path);
+    const char *path_elem;
+    int i = 0;
+
+    if (length == SIZE_MAX) {
+        return MMDB_INVALID_METADATA_ERROR;
+    }
+
+    const char **path = calloc(length + 1, sizeof(const char *));
+    if (NULL == path) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    while (NULL != (path_elem = va_arg(va_path, char *))) {
+        path[i] = path_elem;
+        i++;
+    }
+    path[i] = NULL;
+
+    int status = MMDB_aget_value(start, entry_data, path);
+
+    free(path);
+
+    return status;
+}
+
+static size_t path_length(va_list va_path) {
+    size_t i = 0;
+    va_list path_copy;
+    va_copy(path_copy, va_path);
+
+    while (NULL != va_arg(path_copy, char *)) {
+        i++;
+    }
+
+    va_end(path_copy);
+
+    return i;
+}
+
+int MMDB_aget_value(MMDB_entry_s *const start,
+                    MMDB_entry_data_s *const entry_data,
+                    const char *const *const path) {
+    memset(entry_data, 0, sizeof(MMDB_entry_data_s));
+    DEBUG_NL;
+    DEBUG_MSG("looking up value by path");
+
+    MMDB_s checked;
+    const MMDB_s *const mmdb = entry_database(start, &checked);
+    uint32_t offset;
+    value_header_s value;
+    int status = lookup_path(mmdb, start->offset, path, &offset, &value);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    // Only the value found is decoded in full.
+    status = decode_one_follow(mmdb, offset, entry_data);
+    if (MMDB_SUCCESS != status) {
+        memset(entry_data, 0, sizeof(MMDB_entry_data_s));
+    }
+    return status;
+}
+
+int MMDB_get_utf8(const MMDB_entry_s *const start,
+                  const char *const *const path,
+                  const char **const value,
+                  uint32_t *const length) {
+    MMDB_s checked;
+    const MMDB_s *const mmdb = entry_database(start, &checked);
+    uint32_t offset;
+    value_header_s header;
+    int status = lookup_path(mmdb, start->offset, path, &offset, &header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (header.type != MMDB_DATA_TYPE_UTF8_STRING) {
+        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    }
+
+    *value = header.size == 0
+                 ? ""
+                 : (const char *)&mmdb->data_section[header.payload];
+    *length = header.size;
+    return MMDB_SUCCESS;
+}
+
+int MMDB_get_double(const MMDB_entry_s *const start,
+                    const char *const *const path,
+                    double *const value) {
+    MMDB_s checked;
+    const MMDB_s *const mmdb = entry_database(start, &checked);
+    uint32_t offset;
+    value_header_s header;
+    int status = lookup_path(mmdb, start->offset, path, &offset, &header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    const uint8_t *payload = &mmdb->data_section[header.payload];
+    if (header.type == MMDB_DATA_TYPE_DOUBLE) {
+        *value = get_ieee754_double(payload);
+    } else if (header.type == MMDB_DATA_TYPE_FLOAT) {
+        *value = get_ieee754_float(payload);
+    } else {
+        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    }
+    return MMDB_SUCCESS;
+}
+
+int MMDB_get_uint32(const MMDB_entry_s *const start,
+                    const char *const *const path,
+                    uint32_t *const value) {
+    MMDB_s checked;
+    const MMDB_s *const mmdb = entry_database(start, &checked);
+    uint32_t offset;
+    value_header_s header;
+    int status = lookup_path(mmdb, start->offset, path, &offset, &header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (header.type != MMDB_DATA_TYPE_UINT16 &&
+        header.type != MMDB_DATA_TYPE_UINT32) {
+        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    }
+
+    *value = (uint32_t)get_uintX(&mmdb->data_section[header.payload],
+                                 (int)header.size);
+    return MMDB_SUCCESS;
+}
+
+int MMDB_get_uint64(const MMDB_entry_s *const start,
+                    const char *const *const path,
+                    uint64_t *const value) {
+    MMDB_s checked;
+    const MMDB_s *const mmdb = entry_database(start, &checked);
+    uint32_t offset;
+    value_header_s header;
+    int status = lookup_path(mmdb, start->offset, path, &offset, &header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (header.type != MMDB_DATA_TYPE_UINT16 &&
+        header.type != MMDB_DATA_TYPE_UINT32 &&
+        header.type != MMDB_DATA_TYPE_UINT64) {
+        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    }
+
+    *value = get_uintX(&mmdb->data_section[header.payload],
+                       (int)header.size);
+    return MMDB_SUCCESS;
+}
+
+int MMDB_get_bool(const MMDB_entry_s *const start,
+                  const char *const *const path,
+                  bool *const value) {
+    MMDB_s checked;
+    const MMDB_s *const mmdb = entry_database(start, &checked);
+    uint32_t offset;
+    value_header_s header;
+    int status = lookup_path(mmdb, start->offset, path, &offset, &header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (header.type != MMDB_DATA_TYPE_BOOLEAN) {
+        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    }
+
+    *value = header.size != 0;
+    return MMDB_SUCCESS;
+}
+
+int MMDB_schema_new(const MMDB_schema_field_s *const fields,
+                    size_t field_count,
+                    MMDB_schema_s **const schema) {
+    *schema = NULL;
+
+    // Every element of every path needs at most one node and a copy of its
+    // key, so the schema is allocated at once from the total of both.
+    size_t node_count = 1;
+    size_t strings_size = 0;
+    for (size_t i = 0; i < field_count; i++) {
+        if (NULL == fields[i].path || NULL == fields[i].path[0] ||
+            !schema_type_is_supported(fields[i].type)) {
+            return MMDB_INVALID_LOOKUP_PATH_ERROR;
+        }
+        for (const char *const *elem = fields[i].path; NULL != *elem; elem++) {
+            size_t length = strlen(*elem);
+            if (length > UINT32_MAX ||
+                strings_size > SIZE_MAX - length - 1 ||
+                node_count >= UINT32_MAX) {
+                return MMDB_INVALID_LOOKUP_PATH_ERROR;
+            }
+            strings_size += length + 1;
+            node_count++;
+        }
+    }
+    if (node_count >
+        (SIZE_MAX - sizeof(MMDB_schema_s) - strings_size) /
+            sizeof(schema_node_s)) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    MMDB_schema_s *new_schema =
+        malloc(sizeof(MMDB_schema_s) + node_count * sizeof(schema_node_s) +
+               strings_size);
+    if (NULL == new_schema) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    new_schema->node_count = 1;
+    memset(&new_schema->nodes[0], 0, sizeof(schema_node_s));
+    char *strings = (char *)&new_schema->nodes[node_count];
+
+    for (size_t i = 0; i < field_count; i++) {
+        int status = schema_add_field(new_schema, &fields[i], &strings);
+        if (MMDB_SUCCESS != status) {
+            free(new_schema);
+            return status;
+        }
+    }
+
+    *schema = new_schema;
+    return MMDB_SUCCESS;
+}
+
+/* Adds the nodes for the path of a field that aren't in the schema yet. A
+ * field's path may not be the same as or lead through another field's. */
+static int schema_add_field(MMDB_schema_s *const schema,
+                            const MMDB_schema_field_s *const field,
+                            char **const strings) {
+    uint32_t parent = 0;
+    for (const char *const *elem = field->path; NULL != *elem; elem++) {
+        if (schema->nodes[parent].is_field) {
+            return MMDB_INVALID_LOOKUP_PATH_ERROR;
+        }
+
+        size_t length = strlen(*elem);
+        uint32_t child = schema->nodes[parent].first_child;
+        uint32_t last = 0;
+        while (0 != child) {
+            const schema_node_s *node = &schema->nodes[child];
+            if (node->key_length == length &&
+                !memcmp(node->key, *elem, length)) {
+                break;
+            }
+            last = child;
+            child = node->next_sibling;
+        }
+
+        if (0 == child) {
+            child = schema->node_count++;
+            schema_node_s *node = &schema->nodes[child];
+            memset(node, 0, sizeof(schema_node_s));
+
+            memcpy(*strings, *elem, length + 1);
+            node->key = *strings;
+            node->key_length = (uint32_t)length;
+            *strings += length + 1;
+
+            // Path elements are used as array indexes the same way as by
+            // lookup_path_in_array().
+            char *first_invalid;
+            int saved_errno = errno;
+            errno = 0;
+            node->index = strtol(node->key, &first_invalid, 10);
+            node->has_index = ERANGE != errno && !*first_invalid;
+            errno = saved_errno;
+
+            if (0 == last) {
+                schema->nodes[parent].first_child = child;
+            } else {
+                schema->nodes[last].next_sibling = child;
+            }
+            schema->nodes[parent].child_count++;
+        } else if (NULL == elem[1]) {
+            // The field's path is the same as another field's path or leads
+            // to another field.
+            return MMDB_INVALID_LOOKUP_PATH_ERROR;
+        }
+        parent = child;
+    }
+
+    schema_node_s *node = &schema->nodes[parent];
+    node->is_field = true;
+    node->type = field->type;
+    node->offset = field->offset;
+    return MMDB_SUCCESS;
+}
+
+static bool schema_type_is_supported(uint32_t type) {
+    switch (type) {
+        case MMDB_DATA_TYPE_UTF8_STRING:
+        case MMDB_DATA_TYPE_DOUBLE:
+        case MMDB_DATA_TYPE_FLOAT:
+        case MMDB_DATA_TYPE_UINT16:
+        case MMDB_DATA_TYPE_UINT32:
+        case MMDB_DATA_TYPE_UINT64:
+        case MMDB_DATA_TYPE_INT32:
+        case MMDB_DATA_TYPE_BOOLEAN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void MMDB_schema_free(MMDB_schema_s *const schema) { free(schema); }
+
+int MMDB_schema_decode(const MMDB_schema_s *const schema,
+                       const MMDB_entry_s *const entry,
+                       void *const output) {
+    MMDB_s checked;
+    uint32_t next_offset;
+    return schema_decode_node(entry_database(entry, &checked),
+                              schema,
+                              &schema->nodes[0],
+                              entry->offset,
+                              0,
+                              false,
+                              &next_offset,
+                              output);
+}
+
+/* Decodes the fields under node from the value at offset, which is read once
+ * from start to end. Only the control bytes of values that aren't in the
+ * schema are read. When need_next is false the caller doesn't need the offset
+ * after the value, so a map or array is left as soon as all of the fields
+ * under node have been found. This is always the case for maps reached through
+ * a pointer, such as those shared by many records. */
+static int schema_decode_node(const MMDB_s *const mmdb,
+                              const MMDB_schema_s *const schema,
+                              const schema_node_s *const node,
+                              uint32_t offset,
+                              int depth,
+                              bool need_next,
+                              uint32_t *const next_offset,
+                              void *const output) {
+    if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        DEBUG_MSG("reached the maximum data structure depth");
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    value_header_s value;
+    int status = decode_header(mmdb, offset, &value);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (value.type == MMDB_DATA_TYPE_POINTER) {
+        *next_offset = value.next;
+        need_next = false;
+        status = decode_header(mmdb, value.payload, &value);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+        /* Pointers to pointers are illegal under the spec */
+        if (value.type == MMDB_DATA_TYPE_POINTER) {
+            DEBUG_MSG("pointer points to another pointer");
+            return MMDB_INVALID_DATA_ERROR;
+        }
+    } else {
+        *next_offset = value.next;
+    }
+
+    if (node->is_field) {
+        status = schema_store_value(mmdb, node, &value, output);
+        if (MMDB_SUCCESS != status || !need_next) {
+            return status;
+        }
+        return skip_value(mmdb, offset, depth, next_offset);
+    }
+
+    // A path that leads into a value that isn't a map or array is missing
+    // from the record, like a key that isn't in a map.
+    if (value.type != MMDB_DATA_TYPE_MAP &&
+        value.type != MMDB_DATA_TYPE_ARRAY) {
+        return MMDB_SUCCESS;
+    }
+
+    uint32_t next = value.next;
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < value.size; i++) {
+        if (found == node->child_count && !need_next) {
+            return MMDB_SUCCESS;
+        }
+
+        const schema_node_s *child;
+        if (value.type == MMDB_DATA_TYPE_MAP) {
+            value_header_s key;
+            status = decode_header_follow(mmdb, next, &key);
+            if (MMDB_SUCCESS != status) {
+                return status;
+            }
+            if (MMDB_DATA_TYPE_UTF8_STRING != key.type) {
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            child = schema_find_key(schema, node, mmdb, &key);
+            next = key.next;
+        } else {
+            child = schema_find_index(schema, node, i, value.size);
+        }
+
+        if (NULL == child) {
+            status = skip_value(mmdb, next, depth + 1, &next);
+        } else {
+            found++;
+            status = schema_decode_node(mmdb,
+                                        schema,
+                                        child,
+                                        next,
+                                        depth + 1,
+                                        need_next ||
+                                            found < node->child_count,
+                                        &next,
+                                        output);
+        }
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
+
+    if (need_next) {
+        *next_offset = next;
+    }
+    return MMDB_SUCCESS;
+}
+
+static const schema_node_s *
+schema_find_key(const MMDB_schema_s *const schema,
+                const schema_node_s *const node,
+                const MMDB_s *const mmdb,
+                const value_header_s *const key) {
+    for (uint32_t child = node->first_child; 0 != child;
+         child = schema->nodes[child].next_sibling) {
+        const schema_node_s *candidate = &schema->nodes[child];
+        if (candidate->key_length == key->size &&
+            !memcmp(candidate->key,
+                    &mmdb->data_section[key->payload],
+                    key->size)) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+static const schema_node_s *
+schema_find_index(const MMDB_schema_s *const schema,
+                  const schema_node_s *const node,
+                  uint32_t index,
+                  uint32_t size) {
+    for (uint32_t child = node->first_child; 0 != child;
+         child = schema->nodes[child].next_sibling) {
+        const schema_node_s *candidate = &schema->nodes[child];
+        if (!candidate->has_index) {
+            continue;
+        }
+        long wanted = candidate->index;
+        if (wanted < 0) {
+            wanted += size;
+        }
+        if (wanted >= 0 && (unsigned long)wanted == index) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+/* Writes a value to the output at the offset of the field, converting it to
+ * the field's type. Integers may be widened, and a float may be stored in a
+ * double field. */
+static int schema_store_value(const MMDB_s *const mmdb,
+                              const schema_node_s *const node,
+                              const value_header_s *const value,
+                              void *const output) {
+    uint8_t *const field = (uint8_t *)output + node->offset;
+    const uint8_t *const payload = &mmdb->data_section[value->payload];
+
+    switch (node->type) {
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            if (value->type == MMDB_DATA_TYPE_UTF8_STRING) {
+                MMDB_string_view_s string = {
+                    .data = value->size == 0 ? "" : (const char *)payload,
+                    .length = value->size};
+                memcpy(field, &string, sizeof(string));
+                return MMDB_SUCCESS;
+            }
+            break;
+        case MMDB_DATA_TYPE_DOUBLE:
+            if (value->type == MMDB_DATA_TYPE_DOUBLE ||
+                value->type == MMDB_DATA_TYPE_FLOAT) {
+                double number = value->type == MMDB_DATA_TYPE_DOUBLE
+                                    ? get_ieee754_double(payload)
+                                    : get_ieee754_float(payload);
+                memcpy(field, &number, sizeof(number));
+                return MMDB_SUCCESS;
+            }
+            break;
+        case MMDB_DATA_TYPE_FLOAT:
+            if (value->type == MMDB_DATA_TYPE_FLOAT) {
+                float number = get_ieee754_float(payload);
+                memcpy(field, &number, sizeof(number));
+                return MMDB_SUCCESS;
+            }
+            break;
+        case MMDB_DATA_TYPE_UINT16:
+            if (value->type == MMDB_DATA_TYPE_UINT16) {
+                uint16_t number =
+                    (uint16_t)get_uintX(payload, (int)value->size);
+                memcpy(field, &number, sizeof(number));
+                return MMDB_SUCCESS;
+            }
+            break;
+        case MMDB_DATA_TYPE_UINT32:
+            if (value->type == MMDB_DATA_TYPE_UINT16 ||
+                value->type == MMDB_DATA_TYPE_UINT32) {
+                uint32_t number =
+                    (uint32_t)get_uintX(payload, (int)value->size);
+                memcpy(field, &number, sizeof(number));
+                return MMDB_SUCCESS;
+            }
+            break;
+        case MMDB_DATA_TYPE_UINT64:
+            if (value->type == MMDB_DATA_TYPE_UINT16 ||
+                value->type == MMDB_DATA_TYPE_UINT32 ||
+                value->type == MMDB_DATA_TYPE_UINT64) {
+                uint64_t number = get_uintX(payload, (int)value->size);
+                memcpy(field, &number, sizeof(number));
+                return MMDB_SUCCESS;
+            }
+            break;
+        case MMDB_DATA_TYPE_INT32:
+            if (value->type == MMDB_DATA_TYPE_INT32) {
+                int32_t number = get_sintX(payload, (int)value->size);
+                memcpy(field, &number, sizeof(number));
+                return MMDB_SUCCESS;
+            }
+            break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            if (value->type == MMDB_DATA_TYPE_BOOLEAN) {
+                bool boolean = value->size != 0;
+                memcpy(field, &boolean, sizeof(boolean));
+                return MMDB_SUCCESS;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+}
+
+/* Finds the value at path starting from the value at offset. The path is only
+ * walked with decode_header(), so nothing but the control bytes of the values
+ * passed over is read. value_offset is set to where the value found is, which
+ * may be a pointer to it, and value to its header with any pointer followed. */
+static int lookup_path(const MMDB_s *const mmdb,
+                       uint32_t offset,
+                       const char *const *const path,
+                       uint32_t *const value_offset,
+                       value_header_s *const value) {
+    int status = decode_header_follow(mmdb, offset, value);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    DEBUG_NL;
+    DEBUG_MSGF("top level element is a %s", type_num_to_name(value->type));
+
+    const char *path_elem;
+    int i = 0;
+    while (NULL != (path_elem = path[i++])) {
+        DEBUG_NL;
+        DEBUG_MSGF("path elem = %s", path_elem);
+
+        if (value->type == MMDB_DATA_TYPE_ARRAY) {
+            status = lookup_path_in_array(path_elem, mmdb, &offset, value);
+        } else if (value->type == MMDB_DATA_TYPE_MAP) {
+            status = lookup_path_in_map(path_elem, mmdb, &offset, value);
+        } else {
+            status = MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+        }
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
+
+    *value_offset = offset;
+    return MMDB_SUCCESS;
+}
+
+static int lookup_path_in_array(const char *path_elem,
+                                const MMDB_s *const mmdb,
+                                uint32_t *const offset,
+                                value_header_s *const value) {
+    uint32_t size = value->size;
+    char *first_invalid;
+
+    int saved_errno = errno;
+    errno = 0;
+    long array_index = strtol(path_elem, &first_invalid, 10);
+    if (ERANGE == errno) {
+        errno = saved_errno;
+        return MMDB_INVALID_LOOKUP_PATH_ERROR;
+    }
+    errno = saved_errno;
+
+    if (array_index < 0) {
+        array_index += size;
+
+        if (array_index < 0) {
+            return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+        }
+    }
+
+    if (*first_invalid || (unsigned long)array_index >= size) {
+        return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+    }
+
+    uint32_t next = value->next;
+    for (long i = 0; i < array_index; i++) {
+        /* We don't want to follow a pointer here. If the next element is a
+         * pointer we simply skip it and keep going */
+        int status = skip_value(mmdb, next, 0, &next);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
+
+    *offset = next;
+    return decode_header_follow(mmdb, next, value);
+}
+
+static int lookup_path_in_map(const char *path_elem,
+                              const MMDB_s *const mmdb,
+                              uint32_t *const offset,
+                              value_header_s *const value) {
+    uint32_t size = value->size;
+    uint32_t next = value->next;
+    size_t path_elem_len = strlen(path_elem);
+
+    while (size-- > 0) {
+        value_header_s key;
+        int status = decode_header_follow(mmdb, next, &key);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+
+        if (MMDB_DATA_TYPE_UTF8_STRING != key.type) {
+            return MMDB_INVALID_DATA_ERROR;
+        }
+
+        if (key.size == path_elem_len &&
+            !memcmp(path_elem, &mmdb->data_section[key.payload], key.size)) {
+
+            DEBUG_MSG("found key matching path elem");
+
+            *offset = key.next;
+            return decode_header_follow(mmdb, key.next, value);
+        }
+
+        /* We don't want to follow a pointer here. If the next element is a
+         * pointer we simply skip it and keep going */
+        status = skip_value(mmdb, key.next, 0, &next);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
+
+    return MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR;
+}
+
+/* Sets next_offset to the offset of the entry after the value at offset,
+ * passing over the contents of maps and arrays. A pointer is skipped rather
+ * than followed. */
+static int skip_value(const MMDB_s *const mmdb,
+                      uint32_t offset,
+                      int depth,
+                      uint32_t *const next_offset) {
+    if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        DEBUG_MSG("reached the maximum data structure depth");
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    value_header_s value;
+    int status = decode_header(mmdb, offset, &value);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    uint32_t next = value.next;
+    if (value.type == MMDB_DATA_TYPE_MAP) {
+        for (uint32_t i = 0; i < value.size; i++) {
+            value_header_s key;
+            status = decode_header(mmdb, next, &key);
+            if (MMDB_SUCCESS != status) {
+                return status;
+            }
+            status = skip_value(mmdb, key.next, depth + 1, &next);
+            if (MMDB_SUCCESS != status) {
+                return status;
+            }
+        }
+    } else if (value.type == MMDB_DATA_TYPE_ARRAY) {
+        for (uint32_t i = 0; i < value.size; i++) {
+            status = skip_value(mmdb, next, depth + 1, &next);
+            if (MMDB_SUCCESS != status) {
+                return status;
+            }
+        }
+    }
+
+    *next_offset = next;
+    return MMDB_SUCCESS;
+}
+
+/* Like decode_header(), but a pointer is followed to the value it points to.
+ * As with decode_one_follow(), the next offset is the one after the pointer
+ * unless it points to a map or array. */
+static int decode_header_follow(const MMDB_s *const mmdb,
+                                uint32_t offset,
+                                value_header_s *const header) {
+    int status = decode_header(mmdb, offset, header);
+    if (MMDB_SUCCESS != status || header->type != MMDB_DATA_TYPE_POINTER) {
+        return status;
+    }
+
+    uint32_t next = header->next;
+    status = decode_header(mmdb, header->payload, header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    /* Pointers to pointers are illegal under the spec */
+    if (header->type == MMDB_DATA_TYPE_POINTER) {
+        DEBUG_MSG("pointer points to another pointer");
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    if (header->type != MMDB_DATA_TYPE_MAP &&
+        header->type != MMDB_DATA_TYPE_ARRAY) {
+        header->next = next;
+    }
+    return MMDB_SUCCESS;
+}
+
+static int decode_one_follow(const MMDB_s *const mmdb,
+                             uint32_t offset,
+                             MMDB_entry_data_s *entry_data) {
+    CHECKED_DECODE_ONE(mmdb, offset, entry_data);
+    if (entry_data->type == MMDB_DATA_TYPE_POINTER) {
+        uint32_t next = entry_data->offset_to_next;
+        CHECKED_DECODE_ONE(mmdb, entry_data->pointer, entry_data);
+        /* Pointers to pointers are illegal under the spec */
+        if (entry_data->type == MMDB_DATA_TYPE_POINTER) {
+            DEBUG_MSG("pointer points to another pointer");
+            return MMDB_INVALID_DATA_ERROR;
+        }
+
+        /* The pointer could point to any part of the data section but the
+         * next entry for this particular offset may be the one after the
+         * pointer, not the one after whatever the pointer points to. This
+         * depends on whether the pointer points to something that is a simple
+         * value or a compound value. For a compound value, the next one is
+         * the one after the pointer result, not the one after the pointer. */
+        if (entry_data->type != MMDB_DATA_TYPE_MAP &&
+            entry_data->type != MMDB_DATA_TYPE_ARRAY) {
+
+            entry_data->offset_to_next = next;
+        }
+    }
+
+    return MMDB_SUCCESS;
+}
+
+#if !MMDB_UINT128_IS_BYTE_ARRAY
+static mmdb_uint128_t get_uint128(const uint8_t *p, int length) {
+    mmdb_uint128_t value = 0;
+    while (length-- > 0) {
+        value <<= 8;
+        value += *p++;
+    }
+    return value;
+}
+#endif
+
+static int decode_one(const MMDB_s *const mmdb,
+                      uint32_t offset,
+                      MMDB_entry_data_s *entry_data) {
+    const uint8_t *mem = mmdb->data_section;
+
+    value_header_s header;
+    int status = decode_header(mmdb, offset, &header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    entry_data->offset = offset;
+    entry_data->has_data = true;
+
+    uint32_t type = header.type;
+    uint32_t size = header.size;
+    const uint8_t *payload = &mem[header.payload];
+    entry_data->type = type;
+    entry_data->offset_to_next = header.next;
+
+    switch (type) {
+        case MMDB_DATA_TYPE_POINTER:
+            entry_data->pointer = header.payload;
+            entry_data->data_size = size;
+            break;
+        case MMDB_DATA_TYPE_MAP:
+        case MMDB_DATA_TYPE_ARRAY:
+            entry_data->data_size = size;
+            break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            entry_data->boolean = size ? true : false;
+            entry_data->data_size = 0;
+            DEBUG_MSGF("boolean value: %s",
+                       entry_data->boolean ? "true" : "false");
+            break;
+        case MMDB_DATA_TYPE_UINT16:
+            entry_data->uint16 = (uint16_t)get_uintX(payload, (int)size);
+            DEBUG_MSGF("uint16 value: %u", entry_data->uint16);
+            break;
+        case MMDB_DATA_TYPE_UINT32:
+            entry_data->uint32 = (uint32_t)get_uintX(payload, (int)size);
+            DEBUG_MSGF("uint32 value: %u", entry_data->uint32);
+            break;
+        case MMDB_DATA_TYPE_INT32:
+            entry_data->int32 = get_sintX(payload, (int)size);
+            DEBUG_MSGF("int32 value: %i", entry_data->int32);
+            break;
+        case MMDB_DATA_TYPE_UINT64:
+            entry_data->uint64 = get_uintX(payload, (int)size);
+            DEBUG_MSGF("uint64 value: %" PRIu64, entry_data->uint64);
+            break;
+        case MMDB_DATA_TYPE_UINT128:
+#if MMDB_UINT128_IS_BYTE_ARRAY
+            memset(entry_data->uint128, 0, 16);
+            if (size > 0) {
+                memcpy(entry_data->uint128 + 16 - size, payload, size);
+            }
+#else
+            entry_data->uint128 = get_uint128(payload, (int)size);
+#endif
+            break;
+        case MMDB_DATA_TYPE_FLOAT:
+            entry_data->float_value = get_ieee754_float(payload);
+            DEBUG_MSGF("float value: %f", entry_data->float_value);
+            break;
+        case MMDB_DATA_TYPE_DOUBLE:
+            entry_data->double_value = get_ieee754_double(payload);
+            DEBUG_MSGF("double value: %f", entry_data->double_value);
+            break;
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            entry_data->utf8_string = size == 0 ? "" : (char const *)payload;
+            entry_data->data_size = size;
+#ifdef MMDB_DEBUG
+            char *string =
+                mmdb_strndup(entry_data->utf8_string, size > 50 ? 50 : size);
+            if (NULL == string) {
+                abort();
+            }
+            DEBUG_MSGF("string value: %s", string);
+            free(string);
+#endif
+            break;
+        case MMDB_DATA_TYPE_BYTES:
+            entry_data->bytes = payload;
+            entry_data->data_size = size;
+            break;
+        default:
+            break;
+    }
+
+    return MMDB_SUCCESS;
+}
+
+/* Like decode_one(), but for the value at offset in the data section of an
+ * MMDB_cache_s. The header and any scalar that follows it are read into a
+ * buffer and decoded by decode_one() as if the data section started there,
+ * which checks the value against the real end of the section. Strings and
+ * bytes are copied to the data pool, as nothing may point into the cache. */
+static NOINLINE int cache_decode_one(MMDB_cache_s *const cache,
+                                     MMDB_data_pool_s *const pool,
+                                     uint32_t offset,
+                                     MMDB_entry_data_s *const entry_data) {
+    uint32_t const data_section_size = cache->mmdb.data_section_size;
+    if (offset >= data_section_size) {
+        DEBUG_MSGF("Offset (%d) past data section (%d)",
+                   offset,
+                   data_section_size);
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    uint8_t buffer[CACHE_SCALAR_MAX_SIZE];
+    uint32_t size = data_section_size - offset;
+    if (size > CACHE_SCALAR_MAX_SIZE) {
+        size = CACHE_SCALAR_MAX_SIZE;
+    }
+    int status = block_cache_read(
+        cache->blocks, cache->data_section_offset + offset, size, buffer);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    MMDB_s const window = {.data_section = buffer,
+                           .data_section_size = data_section_size - offset};
+    value_header_s header;
+    status = decode_header(&window, 0, &header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    if (header.type != MMDB_DATA_TYPE_UTF8_STRING &&
+        header.type != MMDB_DATA_TYPE_BYTES) {
+        status = decode_one(&window, 0, entry_data);
+        if (MMDB_SUCCESS == status) {
+            entry_data->offset = offset;
+            entry_data->offset_to_next += offset;
+        }
+        return status;
+    }
+
+    // As with decode_one(), an empty string is "" rather than a pointer to
+    // nothing.
+    uint8_t *bytes = (uint8_t *)"";
+    if (header.size > 0) {
+        bytes = data_pool_alloc_bytes(pool, header.size);
+        if (!bytes) {
+            return MMDB_OUT_OF_MEMORY_ERROR;
+        }
+        status = block_cache_read(cache->blocks,
+                                  cache->data_section_offset + offset +
+                                      header.payload,
+                                  header.size,
+                                  bytes);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
+
+    entry_data->offset = offset;
+    entry_data->offset_to_next = offset + header.next;
+    entry_data->has_data = true;
+    entry_data->type = header.type;
+    entry_data->data_size = header.size;
+    if (header.type == MMDB_DATA_TYPE_UTF8_STRING) {
+        entry_data->utf8_string = (const char *)bytes;
+    } else {
+        entry_data->bytes = bytes;
+    }
+    return MMDB_SUCCESS;
+}
+
+/* Reads the control byte and size of the value at offset and checks that the
+ * value fits in the data section, without decoding the value itself. This is
+ * enough to skip over a value or to read one scalar without filling in an
+ * MMDB_entry_data_s.
+ *
+ * MMDB_verify() has decoded every value that a lookup can reach in a database
+ * opened with MMDB_MODE_VERIFY, so the checks are left out for those. Entries
+ * that it didn't check are decoded with a copy of the database without
+ * MMDB_MODE_VERIFY, see entry_database(). */
+static int decode_header(const MMDB_s *const mmdb,
+                         uint32_t offset,
+                         value_header_s *const header) {
+    if (mmdb->flags & MMDB_MODE_VERIFY) {
+        return decode_header_bounds(mmdb, offset, false, header);
+    }
+    return decode_header_bounds(mmdb, offset, true, header);
+}
+
+static ALWAYS_INLINE int decode_header_bounds(const MMDB_s *const mmdb,
+                                              uint32_t offset,
+                                              bool check_bounds,
+                                              value_header_s *const header) {
+    const uint8_t *mem = mmdb->data_section;
+
+    if (check_bounds && mmdb->data_section_size == 0) {
+        // decode_one is also called with a fake mmdb whose data_section
+        // points at the metadata; either way an empty section is invalid.
+        DEBUG_MSG("decode_one called with an empty section");
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    // We subtract rather than add as it possible that offset + 1
+    // could overflow for a corrupt database while an underflow
+    // from data_section_size - 1 should not be possible.
+    if (check_bounds && offset > mmdb->data_section_size - 1) {
+        DEBUG_MSGF("Offset (%d) past data section (%d)",
+                   offset,
+                   mmdb->data_section_size);
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    DEBUG_NL;
+    DEBUG_MSGF("Offset: %i", offset);
+
+    uint8_t ctrl = mem[offset++];
+    DEBUG_BINARY("Control byte: %s", ctrl);
+
+    int type = (ctrl >> 5) & 7;
+    DEBUG_MSGF("Type: %i (%s)", type, type_num_to_name(type));
+
+    if (type == MMDB_DATA_TYPE_EXTENDED) {
+        // Subtracting 1 to avoid possible overflow on offset + 1
+        if (check_bounds && offset > mmdb->data_section_size - 1) {
+            DEBUG_MSGF("Extended type offset (%d) past data section (%d)",
+                       offset,
+                       mmdb->data_section_size);
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        type = get_ext_type(mem[offset++]);
+        DEBUG_MSGF("Extended type: %i (%s)", type, type_num_to_name(type));
+    }
+
+    header->type = (uint32_t)type;
+
+    if (type == MMDB_DATA_TYPE_POINTER) {
+        uint8_t psize = ((ctrl >> 3) & 3) + 1;
+        DEBUG_MSGF("Pointer size: %i", psize);
+
+        // We check that the offset does not extend past the end of the
+        // database and that the subtraction of psize did not underflow.
+        if (check_bounds && (offset > mmdb->data_section_size - psize ||
+                             mmdb->data_section_size < psize)) {
+            DEBUG_MSGF("Pointer offset (%d) past data section (%d)",
+                       offset + psize,
+                       mmdb->data_section_size);
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        header->payload = get_ptr_from(ctrl, &mem[offset], psize);
+        DEBUG_MSGF("Pointer to: %i", header->payload);
+
+        header->size = psize;
+        header->next = offset + psize;
+        return MMDB_SUCCESS;
+    }
+
+    uint32_t size = ctrl & 31;
+    switch (size) {
+        case 29:
+            // We subtract when checking offset to avoid possible overflow
+            if (check_bounds && offset > mmdb->data_section_size - 1) {
+                DEBUG_MSGF("String end (%d, case 29) past data section (%d)",
+                           offset,
+                           mmdb->data_section_size);
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            size = 29 + mem[offset++];
+            break;
+        case 30:
+            // We subtract when checking offset to avoid possible overflow
+            if (check_bounds && offset > mmdb->data_section_size - 2) {
+                DEBUG_MSGF("String end (%d, case 30) past data section (%d)",
+                           offset,
+                           mmdb->data_section_size);
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            size = 285 + get_uint16(&mem[offset]);
+            offset += 2;
+            break;
+        case 31:
+            // We subtract when checking offset to avoid possible overflow
+            if (check_bounds && offset > mmdb->data_section_size - 3) {
+                DEBUG_MSGF("String end (%d, case 31) past data section (%d)",
+                           offset,
+                           mmdb->data_section_size);
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            size = 65821 + get_uint24(&mem[offset]);
+            offset += 3;
+            break;
+        default:
+            break;
+    }
+
+    DEBUG_MSGF("Size: %i", size);
+
+    header->size = size;
+    header->payload = offset;
+
+    // Maps and arrays are followed by their contents and booleans store
+    // their value in the size.
+    if (type == MMDB_DATA_TYPE_MAP || type == MMDB_DATA_TYPE_ARRAY ||
+        type == MMDB_DATA_TYPE_BOOLEAN) {
+        header->next = offset;
+        return MMDB_SUCCESS;
+    }
+
+    // Check that the data doesn't extend past the end of the memory
+    // buffer and that the calculation in doing this did not underflow.
+    if (check_bounds && (offset > mmdb->data_section_size - size ||
+                         mmdb->data_section_size < size)) {
+        DEBUG_MSGF("Data end (%d) past data section (%d)",
+                   offset + size,
+                   mmdb->data_section_size);
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    header->next = offset + size;
+    // MMDB_verify() has also checked the sizes of the scalars.
+    if (!check_bounds) {
+        return MMDB_SUCCESS;
+    }
+
+    uint32_t maximum_size = UINT32_MAX;
+    switch (type) {
+        case MMDB_DATA_TYPE_UINT16:
+            maximum_size = 2;
+            break;
+        case MMDB_DATA_TYPE_UINT32:
+        case MMDB_DATA_TYPE_INT32:
+            maximum_size = 4;
+            break;
+        case MMDB_DATA_TYPE_UINT64:
+            maximum_size = 8;
+            break;
+        case MMDB_DATA_TYPE_UINT128:
+            maximum_size = 16;
+            break;
+        case MMDB_DATA_TYPE_FLOAT:
+            if (size != 4) {
+                DEBUG_MSGF("float of size %d", size);
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            break;
+        case MMDB_DATA_TYPE_DOUBLE:
+            if (size != 8) {
+                DEBUG_MSGF("double of size %d", size);
+                return MMDB_INVALID_DATA_ERROR;
+            }
+            break;
+        default:
+            break;
+    }
+    if (size > maximum_size) {
+        DEBUG_MSGF("%s of size %d", type_num_to_name(type), size);
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    return MMDB_SUCCESS;
+}
+
+static int get_ext_type(int raw_ext_type) { return 7 + raw_ext_type; }
+
+static uint32_t
+get_ptr_from(uint8_t ctrl, uint8_t const *const ptr, int ptr_size) {
+    uint32_t new_offset;
+    switch (ptr_size) {
+        case 1:
+            new_offset = (uint32_t)((ctrl & 7) << 8) + ptr[0];
+            break;
+        case 2:
+            new_offset = 2048 + (uint32_t)((ctrl & 7) << 16) +
+                         (uint32_t)(ptr[0] << 8) + ptr[1];
+            break;
+        case 3:
+            new_offset =
+                2048 + 524288 + (uint32_t)((ctrl & 7) << 24) + get_uint24(ptr);
+            break;
+        case 4:
+        default:
+            new_offset = get_uint32(ptr);
+            break;
+    }
+    return new_offset;
+}
+
+int MMDB_get_metadata_as_entry_data_list(
+    const MMDB_s *const mmdb, MMDB_entry_data_list_s **const entry_data_list) {
+    MMDB_s metadata_db = make_fake_metadata_db(mmdb);
+
+    MMDB_entry_s metadata_start = {.mmdb = &metadata_db, .offset = 0};
+
+    return MMDB_get_entry_data_list(&metadata_start, entry_data_list);
+}
+
+int MMDB_get_entry_data_list(MMDB_entry_s *start,
+                             MMDB_entry_data_list_s **const entry_data_list) {
+    MMDB_s checked;
+    return pool_entry_data_list(entry_database(start, &checked),
+                                NULL,
+                                start->offset,
+                                entry_data_list);
+}
+
+/* Decodes the value at offset into a list in a new data pool, reading the
+ * values through the cache if there is one. */
+static int
+pool_entry_data_list(const MMDB_s *const mmdb,
+                     MMDB_cache_s *const cache,
+                     uint32_t offset,
+                     MMDB_entry_data_list_s **const entry_data_list) {
+    *entry_data_list = NULL;
+
+    MMDB_data_pool_s *const pool = data_pool_new(MMDB_POOL_INIT_SIZE);
+    if (!pool) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    entry_data_builder_s builder = {
+        .mmdb = mmdb, .cache = cache, .pool = pool, .frame_count = 0};
+    int const status = get_entry_data_list(&builder, offset);
+    if (MMDB_SUCCESS != status) {
+        data_pool_destroy(pool);
+        return status;
+    }
+
+    *entry_data_list = data_pool_to_list(pool);
+    if (!*entry_data_list) {
+        data_pool_destroy(pool);
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    return status;
+}
+
+void MMDB_entry_data_arena_init(MMDB_entry_data_arena_s *const arena,
+                                void *const memory,
+                                size_t size) {
+    arena->memory = memory;
+    arena->size = size;
+    arena->used = 0;
+}
+
+void MMDB_entry_data_arena_reset(MMDB_entry_data_arena_s *const arena) {
+    arena->used = 0;
+}
+
+int MMDB_get_entry_data_list_in_arena(
+    MMDB_entry_s *start,
+    MMDB_entry_data_arena_s *const arena,
+    MMDB_entry_data_list_s **const entry_data_list) {
+    *entry_data_list = NULL;
+
+    // List elements are put after what is already used and frames that
+    // don't fit on the C stack below the end of the arena, with both aligned.
+    uintptr_t const memory = (uintptr_t)arena->memory;
+    size_t const used = arena->used;
+    size_t const padding = (size_t)(ENTRY_DATA_ARENA_ALIGN -
+                                    (memory + used) % ENTRY_DATA_ARENA_ALIGN) %
+                           ENTRY_DATA_ARENA_ALIGN;
+    size_t const first = used + padding;
+    size_t const frames_end =
+        arena->size - (size_t)((memory + arena->size) % ENTRY_DATA_ARENA_ALIGN);
+    if (used > frames_end || padding > frames_end - used) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    arena->used = first;
+    MMDB_s checked;
+    entry_data_builder_s builder = {.mmdb = entry_database(start, &checked),
+                                    .arena = arena,
+                                    .frames_end = frames_end,
+                                    .frame_count = 0};
+    int const status = get_entry_data_list(&builder, start->offset);
+    if (MMDB_SUCCESS != status) {
+        arena->used = used;
+        return status;
+    }
+
+    // The elements are linked as they are allocated, so only the last one
+    // needs to be fixed up.
+    MMDB_entry_data_list_s *const last =
+        (MMDB_entry_data_list_s *)(memory + arena->used) - 1;
+    last->next = NULL;
+    *entry_data_list = (MMDB_entry_data_list_s *)(memory + first);
+    return MMDB_SUCCESS;
+}
+
+/* Decodes the value at offset and everything in it into a list, in the same
+ * order as the values are in the data section. This walks the data with an
+ * explicit stack of frames rather than by recursion, so it uses little of the
+ * C stack however deeply the data is nested. */
+static int get_entry_data_list(entry_data_builder_s *const builder,
+                               uint32_t offset) {
+    uint32_t next_offset = 0;
+    int status = entry_data_list_start_value(builder, offset, 0, &next_offset);
+
+    while (MMDB_SUCCESS == status && builder->frame_count > 0) {
+        entry_data_frame_s *frame =
+            entry_data_frame_at(builder, builder->frame_count - 1);
+
+        if (0 == frame->remaining) {
+            next_offset = frame->via_pointer ? frame->pointer_next
+                                             : frame->offset;
+            frame->container->entry_data.offset_to_next = next_offset;
+            builder->frame_count--;
+            if (builder->frame_count > 0) {
+                entry_data_frame_at(builder, builder->frame_count - 1)
+                    ->offset = next_offset;
+            }
+            continue;
+        }
+
+        frame->remaining--;
+        size_t const frame_count = builder->frame_count;
+        status = entry_data_list_start_value(
+            builder, frame->offset, frame->depth, &next_offset);
+        // A map or array pushes a frame and sets the offset of this one once
+        // it is done.
+        if (MMDB_SUCCESS == status && builder->frame_count == frame_count) {
+            entry_data_frame_at(builder, frame_count - 1)->offset =
+                next_offset;
+        } else if (MMDB_SUCCESS == status) {
+            prefetch_next_sibling(builder, frame_count - 1);
+        }
+    }
+
+    free(builder->heap_frames);
+    builder->heap_frames = NULL;
+    return status;
+}
+
+/* Adds the value at offset to the list. If it is a map or array, or a
+ * pointer to one, a frame is pushed for its contents. Otherwise next_offset is
+ * set to the offset of the value after it. */
+static int entry_data_list_start_value(entry_data_builder_s *const builder,
+                                       uint32_t offset,
+                                       int depth,
+                                       uint32_t *const next_offset) {
+    if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        DEBUG_MSG("reached the maximum data structure depth");
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    const MMDB_s *const mmdb = builder->mmdb;
+    MMDB_entry_data_list_s *const entry_data_list =
+        entry_data_list_alloc(builder);
+    if (!entry_data_list) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    MMDB_entry_data_s *const entry_data = &entry_data_list->entry_data;
+    int status = builder_decode_one(builder, offset, entry_data);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    bool via_pointer = false;
+    uint32_t pointer_next = 0;
+    if (entry_data->type == MMDB_DATA_TYPE_POINTER) {
+        pointer_next = entry_data->offset_to_next;
+        status = builder_decode_one(builder, entry_data->pointer, entry_data);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+
+        /* Pointers to pointers are illegal under the spec */
+        if (entry_data->type == MMDB_DATA_TYPE_POINTER) {
+            DEBUG_MSG("pointer points to another pointer");
+            return MMDB_INVALID_DATA_ERROR;
+        }
+
+        if (entry_data->type != MMDB_DATA_TYPE_ARRAY &&
+            entry_data->type != MMDB_DATA_TYPE_MAP) {
+            entry_data->offset_to_next = pointer_next;
+            *next_offset = pointer_next;
+            return MMDB_SUCCESS;
+        }
+
+        // The map or array pointed to counts as a level of its own.
+        depth++;
+        if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+            DEBUG_MSG("reached the maximum data structure depth");
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        via_pointer = true;
+    }
+
+    uint32_t remaining;
+    uint32_t const contents = entry_data->offset_to_next;
+    if (entry_data->type == MMDB_DATA_TYPE_ARRAY) {
+        /* Each array element needs at least 1 byte. */
+        if (contents > mmdb->data_section_size ||
+            entry_data->data_size > mmdb->data_section_size - contents) {
+            DEBUG_MSG("array size exceeds remaining data section");
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        remaining = entry_data->data_size;
+    } else if (entry_data->type == MMDB_DATA_TYPE_MAP) {
+        /* Each map entry needs at least a key and a value (1 byte each). */
+        if (contents > mmdb->data_section_size ||
+            entry_data->data_size > (mmdb->data_section_size - contents) / 2) {
+            DEBUG_MSG("map size exceeds remaining data section");
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        remaining = entry_data->data_size * 2;
+    } else {
+        *next_offset = entry_data->offset_to_next;
+        return MMDB_SUCCESS;
+    }
+
+    entry_data_frame_s *const frame = entry_data_frame_push(builder);
+    if (!frame) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    frame->container = entry_data_list;
+    frame->remaining = remaining;
+    frame->offset = contents;
+    frame->pointer_next = pointer_next;
+    frame->via_pointer = via_pointer;
+    frame->depth = depth + 1;
+    return MMDB_SUCCESS;
+}
+
+static int builder_decode_one(const entry_data_builder_s *const builder,
+                              uint32_t offset,
+                              MMDB_entry_data_s *const entry_data) {
+    if (builder->cache) {
+        return cache_decode_one(
+            builder->cache, builder->pool, offset, entry_data);
+    }
+    return decode_one(builder->mmdb, offset, entry_data);
+}
+
+/* Records are mostly pointers to maps shared with other records, such as a
+ * city or a country, and each of these is likely to be a cache miss. When the
+ * frame just pushed is for a map or array reached through a pointer, where
+ * the next value in its parent starts is already known. If that value is a
+ * pointer too, this prefetches what it points to so that the miss overlaps
+ * with decoding the contents of the current one.
+ *
+ * This runs for every map and array reached through a pointer, so it only
+ * reads the control bytes it needs rather than calling decode_header(), and
+ * gives up on anything but the usual pointer or short string keys. A target
+ * within PREFETCH_MIN_DISTANCE bytes of the contents being decoded is left
+ * alone, as it is likely to be read with them anyway. The prefetch is only a
+ * hint, so bad data is left for decoding to report. */
+static void prefetch_next_sibling(entry_data_builder_s *const builder,
+                                  size_t parent_index) {
+    const entry_data_frame_s *const parent =
+        entry_data_frame_at(builder, parent_index);
+    const entry_data_frame_s *const frame =
+        entry_data_frame_at(builder, parent_index + 1);
+    // Values read through a cache aren't mapped, so there is nothing to
+    // prefetch.
+    if (builder->cache || !frame->via_pointer || 0 == parent->remaining) {
+        return;
+    }
+
+    const uint8_t *const mem = builder->mmdb->data_section;
+    uint32_t const size = builder->mmdb->data_section_size;
+    uint32_t offset = frame->pointer_next;
+    if (offset >= size) {
+        return;
+    }
+    // A map or array can only be the value of a map entry, so in a map the
+    // key of the next entry comes first.
+    if (parent->container->entry_data.type == MMDB_DATA_TYPE_MAP) {
+        uint8_t const key = mem[offset];
+        if (key >> 5 == MMDB_DATA_TYPE_POINTER) {
+            offset += 2U + ((key >> 3) & 3U);
+        } else if (key >> 5 == MMDB_DATA_TYPE_UTF8_STRING &&
+                   (key & 0x1FU) < 29) {
+            offset += 1U + (key & 0x1FU);
+        } else {
+            return;
+        }
+        if (offset >= size) {
+            return;
+        }
+    }
+
+    uint8_t const ctrl = mem[offset];
+    int const psize = ((ctrl >> 3) & 3) + 1;
+    if (ctrl >> 5 != MMDB_DATA_TYPE_POINTER ||
+        size - offset <= (uint32_t)psize) {
+        return;
+    }
+    uint32_t const target = get_ptr_from(ctrl, &mem[offset + 1], psize);
+    uint32_t const distance =
+        target > frame->offset ? target - frame->offset
+                               : frame->offset - target;
+    if (target < size && distance > PREFETCH_MIN_DISTANCE) {
+        PREFETCH(&mem[target]);
+    }
+}
+
+static MMDB_entry_data_list_s *
+entry_data_list_alloc(entry_data_builder_s *const builder) {
+    if (builder->pool) {
+        return data_pool_alloc(builder->pool);
+    }
+
+    MMDB_entry_data_arena_s *const arena = builder->arena;
+    size_t const size = sizeof(MMDB_entry_data_list_s);
+    size_t const limit =
+        builder->frames_end -
+        builder->spilled_capacity * sizeof(entry_data_frame_s);
+    if (arena->used > limit || size > limit - arena->used) {
+        return NULL;
+    }
+    MMDB_entry_data_list_s *const entry_data_list =
+        (MMDB_entry_data_list_s *)((uint8_t *)arena->memory + arena->used);
+    memset(entry_data_list, 0, size);
+    arena->used += size;
+    // The next element is always allocated right after this one.
+    entry_data_list->next = entry_data_list + 1;
+    return entry_data_list;
+}
+
+static entry_data_frame_s *entry_data_frame_at(entry_data_builder_s *builder,
+                                               size_t index) {
+    if (index < ENTRY_DATA_INLINE_FRAMES) {
+        return &builder->inline_frames[index];
+    }
+    index -= ENTRY_DATA_INLINE_FRAMES;
+    if (builder->pool) {
+        return &builder->heap_frames[index];
+    }
+    entry_data_frame_s *const end =
+        (entry_data_frame_s *)((uint8_t *)builder->arena->memory +
+                               builder->frames_end);
+    return end - index - 1;
+}
+
+static entry_data_frame_s *
+entry_data_frame_push(entry_data_builder_s *const builder) {
+    size_t const index = builder->frame_count;
+    size_t const spilled = index < ENTRY_DATA_INLINE_FRAMES
+                               ? 0
+                               : index - ENTRY_DATA_INLINE_FRAMES + 1;
+    if (spilled > builder->spilled_capacity) {
+        if (builder->pool) {
+            size_t const capacity = builder->spilled_capacity * 2 + 16;
+            entry_data_frame_s *const frames = realloc(
+                builder->heap_frames, capacity * sizeof(entry_data_frame_s));
+            if (!frames) {
+                return NULL;
+            }
+            builder->heap_frames = frames;
+            builder->spilled_capacity = capacity;
+        } else {
+            // The frame takes the space below the lowest frame so far, which
+            // must not have been used for list elements yet.
+            size_t const limit =
+                builder->frames_end - spilled * sizeof(entry_data_frame_s);
+            if (spilled > builder->frames_end / sizeof(entry_data_frame_s) ||
+                builder->arena->used > limit) {
+                return NULL;
+            }
+            builder->spilled_capacity = spilled;
+        }
+    }
+    builder->frame_count++;
+    return entry_data_frame_at(builder, index);
+}
+
+#ifndef __has_builtin
+    #define __has_builtin(x) 0
 #endif
 
 static inline uint32_t mmdb_bswap32(uint32_t x) {
@@ -1859,102 +4811,713 @@ static inline uint64_t mmdb_bswap64(uint64_t x) {
 #endif
 }
 
-static float get_ieee754_float(const uint8_t *restrict p) {
-    float f;
-    uint32_t i;
+static float get_ieee754_float(const uint8_t *restrict p) {
+    float f;
+    uint32_t i;
+
+    memcpy(&i, p, sizeof(uint32_t));
+
+#if MMDB_LITTLE_ENDIAN
+    i = mmdb_bswap32(i);
+#endif
+
+    memcpy(&f, &i, sizeof(float));
+
+    return f;
+}
+
+static double get_ieee754_double(const uint8_t *restrict p) {
+    double d;
+    uint64_t i;
+
+    memcpy(&i, p, sizeof(uint64_t));
+
+#if MMDB_LITTLE_ENDIAN
+    i = mmdb_bswap64(i);
+#endif
+
+    memcpy(&d, &i, sizeof(double));
+
+    return d;
+}
+
+static uint32_t get_uint32(const uint8_t *p) {
+    return p[0] * 16777216U + p[1] * 65536 + p[2] * 256 + p[3];
+}
+
+static uint32_t get_uint24(const uint8_t *p) {
+    return p[0] * 65536U + p[1] * 256 + p[2];
+}
+
+static uint32_t get_uint16(const uint8_t *p) { return p[0] * 256U + p[1]; }
+
+static uint64_t get_uintX(const uint8_t *p, int length) {
+    uint64_t value = 0;
+    while (length-- > 0) {
+        value <<= 8;
+        value += *p++;
+    }
+    return value;
+}
+
+static int32_t get_sintX(const uint8_t *p, int length) {
+    return (int32_t)get_uintX(p, length);
+}
+
+void MMDB_free_entry_data_list(MMDB_entry_data_list_s *const entry_data_list) {
+    if (entry_data_list == NULL) {
+        return;
+    }
+    data_pool_destroy(entry_data_list->pool);
+}
+
+void MMDB_close(MMDB_s *const mmdb) { free_mmdb_struct(mmdb); }
+
+int MMDB_multi_open(const char *const *const filenames,
+                    size_t count,
+                    uint32_t flags,
+                    MMDB_multi_s *const multi) {
+    multi->count = 0;
+    multi->databases = calloc(count == 0 ? 1 : count, sizeof(MMDB_s));
+    if (NULL == multi->databases) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    for (; multi->count < count; multi->count++) {
+        int const status = MMDB_open(
+            filenames[multi->count], flags, &multi->databases[multi->count]);
+        if (MMDB_SUCCESS != status) {
+            int saved_errno = errno;
+            MMDB_multi_close(multi);
+            errno = saved_errno;
+            return status;
+        }
+    }
+
+    return MMDB_SUCCESS;
+}
+
+void MMDB_multi_close(MMDB_multi_s *const multi) {
+    for (size_t i = 0; i < multi->count; i++) {
+        MMDB_close(&multi->databases[i]);
+    }
+    FREE_AND_SET_NULL(multi->databases);
+    multi->count = 0;
+}
+
+int MMDB_cache_open(const char *const filename,
+                    size_t memory_budget,
+                    MMDB_cache_s **const cache) {
+    *cache = NULL;
+    MMDB_cache_s *const new_cache = calloc(1, sizeof(MMDB_cache_s));
+    if (!new_cache) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+    int const status = cache_open(new_cache, filename, memory_budget);
+    if (MMDB_SUCCESS != status) {
+        int saved_errno = errno;
+        MMDB_cache_close(new_cache);
+        errno = saved_errno;
+        return status;
+    }
+
+    *cache = new_cache;
+    return MMDB_SUCCESS;
+}
+
+/* Opens the file and reads the metadata, then splits the memory budget
+ * between the top levels of the search tree, which stay in memory, and the
+ * cache of blocks. The top levels get at most an eighth of it. */
+static int cache_open(MMDB_cache_s *const cache,
+                      const char *const filename,
+                      size_t memory_budget) {
+    cache->mmdb.filename = new_filename(filename);
+    if (NULL == cache->mmdb.filename) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+
+    opened_file_s file;
+    int status = open_file(filename, &file);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    uint64_t search_tree_size = 0;
+    status = cache_read_metadata(cache, &file);
+    if (MMDB_SUCCESS == status) {
+        status =
+            check_data_section(&cache->mmdb, file.size, &search_tree_size);
+    }
+    record_info_s const record_info = record_info_for_database(&cache->mmdb);
+    if (MMDB_SUCCESS == status && record_info.right_record_offset == 0) {
+        status = MMDB_UNKNOWN_DATABASE_FORMAT_ERROR;
+    }
+    if (MMDB_SUCCESS != status) {
+        close_file(&file);
+        return status;
+    }
+    cache->data_section_offset =
+        search_tree_size + MMDB_DATA_SECTION_SEPARATOR;
+    cache->entries.metadata = cache->mmdb.metadata;
+    cache->entries.depth = cache->mmdb.depth;
+
+    size_t const tables = cache->mmdb.metadata.ip_version == 6 ? 2 : 1;
+    size_t top_size;
+    for (cache->top_bits = CACHE_TOP_MAX_BITS;; cache->top_bits--) {
+        top_size = tables * ((size_t)1 << cache->top_bits) *
+                   sizeof(cache_top_s);
+        if (cache->top_bits == 0 || top_size <= memory_budget / 8) {
+            break;
+        }
+    }
+
+    // The cache closes the file when it is freed, even if it fails here.
+    size_t const block_budget =
+        memory_budget > top_size ? memory_budget - top_size : 0;
+    status = block_cache_new(&file, block_budget, &cache->blocks);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+
+    status = cache_build_top(cache, &record_info, 0, 0, &cache->top);
+    if (MMDB_SUCCESS != status || cache->mmdb.metadata.ip_version != 6) {
+        return status;
+    }
+
+    uint32_t node = 0;
+    uint16_t netmask;
+    for (netmask = 0; netmask < 96 && node < cache->mmdb.metadata.node_count;
+         netmask++) {
+        uint32_t right;
+        status = cache_read_node(cache, &record_info, node, &node, &right);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
+    return cache_build_top(
+        cache, &record_info, node, netmask, &cache->ipv4_top);
+}
+
+/* Reads the metadata from the end of the file. Only the values are kept, as
+ * read_metadata() copies the strings. */
+static int cache_read_metadata(MMDB_cache_s *const cache,
+                               const opened_file_s *const file) {
+    size_t const size = file->size > METADATA_BLOCK_MAX_SIZE
+                            ? METADATA_BLOCK_MAX_SIZE
+                            : (size_t)file->size;
+    uint8_t *const tail = malloc(size ? size : 1);
+    if (!tail) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    int status = read_file(file, file->size - size, size, tail);
+    if (MMDB_SUCCESS == status) {
+        uint32_t metadata_size = 0;
+        const uint8_t *const metadata =
+            find_metadata(tail, (ssize_t)size, &metadata_size);
+        if (NULL == metadata) {
+            status = MMDB_INVALID_METADATA_ERROR;
+        } else {
+            cache->mmdb.metadata_section = metadata;
+            cache->mmdb.metadata_section_size = metadata_size;
+            status = read_metadata(&cache->mmdb);
+        }
+    }
+    cache->mmdb.metadata_section = NULL;
+    cache->mmdb.metadata_section_size = 0;
+    free(tail);
+    return status;
+}
+
+/* Reads both records of the node through the cache. */
+static int cache_read_node(MMDB_cache_s *const cache,
+                           const record_info_s *const record_info,
+                           uint32_t node,
+                           uint32_t *const left,
+                           uint32_t *const right) {
+    uint8_t record[8];
+    int const status =
+        block_cache_read(cache->blocks,
+                         (uint64_t)node * record_info->record_length,
+                         record_info->record_length,
+                         record);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    *left = record_info->left_record_getter(record);
+    *right = record_info->right_record_getter(
+        record + record_info->right_record_offset);
+    return MMDB_SUCCESS;
+}
+
+/* Builds the table of where lookups that start at the node in value after
+ * bit bits are once they have followed top_bits more. The table is filled in
+ * one level of the tree at a time, so each node in the top levels is read
+ * once. Each level splits the entries that share a path so far in two halves
+ * for the left and right records of the node they are at. */
+static int cache_build_top(MMDB_cache_s *const cache,
+                           const record_info_s *const record_info,
+                           uint32_t value,
+                           uint16_t bit,
+                           cache_top_s **const top) {
+    size_t const count = (size_t)1 << cache->top_bits;
+    cache_top_s *const table = malloc(count * sizeof(cache_top_s));
+    if (!table) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    *top = table;
+    for (size_t i = 0; i < count; i++) {
+        table[i] = (cache_top_s){.value = value, .bit = bit};
+    }
+
+    for (uint16_t level = 0; level < cache->top_bits; level++) {
+        size_t const span = count >> level;
+        for (size_t first = 0; first < count; first += span) {
+            cache_top_s const node = table[first];
+            if (node.value >= cache->mmdb.metadata.node_count) {
+                continue;
+            }
+            uint32_t left;
+            uint32_t right;
+            int const status =
+                cache_read_node(cache, record_info, node.value, &left, &right);
+            if (MMDB_SUCCESS != status) {
+                return status;
+            }
+            uint16_t const next_bit = node.bit + 1;
+            for (size_t i = first; i < first + span / 2; i++) {
+                table[i] = (cache_top_s){.value = left, .bit = next_bit};
+            }
+            for (size_t i = first + span / 2; i < first + span; i++) {
+                table[i] = (cache_top_s){.value = right, .bit = next_bit};
+            }
+        }
+    }
+    return MMDB_SUCCESS;
+}
+
+const MMDB_metadata_s *MMDB_cache_metadata(const MMDB_cache_s *const cache) {
+    return &cache->mmdb.metadata;
+}
+
+MMDB_lookup_result_s MMDB_cache_lookup_string(MMDB_cache_s *const cache,
+                                              const char *const ipstr,
+                                              int *const gai_error,
+                                              int *const mmdb_error) {
+    MMDB_lookup_result_s result = {
+        .found_entry = false,
+        .netmask = 0,
+        .entry = {.mmdb = &cache->entries, .offset = 0}};
+
+    struct addrinfo *addresses = NULL;
+    *gai_error = resolve_any_address(ipstr, &addresses);
+
+    if (!*gai_error) {
+        result =
+            MMDB_cache_lookup_sockaddr(cache, addresses->ai_addr, mmdb_error);
+    } else {
+        // As with MMDB_lookup_string(), the GAI failure is reported via
+        // *gai_error.
+        *mmdb_error = MMDB_SUCCESS;
+    }
+
+    if (NULL != addresses) {
+        freeaddrinfo(addresses);
+    }
+
+    return result;
+}
+
+MMDB_lookup_result_s
+MMDB_cache_lookup_sockaddr(MMDB_cache_s *const cache,
+                           const struct sockaddr *const sockaddr,
+                           int *const mmdb_error) {
+    MMDB_lookup_result_s result = {
+        .found_entry = false,
+        .netmask = 0,
+        .entry = {.mmdb = &cache->entries, .offset = 0}};
+
+    uint8_t mapped_address[16];
+    uint8_t const *address;
+    *mmdb_error =
+        address_for_sockaddr(&cache->mmdb, sockaddr, mapped_address, &address);
+    if (MMDB_SUCCESS != *mmdb_error) {
+        return result;
+    }
+
+    *mmdb_error =
+        cache_find_address(cache, address, sockaddr->sa_family, &result);
+    return result;
+}
+
+/* Like find_address_in_search_tree(), but the lookup starts from the entry
+ * for the first bits of the address in the top levels of the tree, and the
+ * nodes below them are read through the cache. */
+static int cache_find_address(MMDB_cache_s *const cache,
+                              uint8_t const *address,
+                              sa_family_t address_family,
+                              MMDB_lookup_result_s *const result) {
+    record_info_s const record_info = record_info_for_database(&cache->mmdb);
+    cache_top_s const top =
+        cache_top_for_address(cache, address, address_family);
+    uint32_t value = top.value;
+    uint16_t bit_number = top.bit;
+
+    for (; bit_number < cache->mmdb.depth &&
+           value < cache->mmdb.metadata.node_count;
+         bit_number++) {
+        uint32_t left;
+        uint32_t right;
+        int const status =
+            cache_read_node(cache, &record_info, value, &left, &right);
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+        uint8_t const bit =
+            1U & (address[bit_number >> 3] >> (7 - (bit_number % 8)));
+        value = bit ? right : left;
+    }
+
+    return search_result(&cache->mmdb, value, bit_number, result);
+}
+
+/* Returns where a lookup of the address is once it has followed the top
+ * levels of the tree. IPv4 addresses in an IPv6 database start at the IPv4
+ * start node, after the first 96 bits of the mapped address. */
+static cache_top_s cache_top_for_address(const MMDB_cache_s *const cache,
+                                         uint8_t const *address,
+                                         sa_family_t address_family) {
+    const cache_top_s *top = cache->top;
+    uint16_t first_bit = 0;
+    if (cache->mmdb.metadata.ip_version == 6 && address_family == AF_INET) {
+        top = cache->ipv4_top;
+        first_bit = 96;
+    }
 
-    memcpy(&i, p, sizeof(uint32_t));
+    size_t index = 0;
+    for (uint16_t i = first_bit; i < first_bit + cache->top_bits; i++) {
+        index = (index << 1) | (1U & (address[i >> 3] >> (7 - (i % 8))));
+    }
+    return top[index];
+}
 
-#if MMDB_LITTLE_ENDIAN
-    i = mmdb_bswap32(i);
-#endif
+int MMDB_cache_get_entry_data_list(
+    MMDB_cache_s *const cache,
+    const MMDB_entry_s *const start,
+    MMDB_entry_data_list_s **const entry_data_list) {
+    if (start->mmdb != &cache->entries) {
+        *entry_data_list = NULL;
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    return pool_entry_data_list(
+        &cache->mmdb, cache, start->offset, entry_data_list);
+}
 
-    memcpy(&f, &i, sizeof(float));
+int MMDB_cache_lookup_start(MMDB_cache_s *const cache,
+                            const struct sockaddr *const sockaddr,
+                            MMDB_lookup_state_s *const state) {
+    memset(state, 0, sizeof(MMDB_lookup_state_s));
+    state->cache = cache;
 
-    return f;
+    uint8_t mapped_address[16];
+    uint8_t const *address;
+    int const status =
+        address_for_sockaddr(&cache->mmdb, sockaddr, mapped_address, &address);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    memcpy(state->address,
+           address,
+           cache->mmdb.metadata.ip_version == 4 ? 4 : 16);
+
+    cache_top_s const top =
+        cache_top_for_address(cache, address, sockaddr->sa_family);
+    state->value = top.value;
+    state->current_bit = top.bit;
+    return MMDB_SUCCESS;
 }
 
-static double get_ieee754_double(const uint8_t *restrict p) {
-    double d;
-    uint64_t i;
+/* Walks the search tree below its top levels one node at a time, and then
+ * checks that all of the data of the record it finds is in the cache, without
+ * reading the file. The state keeps the bytes of a node that were in the
+ * cache, so a lookup never has to go back over bytes it has already read.
+ *
+ * The record's data is checked from its start again on each call. A record
+ * that needs more blocks than the cache holds at once can't be kept in it, so
+ * once a lookup has waited for more blocks of its data than the cache holds,
+ * the result is returned without checking the data again. */
+int MMDB_cache_lookup_step(MMDB_lookup_state_s *const state,
+                           MMDB_lookup_result_s *const result) {
+    MMDB_cache_s *const cache = state->cache;
+    record_info_s const record_info = record_info_for_database(&cache->mmdb);
+    state->pending_offset = 0;
+    state->pending_size = 0;
+
+    while (state->current_bit < cache->mmdb.depth &&
+           state->value < cache->mmdb.metadata.node_count) {
+        uint64_t const node_offset =
+            (uint64_t)state->value * record_info.record_length;
+        size_t read;
+        int const status =
+            block_cache_read_cached(cache->blocks,
+                                    node_offset + state->node_read,
+                                    record_info.record_length -
+                                        state->node_read,
+                                    state->node + state->node_read,
+                                    &read);
+        state->node_read = (uint8_t)(state->node_read + read);
+        if (MMDB_SUCCESS != status) {
+            return lookup_pending(
+                state, node_offset + state->node_read, status);
+        }
 
-    memcpy(&i, p, sizeof(uint64_t));
+        uint16_t const bit_number = state->current_bit;
+        uint8_t const bit =
+            1U & (state->address[bit_number >> 3] >> (7 - (bit_number % 8)));
+        state->value =
+            bit ? record_info.right_record_getter(
+                      state->node + record_info.right_record_offset)
+                : record_info.left_record_getter(state->node);
+        state->current_bit++;
+        state->node_read = 0;
+    }
+
+    MMDB_lookup_result_s found = {
+        .found_entry = false,
+        .netmask = 0,
+        .entry = {.mmdb = &cache->entries, .offset = 0}};
+    int status =
+        search_result(&cache->mmdb, state->value, state->current_bit, &found);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
 
-#if MMDB_LITTLE_ENDIAN
-    i = mmdb_bswap64(i);
-#endif
+    size_t const blocks =
+        block_cache_capacity(cache->blocks) / BLOCK_CACHE_BLOCK_SIZE;
+    if (found.found_entry && state->data_loads <= blocks) {
+        uint32_t next_offset;
+        status =
+            lookup_cached_value(state, found.entry.offset, 0, &next_offset);
+        if (MMDB_WOULD_BLOCK_ERROR == status) {
+            state->data_loads++;
+        }
+        if (MMDB_SUCCESS != status) {
+            return status;
+        }
+    }
 
-    memcpy(&d, &i, sizeof(double));
+    *result = found;
+    return MMDB_SUCCESS;
+}
 
-    return d;
+int MMDB_cache_lookup_load(const MMDB_lookup_state_s *const state) {
+    if (0 == state->pending_size) {
+        return MMDB_SUCCESS;
+    }
+    return block_cache_load(state->cache->blocks, state->pending_offset);
 }
 
-static uint32_t get_uint32(const uint8_t *p) {
-    return p[0] * 16777216U + p[1] * 65536 + p[2] * 256 + p[3];
+int MMDB_cache_fill_block(MMDB_cache_s *const cache,
+                          uint64_t offset,
+                          const void *const data,
+                          size_t size) {
+    return block_cache_fill(cache->blocks, offset, data, size);
 }
 
-static uint32_t get_uint24(const uint8_t *p) {
-    return p[0] * 65536U + p[1] * 256 + p[2];
+/* Sets the block that holds the byte at offset in the file as the one the
+ * lookup waits for, if the status is MMDB_WOULD_BLOCK_ERROR, and returns the
+ * status. */
+static int lookup_pending(MMDB_lookup_state_s *const state,
+                          uint64_t offset,
+                          int status) {
+    if (MMDB_WOULD_BLOCK_ERROR == status) {
+        state->pending_offset = offset - offset % BLOCK_CACHE_BLOCK_SIZE;
+        state->pending_size = block_cache_block_size(state->cache->blocks,
+                                                     state->pending_offset);
+    }
+    return status;
 }
 
-static uint32_t get_uint16(const uint8_t *p) { return p[0] * 256U + p[1]; }
+/* Checks that the value at offset is in the cache, along with the values in
+ * it and those that its pointers point to, since decoding the result reads
+ * all of them. */
+static int lookup_cached_value(MMDB_lookup_state_s *const state,
+                               uint32_t offset,
+                               int depth,
+                               uint32_t *const next_offset) {
+    if (depth >= MAXIMUM_DATA_STRUCTURE_DEPTH) {
+        DEBUG_MSG("reached the maximum data structure depth");
+        return MMDB_INVALID_DATA_ERROR;
+    }
 
-static uint64_t get_uintX(const uint8_t *p, int length) {
-    uint64_t value = 0;
-    while (length-- > 0) {
-        value <<= 8;
-        value += *p++;
+    value_header_s value;
+    int status = lookup_cached_header(state, offset, &value);
+    if (MMDB_SUCCESS != status) {
+        return status;
     }
-    return value;
-}
 
-static int32_t get_sintX(const uint8_t *p, int length) {
-    return (int32_t)get_uintX(p, length);
+    uint32_t next = value.next;
+    switch (value.type) {
+        case MMDB_DATA_TYPE_POINTER: {
+            // A pointer can't point to another pointer, which is checked
+            // first so that following pointers can't loop.
+            value_header_s target;
+            status = lookup_cached_header(state, value.payload, &target);
+            if (MMDB_SUCCESS == status &&
+                target.type == MMDB_DATA_TYPE_POINTER) {
+                status = MMDB_INVALID_DATA_ERROR;
+            }
+            if (MMDB_SUCCESS == status) {
+                uint32_t target_next;
+                status = lookup_cached_value(
+                    state, value.payload, depth, &target_next);
+            }
+            break;
+        }
+        case MMDB_DATA_TYPE_MAP:
+            for (uint32_t i = 0; MMDB_SUCCESS == status && i < value.size;
+                 i++) {
+                status = lookup_cached_value(state, next, depth + 1, &next);
+                if (MMDB_SUCCESS == status) {
+                    status =
+                        lookup_cached_value(state, next, depth + 1, &next);
+                }
+            }
+            break;
+        case MMDB_DATA_TYPE_ARRAY:
+            for (uint32_t i = 0; MMDB_SUCCESS == status && i < value.size;
+                 i++) {
+                status = lookup_cached_value(state, next, depth + 1, &next);
+            }
+            break;
+        case MMDB_DATA_TYPE_BOOLEAN:
+            break;
+        default:
+            status = lookup_cached_bytes(state, value.payload, value.size);
+            break;
+    }
+
+    *next_offset = next;
+    return status;
 }
 
-void MMDB_free_entry_data_list(MMDB_entry_data_list_s *const entry_data_list) {
-    if (entry_data_list == NULL) {
-        return;
+/* Reads the header of the value at offset in the data section from the
+ * cache, as cache_decode_one() does, with the offsets in the header made
+ * relative to the start of the data section again. */
+static int lookup_cached_header(MMDB_lookup_state_s *const state,
+                                uint32_t offset,
+                                value_header_s *const header) {
+    const MMDB_cache_s *const cache = state->cache;
+    uint32_t const data_section_size = cache->mmdb.data_section_size;
+    if (offset >= data_section_size) {
+        DEBUG_MSGF("Offset (%d) past data section (%d)",
+                   offset,
+                   data_section_size);
+        return MMDB_INVALID_DATA_ERROR;
     }
-    data_pool_destroy(entry_data_list->pool);
+
+    uint8_t buffer[MAXIMUM_HEADER_SIZE];
+    uint32_t size = data_section_size - offset;
+    if (size > MAXIMUM_HEADER_SIZE) {
+        size = MAXIMUM_HEADER_SIZE;
+    }
+    uint64_t const file_offset = cache->data_section_offset + offset;
+    size_t read;
+    int status = block_cache_read_cached(
+        cache->blocks, file_offset, size, buffer, &read);
+    if (MMDB_SUCCESS != status) {
+        return lookup_pending(state, file_offset + read, status);
+    }
+
+    MMDB_s const window = {.data_section = buffer,
+                           .data_section_size = data_section_size - offset};
+    status = decode_header(&window, 0, header);
+    if (MMDB_SUCCESS != status) {
+        return status;
+    }
+    if (header->type != MMDB_DATA_TYPE_POINTER) {
+        header->payload += offset;
+    }
+    header->next += offset;
+    return MMDB_SUCCESS;
 }
 
-void MMDB_close(MMDB_s *const mmdb) { free_mmdb_struct(mmdb); }
+/* Checks that the size bytes at offset in the data section are in the
+ * cache. */
+static int lookup_cached_bytes(MMDB_lookup_state_s *const state,
+                               uint32_t offset,
+                               uint32_t size) {
+    const MMDB_cache_s *const cache = state->cache;
+    uint64_t const file_offset = cache->data_section_offset + offset;
+    size_t read;
+    int const status = block_cache_read_cached(
+        cache->blocks, file_offset, size, NULL, &read);
+    return lookup_pending(state, file_offset + read, status);
+}
 
-static void free_mmdb_struct(MMDB_s *const mmdb) {
-    if (!mmdb) {
+void MMDB_cache_close(MMDB_cache_s *const cache) {
+    if (!cache) {
         return;
     }
+    block_cache_free(cache->blocks);
+    free(cache->top);
+    free(cache->ipv4_top);
+    free_mmdb_struct(&cache->mmdb);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    free(cache);
+}
+
+/* Copies the file name into a new database_internal_s. */
+static char *new_filename(const char *const filename) {
+    size_t const size = strlen(filename) + 1;
+    database_internal_s *const internal =
+        malloc(sizeof(database_internal_s) + size);
+    if (NULL == internal) {
+        return NULL;
+    }
+    internal->verified_offsets = NULL;
+    memcpy(internal->filename, filename, size);
+    return internal->filename;
+}
 
-    if (NULL != mmdb->filename) {
+static database_internal_s *database_internal(const MMDB_s *const mmdb) {
 #if defined(__clang__)
-    // This is a const char * that we need to free, which isn't valid. However
-    // it would mean changing the public API to fix this.
+    // The file name is a const char * that we need to write to and free, which
+    // isn't valid. However it would mean changing the public API to fix this.
     #pragma clang diagnostic push
     #pragma clang diagnostic ignored "-Wcast-qual"
 #endif
-        FREE_AND_SET_NULL(mmdb->filename);
+    return (database_internal_s *)(void *)(mmdb->filename -
+                                           offsetof(database_internal_s,
+                                                    filename));
 #if defined(__clang__)
     #pragma clang diagnostic pop
 #endif
+}
+
+static void free_mmdb_struct(MMDB_s *const mmdb) {
+    if (!mmdb) {
+        return;
+    }
+
+    if (NULL != mmdb->filename) {
+        database_internal_s *const internal = database_internal(mmdb);
+        free(internal->verified_offsets);
+        free(internal);
+        mmdb->filename = NULL;
     }
     if (NULL != mmdb->file_content) {
+        unmap_file(mmdb->file_content, mmdb->file_size);
 #ifdef _WIN32
-        UnmapViewOfFile(mmdb->file_content);
         /* Winsock is only initialized if open was successful so we only have
          * to cleanup then. */
         WSACleanup();
-#else
-    #if defined(__clang__)
-        // This is a const char * that we need to free, which isn't valid.
-        // However it would mean changing the public API to fix this.
-        #pragma clang diagnostic push
-        #pragma clang diagnostic ignored "-Wcast-qual"
-    #endif
-        munmap((void *)mmdb->file_content, (size_t)mmdb->file_size);
-    #if defined(__clang__)
-        #pragma clang diagnostic pop
-    #endif
 #endif
         mmdb->file_content = NULL;
         mmdb->file_size = 0;
@@ -1964,108 +5527,98 @@ static void free_mmdb_struct(MMDB_s *const mmdb) {
         mmdb->metadata_section_size = 0;
     }
 
-    if (NULL != mmdb->metadata.database_type) {
-#if defined(__clang__)
-    // This is a const char * that we need to free, which isn't valid. However
-    // it would mean changing the public API to fix this.
-    #pragma clang diagnostic push
-    #pragma clang diagnostic ignored "-Wcast-qual"
-#endif
-        FREE_AND_SET_NULL(mmdb->metadata.database_type);
-#if defined(__clang__)
-    #pragma clang diagnostic pop
-#endif
-    }
-
-    free_languages_metadata(mmdb);
-    free_descriptions_metadata(mmdb);
+    free_metadata(mmdb);
 }
 
-static void free_languages_metadata(MMDB_s *mmdb) {
-    if (!mmdb->metadata.languages.names) {
-        return;
-    }
-
-    for (size_t i = 0; i < mmdb->metadata.languages.count; i++) {
-#if defined(__clang__)
-    // This is a const char * that we need to free, which isn't valid. However
-    // it would mean changing the public API to fix this.
-    #pragma clang diagnostic push
-    #pragma clang diagnostic ignored "-Wcast-qual"
-#endif
-        FREE_AND_SET_NULL(mmdb->metadata.languages.names[i]);
-#if defined(__clang__)
-    #pragma clang diagnostic pop
-#endif
-    }
+static void free_metadata(MMDB_s *mmdb) {
+    // The database type, languages and descriptions are all in the block
+    // that languages.names points to.
     FREE_AND_SET_NULL(mmdb->metadata.languages.names);
     mmdb->metadata.languages.count = 0;
+    mmdb->metadata.database_type = NULL;
+    mmdb->metadata.description.descriptions = NULL;
+    mmdb->metadata.description.count = 0;
 }
 
-static void free_descriptions_metadata(MMDB_s *mmdb) {
-    if (!mmdb->metadata.description.count) {
-        return;
-    }
+const char *MMDB_lib_version(void) { return PACKAGE_VERSION; }
 
-    for (size_t i = 0; i < mmdb->metadata.description.count; i++) {
-        if (NULL != mmdb->metadata.description.descriptions[i]) {
-            if (NULL != mmdb->metadata.description.descriptions[i]->language) {
-#if defined(__clang__)
-    // This is a const char * that we need to free, which isn't valid. However
-    // it would mean changing the public API to fix this.
-    #pragma clang diagnostic push
-    #pragma clang diagnostic ignored "-Wcast-qual"
-#endif
-                FREE_AND_SET_NULL(
-                    mmdb->metadata.description.descriptions[i]->language);
-#if defined(__clang__)
-    #pragma clang diagnostic pop
-#endif
-            }
+int MMDB_dump_entry_data_list(FILE *const stream,
+                              MMDB_entry_data_list_s *const entry_data_list,
+                              int indent) {
+    MMDB_dump_sink_s sink;
+    MMDB_dump_sink_init_callback(&sink, dump_to_stream, stream);
+    return MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, indent);
+}
 
-            if (NULL !=
-                mmdb->metadata.description.descriptions[i]->description) {
-#if defined(__clang__)
-    // This is a const char * that we need to free, which isn't valid. However
-    // it would mean changing the public API to fix this.
-    #pragma clang diagnostic push
-    #pragma clang diagnostic ignored "-Wcast-qual"
-#endif
-                FREE_AND_SET_NULL(
-                    mmdb->metadata.description.descriptions[i]->description);
-#if defined(__clang__)
-    #pragma clang diagnostic pop
-#endif
-            }
-            FREE_AND_SET_NULL(mmdb->metadata.description.descriptions[i]);
-        }
+static int dump_to_stream(void *const context,
+                          const char *const data,
+                          size_t size) {
+    return fwrite(data, 1, size, (FILE *)context) == size ? 0 : -1;
+}
+
+void MMDB_dump_sink_init_buffer(MMDB_dump_sink_s *const sink,
+                                char *const buffer,
+                                size_t size) {
+    memset(sink, 0, sizeof(MMDB_dump_sink_s));
+    sink->buffer = buffer;
+    sink->size = size;
+    if (size > 0) {
+        buffer[0] = '\0';
     }
+}
 
-    FREE_AND_SET_NULL(mmdb->metadata.description.descriptions);
-    mmdb->metadata.description.count = 0;
+void MMDB_dump_sink_init_growable(MMDB_dump_sink_s *const sink) {
+    memset(sink, 0, sizeof(MMDB_dump_sink_s));
+    sink->growable = true;
 }
 
-const char *MMDB_lib_version(void) { return PACKAGE_VERSION; }
+void MMDB_dump_sink_init_callback(MMDB_dump_sink_s *const sink,
+                                  MMDB_dump_write_fn callback,
+                                  void *const context) {
+    memset(sink, 0, sizeof(MMDB_dump_sink_s));
+    sink->write = callback;
+    sink->context = context;
+}
 
-int MMDB_dump_entry_data_list(FILE *const stream,
-                              MMDB_entry_data_list_s *const entry_data_list,
-                              int indent) {
-    int status;
-    dump_entry_data_list(stream, entry_data_list, indent, &status);
-    return status;
+void MMDB_dump_sink_reset(MMDB_dump_sink_s *const sink) {
+    sink->length = 0;
+    if (sink->size > 0) {
+        sink->buffer[0] = '\0';
+    }
+}
+
+void MMDB_dump_sink_free(MMDB_dump_sink_s *const sink) {
+    if (sink->growable) {
+        FREE_AND_SET_NULL(sink->buffer);
+        sink->size = 0;
+    }
+    sink->length = 0;
+}
+
+int MMDB_dump_entry_data_list_to_sink(
+    MMDB_dump_sink_s *const sink,
+    MMDB_entry_data_list_s *const entry_data_list,
+    int indent) {
+    dump_writer_s writer;
+    writer.sink = sink;
+    writer.status = MMDB_SUCCESS;
+    writer.staged = 0;
+
+    dump_entry_data_list(&writer, entry_data_list, indent);
+    dump_flush(&writer);
+    return writer.status;
 }
 
 static MMDB_entry_data_list_s *
-dump_entry_data_list(FILE *stream,
+dump_entry_data_list(dump_writer_s *writer,
                      MMDB_entry_data_list_s *entry_data_list,
-                     int indent,
-                     int *status) {
+                     int indent) {
     switch (entry_data_list->entry_data.type) {
         case MMDB_DATA_TYPE_MAP: {
             uint32_t size = entry_data_list->entry_data.data_size;
 
-            print_indentation(stream, indent);
-            fprintf(stream, "{\n");
+            dump_indentation(writer, indent);
+            dump_write(writer, "{\n", 2);
             indent += 2;
 
             for (entry_data_list = entry_data_list->next;
@@ -2074,180 +5627,294 @@ dump_entry_data_list(FILE *stream,
 
                 if (MMDB_DATA_TYPE_UTF8_STRING !=
                     entry_data_list->entry_data.type) {
-                    *status = MMDB_INVALID_DATA_ERROR;
-                    return NULL;
-                }
-                char *key =
-                    mmdb_strndup(entry_data_list->entry_data.utf8_string,
-                                 entry_data_list->entry_data.data_size);
-                if (NULL == key) {
-                    *status = MMDB_OUT_OF_MEMORY_ERROR;
+                    writer->status = MMDB_INVALID_DATA_ERROR;
                     return NULL;
                 }
 
-                print_indentation(stream, indent);
-                fprintf(stream, "\"%s\": \n", key);
-                free(key);
+                dump_indentation(writer, indent);
+                dump_string(writer,
+                            entry_data_list->entry_data.utf8_string,
+                            entry_data_list->entry_data.data_size);
+                dump_write(writer, ": \n", 3);
 
                 entry_data_list = entry_data_list->next;
-                entry_data_list = dump_entry_data_list(
-                    stream, entry_data_list, indent + 2, status);
+                entry_data_list =
+                    dump_entry_data_list(writer, entry_data_list, indent + 2);
 
-                if (MMDB_SUCCESS != *status) {
+                if (MMDB_SUCCESS != writer->status) {
                     return NULL;
                 }
             }
 
             indent -= 2;
-            print_indentation(stream, indent);
-            fprintf(stream, "}\n");
+            dump_indentation(writer, indent);
+            dump_write(writer, "}\n", 2);
         } break;
         case MMDB_DATA_TYPE_ARRAY: {
             uint32_t size = entry_data_list->entry_data.data_size;
 
-            print_indentation(stream, indent);
-            fprintf(stream, "[\n");
+            dump_indentation(writer, indent);
+            dump_write(writer, "[\n", 2);
             indent += 2;
 
             for (entry_data_list = entry_data_list->next;
                  size && entry_data_list;
                  size--) {
-                entry_data_list = dump_entry_data_list(
-                    stream, entry_data_list, indent, status);
-                if (MMDB_SUCCESS != *status) {
+                entry_data_list =
+                    dump_entry_data_list(writer, entry_data_list, indent);
+                if (MMDB_SUCCESS != writer->status) {
                     return NULL;
                 }
             }
 
             indent -= 2;
-            print_indentation(stream, indent);
-            fprintf(stream, "]\n");
+            dump_indentation(writer, indent);
+            dump_write(writer, "]\n", 2);
         } break;
-        case MMDB_DATA_TYPE_UTF8_STRING: {
-            char *string = mmdb_strndup(entry_data_list->entry_data.utf8_string,
-                                        entry_data_list->entry_data.data_size);
-            if (NULL == string) {
-                *status = MMDB_OUT_OF_MEMORY_ERROR;
-                return NULL;
-            }
-            print_indentation(stream, indent);
-            fprintf(stream, "\"%s\" <utf8_string>\n", string);
-            free(string);
+        case MMDB_DATA_TYPE_UTF8_STRING:
+            dump_indentation(writer, indent);
+            dump_string(writer,
+                        entry_data_list->entry_data.utf8_string,
+                        entry_data_list->entry_data.data_size);
+            dump_write(writer, " <utf8_string>\n", 15);
             entry_data_list = entry_data_list->next;
-        } break;
-        case MMDB_DATA_TYPE_BYTES: {
-            char *hex_string =
-                bytes_to_hex(entry_data_list->entry_data.bytes,
-                             entry_data_list->entry_data.data_size);
-
-            if (NULL == hex_string) {
-                *status = MMDB_OUT_OF_MEMORY_ERROR;
-                return NULL;
-            }
-
-            print_indentation(stream, indent);
-            fprintf(stream, "%s <bytes>\n", hex_string);
-            free(hex_string);
-
+            break;
+        case MMDB_DATA_TYPE_BYTES:
+            dump_indentation(writer, indent);
+            dump_hex(writer,
+                     entry_data_list->entry_data.bytes,
+                     entry_data_list->entry_data.data_size);
+            dump_write(writer, " <bytes>\n", 9);
             entry_data_list = entry_data_list->next;
-        } break;
+            break;
         case MMDB_DATA_TYPE_DOUBLE:
-            print_indentation(stream, indent);
-            fprintf(stream,
-                    "%f <double>\n",
-                    entry_data_list->entry_data.double_value);
+            dump_indentation(writer, indent);
+            dump_format(writer,
+                        "%f <double>\n",
+                        entry_data_list->entry_data.double_value);
             entry_data_list = entry_data_list->next;
             break;
         case MMDB_DATA_TYPE_FLOAT:
-            print_indentation(stream, indent);
-            fprintf(stream,
-                    "%f <float>\n",
-                    entry_data_list->entry_data.float_value);
+            dump_indentation(writer, indent);
+            dump_format(writer,
+                        "%f <float>\n",
+                        entry_data_list->entry_data.float_value);
             entry_data_list = entry_data_list->next;
             break;
         case MMDB_DATA_TYPE_UINT16:
-            print_indentation(stream, indent);
-            fprintf(
-                stream, "%u <uint16>\n", entry_data_list->entry_data.uint16);
+            dump_indentation(writer, indent);
+            dump_format(
+                writer, "%u <uint16>\n", entry_data_list->entry_data.uint16);
             entry_data_list = entry_data_list->next;
             break;
         case MMDB_DATA_TYPE_UINT32:
-            print_indentation(stream, indent);
-            fprintf(
-                stream, "%u <uint32>\n", entry_data_list->entry_data.uint32);
+            dump_indentation(writer, indent);
+            dump_format(
+                writer, "%u <uint32>\n", entry_data_list->entry_data.uint32);
             entry_data_list = entry_data_list->next;
             break;
         case MMDB_DATA_TYPE_BOOLEAN:
-            print_indentation(stream, indent);
-            fprintf(stream,
-                    "%s <boolean>\n",
-                    entry_data_list->entry_data.boolean ? "true" : "false");
+            dump_indentation(writer, indent);
+            if (entry_data_list->entry_data.boolean) {
+                dump_write(writer, "true <boolean>\n", 15);
+            } else {
+                dump_write(writer, "false <boolean>\n", 16);
+            }
             entry_data_list = entry_data_list->next;
             break;
         case MMDB_DATA_TYPE_UINT64:
-            print_indentation(stream, indent);
-            fprintf(stream,
-                    "%" PRIu64 " <uint64>\n",
-                    entry_data_list->entry_data.uint64);
+            dump_indentation(writer, indent);
+            dump_format(writer,
+                        "%" PRIu64 " <uint64>\n",
+                        entry_data_list->entry_data.uint64);
             entry_data_list = entry_data_list->next;
             break;
         case MMDB_DATA_TYPE_UINT128:
-            print_indentation(stream, indent);
+            dump_indentation(writer, indent);
 #if MMDB_UINT128_IS_BYTE_ARRAY
-            char *hex_string = bytes_to_hex(
-                (uint8_t *)entry_data_list->entry_data.uint128, 16);
-            if (NULL == hex_string) {
-                *status = MMDB_OUT_OF_MEMORY_ERROR;
-                return NULL;
-            }
-            fprintf(stream, "0x%s <uint128>\n", hex_string);
-            free(hex_string);
+            dump_write(writer, "0x", 2);
+            dump_hex(writer, entry_data_list->entry_data.uint128, 16);
+            dump_write(writer, " <uint128>\n", 11);
 #else
             uint64_t high = entry_data_list->entry_data.uint128 >> 64;
             uint64_t low = (uint64_t)entry_data_list->entry_data.uint128;
-            fprintf(stream,
-                    "0x%016" PRIX64 "%016" PRIX64 " <uint128>\n",
-                    high,
-                    low);
+            dump_format(writer,
+                        "0x%016" PRIX64 "%016" PRIX64 " <uint128>\n",
+                        high,
+                        low);
 #endif
             entry_data_list = entry_data_list->next;
             break;
         case MMDB_DATA_TYPE_INT32:
-            print_indentation(stream, indent);
-            fprintf(stream, "%d <int32>\n", entry_data_list->entry_data.int32);
+            dump_indentation(writer, indent);
+            dump_format(
+                writer, "%d <int32>\n", entry_data_list->entry_data.int32);
             entry_data_list = entry_data_list->next;
             break;
         default:
-            *status = MMDB_INVALID_DATA_ERROR;
+            writer->status = MMDB_INVALID_DATA_ERROR;
             return NULL;
     }
 
-    *status = MMDB_SUCCESS;
     return entry_data_list;
 }
 
-static void print_indentation(FILE *stream, int i) {
-    char buffer[1024];
-    int size = i < 0 ? 0 : (i >= 1024 ? 1023 : i);
-    memset(buffer, 32, (size_t)size);
-    buffer[size] = '\0';
-    fputs(buffer, stream);
+/* Writes to a buffer sink directly, truncating the output if it doesn't fit,
+ * and stages output for a callback sink. */
+static void dump_write(dump_writer_s *writer, const char *data, size_t size) {
+    if (MMDB_SUCCESS != writer->status || 0 == size) {
+        return;
+    }
+
+    MMDB_dump_sink_s *sink = writer->sink;
+    if (NULL != sink->write) {
+        if (size > DUMP_STAGING_SIZE - writer->staged) {
+            dump_flush(writer);
+            if (MMDB_SUCCESS != writer->status) {
+                return;
+            }
+        }
+        if (size > DUMP_STAGING_SIZE) {
+            if (0 != sink->write(sink->context, data, size)) {
+                writer->status = MMDB_IO_ERROR;
+                return;
+            }
+            sink->length += size;
+            return;
+        }
+        memcpy(writer->staging + writer->staged, data, size);
+        writer->staged += size;
+        return;
+    }
+
+    if (sink->growable && !dump_reserve(sink, size)) {
+        writer->status = MMDB_OUT_OF_MEMORY_ERROR;
+        return;
+    }
+    if (sink->length < sink->size) {
+        size_t available = sink->size - sink->length - 1;
+        size_t copy = size < available ? size : available;
+        memcpy(sink->buffer + sink->length, data, copy);
+        sink->buffer[sink->length + copy] = '\0';
+    }
+    sink->length += size;
+}
+
+static void dump_flush(dump_writer_s *writer) {
+    if (0 == writer->staged) {
+        return;
+    }
+
+    MMDB_dump_sink_s *sink = writer->sink;
+    if (0 != sink->write(sink->context, writer->staging, writer->staged)) {
+        if (MMDB_SUCCESS == writer->status) {
+            writer->status = MMDB_IO_ERROR;
+        }
+    } else {
+        sink->length += writer->staged;
+    }
+    writer->staged = 0;
 }
 
-static char *bytes_to_hex(uint8_t const *bytes, uint32_t size) {
-    char *hex_string;
-    MAYBE_CHECK_SIZE_OVERFLOW(size, SIZE_MAX / 2 - 1, NULL);
+/* Makes room for size more bytes and the NUL in a growable sink. The buffer
+ * is kept by MMDB_dump_sink_reset(), so a sink that is reused stops
+ * allocating once it is big enough for the largest dump. */
+static bool dump_reserve(MMDB_dump_sink_s *sink, size_t size) {
+    if (sink->size > sink->length && size < sink->size - sink->length) {
+        return true;
+    }
+    if (size > SIZE_MAX - sink->length - 1) {
+        return false;
+    }
 
-    hex_string = calloc((size * 2) + 1, sizeof(char));
-    if (NULL == hex_string) {
-        return NULL;
+    size_t needed = sink->length + size + 1;
+    size_t new_size = sink->size > 0 ? sink->size : 256;
+    while (new_size < needed) {
+        new_size = new_size > SIZE_MAX / 2 ? needed : new_size * 2;
     }
 
-    for (uint32_t i = 0; i < size; i++) {
-        sprintf(hex_string + (2 * i), "%02X", bytes[i]);
+    char *buffer = realloc(sink->buffer, new_size);
+    if (NULL == buffer) {
+        return false;
+    }
+    sink->buffer = buffer;
+    sink->size = new_size;
+    return true;
+}
+
+static void dump_indentation(dump_writer_s *writer, int i) {
+    static const char spaces[] = "                                "
+                                 "                                ";
+    size_t size = i < 0 ? 0 : (i >= 1024 ? 1023 : (size_t)i);
+    while (size > 0) {
+        size_t chunk = size < sizeof(spaces) - 1 ? size : sizeof(spaces) - 1;
+        dump_write(writer, spaces, chunk);
+        size -= chunk;
+    }
+}
+
+/* Writes a string in double quotes, escaping it the same way as JSON. Runs of
+ * characters that don't need escaping are written at once. */
+static void
+dump_string(dump_writer_s *writer, const char *string, size_t size) {
+    dump_write(writer, "\"", 1);
+
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++) {
+        unsigned char const c = (unsigned char)string[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        dump_write(writer, string + start, i - start);
+        start = i + 1;
+        if (c == '"' || c == '\\') {
+            char escape[2] = {'\\', (char)c};
+            dump_write(writer, escape, 2);
+        } else if (c == '\n') {
+            dump_write(writer, "\\n", 2);
+        } else if (c == '\r') {
+            dump_write(writer, "\\r", 2);
+        } else if (c == '\t') {
+            dump_write(writer, "\\t", 2);
+        } else {
+            dump_format(writer, "\\u%04x", c);
+        }
+    }
+    dump_write(writer, string + start, size - start);
+
+    dump_write(writer, "\"", 1);
+}
+
+static void dump_hex(dump_writer_s *writer, const uint8_t *bytes, size_t size) {
+    static const char digits[] = "0123456789ABCDEF";
+    char hex[128];
+
+    while (size > 0) {
+        size_t chunk = size < sizeof(hex) / 2 ? size : sizeof(hex) / 2;
+        for (size_t i = 0; i < chunk; i++) {
+            hex[2 * i] = digits[bytes[i] >> 4];
+            hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+        }
+        dump_write(writer, hex, 2 * chunk);
+        bytes += chunk;
+        size -= chunk;
     }
+}
+
+static void dump_format(dump_writer_s *writer, const char *format, ...) {
+    // This is only used for numbers, which always fit.
+    char buffer[64];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
 
-    return hex_string;
+    if (size < 0 || (size_t)size >= sizeof(buffer)) {
+        writer->status = MMDB_INVALID_DATA_ERROR;
+        return;
+    }
+    dump_write(writer, buffer, (size_t)size);
 }
 
 const char *MMDB_strerror(int error_code) {
@@ -2286,6 +5953,9 @@ const char *MMDB_strerror(int error_code) {
         case MMDB_INVALID_NETWORK_ADDRESS_ERROR:
             return "The sockaddr family is unsupported; only AF_INET and "
                    "AF_INET6 are accepted";
+        case MMDB_WOULD_BLOCK_ERROR:
+            return "The lookup needs part of the database that is not in "
+                   "memory yet";
         default:
             return "Unknown error code";
     }
@@ -0,0 +1,282 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "tree-layout.h"
+#include "maxminddb.h"
+#include "maxminddb_writer.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The deepest an IPv6 search tree can be.
+#define MAXIMUM_DEPTH (128)
+
+// Blocked layouts put as many levels of a subtree as fit in one page of this
+// many bytes next to each other.
+#define LAYOUT_BLOCK_SIZE (4096)
+// The most nodes a block can have, which is when the nodes are 6 bytes.
+#define MAXIMUM_BLOCK_NODES (LAYOUT_BLOCK_SIZE / 6)
+
+typedef struct layout_state_s {
+    const tree_layout_s *tree;
+    uint32_t *numbers;
+    uint32_t *order;
+    uint32_t count;
+    // For the van Emde Boas layout, the most levels below each node that
+    // have been laid out already.
+    uint8_t *done_height;
+} layout_state_s;
+
+typedef struct layout_entry_s {
+    uint32_t node;
+    uint16_t level;
+} layout_entry_s;
+
+/* *INDENT-OFF* */
+/* --prototypes automatically generated by dev-bin/regen-prototypes.pl - don't remove this comment */
+static void number_node(layout_state_s *const state, uint32_t node);
+static int layout_depth_first(layout_state_s *const state);
+static int layout_blocked(layout_state_s *const state);
+static int layout_van_emde_boas(layout_state_s *const state,
+                                uint32_t root,
+                                uint16_t level,
+                                uint16_t height);
+/* --prototypes end - don't remove this comment-- */
+/* *INDENT-ON* */
+
+int layout_tree(const tree_layout_s *const tree,
+                int layout,
+                uint32_t *const numbers,
+                uint32_t *const order,
+                uint32_t *const count) {
+    *count = 0;
+    if (tree->depth == 0 || tree->depth > MAXIMUM_DEPTH ||
+        tree->node_size < 6) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+    if (tree->node_count == 0) {
+        return MMDB_SUCCESS;
+    }
+
+    layout_state_s state = {
+        .tree = tree,
+        .numbers = numbers,
+        .order = order,
+    };
+
+    int status;
+    switch (layout) {
+        case MMDB_WRITER_LAYOUT_DEPTH_FIRST:
+            status = layout_depth_first(&state);
+            break;
+        case MMDB_WRITER_LAYOUT_BLOCKED:
+            status = layout_blocked(&state);
+            break;
+        case MMDB_WRITER_LAYOUT_VAN_EMDE_BOAS:
+            state.done_height = calloc(tree->node_count, sizeof(uint8_t));
+            if (state.done_height == NULL) {
+                return MMDB_OUT_OF_MEMORY_ERROR;
+            }
+            status = layout_van_emde_boas(&state, 0, 0, tree->depth);
+            free(state.done_height);
+            break;
+        default:
+            return MMDB_INVALID_DATA_ERROR;
+    }
+
+    *count = state.count;
+    return status;
+}
+
+static void number_node(layout_state_s *const state, uint32_t node) {
+    if (state->numbers[node] == TREE_LAYOUT_NO_NODE) {
+        state->numbers[node] = state->count;
+        state->order[state->count++] = node;
+    }
+}
+
+// The stack holds at most one pending right child per level of the tree plus
+// the left child on top of it.
+static int layout_depth_first(layout_state_s *const state) {
+    const tree_layout_s *const tree = state->tree;
+    layout_entry_s stack[MAXIMUM_DEPTH + 2];
+    size_t stack_size = 0;
+
+    stack[stack_size++] = (layout_entry_s){.node = 0, .level = 0};
+    while (stack_size > 0) {
+        layout_entry_s const entry = stack[--stack_size];
+        if (state->numbers[entry.node] != TREE_LAYOUT_NO_NODE) {
+            continue;
+        }
+        if (entry.level >= tree->depth) {
+            return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+        }
+        number_node(state, entry.node);
+
+        uint32_t children[2];
+        tree->children(tree->context, entry.node, children);
+        for (int i = 1; i >= 0; i--) {
+            if (children[i] == TREE_LAYOUT_NO_NODE ||
+                state->numbers[children[i]] != TREE_LAYOUT_NO_NODE) {
+                continue;
+            }
+            if (stack_size == sizeof(stack) / sizeof(stack[0])) {
+                return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+            }
+            stack[stack_size++] = (layout_entry_s){
+                .node = children[i], .level = (uint16_t)(entry.level + 1)};
+        }
+    }
+    return MMDB_SUCCESS;
+}
+
+// Splits the tree into subtrees of as many levels as fit in a page. Each
+// subtree is numbered breadth first, and the subtrees below it are queued so
+// that they are numbered breadth first as well.
+static int layout_blocked(layout_state_s *const state) {
+    const tree_layout_s *const tree = state->tree;
+    uint16_t levels = 1;
+    while (((size_t)2 << levels) - 1 <= LAYOUT_BLOCK_SIZE / tree->node_size &&
+           levels < tree->depth) {
+        levels++;
+    }
+
+    layout_entry_s block[MAXIMUM_BLOCK_NODES];
+    size_t roots_size = 1024;
+    size_t roots_count = 0;
+    size_t next_root = 0;
+    layout_entry_s *roots = malloc(roots_size * sizeof(layout_entry_s));
+    if (roots == NULL) {
+        return MMDB_OUT_OF_MEMORY_ERROR;
+    }
+    roots[roots_count++] = (layout_entry_s){.node = 0, .level = 0};
+
+    int status = MMDB_SUCCESS;
+    while (next_root < roots_count && status == MMDB_SUCCESS) {
+        layout_entry_s const root = roots[next_root++];
+        if (state->numbers[root.node] != TREE_LAYOUT_NO_NODE) {
+            continue;
+        }
+
+        size_t block_count = 0;
+        block[block_count++] = root;
+        number_node(state, root.node);
+        for (size_t i = 0; i < block_count; i++) {
+            layout_entry_s const entry = block[i];
+            if (entry.level >= tree->depth) {
+                status = MMDB_CORRUPT_SEARCH_TREE_ERROR;
+                break;
+            }
+
+            uint32_t children[2];
+            tree->children(tree->context, entry.node, children);
+            for (int j = 0; j < 2; j++) {
+                if (children[j] == TREE_LAYOUT_NO_NODE ||
+                    state->numbers[children[j]] != TREE_LAYOUT_NO_NODE) {
+                    continue;
+                }
+                layout_entry_s const child = {
+                    .node = children[j], .level = (uint16_t)(entry.level + 1)};
+                if (child.level - root.level < levels) {
+                    number_node(state, child.node);
+                    block[block_count++] = child;
+                    continue;
+                }
+
+                if (roots_count == roots_size) {
+                    // Drop the roots we are done with before growing.
+                    if (next_root > 0) {
+                        memmove(roots,
+                                roots + next_root,
+                                (roots_count - next_root) *
+                                    sizeof(layout_entry_s));
+                        roots_count -= next_root;
+                        next_root = 0;
+                    }
+                    if (roots_count == roots_size) {
+                        layout_entry_s *const grown = realloc(
+                            roots, roots_size * 2 * sizeof(layout_entry_s));
+                        if (grown == NULL) {
+                            free(roots);
+                            return MMDB_OUT_OF_MEMORY_ERROR;
+                        }
+                        roots = grown;
+                        roots_size *= 2;
+                    }
+                }
+                roots[roots_count++] = child;
+            }
+        }
+    }
+
+    free(roots);
+    return status;
+}
+
+// Lays out the nodes within height levels of root, which is level levels below
+// the root of the whole tree. The top half of those levels are laid out first
+// and then each of the subtrees below them, recursively, so that any path
+// through the tree crosses as few cache lines and pages as possible whatever
+// their size is.
+static int layout_van_emde_boas(layout_state_s *const state,
+                                uint32_t root,
+                                uint16_t level,
+                                uint16_t height) {
+    const tree_layout_s *const tree = state->tree;
+    if (state->done_height[root] >= height) {
+        return MMDB_SUCCESS;
+    }
+    if (level >= tree->depth) {
+        return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+    }
+
+    if (height == 1) {
+        number_node(state, root);
+        state->done_height[root] = 1;
+        return MMDB_SUCCESS;
+    }
+
+    uint16_t const top = height / 2;
+    int status = layout_van_emde_boas(state, root, level, top);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    // Find the nodes top levels below root from left to right.
+    layout_entry_s stack[MAXIMUM_DEPTH + 2];
+    size_t stack_size = 0;
+    stack[stack_size++] = (layout_entry_s){.node = root, .level = 0};
+    while (stack_size > 0) {
+        layout_entry_s const entry = stack[--stack_size];
+        if (entry.level == top) {
+            status = layout_van_emde_boas(state,
+                                          entry.node,
+                                          (uint16_t)(level + top),
+                                          (uint16_t)(height - top));
+            if (status != MMDB_SUCCESS) {
+                return status;
+            }
+            continue;
+        }
+
+        uint32_t children[2];
+        tree->children(tree->context, entry.node, children);
+        for (int i = 1; i >= 0; i--) {
+            if (children[i] == TREE_LAYOUT_NO_NODE) {
+                continue;
+            }
+            if (stack_size == sizeof(stack) / sizeof(stack[0])) {
+                return MMDB_CORRUPT_SEARCH_TREE_ERROR;
+            }
+            stack[stack_size++] = (layout_entry_s){
+                .node = children[i], .level = (uint16_t)(entry.level + 1)};
+        }
+    }
+
+    if (state->done_height[root] < height) {
+        state->done_height[root] = (uint8_t)height;
+    }
+    return MMDB_SUCCESS;
+}
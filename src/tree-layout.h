@@ -0,0 +1,42 @@
+#ifndef TREE_LAYOUT_H
+#define TREE_LAYOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Marks a record that does not point to another node, and a node that has not
+// been given a number yet.
+#define TREE_LAYOUT_NO_NODE UINT32_MAX
+
+// Sets children to the nodes the left and right records of node point to, or
+// to TREE_LAYOUT_NO_NODE for records that hold data or are empty.
+typedef void (*tree_layout_children_fn)(const void *const context,
+                                        uint32_t node,
+                                        uint32_t children[2]);
+
+// A search tree to lay out. The root is always node 0. Records may point to
+// nodes that are also reachable some other way, such as the IPv4 subtree of an
+// IPv6 database, but no node may be more than depth levels below the root.
+typedef struct tree_layout_s {
+    uint32_t node_count;
+    uint16_t depth;
+    // The size in bytes of a node in the file, which is at least 6. Blocked
+    // layouts fit as many nodes as they can in a page.
+    size_t node_size;
+    tree_layout_children_fn children;
+    const void *context;
+} tree_layout_s;
+
+// Numbers the nodes reachable from the root in the order given by layout,
+// which is one of the MMDB_WRITER_LAYOUT_* values. numbers[node] is set to the
+// position of node in the new order and order[position] to the node at that
+// position. Every entry in numbers must be TREE_LAYOUT_NO_NODE beforehand, and
+// stays that way for the nodes that can't be reached. This returns an MMDB
+// status code.
+int layout_tree(const tree_layout_s *const tree,
+                int layout,
+                uint32_t *const numbers,
+                uint32_t *const order,
+                uint32_t *const count);
+
+#endif
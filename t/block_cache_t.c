@@ -0,0 +1,233 @@
+#include "maxminddb_test_helper.h"
+
+/* Checks that the lists have the same values, and that the values dump the
+ * same so that strings and bytes that are copied out of the cache are too. */
+static bool same_entry_data_lists(MMDB_entry_data_list_s *mapped,
+                                  MMDB_entry_data_list_s *cached) {
+    MMDB_entry_data_list_s *a = mapped;
+    MMDB_entry_data_list_s *b = cached;
+    for (; NULL != a && NULL != b; a = a->next, b = b->next) {
+        if (a->entry_data.type != b->entry_data.type ||
+            a->entry_data.offset != b->entry_data.offset ||
+            a->entry_data.offset_to_next != b->entry_data.offset_to_next ||
+            a->entry_data.data_size != b->entry_data.data_size) {
+            return false;
+        }
+    }
+    if (NULL != a || NULL != b) {
+        return false;
+    }
+
+    MMDB_dump_sink_s mapped_sink;
+    MMDB_dump_sink_s cached_sink;
+    MMDB_dump_sink_init_growable(&mapped_sink);
+    MMDB_dump_sink_init_growable(&cached_sink);
+    bool const same =
+        MMDB_dump_entry_data_list_to_sink(&mapped_sink, mapped, 0) ==
+            MMDB_SUCCESS &&
+        MMDB_dump_entry_data_list_to_sink(&cached_sink, cached, 0) ==
+            MMDB_SUCCESS &&
+        mapped_sink.length == cached_sink.length &&
+        !memcmp(mapped_sink.buffer, cached_sink.buffer, mapped_sink.length);
+    MMDB_dump_sink_free(&mapped_sink);
+    MMDB_dump_sink_free(&cached_sink);
+    return same;
+}
+
+/* Looks the address up in both handles and checks that the results and the
+ * data they point to are the same. */
+static bool same_lookup(const MMDB_s *const mmdb,
+                        MMDB_cache_s *const cache,
+                        const struct sockaddr *const sockaddr) {
+    int mapped_error;
+    int cached_error;
+    MMDB_lookup_result_s mapped =
+        MMDB_lookup_sockaddr(mmdb, sockaddr, &mapped_error);
+    MMDB_lookup_result_s cached =
+        MMDB_cache_lookup_sockaddr(cache, sockaddr, &cached_error);
+    if (mapped_error != cached_error ||
+        mapped.found_entry != cached.found_entry ||
+        mapped.netmask != cached.netmask) {
+        return false;
+    }
+    if (!mapped.found_entry) {
+        return true;
+    }
+    if (mapped.entry.offset != cached.entry.offset) {
+        return false;
+    }
+
+    MMDB_entry_data_list_s *mapped_list = NULL;
+    MMDB_entry_data_list_s *cached_list = NULL;
+    bool const same =
+        MMDB_get_entry_data_list(&mapped.entry, &mapped_list) ==
+            MMDB_SUCCESS &&
+        MMDB_cache_get_entry_data_list(cache, &cached.entry, &cached_list) ==
+            MMDB_SUCCESS &&
+        same_entry_data_lists(mapped_list, cached_list);
+    MMDB_free_entry_data_list(mapped_list);
+    MMDB_free_entry_data_list(cached_list);
+    return same;
+}
+
+static MMDB_cache_s *cache_open_ok(const char *path, size_t memory_budget) {
+    MMDB_cache_s *cache = NULL;
+    int const status = MMDB_cache_open(path, memory_budget, &cache);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "opened %s with a budget of %zu bytes",
+           path,
+           memory_budget);
+    return MMDB_SUCCESS == status ? cache : NULL;
+}
+
+/* Looks up the first address of each network of the database and some
+ * addresses given as strings, which for an IPv6 database include IPv4
+ * addresses that start at the IPv4 start node. */
+static void test_database(const char *filename, size_t memory_budget) {
+    char *path = test_database_path(filename);
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    MMDB_cache_s *cache = cache_open_ok(path, memory_budget);
+    free(path);
+    if (NULL == mmdb || NULL == cache) {
+        BAIL_OUT("could not open %s", filename);
+    }
+
+    const MMDB_metadata_s *metadata = MMDB_cache_metadata(cache);
+    ok(metadata->node_count == mmdb->metadata.node_count &&
+           metadata->ip_version == mmdb->metadata.ip_version &&
+           metadata->build_epoch == mmdb->metadata.build_epoch &&
+           !strcmp(metadata->database_type, mmdb->metadata.database_type),
+       "the metadata of %s is the same",
+       filename);
+
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init(mmdb, 0, &iterator);
+    int networks = 0;
+    int same = 0;
+    MMDB_network_s network;
+    while (MMDB_SUCCESS == status &&
+           MMDB_network_iterator_next(&iterator, &network, &status)) {
+        networks++;
+        struct sockaddr_in sin = {.sin_family = AF_INET};
+        struct sockaddr_in6 sin6 = {.sin6_family = AF_INET6};
+        const struct sockaddr *sockaddr;
+        if (network.ip_version == 4) {
+            memcpy(&sin.sin_addr, network.address, 4);
+            sockaddr = (const struct sockaddr *)&sin;
+        } else {
+            memcpy(&sin6.sin6_addr, network.address, 16);
+            sockaddr = (const struct sockaddr *)&sin6;
+        }
+        if (same_lookup(mmdb, cache, sockaddr)) {
+            same++;
+        }
+    }
+    cmp_ok(status, "==", MMDB_SUCCESS, "iterated over %s", filename);
+    ok(networks > 0 && same == networks,
+       "%d of the %d networks of %s are the same through the cache",
+       same,
+       networks,
+       filename);
+
+    const char *ips[] = {"1.1.1.1",
+                         "1.1.1.3",
+                         "81.2.69.160",
+                         "255.255.255.255",
+                         "::1.1.1.1",
+                         "::2:0:58",
+                         "2001:218::",
+                         "::"};
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); i++) {
+        struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                                 .ai_flags = AI_NUMERICHOST,
+                                 .ai_socktype = SOCK_STREAM};
+        struct addrinfo *addresses;
+        if (getaddrinfo(ips[i], NULL, &hints, &addresses) != 0) {
+            BAIL_OUT("could not resolve %s", ips[i]);
+        }
+        ok(same_lookup(mmdb, cache, addresses->ai_addr),
+           "%s is the same through the cache in %s",
+           ips[i],
+           filename);
+        freeaddrinfo(addresses);
+    }
+
+    MMDB_cache_close(cache);
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+static void test_errors(void) {
+    MMDB_cache_s *cache = NULL;
+    cmp_ok(MMDB_cache_open("does-not-exist.mmdb", 0, &cache),
+           "==",
+           MMDB_FILE_OPEN_ERROR,
+           "opening a missing file is an error");
+    ok(NULL == cache, "and there is no cache");
+
+    char *path = test_database_path("MaxMind-DB-test-ipv4-24.mmdb");
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    cache = cache_open_ok(path, 0);
+    free(path);
+    if (NULL == mmdb || NULL == cache) {
+        BAIL_OUT("could not open MaxMind-DB-test-ipv4-24.mmdb");
+    }
+
+    int gai_error;
+    int mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_cache_lookup_string(cache, "1.1.1.1", &gai_error, &mmdb_error);
+    ok(0 == gai_error && MMDB_SUCCESS == mmdb_error && result.found_entry,
+       "found 1.1.1.1");
+    MMDB_entry_data_s entry_data;
+    cmp_ok(MMDB_get_value(&result.entry, &entry_data, "ip", NULL),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "the entry of a cached lookup can't be read as if it were mapped");
+
+    MMDB_entry_data_list_s *list = NULL;
+    MMDB_lookup_result_s mapped =
+        MMDB_lookup_string(mmdb, "1.1.1.1", &gai_error, &mmdb_error);
+    cmp_ok(MMDB_cache_get_entry_data_list(cache, &mapped.entry, &list),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "an entry from another database is an error");
+    ok(NULL == list, "and there is no list");
+
+    result = MMDB_cache_lookup_string(cache, "::1", &gai_error, &mmdb_error);
+    cmp_ok(mmdb_error,
+           "==",
+           MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR,
+           "an IPv6 lookup in an IPv4 database is an error");
+
+    result =
+        MMDB_cache_lookup_string(cache, "not an ip", &gai_error, &mmdb_error);
+    ok(0 != gai_error && MMDB_SUCCESS == mmdb_error && !result.found_entry,
+       "a getaddrinfo error for an invalid address");
+
+    MMDB_cache_close(cache);
+    MMDB_cache_close(NULL);
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    const char *filenames[] = {"GeoIP2-City-Test.mmdb",
+                               "MaxMind-DB-test-decoder.mmdb",
+                               "MaxMind-DB-test-ipv4-24.mmdb",
+                               "MaxMind-DB-test-ipv6-28.mmdb",
+                               "MaxMind-DB-test-mixed-32.mmdb"};
+    // No budget at all still leaves one block, which every read evicts. A
+    // few blocks are split between shards with a smaller top of the tree.
+    size_t const budgets[] = {0, 200000, SIZE_MAX};
+    for (size_t i = 0; i < sizeof(filenames) / sizeof(filenames[0]); i++) {
+        for (size_t j = 0; j < sizeof(budgets) / sizeof(budgets[0]); j++) {
+            test_database(filenames[i], budgets[j]);
+        }
+    }
+    test_errors();
+    done_testing();
+}
@@ -8,6 +8,7 @@
 static void test_data_pool_new(void);
 static void test_data_pool_destroy(void);
 static void test_data_pool_alloc(void);
+static void test_data_pool_alloc_bytes(void);
 static void test_data_pool_to_list(void);
 static bool create_and_check_list(size_t const, size_t const);
 static void check_block_count(MMDB_entry_data_list_s const *const,
@@ -18,6 +19,7 @@ int main(void) {
     test_data_pool_new();
     test_data_pool_destroy();
     test_data_pool_alloc();
+    test_data_pool_alloc_bytes();
     test_data_pool_to_list();
     done_testing();
 }
@@ -126,6 +128,30 @@ static void test_data_pool_alloc(void) {
     }
 }
 
+static void test_data_pool_alloc_bytes(void) {
+    MMDB_data_pool_s *const pool = data_pool_new(1);
+    ok(pool != NULL, "created pool");
+
+    uint8_t *const first = data_pool_alloc_bytes(pool, 10);
+    ok(first != NULL, "allocated 10 bytes");
+    memset(first, 'a', 10);
+    uint8_t *const second = data_pool_alloc_bytes(pool, 20);
+    ok(second == first + 10, "the next bytes come from the same chunk");
+    memset(second, 'b', 20);
+
+    size_t const large_size = DATA_POOL_BYTES_CHUNK_SIZE * 2;
+    uint8_t *const large = data_pool_alloc_bytes(pool, large_size);
+    ok(large != NULL, "allocated more bytes than a chunk holds");
+    memset(large, 'c', large_size);
+    ok(first[9] == 'a' && second[0] == 'b',
+       "the earlier bytes are left alone");
+
+    ok(data_pool_alloc_bytes(pool, SIZE_MAX) == NULL,
+       "a size that doesn't fit in memory fails");
+
+    data_pool_destroy(pool);
+}
+
 static void test_data_pool_to_list(void) {
     {
         size_t const initial_size = 16;
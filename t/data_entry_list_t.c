@@ -1,5 +1,7 @@
 #include "maxminddb_test_helper.h"
 
+#define DATABASE "data_entry_list_t.mmdb"
+
 MMDB_entry_data_list_s *
 test_array_value(MMDB_entry_data_list_s *entry_data_list) {
     MMDB_entry_data_list_s *array = entry_data_list = entry_data_list->next;
@@ -340,6 +342,94 @@ test_utf8_string_value(MMDB_entry_data_list_s *entry_data_list) {
     return entry_data_list;
 }
 
+/* Checks that MMDB_get_entry_data_list_in_arena() returns the same list as
+ * MMDB_get_entry_data_list() and that it uses only the memory it is given. */
+static void test_arena_list(MMDB_entry_s *entry, const char *description) {
+    MMDB_entry_data_list_s *expect;
+    int status = MMDB_get_entry_data_list(entry, &expect);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("MMDB_get_entry_data_list failed with %s",
+                 MMDB_strerror(status));
+    }
+    size_t count = 0;
+    for (MMDB_entry_data_list_s *list = expect; list != NULL;
+         list = list->next) {
+        count++;
+    }
+
+    // Room for the list twice and the frames of deep lists, with an odd
+    // start to check the alignment.
+    size_t size = 4 * count * sizeof(MMDB_entry_data_list_s) + 64;
+    char *memory = malloc(size + 1);
+    if (memory == NULL) {
+        BAIL_OUT("could not allocate the arena");
+    }
+    MMDB_entry_data_arena_s arena;
+    MMDB_entry_data_arena_init(&arena, memory + 1, size);
+
+    MMDB_entry_data_list_s *first;
+    status = MMDB_get_entry_data_list_in_arena(entry, &arena, &first);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_get_entry_data_list_in_arena - %s",
+           description);
+
+    bool same = status == MMDB_SUCCESS;
+    MMDB_entry_data_list_s *list = first;
+    for (MMDB_entry_data_list_s *other = expect; same && other != NULL;
+         other = other->next, list = list->next) {
+        same = list != NULL &&
+               (char *)list > memory && (char *)list < memory + size + 1 &&
+               (uintptr_t)list % sizeof(void *) == 0 &&
+               list->entry_data.type == other->entry_data.type &&
+               list->entry_data.offset == other->entry_data.offset &&
+               list->entry_data.offset_to_next ==
+                   other->entry_data.offset_to_next &&
+               list->entry_data.data_size == other->entry_data.data_size;
+    }
+    ok(same && list == NULL,
+       "the arena list is the same as the list from "
+       "MMDB_get_entry_data_list - %s",
+       description);
+
+    MMDB_entry_data_list_s *second;
+    status = MMDB_get_entry_data_list_in_arena(entry, &arena, &second);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "a second list fits in the arena - %s",
+           description);
+    ok(status == MMDB_SUCCESS && second != first &&
+           second->entry_data.offset == first->entry_data.offset,
+       "the second list is after the first - %s",
+       description);
+
+    MMDB_entry_data_arena_s small;
+    MMDB_entry_data_arena_init(
+        &small, memory, count * sizeof(MMDB_entry_data_list_s) / 2);
+    status = MMDB_get_entry_data_list_in_arena(entry, &small, &second);
+    cmp_ok(status,
+           "==",
+           MMDB_OUT_OF_MEMORY_ERROR,
+           "the list does not fit in a small arena - %s",
+           description);
+    cmp_ok(small.used,
+           "==",
+           0,
+           "a list that does not fit uses no memory - %s",
+           description);
+
+    MMDB_entry_data_arena_reset(&arena);
+    status = MMDB_get_entry_data_list_in_arena(entry, &arena, &second);
+    ok(status == MMDB_SUCCESS && second == first,
+       "the arena is reused after MMDB_entry_data_arena_reset - %s",
+       description);
+
+    free(memory);
+    MMDB_free_entry_data_list(expect);
+}
+
 void run_tests(int mode, const char *description) {
     const char *filename = "MaxMind-DB-test-decoder.mmdb";
     char *path = test_database_path(filename);
@@ -418,12 +508,86 @@ void run_tests(int mode, const char *description) {
 
     MMDB_free_entry_data_list(first);
 
+    test_arena_list(&result.entry, description);
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+/* Inserts n nested arrays, each holding the next array and a string, around
+ * a uint32. */
+static MMDB_s *write_nested_arrays(int n) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Nested Arrays", 0);
+    MMDB_writer_value_s *value = MMDB_writer_uint32(writer, 42);
+    for (int i = 0; i < n; i++) {
+        MMDB_writer_value_s *array = MMDB_writer_array(writer);
+        MMDB_writer_array_append(writer, array, value);
+        MMDB_writer_array_append(
+            writer, array, MMDB_writer_utf8_string(writer, "x", 1));
+        value = array;
+    }
+    if (MMDB_writer_insert_network(
+            writer, "1.0.0.0/24", value, MMDB_WRITER_INSERT_REPLACE) !=
+        MMDB_SUCCESS) {
+        BAIL_OUT("could not insert 1.0.0.0/24");
+    }
+    return write_and_open(writer, DATABASE);
+}
+
+static void test_nested_arrays(void) {
+    int n = 200;
+    MMDB_s *mmdb = write_nested_arrays(n);
+
+    int gai_error, mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_lookup_string(mmdb, "1.0.0.1", &gai_error, &mmdb_error);
+    ok(result.found_entry, "1.0.0.1 is in the database");
+
+    MMDB_entry_data_list_s *entry_data_list;
+    int status = MMDB_get_entry_data_list(&result.entry, &entry_data_list);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_get_entry_data_list with %d nested arrays",
+           n);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("MMDB_get_entry_data_list failed");
+    }
+
+    // The arrays come first, then the uint32, then the strings from the
+    // innermost array out.
+    MMDB_entry_data_list_s *list = entry_data_list;
+    int arrays = 0;
+    while (list != NULL && list->entry_data.type == MMDB_DATA_TYPE_ARRAY &&
+           list->entry_data.data_size == 2) {
+        arrays++;
+        list = list->next;
+    }
+    cmp_ok(arrays, "==", n, "found every array");
+    ok(list != NULL && list->entry_data.type == MMDB_DATA_TYPE_UINT32 &&
+           list->entry_data.uint32 == 42,
+       "found the uint32 in the innermost array");
+    int strings = 0;
+    for (list = list != NULL ? list->next : NULL; list != NULL;
+         list = list->next) {
+        if (list->entry_data.type == MMDB_DATA_TYPE_UTF8_STRING) {
+            strings++;
+        }
+    }
+    cmp_ok(strings, "==", n, "found the string of every array");
+
+    MMDB_free_entry_data_list(entry_data_list);
+
+    test_arena_list(&result.entry, "nested arrays");
+
     MMDB_close(mmdb);
     free(mmdb);
+    remove(DATABASE);
 }
 
 int main(void) {
     plan(NO_PLAN);
     for_all_modes(&run_tests);
+    test_nested_arrays();
     done_testing();
 }
@@ -415,6 +415,136 @@ void test_all_data_types_as_zero(MMDB_lookup_result_s *result,
     }
 }
 
+void test_typed_accessors(MMDB_lookup_result_s *result,
+                          const char *ip,
+                          const char *mode_desc) {
+    const MMDB_entry_s *entry = &result->entry;
+
+    {
+        const char *path[] = {"map", "mapX", "utf8_stringX", NULL};
+        const char *string = NULL;
+        uint32_t length = 0;
+        int status = MMDB_get_utf8(entry, path, &string, &length);
+        cmp_ok(status,
+               "==",
+               MMDB_SUCCESS,
+               "MMDB_get_utf8 for %s - %s",
+               ip,
+               mode_desc);
+        cmp_ok(length, "==", 5, "MMDB_get_utf8 returns the length");
+        ok(string != NULL && memcmp(string, "hello", 5) == 0,
+           "MMDB_get_utf8 returns the string");
+    }
+
+    {
+        const char *path[] = {"double", NULL};
+        double value = 0;
+        int status = MMDB_get_double(entry, path, &value);
+        cmp_ok(status,
+               "==",
+               MMDB_SUCCESS,
+               "MMDB_get_double for %s - %s",
+               ip,
+               mode_desc);
+        compare_double(value, 42.123456);
+
+        const char *float_path[] = {"float", NULL};
+        status = MMDB_get_double(entry, float_path, &value);
+        cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_get_double reads a float");
+        compare_float((float)value, 1.1F);
+    }
+
+    {
+        const char *uint16_path[] = {"uint16", NULL};
+        uint32_t value = 0;
+        int status = MMDB_get_uint32(entry, uint16_path, &value);
+        cmp_ok(status,
+               "==",
+               MMDB_SUCCESS,
+               "MMDB_get_uint32 reads a uint16 for %s - %s",
+               ip,
+               mode_desc);
+        cmp_ok(value, "==", 100, "MMDB_get_uint32 returns 100");
+
+        const char *uint32_path[] = {"uint32", NULL};
+        status = MMDB_get_uint32(entry, uint32_path, &value);
+        cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_get_uint32 reads a uint32");
+        cmp_ok(value, "==", 1 << 28, "MMDB_get_uint32 returns 2**28");
+
+        const char *array_path[] = {"array", "1", NULL};
+        status = MMDB_get_uint32(entry, array_path, &value);
+        cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_get_uint32 in an array");
+        cmp_ok(value, "==", 2, "MMDB_get_uint32 returns array[1]");
+    }
+
+    {
+        const char *path[] = {"uint64", NULL};
+        uint64_t value = 0;
+        int status = MMDB_get_uint64(entry, path, &value);
+        cmp_ok(status,
+               "==",
+               MMDB_SUCCESS,
+               "MMDB_get_uint64 for %s - %s",
+               ip,
+               mode_desc);
+        ok(value == (uint64_t)1 << 60, "MMDB_get_uint64 returns 2**60");
+    }
+
+    {
+        const char *path[] = {"boolean", NULL};
+        bool value = false;
+        int status = MMDB_get_bool(entry, path, &value);
+        cmp_ok(status,
+               "==",
+               MMDB_SUCCESS,
+               "MMDB_get_bool for %s - %s",
+               ip,
+               mode_desc);
+        ok(value, "MMDB_get_bool returns true");
+    }
+
+    {
+        const char *string_path[] = {"utf8_string", NULL};
+        uint32_t value = 42;
+        int status = MMDB_get_uint32(entry, string_path, &value);
+        cmp_ok(status,
+               "==",
+               MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR,
+               "MMDB_get_uint32 of a string is an error");
+        cmp_ok(value, "==", 42, "the value is left alone on error");
+
+        const char *uint64_path[] = {"uint64", NULL};
+        status = MMDB_get_uint32(entry, uint64_path, &value);
+        cmp_ok(status,
+               "==",
+               MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR,
+               "MMDB_get_uint32 of a uint64 is an error");
+
+        const char *map_path[] = {"map", NULL};
+        const char *string;
+        uint32_t length;
+        status = MMDB_get_utf8(entry, map_path, &string, &length);
+        cmp_ok(status,
+               "==",
+               MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR,
+               "MMDB_get_utf8 of a map is an error");
+
+        const char *missing_path[] = {"map", "nope", NULL};
+        status = MMDB_get_utf8(entry, missing_path, &string, &length);
+        cmp_ok(status,
+               "==",
+               MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR,
+               "MMDB_get_utf8 of a missing key is an error");
+
+        const char *scalar_path[] = {"uint16", "0", NULL};
+        status = MMDB_get_uint32(entry, scalar_path, &value);
+        cmp_ok(status,
+               "==",
+               MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR,
+               "MMDB_get_uint32 below a scalar is an error");
+    }
+}
+
 void run_tests(int mode, const char *mode_desc) {
     const char *filename = "MaxMind-DB-test-decoder.mmdb";
     char *path = test_database_path(filename);
@@ -481,6 +611,7 @@ void run_tests(int mode, const char *mode_desc) {
                mode_desc);
 
         test_all_data_types(&result, ip, filename, mode_desc);
+        test_typed_accessors(&result, ip, mode_desc);
     }
 
     {
@@ -0,0 +1,250 @@
+#include "maxminddb_test_helper.h"
+
+#ifndef _WIN32
+    #include <arpa/inet.h>
+#endif
+
+#define OLD_DATABASE "diff_t_old.mmdb"
+#define NEW_DATABASE "diff_t_new.mmdb"
+
+typedef struct {
+    char change;
+    const char *network;
+} expected_diff_s;
+
+/* A map of a name, a number and an array of tags. When reversed is true the
+ * keys are added in the opposite order, which doesn't change the data. */
+static MMDB_writer_value_s *
+record_value(MMDB_writer_s *writer, const char *name, bool reversed) {
+    MMDB_writer_value_s *tags = MMDB_writer_array(writer);
+    MMDB_writer_array_append(
+        writer, tags, MMDB_writer_utf8_string(writer, name, strlen(name)));
+    MMDB_writer_array_append(writer, tags, MMDB_writer_double(writer, 1.5));
+
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    if (reversed) {
+        map_add_ok(writer, map, "tags", tags);
+        map_add_ok(writer, map, "number", MMDB_writer_uint32(writer, 42));
+        map_add_ok(writer,
+                   map,
+                   "name",
+                   MMDB_writer_utf8_string(writer, name, strlen(name)));
+    } else {
+        map_add_ok(writer,
+                   map,
+                   "name",
+                   MMDB_writer_utf8_string(writer, name, strlen(name)));
+        map_add_ok(writer, map, "number", MMDB_writer_uint32(writer, 42));
+        map_add_ok(writer, map, "tags", tags);
+    }
+    return map;
+}
+
+static void insert_ok(MMDB_writer_s *writer,
+                      const char *network,
+                      const char *name,
+                      bool reversed) {
+    int status =
+        MMDB_writer_insert_network(writer,
+                                   network,
+                                   record_value(writer, name, reversed),
+                                   MMDB_WRITER_INSERT_REPLACE);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not insert %s", network);
+    }
+}
+
+static void test_diff(MMDB_s *old_mmdb,
+                      MMDB_s *new_mmdb,
+                      uint32_t flags,
+                      const expected_diff_s *expect,
+                      size_t expect_count,
+                      const char *description) {
+    MMDB_diff_iterator_s iterator;
+    int status = MMDB_diff_iterator_init(old_mmdb, new_mmdb, flags, &iterator);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_diff_iterator_init - %s",
+           description);
+    if (status != MMDB_SUCCESS) {
+        return;
+    }
+
+    size_t count = 0;
+    MMDB_network_diff_s diff;
+    while (MMDB_diff_iterator_next(&iterator, &diff, &status)) {
+        if (count >= expect_count) {
+            count++;
+            continue;
+        }
+
+        char address[INET6_ADDRSTRLEN];
+        inet_ntop(diff.ip_version == 4 ? AF_INET : AF_INET6,
+                  diff.address,
+                  address,
+                  sizeof(address));
+        char network[INET6_ADDRSTRLEN + 8];
+        snprintf(network, sizeof(network), "%s/%d", address, diff.netmask);
+        is(network,
+           expect[count].network,
+           "network %zu - %s",
+           count,
+           description);
+
+        char change = !diff.old_found_entry   ? '+'
+                      : !diff.new_found_entry ? '-'
+                                              : '~';
+        cmp_ok(change,
+               "==",
+               expect[count].change,
+               "%s is reported as %c - %s",
+               network,
+               expect[count].change,
+               description);
+        if (diff.old_found_entry) {
+            ok(diff.old_entry.mmdb == old_mmdb,
+               "old entry is in the old database - %s",
+               description);
+        }
+        if (diff.new_found_entry) {
+            ok(diff.new_entry.mmdb == new_mmdb,
+               "new entry is in the new database - %s",
+               description);
+        }
+        count++;
+    }
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "diff finished without error - %s",
+           description);
+    cmp_ok(count,
+           "==",
+           expect_count,
+           "number of differences - %s",
+           description);
+}
+
+static void test_same_data(void) {
+    MMDB_writer_s *old_writer =
+        new_writer_ok(6, "Diff Test", MMDB_WRITER_ALIAS_IPV4);
+    insert_ok(old_writer, "1.0.0.0/24", "one", false);
+    insert_ok(old_writer, "2001:db8::/32", "v6", false);
+    MMDB_s *old_mmdb = write_and_open(old_writer, OLD_DATABASE);
+
+    // The new database stores the same data with its keys in another order,
+    // splits 1.0.0.0/24 into two networks and has no IPv4 aliases.
+    MMDB_writer_s *new_writer = new_writer_ok(6, "Diff Test", 0);
+    insert_ok(new_writer, "1.0.0.0/25", "one", true);
+    insert_ok(new_writer, "1.0.0.128/25", "one", false);
+    insert_ok(new_writer, "2001:db8::/32", "v6", true);
+    MMDB_s *new_mmdb = write_and_open(new_writer, NEW_DATABASE);
+
+    test_diff(old_mmdb, new_mmdb, 0, NULL, 0, "same data");
+    test_diff(old_mmdb, old_mmdb, 0, NULL, 0, "database with itself");
+
+    expected_diff_s aliases[] = {
+        {'-', "::ffff:1.0.0.0/120"},
+        {'-', "2001:0:100::/56"},
+        {'-', "2002:100::/40"},
+    };
+    test_diff(old_mmdb,
+              new_mmdb,
+              MMDB_ITERATOR_INCLUDE_ALIASED_NETWORKS,
+              aliases,
+              sizeof(aliases) / sizeof(aliases[0]),
+              "including aliased networks");
+
+    close_and_remove(new_mmdb, NEW_DATABASE);
+    close_and_remove(old_mmdb, OLD_DATABASE);
+}
+
+static void test_changes(void) {
+    MMDB_writer_s *old_writer = new_writer_ok(4, "Diff Test", 0);
+    insert_ok(old_writer, "1.0.0.0/24", "one", false);
+    insert_ok(old_writer, "2.0.0.0/24", "two", false);
+    insert_ok(old_writer, "3.0.0.0/16", "three", false);
+    MMDB_s *old_mmdb = write_and_open(old_writer, OLD_DATABASE);
+
+    MMDB_writer_s *new_writer = new_writer_ok(4, "Diff Test", 0);
+    insert_ok(new_writer, "1.0.0.0/24", "one", true);
+    insert_ok(new_writer, "2.0.0.0/24", "TWO", false);
+    insert_ok(new_writer, "3.0.0.0/17", "three", false);
+    insert_ok(new_writer, "4.0.0.0/24", "four", false);
+    MMDB_s *new_mmdb = write_and_open(new_writer, NEW_DATABASE);
+
+    expected_diff_s changes[] = {
+        {'~', "2.0.0.0/24"},
+        {'-', "3.0.128.0/17"},
+        {'+', "4.0.0.0/24"},
+    };
+    test_diff(old_mmdb,
+              new_mmdb,
+              0,
+              changes,
+              sizeof(changes) / sizeof(changes[0]),
+              "changed networks");
+
+    expected_diff_s reversed[] = {
+        {'~', "2.0.0.0/24"},
+        {'+', "3.0.128.0/17"},
+        {'-', "4.0.0.0/24"},
+    };
+    test_diff(new_mmdb,
+              old_mmdb,
+              0,
+              reversed,
+              sizeof(reversed) / sizeof(reversed[0]),
+              "changed networks in reverse");
+
+    close_and_remove(new_mmdb, NEW_DATABASE);
+    close_and_remove(old_mmdb, OLD_DATABASE);
+}
+
+static void test_test_database(const char *filename) {
+    char *path = test_database_path(filename);
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+    if (!mmdb) {
+        return;
+    }
+
+    test_diff(mmdb, mmdb, 0, NULL, 0, filename);
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+static void test_different_ip_versions(void) {
+    char *path = test_database_path("MaxMind-DB-test-ipv4-24.mmdb");
+    MMDB_s *ipv4 = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+    path = test_database_path("MaxMind-DB-test-ipv6-24.mmdb");
+    MMDB_s *ipv6 = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+    if (!ipv4 || !ipv6) {
+        BAIL_OUT("could not open the test databases");
+    }
+
+    MMDB_diff_iterator_s iterator;
+    cmp_ok(MMDB_diff_iterator_init(ipv4, ipv6, 0, &iterator),
+           "==",
+           MMDB_INVALID_METADATA_ERROR,
+           "databases with different IP versions can't be compared");
+
+    MMDB_close(ipv6);
+    free(ipv6);
+    MMDB_close(ipv4);
+    free(ipv4);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    test_same_data();
+    test_changes();
+    test_test_database("MaxMind-DB-test-decoder.mmdb");
+    test_test_database("GeoIP2-City-Test.mmdb");
+    test_different_ip_versions();
+    done_testing();
+}
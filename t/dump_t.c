@@ -2,6 +2,8 @@
 
 #include "maxminddb_test_helper.h"
 
+#define DATABASE "dump_t.mmdb"
+
 #ifdef HAVE_OPEN_MEMSTREAM
 void run_tests(int mode, const char *mode_desc) {
     const char *filename = "MaxMind-DB-test-decoder.mmdb";
@@ -87,13 +89,196 @@ void run_tests(int mode, const char *mode_desc) {
     free(mmdb);
 }
 
+#endif
+
+/* The output expected for the record written by write_record(). */
+static const char *expect_sink_output(void) {
+    static char expect[2048];
+    char long_string[1001];
+    memset(long_string, 'x', 1000);
+    long_string[1000] = '\0';
+    snprintf(expect,
+             sizeof(expect),
+             "{\n"
+             "  \"key \\\"quoted\\\"\": \n"
+             "    [\n"
+             "      \"tab\\t newline\\n \\\\ \\u0001 \\u0000 ☯\" "
+             "<utf8_string>\n"
+             "      DEADBEEF <bytes>\n"
+             "      \"%s\" <utf8_string>\n"
+             "    ]\n"
+             "}\n",
+             long_string);
+    return expect;
+}
+
+static MMDB_entry_data_list_s *write_record(MMDB_s **mmdb) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Dump Test", 0);
+
+    const char escaped[] = "tab\t newline\n \\ \x01 \0 ☯";
+    const uint8_t bytes[] = {0xde, 0xad, 0xbe, 0xef};
+    char long_string[1000];
+    memset(long_string, 'x', sizeof(long_string));
+
+    MMDB_writer_value_s *array = MMDB_writer_array(writer);
+    MMDB_writer_array_append(
+        writer,
+        array,
+        MMDB_writer_utf8_string(writer, escaped, sizeof(escaped) - 1));
+    MMDB_writer_array_append(
+        writer, array, MMDB_writer_bytes(writer, bytes, sizeof(bytes)));
+    MMDB_writer_array_append(
+        writer,
+        array,
+        MMDB_writer_utf8_string(writer, long_string, sizeof(long_string)));
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    const char *key = "key \"quoted\"";
+    map_add_ok(writer, map, key, array);
+
+    if (MMDB_writer_insert_network(
+            writer, "1.0.0.0/24", map, MMDB_WRITER_INSERT_REPLACE) !=
+        MMDB_SUCCESS) {
+        BAIL_OUT("could not insert 1.0.0.0/24");
+    }
+    *mmdb = write_and_open(writer, DATABASE);
+    int gai_error, mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_lookup_string(*mmdb, "1.0.0.1", &gai_error, &mmdb_error);
+    MMDB_entry_data_list_s *entry_data_list = NULL;
+    if (!result.found_entry ||
+        MMDB_get_entry_data_list(&result.entry, &entry_data_list) !=
+            MMDB_SUCCESS) {
+        BAIL_OUT("could not get the record from %s", DATABASE);
+    }
+    return entry_data_list;
+}
+
+static void test_growable_sink(MMDB_entry_data_list_s *entry_data_list) {
+    const char *expect = expect_sink_output();
+
+    MMDB_dump_sink_s sink;
+    MMDB_dump_sink_init_growable(&sink);
+    int status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status, "==", MMDB_SUCCESS, "dump to a growable sink");
+    is(sink.buffer, expect, "growable sink output is escaped");
+    cmp_ok(sink.length, "==", strlen(expect), "growable sink length");
+
+    char *buffer = sink.buffer;
+    MMDB_dump_sink_reset(&sink);
+    is(sink.buffer, "", "MMDB_dump_sink_reset empties the buffer");
+    status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status, "==", MMDB_SUCCESS, "dump to a reset growable sink");
+    is(sink.buffer, expect, "reset growable sink output");
+    ok(sink.buffer == buffer, "a reset growable sink keeps its buffer");
+
+    MMDB_dump_sink_free(&sink);
+    ok(sink.buffer == NULL, "MMDB_dump_sink_free frees the buffer");
+}
+
+static void test_buffer_sink(MMDB_entry_data_list_s *entry_data_list) {
+    const char *expect = expect_sink_output();
+
+    char buffer[2048];
+    MMDB_dump_sink_s sink;
+    MMDB_dump_sink_init_buffer(&sink, buffer, sizeof(buffer));
+    int status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status, "==", MMDB_SUCCESS, "dump to a buffer sink");
+    is(buffer, expect, "buffer sink output");
+
+    // A second dump is appended to the first.
+    status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status, "==", MMDB_SUCCESS, "dump again to a full buffer sink");
+    cmp_ok(sink.length,
+           "==",
+           2 * strlen(expect),
+           "buffer sink length counts truncated output");
+    cmp_ok(strlen(buffer),
+           "==",
+           sizeof(buffer) - 1,
+           "buffer sink output is truncated and NUL terminated");
+    ok(strncmp(buffer + strlen(expect), expect, 100) == 0,
+       "the second dump is appended");
+
+    char small[16];
+    MMDB_dump_sink_init_buffer(&sink, small, sizeof(small));
+    status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status, "==", MMDB_SUCCESS, "dump to a small buffer sink");
+    ok(strncmp(small, expect, sizeof(small) - 1) == 0 &&
+           small[sizeof(small) - 1] == '\0',
+       "small buffer sink holds the start of the output");
+    cmp_ok(sink.length, "==", strlen(expect), "small buffer sink length");
+
+    MMDB_dump_sink_init_buffer(&sink, NULL, 0);
+    status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status, "==", MMDB_SUCCESS, "dump to an empty buffer sink");
+    cmp_ok(sink.length,
+           "==",
+           strlen(expect),
+           "an empty buffer sink measures the output");
+}
+
+typedef struct {
+    char buffer[4096];
+    size_t length;
+    int calls;
+    int fail_after;
+} callback_context_s;
+
+static int write_callback(void *const context,
+                          const char *const data,
+                          size_t size) {
+    callback_context_s *callback = context;
+    if (callback->calls++ == callback->fail_after ||
+        callback->length + size >= sizeof(callback->buffer)) {
+        return 1;
+    }
+    memcpy(callback->buffer + callback->length, data, size);
+    callback->length += size;
+    callback->buffer[callback->length] = '\0';
+    return 0;
+}
+
+static void test_callback_sink(MMDB_entry_data_list_s *entry_data_list) {
+    const char *expect = expect_sink_output();
+
+    callback_context_s context = {.fail_after = -1};
+    MMDB_dump_sink_s sink;
+    MMDB_dump_sink_init_callback(&sink, write_callback, &context);
+    int status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status, "==", MMDB_SUCCESS, "dump to a callback sink");
+    is(context.buffer, expect, "callback sink output");
+    cmp_ok(sink.length, "==", strlen(expect), "callback sink length");
+    ok(context.calls < 10, "the callback is called with large chunks");
+
+    context = (callback_context_s){.fail_after = 1};
+    MMDB_dump_sink_init_callback(&sink, write_callback, &context);
+    status = MMDB_dump_entry_data_list_to_sink(&sink, entry_data_list, 0);
+    cmp_ok(status,
+           "==",
+           MMDB_IO_ERROR,
+           "a failing callback stops the dump with MMDB_IO_ERROR");
+    cmp_ok(context.calls, "==", 2, "the callback isn't called after failing");
+}
+
+static void test_sinks(void) {
+    MMDB_s *mmdb;
+    MMDB_entry_data_list_s *entry_data_list = write_record(&mmdb);
+
+    test_growable_sink(entry_data_list);
+    test_buffer_sink(entry_data_list);
+    test_callback_sink(entry_data_list);
+
+    MMDB_free_entry_data_list(entry_data_list);
+    MMDB_close(mmdb);
+    free(mmdb);
+    remove(DATABASE);
+}
+
 int main(void) {
     plan(NO_PLAN);
+#ifdef HAVE_OPEN_MEMSTREAM
     for_all_modes(&run_tests);
+#endif
+    test_sinks();
     done_testing();
 }
-#else
-int main(void) {
-    plan(SKIP_ALL, "This test requires the open_memstream() function");
-}
-#endif
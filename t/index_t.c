@@ -0,0 +1,307 @@
+#include "maxminddb_test_helper.h"
+
+#ifndef _WIN32
+    #include <arpa/inet.h>
+#endif
+
+#define DATABASE "index_t.mmdb"
+#define OTHER_DATABASE "index_t_other.mmdb"
+#define INDEX "index_t.idx"
+
+/* Inserts a network with data like {"country": {"iso_code": country}}, or
+ * with a map without a country when country is NULL. */
+static void
+insert_ok(MMDB_writer_s *writer, const char *network, const char *country) {
+    MMDB_writer_value_s *record = MMDB_writer_map(writer);
+    if (country != NULL) {
+        MMDB_writer_value_s *map = MMDB_writer_map(writer);
+        MMDB_writer_map_add(
+            writer,
+            map,
+            "iso_code",
+            strlen("iso_code"),
+            MMDB_writer_utf8_string(writer, country, strlen(country)));
+        MMDB_writer_map_add(writer, record, "country", strlen("country"), map);
+    }
+    MMDB_writer_value_s *name =
+        MMDB_writer_utf8_string(writer, network, strlen(network));
+    MMDB_writer_map_add(writer, record, "network", strlen("network"), name);
+
+    int status = MMDB_writer_insert_network(
+        writer, network, record, MMDB_WRITER_INSERT_REPLACE);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not insert %s", network);
+    }
+}
+
+static void network_string(const MMDB_network_s *network,
+                           char *buffer,
+                           size_t size) {
+    char address[INET6_ADDRSTRLEN];
+    inet_ntop(network->ip_version == 4 ? AF_INET : AF_INET6,
+              network->address,
+              address,
+              sizeof(address));
+    snprintf(buffer, size, "%s/%d", address, network->netmask);
+}
+
+static void test_networks(MMDB_index_iterator_s *iterator,
+                          const char *const *expect,
+                          size_t expect_count,
+                          const char *description) {
+    size_t count = 0;
+    int status;
+    MMDB_network_s network;
+    while (MMDB_index_iterator_next(iterator, &network, &status)) {
+        if (count < expect_count) {
+            char buffer[INET6_ADDRSTRLEN + 8];
+            network_string(&network, buffer, sizeof(buffer));
+            is(buffer, expect[count], "network %zu - %s", count, description);
+            ok(network.found_entry, "network has an entry - %s", description);
+
+            // The data of every network in these tests has a network key.
+            MMDB_entry_data_s entry_data;
+            int get_status =
+                MMDB_get_value(&network.entry, &entry_data, "network", NULL);
+            cmp_ok(get_status,
+                   "==",
+                   MMDB_SUCCESS,
+                   "entry of network %zu has data - %s",
+                   count,
+                   description);
+        }
+        count++;
+    }
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "iteration finished without error - %s",
+           description);
+    cmp_ok(count,
+           "==",
+           expect_count,
+           "number of networks - %s",
+           description);
+}
+
+static void test_key(const MMDB_index_s *index,
+                     const char *key,
+                     const char *const *expect,
+                     size_t expect_count) {
+    MMDB_index_iterator_s iterator;
+    int status = MMDB_index_iterator_init(index, key, &iterator);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_index_iterator_init - key %s",
+           key);
+    test_networks(&iterator, expect, expect_count, key);
+}
+
+static MMDB_s *write_countries(const char *filename) {
+    MMDB_writer_s *writer = new_writer_ok(6, "Index Test", 0);
+    insert_ok(writer, "1.0.0.0/24", "US");
+    insert_ok(writer, "2.0.0.0/16", "DE");
+    insert_ok(writer, "3.0.0.0/24", "US");
+    insert_ok(writer, "4.0.0.0/24", NULL);
+    insert_ok(writer, "2001:db8::/32", "US");
+    return write_and_open(writer, filename);
+}
+
+static void test_path_index(void) {
+    MMDB_s *mmdb = write_countries(DATABASE);
+
+    const char *path[] = {"country", "iso_code", NULL};
+    int status = MMDB_index_build(mmdb, path, INDEX);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_index_build with a path");
+
+    MMDB_index_s index;
+    status = MMDB_index_open(INDEX, mmdb, &index);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_index_open with a path");
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not open the index");
+    }
+
+    const char *us[] = {"1.0.0.0/24", "3.0.0.0/24", "2001:db8::/32"};
+    test_key(&index, "US", us, sizeof(us) / sizeof(us[0]));
+    const char *de[] = {"2.0.0.0/16"};
+    test_key(&index, "DE", de, sizeof(de) / sizeof(de[0]));
+    test_key(&index, "FR", NULL, 0);
+    test_key(&index, "U", NULL, 0);
+    test_key(&index, "", NULL, 0);
+
+    int gai_error, mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_lookup_string(mmdb, "3.0.0.1", &gai_error, &mmdb_error);
+    ok(result.found_entry, "3.0.0.1 is in the database");
+    MMDB_index_iterator_s iterator;
+    status = MMDB_index_iterator_init_entry(&index, &result.entry, &iterator);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_index_iterator_init_entry");
+    test_networks(&iterator, us, sizeof(us) / sizeof(us[0]), "3.0.0.1");
+
+    result = MMDB_lookup_string(mmdb, "4.0.0.1", &gai_error, &mmdb_error);
+    ok(result.found_entry, "4.0.0.1 is in the database");
+    status = MMDB_index_iterator_init_entry(&index, &result.entry, &iterator);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_index_iterator_init_entry without the path");
+    test_networks(&iterator, NULL, 0, "4.0.0.1");
+
+    MMDB_index_close(&index);
+    ok(index.file_content == NULL, "MMDB_index_close clears the index");
+
+    MMDB_close(mmdb);
+    free(mmdb);
+    remove(DATABASE);
+    remove(INDEX);
+}
+
+static void test_record_index(void) {
+    char *path = test_database_path("GeoIP2-City-Test.mmdb");
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+    if (!mmdb) {
+        return;
+    }
+
+    int status = MMDB_index_build(mmdb, NULL, INDEX);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_index_build without a path");
+
+    MMDB_index_s index;
+    status = MMDB_index_open(INDEX, mmdb, &index);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_index_open without a path");
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not open the index");
+    }
+
+    // Every network must be found by looking up the networks of its own
+    // record.
+    MMDB_network_iterator_s networks;
+    MMDB_network_iterator_init(
+        mmdb, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &networks);
+    size_t network_count = 0;
+    size_t found_count = 0;
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&networks, &network, &status)) {
+        network_count++;
+
+        MMDB_index_iterator_s iterator;
+        if (MMDB_index_iterator_init_entry(
+                &index, &network.entry, &iterator) != MMDB_SUCCESS) {
+            continue;
+        }
+        MMDB_network_s indexed;
+        int index_status;
+        while (MMDB_index_iterator_next(&iterator, &indexed, &index_status)) {
+            if (indexed.entry.offset != network.entry.offset) {
+                break;
+            }
+            if (indexed.netmask == network.netmask &&
+                memcmp(indexed.address, network.address, 16) == 0) {
+                found_count++;
+                break;
+            }
+        }
+    }
+    ok(network_count > 0, "the database has networks");
+    cmp_ok(found_count,
+           "==",
+           network_count,
+           "every network is found through its record");
+
+    MMDB_index_close(&index);
+    MMDB_close(mmdb);
+    free(mmdb);
+    remove(INDEX);
+}
+
+static void write_file(const char *filename, const uint8_t *data, size_t size) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL || fwrite(data, 1, size, file) != size) {
+        BAIL_OUT("could not write %s", filename);
+    }
+    fclose(file);
+}
+
+static void test_bad_indexes(void) {
+    MMDB_s *mmdb = write_countries(DATABASE);
+    MMDB_index_s index;
+
+    cmp_ok(MMDB_index_open("does-not-exist.idx", mmdb, &index),
+           "==",
+           MMDB_FILE_OPEN_ERROR,
+           "a missing index can't be opened");
+
+    char *path = test_database_path("GeoIP2-City-Test.mmdb");
+    cmp_ok(MMDB_index_open(path, mmdb, &index),
+           "==",
+           MMDB_UNKNOWN_DATABASE_FORMAT_ERROR,
+           "a database isn't an index");
+    free(path);
+
+    const char *country_path[] = {"country", "iso_code", NULL};
+    if (MMDB_index_build(mmdb, country_path, INDEX) != MMDB_SUCCESS) {
+        BAIL_OUT("could not build the index");
+    }
+
+    // A database with the same networks and data but another build epoch.
+    MMDB_s *other = write_countries(OTHER_DATABASE);
+    other->metadata.build_epoch++;
+    cmp_ok(MMDB_index_open(INDEX, other, &index),
+           "==",
+           MMDB_INVALID_METADATA_ERROR,
+           "an index can't be opened with another database");
+    MMDB_close(other);
+    free(other);
+    remove(OTHER_DATABASE);
+
+    FILE *file = fopen(INDEX, "rb");
+    uint8_t content[4096];
+    size_t size = fread(content, 1, sizeof(content), file);
+    fclose(file);
+    if (size == 0 || size == sizeof(content)) {
+        BAIL_OUT("unexpected index size");
+    }
+
+    write_file(INDEX, content, size - 1);
+    cmp_ok(MMDB_index_open(INDEX, mmdb, &index),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a truncated index can't be opened");
+
+    // The keys start after the 56 byte header and the path, which is padded
+    // to 20 bytes. Giving the first key, DE, more networks than there are
+    // leaves the size of the index right.
+    uint8_t changed[4096];
+    memcpy(changed, content, size);
+    changed[56 + 20 + 12] = 0xff;
+    write_file(INDEX, changed, size);
+    cmp_ok(MMDB_index_open(INDEX, mmdb, &index),
+           "==",
+           MMDB_SUCCESS,
+           "an index with a bad key can be opened");
+    MMDB_index_iterator_s iterator;
+    cmp_ok(MMDB_index_iterator_init(&index, "DE", &iterator),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "networks out of bounds are found by MMDB_index_iterator_init");
+    cmp_ok(MMDB_index_iterator_init(&index, "US", &iterator),
+           "==",
+           MMDB_SUCCESS,
+           "the other keys can still be used");
+    MMDB_index_close(&index);
+
+    MMDB_close(mmdb);
+    free(mmdb);
+    remove(DATABASE);
+    remove(INDEX);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    test_path_index();
+    test_record_index();
+    test_bad_indexes();
+    done_testing();
+}
@@ -0,0 +1,181 @@
+#include "maxminddb_test_helper.h"
+
+#define DATABASE "MaxMind-DB-test-mixed-32.mmdb"
+
+static MMDB_s *open_database(uint32_t flags, const char *description) {
+    char *path = test_database_path(DATABASE);
+    MMDB_s *mmdb = open_ok(path, flags, description);
+    free(path);
+    if (NULL == mmdb) {
+        BAIL_OUT("could not open %s", DATABASE);
+    }
+    return mmdb;
+}
+
+static void test_start_node(void) {
+    MMDB_s *eager = open_database(MMDB_MODE_MMAP, "mmap mode");
+    MMDB_s *lazy = open_database(MMDB_MODE_MMAP | MMDB_MODE_LAZY, "lazy mode");
+
+    cmp_ok(eager->ipv4_start_node.netmask,
+           "==",
+           96,
+           "MMDB_open finds the IPv4 start node");
+    ok(lazy->ipv4_start_node.netmask > 128,
+       "MMDB_open does not find the IPv4 start node in lazy mode");
+
+    int mmdb_error;
+    int gai_error;
+    MMDB_lookup_string(lazy, "::2:0:0", &gai_error, &mmdb_error);
+    cmp_ok(mmdb_error, "==", MMDB_SUCCESS, "looked up an IPv6 address");
+    ok(lazy->ipv4_start_node.netmask > 128,
+       "an IPv6 lookup does not need the IPv4 start node");
+
+    MMDB_lookup_string(lazy, "1.1.1.1", &gai_error, &mmdb_error);
+    cmp_ok(mmdb_error, "==", MMDB_SUCCESS, "looked up an IPv4 address");
+    cmp_ok(lazy->ipv4_start_node.netmask,
+           "==",
+           eager->ipv4_start_node.netmask,
+           "an IPv4 lookup finds the start node netmask");
+    cmp_ok(lazy->ipv4_start_node.node_value,
+           "==",
+           eager->ipv4_start_node.node_value,
+           "an IPv4 lookup finds the start node");
+
+    MMDB_close(eager);
+    free(eager);
+    MMDB_close(lazy);
+    free(lazy);
+}
+
+static void test_get_ipv4_start_node(void) {
+    MMDB_s *eager = open_database(MMDB_MODE_MMAP, "mmap mode");
+    MMDB_s *lazy = open_database(MMDB_MODE_MMAP | MMDB_MODE_LAZY, "lazy mode");
+
+    MMDB_ipv4_start_node_s start_node;
+    cmp_ok(MMDB_get_ipv4_start_node(lazy, &start_node),
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_get_ipv4_start_node succeeds before any lookup");
+    cmp_ok(start_node.netmask,
+           "==",
+           eager->ipv4_start_node.netmask,
+           "it finds the start node netmask in lazy mode");
+    cmp_ok(start_node.node_value,
+           "==",
+           eager->ipv4_start_node.node_value,
+           "it finds the start node in lazy mode");
+    cmp_ok(lazy->ipv4_start_node.netmask,
+           "==",
+           eager->ipv4_start_node.netmask,
+           "and stores it in the handle");
+
+    cmp_ok(MMDB_get_ipv4_start_node(eager, &start_node),
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_get_ipv4_start_node succeeds without lazy mode");
+    ok(start_node.netmask == eager->ipv4_start_node.netmask &&
+           start_node.node_value == eager->ipv4_start_node.node_value,
+       "it gives the start node that MMDB_open found");
+
+    MMDB_close(eager);
+    free(eager);
+    MMDB_close(lazy);
+    free(lazy);
+
+    char *path = test_database_path("MaxMind-DB-test-ipv4-24.mmdb");
+    MMDB_s *ipv4 = open_ok(path, MMDB_MODE_MMAP | MMDB_MODE_LAZY, "lazy mode");
+    free(path);
+    if (NULL == ipv4) {
+        BAIL_OUT("could not open MaxMind-DB-test-ipv4-24.mmdb");
+    }
+    cmp_ok(MMDB_get_ipv4_start_node(ipv4, &start_node),
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_get_ipv4_start_node succeeds for an IPv4 database");
+    ok(start_node.netmask == 0 && start_node.node_value == 0,
+       "the IPv4 start node of an IPv4 database is the root");
+    MMDB_close(ipv4);
+    free(ipv4);
+}
+
+static void test_lookups(void) {
+    const char *ips[] = {"1.1.1.1",
+                         "1.1.1.3",
+                         "1.1.1.32",
+                         "2.2.2.2",
+                         "::1:ffff:ffff",
+                         "::2:0:40",
+                         "::1.1.1.1",
+                         "::ffff:1.1.1.1",
+                         "2002:101:101::"};
+    MMDB_s *eager = open_database(MMDB_MODE_MMAP, "mmap mode");
+
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); i++) {
+        // A new handle each time so that every address is the first lookup.
+        MMDB_s *lazy =
+            open_database(MMDB_MODE_MMAP | MMDB_MODE_LAZY, "lazy mode");
+
+        int gai_error;
+        int eager_error;
+        MMDB_lookup_result_s expect =
+            MMDB_lookup_string(eager, ips[i], &gai_error, &eager_error);
+        int lazy_error;
+        MMDB_lookup_result_s got =
+            MMDB_lookup_string(lazy, ips[i], &gai_error, &lazy_error);
+
+        cmp_ok(lazy_error, "==", eager_error, "same status for %s", ips[i]);
+        ok(got.found_entry == expect.found_entry &&
+               got.netmask == expect.netmask &&
+               got.entry.offset == expect.entry.offset,
+           "same result for %s",
+           ips[i]);
+
+        MMDB_close(lazy);
+        free(lazy);
+    }
+
+    MMDB_close(eager);
+    free(eager);
+}
+
+static int count_networks(MMDB_s *mmdb) {
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init(
+        mmdb, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    if (status != MMDB_SUCCESS) {
+        return -1;
+    }
+
+    int count = 0;
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        count++;
+    }
+    return status == MMDB_SUCCESS ? count : -1;
+}
+
+static void test_network_iterator(void) {
+    MMDB_s *eager = open_database(MMDB_MODE_MMAP, "mmap mode");
+    MMDB_s *lazy = open_database(MMDB_MODE_MMAP | MMDB_MODE_LAZY, "lazy mode");
+
+    int const expect = count_networks(eager);
+    ok(expect > 0, "iterated over the networks");
+    cmp_ok(count_networks(lazy),
+           "==",
+           expect,
+           "the iterator skips the same aliased networks in lazy mode");
+
+    MMDB_close(eager);
+    free(eager);
+    MMDB_close(lazy);
+    free(lazy);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    test_start_node();
+    test_get_ipv4_start_node();
+    test_lookups();
+    test_network_iterator();
+    done_testing();
+}
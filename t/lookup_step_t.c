@@ -0,0 +1,394 @@
+#include "maxminddb_test_helper.h"
+
+#ifndef _WIN32
+    #include <arpa/inet.h>
+#endif
+
+#define STEP_TEST_DATABASE "lookup-step-test.mmdb"
+
+// A lookup waits for each block at most once per node or value it reads, so
+// a lookup that is still pending after this many loads never finishes.
+#define MAX_LOADS 1000
+
+/* Reads the block the lookup waits for from the file itself and puts it in
+ * the cache, as a caller with its own I/O would. */
+static int fill_pending_block(const char *path,
+                              const MMDB_lookup_state_s *const state) {
+    FILE *stream = fopen(path, "rb");
+    uint8_t *block = malloc(state->pending_size);
+    int status = MMDB_IO_ERROR;
+    if (NULL != stream && NULL != block &&
+        fseek(stream, (long)state->pending_offset, SEEK_SET) == 0 &&
+        fread(block, 1, state->pending_size, stream) == state->pending_size) {
+        status = MMDB_cache_fill_block(
+            state->cache, state->pending_offset, block, state->pending_size);
+    }
+    free(block);
+    if (NULL != stream) {
+        fclose(stream);
+    }
+    return status;
+}
+
+/* Returns whether the lists dump the same, so that strings and bytes that are
+ * copied out of the cache are the same too. */
+static bool same_dump(MMDB_entry_data_list_s *mapped,
+                      MMDB_entry_data_list_s *cached) {
+    MMDB_dump_sink_s mapped_sink;
+    MMDB_dump_sink_s cached_sink;
+    MMDB_dump_sink_init_growable(&mapped_sink);
+    MMDB_dump_sink_init_growable(&cached_sink);
+    bool const same =
+        MMDB_dump_entry_data_list_to_sink(&mapped_sink, mapped, 0) ==
+            MMDB_SUCCESS &&
+        MMDB_dump_entry_data_list_to_sink(&cached_sink, cached, 0) ==
+            MMDB_SUCCESS &&
+        mapped_sink.length == cached_sink.length &&
+        !memcmp(mapped_sink.buffer, cached_sink.buffer, mapped_sink.length);
+    MMDB_dump_sink_free(&mapped_sink);
+    MMDB_dump_sink_free(&cached_sink);
+    return same;
+}
+
+/* Looks the address up in steps, putting each block it waits for in the
+ * cache, and returns whether it finds the same as MMDB_lookup_sockaddr() with
+ * the same data. The blocks are read by MMDB_cache_lookup_load(), or by the
+ * caller if path is set. */
+static bool same_stepped_lookup(const MMDB_s *const mmdb,
+                                MMDB_cache_s *const cache,
+                                const struct sockaddr *const sockaddr,
+                                const char *path,
+                                int *const waits) {
+    MMDB_lookup_state_s state;
+    MMDB_lookup_result_s result = {0};
+    int status = MMDB_cache_lookup_start(cache, sockaddr, &state);
+    for (int i = 0; MMDB_SUCCESS == status && i < MAX_LOADS; i++) {
+        status = MMDB_cache_lookup_step(&state, &result);
+        if (MMDB_WOULD_BLOCK_ERROR != status) {
+            break;
+        }
+        if (state.pending_size == 0) {
+            return false;
+        }
+        (*waits)++;
+        status = path ? fill_pending_block(path, &state)
+                      : MMDB_cache_lookup_load(&state);
+    }
+
+    int mmdb_error;
+    MMDB_lookup_result_s expect =
+        MMDB_lookup_sockaddr(mmdb, sockaddr, &mmdb_error);
+    if (status != mmdb_error || result.found_entry != expect.found_entry ||
+        result.netmask != expect.netmask) {
+        return false;
+    }
+    if (!result.found_entry) {
+        return true;
+    }
+    if (result.entry.offset != expect.entry.offset) {
+        return false;
+    }
+
+    MMDB_entry_data_list_s *mapped_list = NULL;
+    MMDB_entry_data_list_s *cached_list = NULL;
+    bool const same =
+        MMDB_get_entry_data_list(&expect.entry, &mapped_list) ==
+            MMDB_SUCCESS &&
+        MMDB_cache_get_entry_data_list(cache, &result.entry, &cached_list) ==
+            MMDB_SUCCESS &&
+        same_dump(mapped_list, cached_list);
+    MMDB_free_entry_data_list(mapped_list);
+    MMDB_free_entry_data_list(cached_list);
+    return same;
+}
+
+static MMDB_cache_s *cache_open_ok(const char *path, size_t memory_budget) {
+    MMDB_cache_s *cache = NULL;
+    int const status = MMDB_cache_open(path, memory_budget, &cache);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "opened %s with a budget of %zu bytes",
+           path,
+           memory_budget);
+    return MMDB_SUCCESS == status ? cache : NULL;
+}
+
+/* Writes a database whose search tree and data section both take several
+ * blocks. Each record has strings of its own and a pointer to one of a few
+ * shared maps with long strings, which are stored once. */
+static void write_database(void) {
+    MMDB_writer_s *writer = new_writer_ok(6, "Lookup Step Test", 0);
+
+    MMDB_writer_value_s *shared[16];
+    char text[2048];
+    for (size_t i = 0; i < sizeof(shared) / sizeof(shared[0]); i++) {
+        memset(text, 'a' + (int)i, sizeof(text));
+        shared[i] = MMDB_writer_map(writer);
+        map_add_ok(writer,
+                   shared[i],
+                   "text",
+                   MMDB_writer_utf8_string(writer, text, sizeof(text)));
+        map_add_ok(writer,
+                   shared[i],
+                   "number",
+                   MMDB_writer_uint32(writer, (uint32_t)i));
+    }
+
+    for (int i = 0; i < 20000; i++) {
+        char network[64];
+        snprintf(network, sizeof(network), "2001:db8:%x::/48", i);
+        int const length =
+            snprintf(text, sizeof(text), "network %d of the step test", i);
+        MMDB_writer_value_s *record = MMDB_writer_map(writer);
+        map_add_ok(writer,
+                   record,
+                   "name",
+                   MMDB_writer_utf8_string(writer, text, (size_t)length));
+        map_add_ok(
+            writer, record, "id", MMDB_writer_uint32(writer, (uint32_t)i));
+        map_add_ok(writer,
+                   record,
+                   "shared",
+                   shared[(size_t)i % (sizeof(shared) / sizeof(shared[0]))]);
+        if (MMDB_writer_insert_network(
+                writer, network, record, MMDB_WRITER_INSERT_REPLACE) !=
+            MMDB_SUCCESS) {
+            BAIL_OUT("could not insert %s", network);
+        }
+    }
+
+    MMDB_writer_value_s *record = MMDB_writer_map(writer);
+    map_add_ok(writer, record, "ipv4", MMDB_writer_boolean(writer, true));
+    if (MMDB_writer_insert_network(
+            writer, "::1.2.0.0/112", record, MMDB_WRITER_INSERT_REPLACE) !=
+        MMDB_SUCCESS) {
+        BAIL_OUT("could not insert ::1.2.0.0/112");
+    }
+
+    write_ok(writer, STEP_TEST_DATABASE);
+}
+
+/* Looks up addresses in every 97th network along with addresses that aren't
+ * in the database and IPv4 addresses, through a cache with the budget. */
+static void test_written_database(size_t memory_budget, bool fill) {
+    MMDB_s *mmdb = open_ok(STEP_TEST_DATABASE, MMDB_MODE_MMAP, "mmap mode");
+    MMDB_cache_s *cache = cache_open_ok(STEP_TEST_DATABASE, memory_budget);
+    if (NULL == mmdb || NULL == cache) {
+        BAIL_OUT("could not open %s", STEP_TEST_DATABASE);
+    }
+
+    int lookups = 0;
+    int same = 0;
+    int waits = 0;
+    for (int i = 0; i < 20100; i += 97) {
+        struct sockaddr_in6 sin6 = {.sin6_family = AF_INET6};
+        char address[64];
+        snprintf(address, sizeof(address), "2001:db8:%x::%x", i, i);
+        if (inet_pton(AF_INET6, address, &sin6.sin6_addr) != 1) {
+            BAIL_OUT("could not parse %s", address);
+        }
+        lookups++;
+        if (same_stepped_lookup(mmdb,
+                                cache,
+                                (const struct sockaddr *)&sin6,
+                                fill ? STEP_TEST_DATABASE : NULL,
+                                &waits)) {
+            same++;
+        }
+    }
+    const char *ipv4[] = {"1.2.3.4", "1.3.0.0", "0.0.0.0"};
+    for (size_t i = 0; i < sizeof(ipv4) / sizeof(ipv4[0]); i++) {
+        struct sockaddr_in sin = {.sin_family = AF_INET};
+        if (inet_pton(AF_INET, ipv4[i], &sin.sin_addr) != 1) {
+            BAIL_OUT("could not parse %s", ipv4[i]);
+        }
+        lookups++;
+        if (same_stepped_lookup(mmdb,
+                                cache,
+                                (const struct sockaddr *)&sin,
+                                fill ? STEP_TEST_DATABASE : NULL,
+                                &waits)) {
+            same++;
+        }
+    }
+    cmp_ok(same,
+           "==",
+           lookups,
+           "%d of %d stepped lookups with a budget of %zu bytes are the same",
+           same,
+           lookups,
+           memory_budget);
+    // Opening the cache only reads the top of the search tree, so the first
+    // lookups have to wait for the data section.
+    ok(waits > 0,
+       "the lookups waited %d times with a budget of %zu bytes%s",
+       waits,
+       memory_budget,
+       fill ? " and the caller reading the blocks" : "");
+
+    MMDB_cache_close(cache);
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+/* Once a lookup has finished in a cache that holds the whole file, its data
+ * stays in the cache, so stepping it again doesn't wait. */
+static void test_finished_lookup(void) {
+    MMDB_cache_s *cache = cache_open_ok(STEP_TEST_DATABASE, SIZE_MAX);
+    if (NULL == cache) {
+        BAIL_OUT("could not open %s", STEP_TEST_DATABASE);
+    }
+
+    struct sockaddr_in6 sin6 = {.sin6_family = AF_INET6};
+    inet_pton(AF_INET6, "2001:db8:1234::1", &sin6.sin6_addr);
+    MMDB_lookup_state_s state;
+    cmp_ok(MMDB_cache_lookup_start(cache, (struct sockaddr *)&sin6, &state),
+           "==",
+           MMDB_SUCCESS,
+           "started a lookup of 2001:db8:1234::1");
+    MMDB_lookup_result_s result;
+    int status;
+    int waits = 0;
+    while ((status = MMDB_cache_lookup_step(&state, &result)) ==
+               MMDB_WOULD_BLOCK_ERROR &&
+           waits < MAX_LOADS) {
+        ok(state.pending_offset % 65536 == 0 && state.pending_size > 0,
+           "the lookup waits for the block at %llu",
+           (unsigned long long)state.pending_offset);
+        cmp_ok(MMDB_cache_lookup_load(&state),
+               "==",
+               MMDB_SUCCESS,
+               "loaded the block the lookup waits for");
+        waits++;
+    }
+    cmp_ok(status, "==", MMDB_SUCCESS, "the lookup finishes");
+    ok(result.found_entry, "2001:db8:1234::1 is in the database");
+    cmp_ok(MMDB_cache_lookup_step(&state, &result),
+           "==",
+           MMDB_SUCCESS,
+           "stepping the finished lookup again doesn't wait");
+    ok(state.pending_size == 0, "and there is no block pending");
+    cmp_ok(MMDB_cache_lookup_load(&state),
+           "==",
+           MMDB_SUCCESS,
+           "loading without a block pending does nothing");
+
+    MMDB_cache_close(cache);
+}
+
+static void test_errors(void) {
+    MMDB_cache_s *cache = cache_open_ok(STEP_TEST_DATABASE, 0);
+    if (NULL == cache) {
+        BAIL_OUT("could not open %s", STEP_TEST_DATABASE);
+    }
+
+    uint8_t block[16] = {0};
+    cmp_ok(MMDB_cache_fill_block(cache, 1, block, sizeof(block)),
+           "==",
+           MMDB_IO_ERROR,
+           "a block must start at a multiple of the block size");
+    cmp_ok(MMDB_cache_fill_block(cache, 0, block, sizeof(block)),
+           "==",
+           MMDB_IO_ERROR,
+           "a block must be the size of the block in the file");
+    cmp_ok(MMDB_cache_fill_block(cache, UINT64_C(1) << 40, block, 0),
+           "==",
+           MMDB_IO_ERROR,
+           "a block must be in the file");
+    MMDB_cache_close(cache);
+
+    MMDB_writer_s *writer = new_writer_ok(4, "Lookup Step Test", 0);
+    MMDB_writer_value_s *record = MMDB_writer_map(writer);
+    map_add_ok(writer, record, "ipv4", MMDB_writer_boolean(writer, true));
+    if (MMDB_writer_insert_network(
+            writer, "1.2.0.0/16", record, MMDB_WRITER_INSERT_REPLACE) !=
+        MMDB_SUCCESS) {
+        BAIL_OUT("could not insert 1.2.0.0/16");
+    }
+    write_ok(writer, STEP_TEST_DATABASE);
+    cache = cache_open_ok(STEP_TEST_DATABASE, 0);
+    if (NULL == cache) {
+        BAIL_OUT("could not open %s", STEP_TEST_DATABASE);
+    }
+
+    struct sockaddr_in6 sin6 = {.sin6_family = AF_INET6};
+    MMDB_lookup_state_s state;
+    cmp_ok(MMDB_cache_lookup_start(cache, (struct sockaddr *)&sin6, &state),
+           "==",
+           MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR,
+           "an IPv6 lookup in an IPv4 database fails to start");
+
+    ok(strcmp(MMDB_strerror(MMDB_WOULD_BLOCK_ERROR), "Unknown error code"),
+       "MMDB_WOULD_BLOCK_ERROR has an error message");
+
+    MMDB_cache_close(cache);
+    remove(STEP_TEST_DATABASE);
+}
+
+/* Compares stepped lookups in the test databases with mapped lookups. */
+static void test_database(const char *filename, size_t memory_budget) {
+    const char *ips[] = {"1.1.1.1",
+                         "1.1.1.3",
+                         "81.2.69.160",
+                         "175.16.199.0",
+                         "255.255.255.255",
+                         "::1.1.1.1",
+                         "::2:0:58",
+                         "2001:218::"};
+    char *path = test_database_path(filename);
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    MMDB_cache_s *cache = cache_open_ok(path, memory_budget);
+    free(path);
+    if (NULL == mmdb || NULL == cache) {
+        BAIL_OUT("could not open %s", filename);
+    }
+
+    int waits = 0;
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); i++) {
+        if (mmdb->metadata.ip_version == 4 && strchr(ips[i], ':')) {
+            continue;
+        }
+        struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                                 .ai_flags = AI_NUMERICHOST,
+                                 .ai_socktype = SOCK_STREAM};
+        struct addrinfo *addresses;
+        if (getaddrinfo(ips[i], NULL, &hints, &addresses) != 0) {
+            BAIL_OUT("could not resolve %s", ips[i]);
+        }
+        ok(same_stepped_lookup(mmdb, cache, addresses->ai_addr, NULL, &waits),
+           "the same result for %s in %s",
+           ips[i],
+           filename);
+        freeaddrinfo(addresses);
+    }
+    diag("%d waits for %s", waits, filename);
+
+    MMDB_cache_close(cache);
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    write_database();
+    // No budget leaves one block, which every block that is put in the cache
+    // evicts. A few blocks are split between shards.
+    size_t const budgets[] = {0, 300000, SIZE_MAX};
+    for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+        test_written_database(budgets[i], false);
+        test_written_database(budgets[i], true);
+    }
+    test_finished_lookup();
+    test_errors();
+
+    const char *filenames[] = {"GeoIP2-City-Test.mmdb",
+                               "MaxMind-DB-test-ipv4-28.mmdb",
+                               "MaxMind-DB-test-mixed-24.mmdb",
+                               "MaxMind-DB-test-ipv6-32.mmdb"};
+    for (size_t i = 0; i < sizeof(filenames) / sizeof(filenames[0]); i++) {
+        test_database(filenames[i], 0);
+        test_database(filenames[i], SIZE_MAX);
+    }
+    done_testing();
+}
@@ -45,6 +45,7 @@ void for_all_record_sizes(const char *filename_fmt,
 
 void for_all_modes(void (*tests)(int mode, const char *description)) {
     tests(MMDB_MODE_MMAP, "mmap mode");
+    tests(MMDB_MODE_MMAP | MMDB_MODE_LAZY, "lazy mmap mode");
 }
 
 char *test_database_path(const char *filename) {
@@ -280,3 +281,44 @@ void compare_float(float got, float expect) {
             "  got %2.4f but expected %2.1f (diff = %2.1f)", got, expect, diff);
     }
 }
+
+MMDB_writer_s *
+new_writer_ok(uint16_t ip_version, const char *database_type, uint32_t flags) {
+    MMDB_writer_s *writer;
+    int status = MMDB_writer_new(ip_version, database_type, flags, &writer);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_writer_new for IPv%d", ip_version);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not create a writer");
+    }
+    return writer;
+}
+
+void map_add_ok(MMDB_writer_s *writer,
+                MMDB_writer_value_s *map,
+                const char *key,
+                MMDB_writer_value_s *value) {
+    int status = MMDB_writer_map_add(writer, map, key, strlen(key), value);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("MMDB_writer_map_add failed for %s", key);
+    }
+}
+
+void write_ok(MMDB_writer_s *writer, const char *filename) {
+    int status = MMDB_writer_write(writer, filename);
+    MMDB_writer_free(writer);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_writer_write %s", filename);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not write %s", filename);
+    }
+}
+
+MMDB_s *write_and_open(MMDB_writer_s *writer, const char *filename) {
+    write_ok(writer, filename);
+    return open_ok(filename, MMDB_MODE_MMAP, "mmap mode");
+}
+
+void close_and_remove(MMDB_s *mmdb, const char *filename) {
+    MMDB_close(mmdb);
+    free(mmdb);
+    remove(filename);
+}
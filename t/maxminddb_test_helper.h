@@ -11,6 +11,7 @@
 #include "libtap/tap.h"
 #include "maxminddb-compat-util.h"
 #include "maxminddb.h"
+#include "maxminddb_writer.h"
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
@@ -72,4 +73,16 @@ extern MMDB_entry_data_s data_ok(MMDB_lookup_result_s *result,
 extern void compare_double(double got, double expect);
 extern void compare_float(float got, float expect);
 
+/* Helpers for tests that write their own databases. The writer is freed once
+ * it is written, and the test bails out if writing fails. */
+extern MMDB_writer_s *
+new_writer_ok(uint16_t ip_version, const char *database_type, uint32_t flags);
+extern void map_add_ok(MMDB_writer_s *writer,
+                       MMDB_writer_value_s *map,
+                       const char *key,
+                       MMDB_writer_value_s *value);
+extern void write_ok(MMDB_writer_s *writer, const char *filename);
+extern MMDB_s *write_and_open(MMDB_writer_s *writer, const char *filename);
+extern void close_and_remove(MMDB_s *mmdb, const char *filename);
+
 #endif
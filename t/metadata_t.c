@@ -1,5 +1,9 @@
 #include "maxminddb_test_helper.h"
 
+#define EMPTY_DATABASE "metadata_t_empty.mmdb"
+#define MARKER_DATABASE "metadata_t_marker.mmdb"
+#define METADATA_MARKER "\xab\xcd\xefMaxMind.com"
+
 void test_metadata(MMDB_s *mmdb, const char *mode_desc) {
     cmp_ok(mmdb->metadata.node_count,
            "==",
@@ -264,8 +268,110 @@ void run_tests(int mode, const char *mode_desc) {
     free(mmdb);
 }
 
+/* A database with an empty type and no languages or descriptions. */
+void test_empty_metadata(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "", 0);
+    MMDB_writer_set_build_epoch(writer, 1700000000);
+    MMDB_s *mmdb = write_and_open(writer, EMPTY_DATABASE);
+    if (NULL == mmdb) {
+        return;
+    }
+    is(mmdb->metadata.database_type, "", "database_type is empty");
+    cmp_ok(mmdb->metadata.languages.count, "==", 0, "no languages");
+    cmp_ok(mmdb->metadata.description.count, "==", 0, "no descriptions");
+    cmp_ok(mmdb->metadata.build_epoch,
+           "==",
+           1700000000,
+           "build_epoch is 1700000000");
+
+    MMDB_close(mmdb);
+    ok(NULL == mmdb->metadata.database_type,
+       "MMDB_close clears database_type");
+    free(mmdb);
+    remove(EMPTY_DATABASE);
+}
+
+static size_t write_empty_database(const char *type, uint8_t *content) {
+    write_ok(new_writer_ok(4, type, 0), MARKER_DATABASE);
+
+    FILE *file = fopen(MARKER_DATABASE, "rb");
+    if (NULL == file) {
+        BAIL_OUT("could not read %s", MARKER_DATABASE);
+    }
+    size_t size = fread(content, 1, 4096, file);
+    fclose(file);
+    if (size == 0 || size == 4096) {
+        BAIL_OUT("unexpected database size");
+    }
+    return size;
+}
+
+static void write_file(const uint8_t *data, size_t size) {
+    FILE *file = fopen(MARKER_DATABASE, "wb");
+    if (NULL == file || fwrite(data, 1, size, file) != size) {
+        BAIL_OUT("could not write %s", MARKER_DATABASE);
+    }
+    fclose(file);
+}
+
+static int open_status(MMDB_s *mmdb) {
+    return MMDB_open(MARKER_DATABASE, MMDB_MODE_MMAP, mmdb);
+}
+
+/* The metadata is found after the last marker in the file. */
+void test_metadata_marker(void) {
+    const size_t marker_len = strlen(METADATA_MARKER);
+    uint8_t first[4096];
+    size_t first_size = write_empty_database("First", first);
+    uint8_t second[4096];
+    size_t second_size = write_empty_database("Second", second);
+
+    // Both files have the same tree and data section, so the metadata of
+    // the second one is everything after its tree and data section.
+    size_t offset = second_size - marker_len;
+    while (offset > 0 && memcmp(second + offset, METADATA_MARKER, marker_len)) {
+        offset--;
+    }
+    if (0 == offset) {
+        BAIL_OUT("no metadata marker found");
+    }
+
+    uint8_t content[8192];
+    memcpy(content, first, first_size);
+    memcpy(content + first_size, second + offset, second_size - offset);
+    write_file(content, first_size + second_size - offset);
+
+    MMDB_s mmdb;
+    int status = open_status(&mmdb);
+    cmp_ok(status, "==", MMDB_SUCCESS, "opened a file with two markers");
+    if (MMDB_SUCCESS == status) {
+        is(mmdb.metadata.database_type,
+           "Second",
+           "the metadata after the last marker is used");
+        MMDB_close(&mmdb);
+    }
+
+    memcpy(content, first, first_size);
+    memcpy(content + first_size, METADATA_MARKER, marker_len);
+    write_file(content, first_size + marker_len);
+    cmp_ok(open_status(&mmdb),
+           "==",
+           MMDB_INVALID_METADATA_ERROR,
+           "a marker at the end of the file has no metadata");
+
+    write_file(first, offset);
+    cmp_ok(open_status(&mmdb),
+           "==",
+           MMDB_INVALID_METADATA_ERROR,
+           "a file without a marker has no metadata");
+
+    remove(MARKER_DATABASE);
+}
+
 int main(void) {
     plan(NO_PLAN);
     for_all_modes(&run_tests);
+    test_empty_metadata();
+    test_metadata_marker();
     done_testing();
 }
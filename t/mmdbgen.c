@@ -0,0 +1,273 @@
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+#include "maxminddb.h"
+#include "synthetic_db.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// mmdbgen writes a synthetic database for scale testing and benchmarking. See
+// synthetic_db.h for what goes into it.
+
+static void usage(char *program, int exit_code, const char *error);
+static bool parse_number(const char *const value,
+                         double max,
+                         double *const number);
+static bool write_ip_file(const synthetic_db_s *const db,
+                          const char *const ip_file);
+static bool report(const synthetic_db_s *const db,
+                   const char *const filename,
+                   double seconds);
+
+int main(int argc, char **argv) {
+    enum {
+        OPTION_IP_VERSION = 256,
+        OPTION_RECORD_SIZE,
+        OPTION_IPV4_PERCENT,
+        OPTION_SHAPE,
+        OPTION_DEDUP_RATIO,
+        OPTION_SEED,
+        OPTION_IP_FILE,
+    };
+
+    char *program = basename(argv[0]);
+    const char *output = NULL;
+    const char *ip_file = NULL;
+    synthetic_db_s db;
+    synthetic_db_init(&db);
+
+    while (1) {
+        static struct option long_options[] = {
+            {"output", required_argument, 0, 'o'},
+            {"nodes", required_argument, 0, 'n'},
+            {"ip-version", required_argument, 0, OPTION_IP_VERSION},
+            {"record-size", required_argument, 0, OPTION_RECORD_SIZE},
+            {"ipv4-percent", required_argument, 0, OPTION_IPV4_PERCENT},
+            {"shape", required_argument, 0, OPTION_SHAPE},
+            {"dedup-ratio", required_argument, 0, OPTION_DEDUP_RATIO},
+            {"seed", required_argument, 0, OPTION_SEED},
+            {"ip-file", required_argument, 0, OPTION_IP_FILE},
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}};
+
+        int opt_index;
+        int opt_char =
+            getopt_long(argc, argv, "o:n:h?", long_options, &opt_index);
+        double number;
+
+        if (-1 == opt_char) {
+            break;
+        }
+
+        if ('o' == opt_char) {
+            output = optarg;
+        } else if ('n' == opt_char) {
+            if (!parse_number(optarg, UINT32_MAX, &number) || number < 1) {
+                usage(program, 1, "The --nodes must be from 1 to 4294967295");
+            }
+            db.node_count = (uint64_t)number;
+        } else if (OPTION_IP_VERSION == opt_char) {
+            if (!parse_number(optarg, 6, &number) ||
+                (number != 4 && number != 6)) {
+                usage(program, 1, "The --ip-version must be 4 or 6");
+            }
+            db.ip_version = (uint16_t)number;
+        } else if (OPTION_RECORD_SIZE == opt_char) {
+            if (!parse_number(optarg, 32, &number) ||
+                (number != 24 && number != 28 && number != 32)) {
+                usage(program, 1, "The --record-size must be 24, 28 or 32");
+            }
+            db.record_size = (uint16_t)number;
+        } else if (OPTION_IPV4_PERCENT == opt_char) {
+            if (!parse_number(optarg, 100, &number)) {
+                usage(program, 1, "The --ipv4-percent must be from 0 to 100");
+            }
+            db.ipv4_percent = (unsigned int)number;
+        } else if (OPTION_SHAPE == opt_char) {
+            if (synthetic_shape_from_name(optarg, &db.shape) != MMDB_SUCCESS) {
+                usage(program, 1, "The --shape must be flat, city or nested");
+            }
+        } else if (OPTION_DEDUP_RATIO == opt_char) {
+            char *end;
+            db.dedup_ratio = strtod(optarg, &end);
+            if (*end != '\0' || !(db.dedup_ratio >= 0.0) ||
+                db.dedup_ratio >= 1.0) {
+                usage(program,
+                      1,
+                      "The --dedup-ratio must be at least 0 and less than 1");
+            }
+        } else if (OPTION_SEED == opt_char) {
+            if (!parse_number(optarg, UINT32_MAX, &number)) {
+                usage(program, 1, "The --seed must be from 0 to 4294967295");
+            }
+            db.seed = (uint64_t)number;
+        } else if (OPTION_IP_FILE == opt_char) {
+            ip_file = optarg;
+        } else if ('h' == opt_char || '?' == opt_char) {
+            usage(program, 0, NULL);
+        }
+    }
+
+    if (NULL == output) {
+        usage(program, 1, "You must provide a filename with --output");
+    }
+
+    int status = synthetic_db_prepare(&db);
+    if (status != MMDB_SUCCESS) {
+        usage(program,
+              1,
+              "An IPv4 database can't have more than about 9 million nodes");
+    }
+
+    clock_t const clock_start = clock();
+    status = synthetic_db_write(&db, output);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr, "%s: %s\n", output, MMDB_strerror(status));
+        return 1;
+    }
+    double const seconds =
+        (double)(clock() - clock_start) / (double)CLOCKS_PER_SEC;
+
+    if (ip_file != NULL && !write_ip_file(&db, ip_file)) {
+        return 1;
+    }
+
+    return report(&db, output, seconds) ? 0 : 1;
+}
+
+static void usage(char *program, int exit_code, const char *error) {
+    if (NULL != error) {
+        fprintf(stderr, "\n  *ERROR: %s\n", error);
+    }
+
+    char *usage =
+        "\n"
+        "  %s --output /path/to/file.mmdb [--nodes N]\n"
+        "\n"
+        "  This application accepts the following options:\n"
+        "\n"
+        "      --output (-o)    The path of the MMDB file to write. Required.\n"
+        "\n"
+        "      --nodes (-n)     The number of search tree nodes to aim for.\n"
+        "                       Defaults to 1000000.\n"
+        "\n"
+        "      --ip-version     Either 4 or 6. Defaults to 6.\n"
+        "\n"
+        "      --record-size    24, 28 or 32. Defaults to the smallest record "
+        "size\n"
+        "                       that fits the database.\n"
+        "\n"
+        "      --ipv4-percent   The share of the networks that are IPv4 in an "
+        "IPv6\n"
+        "                       database. Defaults to 25.\n"
+        "\n"
+        "      --shape          The shape of the records: flat, city or "
+        "nested.\n"
+        "                       Defaults to flat.\n"
+        "\n"
+        "      --dedup-ratio    The share of the networks whose record is the "
+        "same\n"
+        "                       as another network's. Defaults to 0.\n"
+        "\n"
+        "      --seed           Picks a different set of networks. Defaults to "
+        "1.\n"
+        "\n"
+        "      --ip-file        Also write one address from each network to "
+        "this\n"
+        "                       file, for mmdblookup --ip-file.\n"
+        "\n"
+        "      --help (-h -?)   Show usage information.\n"
+        "\n";
+
+    fprintf(stdout, usage, program);
+    exit(exit_code);
+}
+
+static bool parse_number(const char *const value,
+                         double max,
+                         double *const number) {
+    char *end;
+    errno = 0;
+    unsigned long long const n = strtoull(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || value[0] == '-' ||
+        (double)n > max) {
+        return false;
+    }
+    *number = (double)n;
+    return true;
+}
+
+static bool write_ip_file(const synthetic_db_s *const db,
+                          const char *const ip_file) {
+    FILE *const fh = fopen(ip_file, "w");
+    if (!fh) {
+        fprintf(stderr, "fopen(): %s: %s\n", ip_file, strerror(errno));
+        return false;
+    }
+
+    uint64_t const network_count = synthetic_db_network_count(db);
+    for (uint64_t i = 0; i < network_count; i++) {
+        synthetic_network_s network;
+        synthetic_db_network(db, i, &network);
+
+        char address[INET6_ADDRSTRLEN];
+        inet_ntop(network.ip_version == 4 ? AF_INET : AF_INET6,
+                  network.address,
+                  address,
+                  sizeof(address));
+        if (fprintf(fh, "%s\n", address) < 0) {
+            break;
+        }
+    }
+
+    if (ferror(fh) || fclose(fh) != 0) {
+        fprintf(stderr, "fprintf(): %s: %s\n", ip_file, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool report(const synthetic_db_s *const db,
+                   const char *const filename,
+                   double seconds) {
+    MMDB_s mmdb;
+    int const status = MMDB_open(filename, MMDB_MODE_MMAP, &mmdb);
+    if (status != MMDB_SUCCESS) {
+        fprintf(stderr,
+                "MMDB_open(): %s: %s\n",
+                filename,
+                MMDB_strerror(status));
+        return false;
+    }
+
+    struct stat st;
+    unsigned long long const size =
+        stat(filename, &st) == 0 ? (unsigned long long)st.st_size : 0;
+
+    fprintf(stdout,
+            "%s: %u nodes, %u bit records, %llu IPv4 networks, %llu IPv6 "
+            "networks, %u records, %llu bytes in %.2f seconds\n",
+            filename,
+            (unsigned int)mmdb.metadata.node_count,
+            (unsigned int)mmdb.metadata.record_size,
+            (unsigned long long)db->ipv4_network_count,
+            (unsigned long long)db->ipv6_network_count,
+            (unsigned int)db->record_count,
+            size,
+            seconds);
+
+    MMDB_close(&mmdb);
+    return true;
+}
@@ -3,6 +3,7 @@
 use strict;
 use warnings;
 
+use File::Temp qw( tempdir );
 use FindBin qw( $Bin );
 
 eval <<'EOF';
@@ -18,7 +19,9 @@ if ($@) {
 }
 
 my $mmdblookup    = "$Bin/../bin/mmdblookup";
+my $mmdbwriter    = "$Bin/../bin/mmdbwriter";
 my $test_data_dir = "$Bin/maxmind-db/test-data";
+my $temp_dir      = tempdir( CLEANUP => 1 );
 
 {
     ok( -x $mmdblookup, 'mmdblookup script is executable' );
@@ -97,8 +100,169 @@ _test_stderr(
     'error for bad PI address'
 );
 
+_test_stdout(
+    ['--file', "$test_data_dir/GeoIP2-City-Test.mmdb", '--export', 'jsonl'],
+    qr/^\{"network":"2\.125\.160\.216\/\d+","data":\{.*"en":"Boxford"/m,
+    0,
+    'jsonl export includes 2.125.160.216'
+);
+
+_test_stdout(
+    ['--file', "$test_data_dir/GeoIP2-City-Test.mmdb", '--export', 'csv'],
+    qr/\Anetwork,.*\bcity\.names\.en\b.*\n.*^2\.125\.160\.216\/\d+,.*Boxford/ms,
+    0,
+    'csv export includes a header and 2.125.160.216'
+);
+
+_test_stdout(
+    [
+        '--file', "$test_data_dir/GeoIP2-City-Test.mmdb", '--export', 'jsonl',
+        '--ip',   '2.125.160.216/30'
+    ],
+    qr/\A\{"network":"2\.125\.160\.216\/29","data":\{[^\n]*\}\}\n\z/,
+    0,
+    'jsonl export of a network inside 2.125.160.216/29 only includes that network'
+);
+
+_test_stderr(
+    [
+        '--file', "$test_data_dir/GeoIP2-City-Test.mmdb", '--export', 'jsonl',
+        '--ip',   '2.125.160.216/33'
+    ],
+    qr{Invalid network: 2\.125\.160\.216/33},
+    1,
+    'error for an invalid export network'
+);
+
+_test_stderr(
+    ['--file', "$test_data_dir/GeoIP2-City-Test.mmdb", '--export', 'xml'],
+    qr{ERROR: The --export format must be jsonl or csv},
+    1,
+    'error for unknown export format'
+);
+
+{
+    my $jsonl = <<'EOF';
+{"network":"1.1.1.0/24","data":{"a":{"b":"nested"},"a.b":"dotted","x,y":"comma","q\"k":"say \"hi\"","list":[1,{"k":"v"},[true,false]],"b\\":"backslash"}}
+{"network":"2.2.2.0/24","data":{"a":{"c":2.5},"list":[7]}}
+{"network":"3.3.3.0/24","data":"just a string"}
+EOF
+    my $database = _write_database( 'export-keys', $jsonl );
+
+    my $csv = <<'EOF';
+network,a.b,a.c,a\.b,b\\,data,list.0,list.1.k,list.2.0,list.2.1,"q""k","x,y"
+1.1.1.0/24,nested,,dotted,backslash,,1,v,true,false,"say ""hi""",comma
+2.2.2.0/24,,2.5,,,,7,,,,,
+3.3.3.0/24,,,,,just a string,,,,,,
+EOF
+    _test_stdout(
+        [ '--file', $database, '--export', 'csv' ],
+        qr/\A\Q$csv\E\z/,
+        0,
+        'csv export escapes dots in keys and quotes commas and quotes'
+    );
+
+    _test_stdout(
+        [ '--file', $database, '--export', 'jsonl' ],
+        qr/\A\Q$jsonl\E\z/,
+        0,
+        'jsonl export writes the same lines that the database was written from'
+    );
+}
+
+{
+    # Many networks sharing fewer records, with the networks that share a
+    # record far apart.
+    my $lines = q{};
+    for my $i ( 0 .. 69_999 ) {
+        my $id = $i % 1000;
+        $lines .= sprintf(
+            qq{{"network":"%d.%d.%d.0/24","data":{"id":%d,"names":{"en":"n%d"},"list":[%d,{"k":%d}]}}\n},
+            1 + ( $i >> 16 ), ( $i >> 8 ) & 255, $i & 255, $id, $id,
+            $i % 7, $id
+        );
+    }
+    my $database = _write_database( 'export-threads', $lines );
+
+    for my $format (qw( csv jsonl )) {
+        my %output;
+        for my $threads ( 1, 4 ) {
+            my $stderr;
+            run3(
+                [
+                    $mmdblookup, '--file', $database, '--export', $format,
+                    '--threads', $threads
+                ],
+                \undef,
+                \$output{$threads},
+                \$stderr,
+            );
+            is( $? >> 8, 0, "$format export with $threads threads succeeded" );
+            is( $stderr, q{}, "no errors from $format export with $threads threads" );
+        }
+
+        my $rows = () = $output{4} =~ /\n/g;
+        is(
+            $rows, $format eq 'csv' ? 70_001 : 70_000,
+            "$format export with 4 threads has a line for every network"
+        );
+        ok(
+            $output{4} eq $output{1},
+            "$format export with 4 threads is the same as with 1 thread"
+        );
+    }
+}
+
+{
+    # The writer doesn't store maps with a repeated key, so rename one of the
+    # keys in the written database.
+    my $database = _write_database(
+        'export-duplicate',
+        qq{{"network":"4.4.4.0/24","data":{"dupA":1,"dupB":2}}\n}
+    );
+    open my $fh, '<:raw', $database or die "Can't read $database: $!";
+    my $bytes = do { local $/; <$fh> };
+    close $fh;
+    is( ( $bytes =~ s/dupB/dupA/g ), 1, 'renamed the key in the database' );
+    open $fh, '>:raw', $database or die "Can't write $database: $!";
+    print {$fh} $bytes;
+    close $fh;
+
+    _test_stderr(
+        [ '--file', $database, '--export', 'csv' ],
+        qr{The record at data section offset \d+ has the column dupA more than once},
+        1,
+        'error for a csv export of a record with a repeated column'
+    );
+}
+
 done_testing();
 
+sub _write_database {
+    my $name  = shift;
+    my $lines = shift;
+
+    my $input = "$temp_dir/$name.jsonl";
+    open my $fh, '>', $input or die "Can't write $input: $!";
+    print {$fh} $lines;
+    close $fh;
+
+    my $database = "$temp_dir/$name.mmdb";
+    my $stderr;
+    run3(
+        [
+            $mmdbwriter,        '--input', $input, '--output', $database,
+            '--database-type', 'Test'
+        ],
+        \undef,
+        \undef,
+        \$stderr,
+    );
+    die "mmdbwriter failed: $stderr" if $?;
+
+    return $database;
+}
+
 sub _test_stdout {
     my $args          = shift;
     my $expect_stdout = shift;
@@ -0,0 +1,142 @@
+#include "maxminddb_test_helper.h"
+
+// More databases than MMDB_multi_lookup_sockaddr() walks at a time, so that
+// the lookups cross from one batch to the next.
+#define DATABASE_COUNT 18
+
+static const char *const names[] = {"GeoIP2-City-Test.mmdb",
+                                    "MaxMind-DB-test-ipv4-24.mmdb",
+                                    "MaxMind-DB-test-ipv6-28.mmdb",
+                                    "MaxMind-DB-test-mixed-32.mmdb",
+                                    "MaxMind-DB-test-decoder.mmdb"};
+
+#define NAME_COUNT (sizeof(names) / sizeof(names[0]))
+
+static void open_multi_ok(uint32_t flags, MMDB_multi_s *const multi) {
+    char *paths[DATABASE_COUNT];
+    for (size_t i = 0; i < DATABASE_COUNT; i++) {
+        paths[i] = test_database_path(names[i % NAME_COUNT]);
+    }
+
+    int status = MMDB_multi_open(
+        (const char *const *)paths, DATABASE_COUNT, flags, multi);
+    cmp_ok(status, "==", MMDB_SUCCESS, "opened %d databases", DATABASE_COUNT);
+    if (MMDB_SUCCESS != status) {
+        BAIL_OUT("could not open the databases");
+    }
+    cmp_ok(multi->count, "==", DATABASE_COUNT, "the count is set");
+
+    for (size_t i = 0; i < DATABASE_COUNT; i++) {
+        free(paths[i]);
+    }
+}
+
+/* Checks that looking the address up in all of the databases at once gives
+ * the same results as looking it up in each of them. */
+static void test_lookup(const MMDB_multi_s *const multi, const char *ip) {
+    MMDB_lookup_result_s results[DATABASE_COUNT];
+    int mmdb_errors[DATABASE_COUNT];
+    int gai_error;
+    MMDB_multi_lookup_string(multi, ip, &gai_error, results, mmdb_errors);
+    cmp_ok(gai_error, "==", 0, "no getaddrinfo error for %s", ip);
+
+    int same = 0;
+    int found = 0;
+    for (size_t i = 0; i < multi->count; i++) {
+        int expect_gai_error;
+        int expect_error;
+        MMDB_lookup_result_s expect = MMDB_lookup_string(
+            &multi->databases[i], ip, &expect_gai_error, &expect_error);
+        if (mmdb_errors[i] == expect_error &&
+            results[i].found_entry == expect.found_entry &&
+            results[i].netmask == expect.netmask &&
+            results[i].entry.mmdb == &multi->databases[i] &&
+            results[i].entry.offset == expect.entry.offset) {
+            same++;
+        }
+        if (results[i].found_entry) {
+            found++;
+        }
+    }
+    cmp_ok(same,
+           "==",
+           DATABASE_COUNT,
+           "%s has the same result in each database (found in %d)",
+           ip,
+           found);
+}
+
+static void test_lookups(uint32_t flags, const char *mode) {
+    diag("%s", mode);
+    MMDB_multi_s multi;
+    open_multi_ok(flags, &multi);
+
+    const char *ips[] = {"1.1.1.1",
+                         "1.1.1.3",
+                         "81.2.69.160",
+                         "255.255.255.255",
+                         "::1.1.1.1",
+                         "::ffff:1.1.1.1",
+                         "::2:0:58",
+                         "2001:db8::1",
+                         "::"};
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); i++) {
+        test_lookup(&multi, ips[i]);
+    }
+
+    // An IPv6 address is an error for the IPv4 database but not the others.
+    MMDB_lookup_result_s results[DATABASE_COUNT];
+    int mmdb_errors[DATABASE_COUNT];
+    int gai_error;
+    MMDB_multi_lookup_string(
+        &multi, "2001:db8::1", &gai_error, results, mmdb_errors);
+    cmp_ok(mmdb_errors[1],
+           "==",
+           MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR,
+           "an IPv6 lookup in an IPv4 database is an error");
+    cmp_ok(mmdb_errors[2],
+           "==",
+           MMDB_SUCCESS,
+           "but not in the IPv6 database after it");
+
+    MMDB_multi_lookup_string(
+        &multi, "not an ip", &gai_error, results, mmdb_errors);
+    ok(gai_error != 0, "a getaddrinfo error for an invalid address");
+    int unset = 0;
+    for (size_t i = 0; i < DATABASE_COUNT; i++) {
+        if (mmdb_errors[i] == MMDB_SUCCESS && !results[i].found_entry) {
+            unset++;
+        }
+    }
+    cmp_ok(unset,
+           "==",
+           DATABASE_COUNT,
+           "no database has a result or an error for an invalid address");
+
+    MMDB_multi_close(&multi);
+    ok(multi.count == 0 && multi.databases == NULL,
+       "MMDB_multi_close resets the struct");
+}
+
+static void test_open_error(void) {
+    char *path = test_database_path("GeoIP2-City-Test.mmdb");
+    const char *paths[] = {path, "does-not-exist.mmdb"};
+    MMDB_multi_s multi;
+    int status = MMDB_multi_open(paths, 2, MMDB_MODE_MMAP, &multi);
+    cmp_ok(status,
+           "==",
+           MMDB_FILE_OPEN_ERROR,
+           "opening a missing database is an error");
+    ok(multi.count == 0 && multi.databases == NULL,
+       "the databases that were opened are closed again");
+    free(path);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    test_lookups(MMDB_MODE_MMAP, "mmap mode");
+    test_lookups(MMDB_MODE_MMAP | MMDB_MODE_VERIFY, "verified mode");
+    test_lookups(MMDB_MODE_MMAP | MMDB_MODE_LAZY, "lazy mode");
+    test_open_error();
+    done_testing();
+}
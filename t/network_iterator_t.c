@@ -0,0 +1,205 @@
+#include "maxminddb_test_helper.h"
+
+#ifndef _WIN32
+    #include <arpa/inet.h>
+#endif
+
+typedef struct network_test_s {
+    const char *network;
+    const char *ip;
+} network_test_s;
+
+static void network_to_string(MMDB_network_s *network, char *buf, size_t len) {
+    char address[INET6_ADDRSTRLEN];
+    inet_ntop(network->ip_version == 4 ? AF_INET : AF_INET6,
+              network->address,
+              address,
+              sizeof(address));
+    snprintf(buf, len, "%s/%d", address, network->netmask);
+}
+
+static void test_networks(MMDB_s *mmdb,
+                          uint32_t flags,
+                          const network_test_s *expect,
+                          size_t expect_count,
+                          const char *description) {
+    MMDB_network_iterator_s iterator;
+    int status = MMDB_network_iterator_init(mmdb, flags, &iterator);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_network_iterator_init succeeded - %s",
+           description);
+
+    MMDB_network_s network;
+    int mmdb_error;
+    size_t i = 0;
+    while (MMDB_network_iterator_next(&iterator, &network, &mmdb_error)) {
+        if (i >= expect_count) {
+            i++;
+            continue;
+        }
+
+        char got[64];
+        network_to_string(&network, got, sizeof(got));
+        is(got, expect[i].network, "network %zu - %s", i, description);
+
+        ok(network.found_entry, "network %s has an entry", got);
+        MMDB_entry_data_s entry_data;
+        status = MMDB_get_value(&network.entry, &entry_data, "ip", NULL);
+        cmp_ok(status, "==", MMDB_SUCCESS, "got ip value for %s", got);
+        if (status == MMDB_SUCCESS) {
+            char *ip = dup_entry_string_or_bail(entry_data);
+            is(ip, expect[i].ip, "ip value for %s", got);
+            free(ip);
+        }
+        i++;
+    }
+
+    cmp_ok(mmdb_error,
+           "==",
+           MMDB_SUCCESS,
+           "iteration finished without error - %s",
+           description);
+    cmp_ok(i,
+           "==",
+           expect_count,
+           "iterated over all expected networks - %s",
+           description);
+}
+
+static void test_ipv4(int record_size,
+                      const char *filename,
+                      const char *UNUSED(record_size_desc)) {
+    char *path = test_database_path(filename);
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    const network_test_s expect[] = {
+        {"1.1.1.1/32", "1.1.1.1"},
+        {"1.1.1.2/31", "1.1.1.2"},
+        {"1.1.1.4/30", "1.1.1.4"},
+        {"1.1.1.8/29", "1.1.1.8"},
+        {"1.1.1.16/28", "1.1.1.16"},
+        {"1.1.1.32/32", "1.1.1.32"},
+    };
+
+    char description[50];
+    snprintf(description, 50, "IPv4 - %d bit record", record_size);
+    test_networks(mmdb,
+                  MMDB_ITERATOR_SKIP_EMPTY_NETWORKS,
+                  expect,
+                  sizeof(expect) / sizeof(expect[0]),
+                  description);
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+static const network_test_s mixed_expect[] = {
+    {"1.1.1.1/32", "::1.1.1.1"},
+    {"1.1.1.2/31", "::1.1.1.2"},
+    {"1.1.1.4/30", "::1.1.1.4"},
+    {"1.1.1.8/29", "::1.1.1.8"},
+    {"1.1.1.16/28", "::1.1.1.16"},
+    {"1.1.1.32/32", "::1.1.1.32"},
+    {"::1:ffff:ffff/128", "::1:ffff:ffff"},
+    {"::2:0:0/122", "::2:0:0"},
+    {"::2:0:40/124", "::2:0:40"},
+    {"::2:0:50/125", "::2:0:50"},
+    {"::2:0:58/127", "::2:0:58"},
+};
+
+static void test_mixed(int record_size,
+                       const char *filename,
+                       const char *UNUSED(record_size_desc)) {
+    char *path = test_database_path(filename);
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    char description[50];
+    snprintf(description, 50, "mixed - %d bit record", record_size);
+    test_networks(mmdb,
+                  MMDB_ITERATOR_SKIP_EMPTY_NETWORKS,
+                  mixed_expect,
+                  sizeof(mixed_expect) / sizeof(mixed_expect[0]),
+                  description);
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+static void test_aliased_networks(void) {
+    char *path = test_database_path("MaxMind-DB-test-mixed-24.mmdb");
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    MMDB_network_iterator_s iterator;
+    MMDB_network_iterator_init(mmdb,
+                               MMDB_ITERATOR_SKIP_EMPTY_NETWORKS |
+                                   MMDB_ITERATOR_INCLUDE_ALIASED_NETWORKS,
+                               &iterator);
+
+    MMDB_network_s network;
+    int mmdb_error;
+    size_t count = 0;
+    bool found_mapped = false;
+    bool found_6to4 = false;
+    while (MMDB_network_iterator_next(&iterator, &network, &mmdb_error)) {
+        char got[64];
+        network_to_string(&network, got, sizeof(got));
+        if (strcmp(got, "::ffff:1.1.1.1/128") == 0) {
+            found_mapped = true;
+        }
+        if (strcmp(got, "2002:101:101::/48") == 0) {
+            found_6to4 = true;
+        }
+        count++;
+    }
+    cmp_ok(mmdb_error, "==", MMDB_SUCCESS, "aliased iteration succeeded");
+    cmp_ok(count,
+           "==",
+           3 * 6 + 5,
+           "the IPv4 networks are returned once per alias");
+    ok(found_mapped, "found IPv4 network aliased under ::ffff:0:0/96");
+    ok(found_6to4, "found IPv4 network aliased under 2002::/16");
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+static void test_empty_networks(void) {
+    char *path = test_database_path("MaxMind-DB-test-ipv4-24.mmdb");
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    MMDB_network_iterator_s iterator;
+    MMDB_network_iterator_init(mmdb, 0, &iterator);
+
+    MMDB_network_s network;
+    int mmdb_error;
+    size_t data_count = 0;
+    uint64_t addresses = 0;
+    while (MMDB_network_iterator_next(&iterator, &network, &mmdb_error)) {
+        if (network.found_entry) {
+            data_count++;
+        }
+        addresses += (uint64_t)1 << (32 - network.netmask);
+    }
+    cmp_ok(mmdb_error, "==", MMDB_SUCCESS, "iteration with empty succeeded");
+    cmp_ok(data_count, "==", 6, "found all networks with data");
+    ok(addresses == ((uint64_t)1 << 32),
+       "networks including empty ones cover the whole address space");
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    for_all_record_sizes("MaxMind-DB-test-ipv4-%i.mmdb", &test_ipv4);
+    for_all_record_sizes("MaxMind-DB-test-mixed-%i.mmdb", &test_mixed);
+    test_aliased_networks();
+    test_empty_networks();
+    done_testing();
+}
@@ -0,0 +1,326 @@
+#include "maxminddb_test_helper.h"
+
+#define MAX_NETWORKS 1024
+
+static size_t collect_networks(MMDB_network_iterator_s *iterator,
+                               MMDB_network_s *networks,
+                               size_t max) {
+    size_t count = 0;
+    int mmdb_error;
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(iterator, &network, &mmdb_error)) {
+        if (count < max) {
+            networks[count] = network;
+        }
+        count++;
+    }
+    cmp_ok(mmdb_error, "==", MMDB_SUCCESS, "iteration finished without error");
+    return count;
+}
+
+static bool same_network(MMDB_network_s *a, MMDB_network_s *b) {
+    return a->ip_version == b->ip_version && a->netmask == b->netmask &&
+           memcmp(a->address, b->address, 16) == 0 &&
+           a->found_entry == b->found_entry &&
+           (!a->found_entry || a->entry.offset == b->entry.offset);
+}
+
+static void test_split(MMDB_s *mmdb,
+                       uint16_t netmask,
+                       uint32_t flags,
+                       const char *filename) {
+    MMDB_network_s *expect = calloc(MAX_NETWORKS, sizeof(MMDB_network_s));
+    MMDB_network_s *got = calloc(MAX_NETWORKS, sizeof(MMDB_network_s));
+    if (!expect || !got) {
+        BAIL_OUT("could not allocate memory");
+    }
+
+    MMDB_network_iterator_s iterator;
+    MMDB_network_iterator_init(mmdb, flags, &iterator);
+    size_t expect_count = collect_networks(&iterator, expect, MAX_NETWORKS);
+    if (expect_count > MAX_NETWORKS) {
+        BAIL_OUT("too many networks in %s", filename);
+    }
+
+    MMDB_network_subtree_s *subtrees;
+    size_t subtree_count;
+    int status = MMDB_get_network_subtrees(
+        mmdb, netmask, flags, &subtrees, &subtree_count);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_get_network_subtrees for /%d - %s",
+           netmask,
+           filename);
+    if (status != MMDB_SUCCESS) {
+        free(expect);
+        free(got);
+        return;
+    }
+    cmp_ok(subtree_count, ">", 0, "got subtrees for /%d", netmask);
+
+    size_t got_count = 0;
+    bool all_match = true;
+    for (size_t i = 0; i < subtree_count; i++) {
+        status = MMDB_network_iterator_init_subtree(
+            &subtrees[i], flags, &iterator);
+        if (status != MMDB_SUCCESS) {
+            all_match = false;
+            break;
+        }
+
+        size_t count = collect_networks(&iterator, got, MAX_NETWORKS);
+        for (size_t j = 0; j < count; j++) {
+            if (got_count + j >= expect_count ||
+                !same_network(&got[j], &expect[got_count + j])) {
+                all_match = false;
+            }
+        }
+        got_count += count;
+    }
+
+    ok(all_match,
+       "iterating the /%d subtrees in order returns the same networks as "
+       "iterating the whole tree - %s",
+       netmask,
+       filename);
+    cmp_ok(got_count,
+           "==",
+           expect_count,
+           "subtrees for /%d cover every network - %s",
+           netmask,
+           filename);
+
+    MMDB_free_network_subtrees(subtrees);
+    free(expect);
+    free(got);
+}
+
+static void test_ipv4_subtrees_are_split(void) {
+    char *path = test_database_path("MaxMind-DB-test-mixed-24.mmdb");
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    MMDB_network_subtree_s *subtrees;
+    size_t count;
+    int status = MMDB_get_network_subtrees(
+        mmdb, 16, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &subtrees, &count);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_get_network_subtrees for /16");
+
+    // 1.1.0.0/16 is at ::101:0/112 in the search tree.
+    const uint8_t ipv4_network[16] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0};
+    const uint8_t zeros[16] = {0};
+    bool found = false;
+    for (size_t i = 0; i < count; i++) {
+        if (subtrees[i].depth == 112 &&
+            memcmp(subtrees[i].address, ipv4_network, 16) == 0) {
+            found = true;
+        }
+        ok(subtrees[i].depth >= 96 ||
+               memcmp(subtrees[i].address, zeros, 16) != 0,
+           "subtree at depth %d does not contain all of ::/96",
+           subtrees[i].depth);
+    }
+    ok(found, "the IPv4 subtree is split at IPv4 /16 boundaries");
+
+    MMDB_free_network_subtrees(subtrees);
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+// Moves an IPv4 network in an IPv6 database to where it is in the search
+// tree, so that it can be compared with IPv6 networks.
+static uint16_t tree_address(const MMDB_s *mmdb,
+                             const uint8_t *address,
+                             uint16_t ip_version,
+                             uint16_t netmask,
+                             uint8_t *tree) {
+    memset(tree, 0, 16);
+    if (ip_version == 4 && mmdb->metadata.ip_version == 6) {
+        memcpy(tree + 12, address, 4);
+        return netmask + 96;
+    }
+    memcpy(tree, address, ip_version == 4 ? 4 : 16);
+    return netmask;
+}
+
+static bool overlaps(const MMDB_s *mmdb,
+                     const MMDB_network_s *network,
+                     const uint8_t *address,
+                     uint16_t ip_version,
+                     uint16_t netmask) {
+    uint8_t a[16], b[16];
+    uint16_t a_bits = tree_address(
+        mmdb, network->address, network->ip_version, network->netmask, a);
+    uint16_t b_bits = tree_address(mmdb, address, ip_version, netmask, b);
+    uint16_t bits = a_bits < b_bits ? a_bits : b_bits;
+    for (uint16_t i = 0; i < bits; i++) {
+        uint8_t mask = (uint8_t)(1U << (7 - (i % 8)));
+        if ((a[i >> 3] & mask) != (b[i >> 3] & mask)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_lookup_network_subtree(MMDB_s *mmdb,
+                                        const char *network,
+                                        const char *filename) {
+    char address[INET6_ADDRSTRLEN];
+    const char *slash = strchr(network, '/');
+    memcpy(address, network, (size_t)(slash - network));
+    address[slash - network] = '\0';
+    uint16_t netmask = (uint16_t)atoi(slash + 1);
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                             .ai_flags = AI_NUMERICHOST,
+                             .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addresses;
+    if (getaddrinfo(address, NULL, &hints, &addresses) != 0) {
+        BAIL_OUT("could not parse %s", network);
+    }
+    uint16_t ip_version = addresses->ai_family == AF_INET ? 4 : 6;
+    uint8_t bytes[16] = {0};
+    if (ip_version == 4) {
+        memcpy(bytes,
+               &((struct sockaddr_in *)addresses->ai_addr)->sin_addr.s_addr,
+               4);
+    } else {
+        memcpy(bytes,
+               ((struct sockaddr_in6 *)addresses->ai_addr)->sin6_addr.s6_addr,
+               16);
+    }
+
+    MMDB_network_subtree_s subtree;
+    int status = MMDB_lookup_network_subtree(
+        mmdb, addresses->ai_addr, netmask, &subtree);
+    freeaddrinfo(addresses);
+    cmp_ok(status,
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_lookup_network_subtree for %s - %s",
+           network,
+           filename);
+    if (status != MMDB_SUCCESS) {
+        return;
+    }
+
+    MMDB_network_s *all = calloc(MAX_NETWORKS, sizeof(MMDB_network_s));
+    MMDB_network_s *got = calloc(MAX_NETWORKS, sizeof(MMDB_network_s));
+    if (!all || !got) {
+        BAIL_OUT("could not allocate memory");
+    }
+
+    MMDB_network_iterator_s iterator;
+    MMDB_network_iterator_init(mmdb, 0, &iterator);
+    size_t all_count = collect_networks(&iterator, all, MAX_NETWORKS);
+    MMDB_network_iterator_init_subtree(&subtree, 0, &iterator);
+    size_t got_count = collect_networks(&iterator, got, MAX_NETWORKS);
+    if (all_count > MAX_NETWORKS || got_count > MAX_NETWORKS) {
+        BAIL_OUT("too many networks in %s", filename);
+    }
+
+    size_t expect_count = 0;
+    bool all_match = true;
+    for (size_t i = 0; i < all_count; i++) {
+        if (!overlaps(mmdb, &all[i], bytes, ip_version, netmask)) {
+            continue;
+        }
+        if (expect_count >= got_count ||
+            !same_network(&all[i], &got[expect_count])) {
+            all_match = false;
+        }
+        expect_count++;
+    }
+
+    ok(all_match,
+       "the subtree for %s returns the networks that overlap it - %s",
+       network,
+       filename);
+    cmp_ok(got_count,
+           "==",
+           expect_count,
+           "the subtree for %s returns every network that overlaps it - %s",
+           network,
+           filename);
+
+    free(all);
+    free(got);
+}
+
+static void test_lookup_network_subtree_errors(void) {
+    char *path = test_database_path("MaxMind-DB-test-ipv4-24.mmdb");
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    struct sockaddr_in ipv4 = {.sin_family = AF_INET};
+    struct sockaddr_in6 ipv6 = {.sin6_family = AF_INET6};
+    MMDB_network_subtree_s subtree;
+    cmp_ok(MMDB_lookup_network_subtree(
+               mmdb, (struct sockaddr *)&ipv4, 33, &subtree),
+           "==",
+           MMDB_INVALID_NETWORK_ADDRESS_ERROR,
+           "an IPv4 netmask larger than 32 is rejected");
+    cmp_ok(MMDB_lookup_network_subtree(
+               mmdb, (struct sockaddr *)&ipv6, 16, &subtree),
+           "==",
+           MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR,
+           "an IPv6 network in an IPv4 database is rejected");
+
+    // 1.1.1.4/31 is part of 1.1.1.4/30, so the subtree is that network.
+    ipv4.sin_addr.s_addr = htonl(0x01010104);
+    cmp_ok(MMDB_lookup_network_subtree(
+               mmdb, (struct sockaddr *)&ipv4, 31, &subtree),
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_lookup_network_subtree for 1.1.1.4/31");
+    cmp_ok(subtree.depth, "==", 30, "the subtree is the containing /30");
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+static void run_tests(int UNUSED(record_size),
+                      const char *filename,
+                      const char *UNUSED(record_size_desc)) {
+    char *path = test_database_path(filename);
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    uint16_t netmasks[] = {0, 1, 8, 16, 32, 128};
+    for (size_t i = 0; i < sizeof(netmasks) / sizeof(netmasks[0]); i++) {
+        test_split(
+            mmdb, netmasks[i], MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, filename);
+        test_split(mmdb, netmasks[i], 0, filename);
+    }
+
+    const char *networks[] = {
+        "0.0.0.0/0", "1.1.1.0/24", "1.1.1.4/31", "1.1.1.32/32", "1.1.0.0/16"};
+    for (size_t i = 0; i < sizeof(networks) / sizeof(networks[0]); i++) {
+        test_lookup_network_subtree(mmdb, networks[i], filename);
+    }
+    if (mmdb->metadata.ip_version == 6) {
+        const char *ipv6_networks[] = {"::/0",
+                                       "::/64",
+                                       "::2:0:0/120",
+                                       "::2:0:50/126",
+                                       "::1:ffff:ffff/128"};
+        size_t count = sizeof(ipv6_networks) / sizeof(ipv6_networks[0]);
+        for (size_t i = 0; i < count; i++) {
+            test_lookup_network_subtree(mmdb, ipv6_networks[i], filename);
+        }
+    }
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    for_all_record_sizes("MaxMind-DB-test-ipv4-%i.mmdb", &run_tests);
+    for_all_record_sizes("MaxMind-DB-test-mixed-%i.mmdb", &run_tests);
+    test_ipv4_subtrees_are_split();
+    test_lookup_network_subtree_errors();
+    done_testing();
+}
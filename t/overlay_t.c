@@ -0,0 +1,139 @@
+#include "maxminddb_test_helper.h"
+
+#define OVERLAY_DATABASE "overlay_t_overlay.mmdb"
+#define VENDOR_DATABASE "overlay_t_vendor.mmdb"
+
+static void insert_ok(MMDB_writer_s *writer,
+                      const char *network,
+                      const char *name) {
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    int status = MMDB_writer_map_add(
+        writer,
+        map,
+        "name",
+        strlen("name"),
+        MMDB_writer_utf8_string(writer, name, strlen(name)));
+    if (status == MMDB_SUCCESS) {
+        status = MMDB_writer_insert_network(
+            writer, network, map, MMDB_WRITER_INSERT_REPLACE);
+    }
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not insert %s", network);
+    }
+}
+
+/* A small IPv4 overlay with corrections on top of an IPv6 vendor database. */
+static void write_databases(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Overlay Test", 0);
+    insert_ok(writer, "1.1.1.0/24", "override");
+    write_ok(writer, OVERLAY_DATABASE);
+
+    writer = new_writer_ok(6, "Vendor Test", MMDB_WRITER_ALIAS_IPV4);
+    insert_ok(writer, "1.0.0.0/8", "vendor");
+    insert_ok(writer, "2001:db8::/32", "vendor IPv6");
+    write_ok(writer, VENDOR_DATABASE);
+}
+
+static void open_multi_ok(const char *const *filenames,
+                          size_t count,
+                          MMDB_multi_s *const multi) {
+    if (MMDB_multi_open(filenames, count, MMDB_MODE_MMAP, multi) !=
+        MMDB_SUCCESS) {
+        BAIL_OUT("could not open the databases");
+    }
+}
+
+/* Looks the address up and checks which layer answered, with what name and
+ * netmask. A layer of -1 means that no layer has data for it. */
+static void test_lookup(const MMDB_multi_s *const multi,
+                        const char *ip,
+                        int layer,
+                        const char *name,
+                        uint16_t netmask) {
+    int gai_error;
+    int mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_overlay_lookup_string(multi, ip, &gai_error, &mmdb_error);
+    cmp_ok(gai_error, "==", 0, "no getaddrinfo error for %s", ip);
+    cmp_ok(mmdb_error, "==", MMDB_SUCCESS, "no lookup error for %s", ip);
+
+    if (layer < 0) {
+        ok(!result.found_entry, "%s has no data in any layer", ip);
+    } else {
+        ok(result.found_entry && result.entry.mmdb == &multi->databases[layer],
+           "%s is found in layer %d",
+           ip,
+           layer);
+        MMDB_entry_data_s entry_data;
+        int status = MMDB_get_value(&result.entry, &entry_data, "name", NULL);
+        ok(MMDB_SUCCESS == status && entry_data.has_data &&
+               entry_data.data_size == strlen(name) &&
+               !memcmp(entry_data.utf8_string, name, strlen(name)),
+           "the name for %s is %s",
+           ip,
+           name);
+    }
+    cmp_ok(result.netmask, "==", netmask, "the netmask for %s", ip);
+}
+
+static void test_overlay(void) {
+    const char *filenames[] = {OVERLAY_DATABASE, VENDOR_DATABASE};
+    MMDB_multi_s multi;
+    open_multi_ok(filenames, 2, &multi);
+
+    test_lookup(&multi, "1.1.1.1", 0, "override", 24);
+    // The vendor's /8 only holds outside of the overlay's networks, so the
+    // netmask is that of the overlay's empty network when it is smaller,
+    // 1.0.0.0/15 (111 - 96) and 1.128.0.0/9 (105 - 96) here.
+    test_lookup(&multi, "1.2.3.4", 1, "vendor", 111);
+    test_lookup(&multi, "1.128.0.0", 1, "vendor", 105);
+    // The IPv4 overlay can't hold IPv6 addresses, so they go to the vendor.
+    test_lookup(&multi, "2001:db8::1", 1, "vendor IPv6", 32);
+    test_lookup(&multi, "2.2.2.2", -1, NULL, 103);
+
+    int gai_error;
+    int mmdb_error;
+    MMDB_lookup_result_s result = MMDB_overlay_lookup_string(
+        &multi, "not an ip", &gai_error, &mmdb_error);
+    ok(gai_error != 0 && mmdb_error == MMDB_SUCCESS && !result.found_entry,
+       "a getaddrinfo error for an invalid address");
+
+    MMDB_multi_close(&multi);
+
+    // With the layers the other way around, the vendor answers for all of
+    // its networks. Netmasks are in terms of the last layer looked at when
+    // none of them has data.
+    const char *reversed[] = {VENDOR_DATABASE, OVERLAY_DATABASE};
+    open_multi_ok(reversed, 2, &multi);
+    test_lookup(&multi, "1.1.1.1", 0, "vendor", 104);
+    test_lookup(&multi, "2.2.2.2", -1, NULL, 7);
+    MMDB_multi_close(&multi);
+}
+
+static void test_ipv4_layers(void) {
+    const char *filenames[] = {OVERLAY_DATABASE, OVERLAY_DATABASE};
+    MMDB_multi_s multi;
+    open_multi_ok(filenames, 2, &multi);
+
+    int gai_error;
+    int mmdb_error;
+    MMDB_lookup_result_s result = MMDB_overlay_lookup_string(
+        &multi, "2001:db8::1", &gai_error, &mmdb_error);
+    cmp_ok(mmdb_error,
+           "==",
+           MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR,
+           "an IPv6 address is an error when no layer can hold it");
+    ok(!result.found_entry, "and it isn't found");
+
+    MMDB_multi_close(&multi);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    write_databases();
+    test_overlay();
+    test_ipv4_layers();
+    remove(OVERLAY_DATABASE);
+    remove(VENDOR_DATABASE);
+    done_testing();
+}
@@ -0,0 +1,351 @@
+#include "maxminddb_test_helper.h"
+
+#include <stddef.h>
+
+typedef struct {
+    MMDB_string_view_s utf8_string;
+    MMDB_string_view_s nested_string;
+    double double_value;
+    double float_as_double;
+    float float_value;
+    uint16_t uint16;
+    uint32_t uint16_as_uint32;
+    uint32_t uint32;
+    uint64_t uint64;
+    int32_t int32;
+    bool boolean;
+    uint32_t first;
+    uint32_t last;
+    uint32_t nested_array;
+    uint32_t missing;
+    uint32_t below_scalar;
+} all_types_s;
+
+static const char *utf8_string_path[] = {"utf8_string", NULL};
+static const char *nested_string_path[] = {
+    "map", "mapX", "utf8_stringX", NULL};
+static const char *double_path[] = {"double", NULL};
+static const char *float_path[] = {"float", NULL};
+static const char *uint16_path[] = {"uint16", NULL};
+static const char *uint32_path[] = {"uint32", NULL};
+static const char *uint64_path[] = {"uint64", NULL};
+static const char *int32_path[] = {"int32", NULL};
+static const char *boolean_path[] = {"boolean", NULL};
+static const char *first_path[] = {"array", "0", NULL};
+static const char *last_path[] = {"array", "-1", NULL};
+static const char *nested_array_path[] = {"map", "mapX", "arrayX", "1", NULL};
+static const char *missing_path[] = {"map", "missing", NULL};
+static const char *below_scalar_path[] = {"uint128", "0", NULL};
+
+static MMDB_schema_s *new_schema_ok(const MMDB_schema_field_s *fields,
+                                    size_t count,
+                                    const char *description) {
+    MMDB_schema_s *schema;
+    int status = MMDB_schema_new(fields, count, &schema);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_schema_new - %s", description);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not create the schema");
+    }
+    return schema;
+}
+
+static void test_all_types(MMDB_s *mmdb, const char *mode_desc) {
+    MMDB_schema_field_s fields[] = {
+        {utf8_string_path,
+         MMDB_DATA_TYPE_UTF8_STRING,
+         offsetof(all_types_s, utf8_string)},
+        {nested_string_path,
+         MMDB_DATA_TYPE_UTF8_STRING,
+         offsetof(all_types_s, nested_string)},
+        {double_path,
+         MMDB_DATA_TYPE_DOUBLE,
+         offsetof(all_types_s, double_value)},
+        {float_path, MMDB_DATA_TYPE_FLOAT, offsetof(all_types_s, float_value)},
+        {uint16_path, MMDB_DATA_TYPE_UINT16, offsetof(all_types_s, uint16)},
+        {uint32_path, MMDB_DATA_TYPE_UINT32, offsetof(all_types_s, uint32)},
+        {uint64_path, MMDB_DATA_TYPE_UINT64, offsetof(all_types_s, uint64)},
+        {int32_path, MMDB_DATA_TYPE_INT32, offsetof(all_types_s, int32)},
+        {boolean_path, MMDB_DATA_TYPE_BOOLEAN, offsetof(all_types_s, boolean)},
+        {first_path, MMDB_DATA_TYPE_UINT32, offsetof(all_types_s, first)},
+        {last_path, MMDB_DATA_TYPE_UINT32, offsetof(all_types_s, last)},
+        {nested_array_path,
+         MMDB_DATA_TYPE_UINT32,
+         offsetof(all_types_s, nested_array)},
+        {missing_path, MMDB_DATA_TYPE_UINT32, offsetof(all_types_s, missing)},
+        {below_scalar_path,
+         MMDB_DATA_TYPE_UINT32,
+         offsetof(all_types_s, below_scalar)},
+    };
+    MMDB_schema_s *schema = new_schema_ok(
+        fields, sizeof(fields) / sizeof(fields[0]), "all types");
+
+    const char *filename = "MaxMind-DB-test-decoder.mmdb";
+    MMDB_lookup_result_s result =
+        lookup_string_ok(mmdb, "1.1.1.1", filename, mode_desc);
+
+    all_types_s decoded;
+    memset(&decoded, 0, sizeof(decoded));
+    decoded.missing = 42;
+    decoded.below_scalar = 42;
+    int status = MMDB_schema_decode(schema, &result.entry, &decoded);
+    cmp_ok(status, "==", MMDB_SUCCESS, "MMDB_schema_decode - %s", mode_desc);
+
+    const char *unicode = "unicode! ☯ - ♫";
+    cmp_ok(decoded.utf8_string.length,
+           "==",
+           strlen(unicode),
+           "utf8_string length");
+    ok(memcmp(decoded.utf8_string.data, unicode, strlen(unicode)) == 0,
+       "utf8_string points into the database");
+    cmp_ok(decoded.nested_string.length, "==", 5, "nested string length");
+    ok(memcmp(decoded.nested_string.data, "hello", 5) == 0,
+       "nested string in a map in a map");
+    compare_double(decoded.double_value, 42.123456);
+    compare_float(decoded.float_value, 1.1F);
+    cmp_ok(decoded.uint16, "==", 100, "uint16");
+    cmp_ok(decoded.uint32, "==", 1 << 28, "uint32");
+    ok(decoded.uint64 == (uint64_t)1 << 60, "uint64");
+    cmp_ok(decoded.int32, "==", -268435456, "int32");
+    ok(decoded.boolean, "boolean");
+    cmp_ok(decoded.first, "==", 1, "first array element");
+    cmp_ok(decoded.last, "==", 3, "last array element by negative index");
+    cmp_ok(decoded.nested_array, "==", 8, "array element in a nested map");
+    cmp_ok(decoded.missing, "==", 42, "a missing key is left alone");
+    cmp_ok(decoded.below_scalar, "==", 42, "a path below a scalar is missing");
+
+    MMDB_schema_free(schema);
+}
+
+static void test_widening(MMDB_s *mmdb, const char *mode_desc) {
+    MMDB_schema_field_s fields[] = {
+        {float_path,
+         MMDB_DATA_TYPE_DOUBLE,
+         offsetof(all_types_s, float_as_double)},
+        {uint16_path,
+         MMDB_DATA_TYPE_UINT32,
+         offsetof(all_types_s, uint16_as_uint32)},
+        {uint32_path, MMDB_DATA_TYPE_UINT64, offsetof(all_types_s, uint64)},
+    };
+    MMDB_schema_s *schema = new_schema_ok(
+        fields, sizeof(fields) / sizeof(fields[0]), "widening");
+
+    const char *filename = "MaxMind-DB-test-decoder.mmdb";
+    MMDB_lookup_result_s result =
+        lookup_string_ok(mmdb, "1.1.1.1", filename, mode_desc);
+
+    all_types_s decoded;
+    memset(&decoded, 0, sizeof(decoded));
+    int status = MMDB_schema_decode(schema, &result.entry, &decoded);
+    cmp_ok(status, "==", MMDB_SUCCESS, "widening decode - %s", mode_desc);
+    compare_float((float)decoded.float_as_double, 1.1F);
+    cmp_ok(decoded.uint16_as_uint32, "==", 100, "uint16 into a uint32");
+    ok(decoded.uint64 == 1 << 28, "uint32 into a uint64");
+
+    MMDB_schema_free(schema);
+}
+
+static void test_type_mismatch(MMDB_s *mmdb, const char *mode_desc) {
+    MMDB_schema_field_s narrowing[] = {
+        {uint64_path, MMDB_DATA_TYPE_UINT32, offsetof(all_types_s, uint32)},
+    };
+    MMDB_schema_field_s string_as_number[] = {
+        {utf8_string_path,
+         MMDB_DATA_TYPE_DOUBLE,
+         offsetof(all_types_s, double_value)},
+    };
+    const char *map_path[] = {"map", NULL};
+    MMDB_schema_field_s map_as_string[] = {
+        {map_path,
+         MMDB_DATA_TYPE_UTF8_STRING,
+         offsetof(all_types_s, utf8_string)},
+    };
+    struct {
+        MMDB_schema_field_s *field;
+        const char *description;
+    } tests[] = {
+        {narrowing, "a uint64 into a uint32"},
+        {string_as_number, "a string into a double"},
+        {map_as_string, "a map into a string"},
+    };
+
+    const char *filename = "MaxMind-DB-test-decoder.mmdb";
+    MMDB_lookup_result_s result =
+        lookup_string_ok(mmdb, "1.1.1.1", filename, mode_desc);
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        MMDB_schema_s *schema =
+            new_schema_ok(tests[i].field, 1, tests[i].description);
+        all_types_s decoded;
+        cmp_ok(MMDB_schema_decode(schema, &result.entry, &decoded),
+               "==",
+               MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR,
+               "decoding %s is an error - %s",
+               tests[i].description,
+               mode_desc);
+        MMDB_schema_free(schema);
+    }
+}
+
+static void test_bad_schemas(void) {
+    const char *empty_path[] = {NULL};
+    const char *map_path[] = {"map", NULL};
+    const char *map_key_path[] = {"map", "mapX", NULL};
+    MMDB_schema_field_s empty[] = {{empty_path, MMDB_DATA_TYPE_UINT32, 0}};
+    MMDB_schema_field_s no_path[] = {{NULL, MMDB_DATA_TYPE_UINT32, 0}};
+    MMDB_schema_field_s map_type[] = {{map_path, MMDB_DATA_TYPE_MAP, 0}};
+    MMDB_schema_field_s duplicate[] = {
+        {uint16_path, MMDB_DATA_TYPE_UINT32, 0},
+        {uint16_path, MMDB_DATA_TYPE_UINT16, 8},
+    };
+    MMDB_schema_field_s through_field[] = {
+        {map_path, MMDB_DATA_TYPE_UINT32, 0},
+        {map_key_path, MMDB_DATA_TYPE_UINT32, 8},
+    };
+    MMDB_schema_field_s to_parent[] = {
+        {map_key_path, MMDB_DATA_TYPE_UINT32, 0},
+        {map_path, MMDB_DATA_TYPE_UINT32, 8},
+    };
+    struct {
+        MMDB_schema_field_s *fields;
+        size_t count;
+        const char *description;
+    } tests[] = {
+        {empty, 1, "an empty path"},
+        {no_path, 1, "a NULL path"},
+        {map_type, 1, "a map field"},
+        {duplicate, 2, "the same path twice"},
+        {through_field, 2, "a path through another field"},
+        {to_parent, 2, "a path to the parent of another field"},
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        MMDB_schema_s *schema = (MMDB_schema_s *)1;
+        cmp_ok(MMDB_schema_new(tests[i].fields, tests[i].count, &schema),
+               "==",
+               MMDB_INVALID_LOOKUP_PATH_ERROR,
+               "a schema with %s is invalid",
+               tests[i].description);
+        ok(schema == NULL, "no schema for %s", tests[i].description);
+    }
+
+    MMDB_schema_s *schema = new_schema_ok(NULL, 0, "no fields");
+    MMDB_schema_free(schema);
+}
+
+typedef struct {
+    MMDB_string_view_s city;
+    MMDB_string_view_s country;
+    MMDB_string_view_s subdivision;
+    double latitude;
+    double longitude;
+    uint16_t accuracy_radius;
+    uint32_t geoname_id;
+} city_s;
+
+/* Decodes every record of the City database and checks each field against
+ * what the typed accessors return for it. */
+static void test_city(void) {
+    char *path = test_database_path("GeoIP2-City-Test.mmdb");
+    MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+    if (!mmdb) {
+        return;
+    }
+
+    const char *city_path[] = {"city", "names", "en", NULL};
+    const char *country_path[] = {"country", "iso_code", NULL};
+    const char *subdivision_path[] = {"subdivisions", "0", "iso_code", NULL};
+    const char *latitude_path[] = {"location", "latitude", NULL};
+    const char *longitude_path[] = {"location", "longitude", NULL};
+    const char *accuracy_path[] = {"location", "accuracy_radius", NULL};
+    const char *geoname_path[] = {"city", "geoname_id", NULL};
+    MMDB_schema_field_s fields[] = {
+        {city_path, MMDB_DATA_TYPE_UTF8_STRING, offsetof(city_s, city)},
+        {country_path, MMDB_DATA_TYPE_UTF8_STRING, offsetof(city_s, country)},
+        {subdivision_path,
+         MMDB_DATA_TYPE_UTF8_STRING,
+         offsetof(city_s, subdivision)},
+        {latitude_path, MMDB_DATA_TYPE_DOUBLE, offsetof(city_s, latitude)},
+        {longitude_path, MMDB_DATA_TYPE_DOUBLE, offsetof(city_s, longitude)},
+        {accuracy_path,
+         MMDB_DATA_TYPE_UINT16,
+         offsetof(city_s, accuracy_radius)},
+        {geoname_path, MMDB_DATA_TYPE_UINT32, offsetof(city_s, geoname_id)},
+    };
+    MMDB_schema_s *schema =
+        new_schema_ok(fields, sizeof(fields) / sizeof(fields[0]), "city");
+
+    MMDB_network_iterator_s iterator;
+    MMDB_network_iterator_init(
+        mmdb, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    size_t record_count = 0;
+    size_t mismatch_count = 0;
+    int status;
+    MMDB_network_s network;
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        city_s decoded;
+        memset(&decoded, 0, sizeof(decoded));
+        if (MMDB_schema_decode(schema, &network.entry, &decoded) !=
+            MMDB_SUCCESS) {
+            mismatch_count++;
+            continue;
+        }
+        record_count++;
+
+        const char *const *string_paths[] = {
+            city_path, country_path, subdivision_path};
+        MMDB_string_view_s *strings[] = {
+            &decoded.city, &decoded.country, &decoded.subdivision};
+        for (size_t i = 0; i < 3; i++) {
+            const char *string = NULL;
+            uint32_t length = 0;
+            MMDB_get_utf8(&network.entry, string_paths[i], &string, &length);
+            if (strings[i]->data != string || strings[i]->length != length) {
+                mismatch_count++;
+            }
+        }
+
+        double latitude = 0, longitude = 0;
+        MMDB_get_double(&network.entry, latitude_path, &latitude);
+        MMDB_get_double(&network.entry, longitude_path, &longitude);
+        uint32_t accuracy_radius = 0, geoname_id = 0;
+        MMDB_get_uint32(&network.entry, accuracy_path, &accuracy_radius);
+        MMDB_get_uint32(&network.entry, geoname_path, &geoname_id);
+        if (decoded.latitude != latitude || decoded.longitude != longitude ||
+            decoded.accuracy_radius != accuracy_radius ||
+            decoded.geoname_id != geoname_id) {
+            mismatch_count++;
+        }
+    }
+    cmp_ok(status, "==", MMDB_SUCCESS, "iterated over the City database");
+    ok(record_count > 0, "decoded the City records");
+    cmp_ok(mismatch_count,
+           "==",
+           0,
+           "decoded City records match the typed accessors");
+
+    MMDB_schema_free(schema);
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+void run_tests(int mode, const char *mode_desc) {
+    char *path = test_database_path("MaxMind-DB-test-decoder.mmdb");
+    MMDB_s *mmdb = open_ok(path, mode, mode_desc);
+    free(path);
+
+    test_all_types(mmdb, mode_desc);
+    test_widening(mmdb, mode_desc);
+    test_type_mismatch(mmdb, mode_desc);
+
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    for_all_modes(&run_tests);
+    test_bad_schemas();
+    test_city();
+    done_testing();
+}
@@ -0,0 +1,450 @@
+#include "synthetic_db.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined _MSC_VER && _MSC_VER < 1900
+    #define snprintf _snprintf
+#endif
+
+// Every network gets a slot of its own at the top of the search tree so that
+// no two networks overlap. Below the slot the network goes between
+// MIN_DEPTH_BELOW_SLOT and MAX_DEPTH_BELOW_SLOT bits further, which is where
+// most of the nodes come from.
+#define MIN_DEPTH_BELOW_SLOT (4)
+#define MAX_DEPTH_BELOW_SLOT (12)
+// The slots take about one node per network and the bits below a slot take
+// the average depth below it.
+#define NODES_PER_NETWORK                                                      \
+    (1 + (MIN_DEPTH_BELOW_SLOT + MAX_DEPTH_BELOW_SLOT) / 2)
+#define MAX_IPV4_SLOT_BITS (32 - MAX_DEPTH_BELOW_SLOT)
+#define MAX_NODE_COUNT (UINT32_MAX)
+
+// IPv6 networks are put in 2000::/3, where the global unicast addresses are.
+#define IPV6_PREFIX (0x1)
+#define IPV6_PREFIX_BITS (3)
+
+#define COUNTRY_COUNT (250)
+#define SUBDIVISION_COUNT (4000)
+#define TIME_ZONE_COUNT (40)
+
+// A fixed build epoch keeps the output the same for the same parameters.
+#define SYNTHETIC_BUILD_EPOCH (1700000000)
+
+static unsigned int bits_needed(uint64_t count);
+static uint64_t mix(uint64_t seed, uint64_t index);
+static void put_bits(uint8_t *const address,
+                     unsigned int offset,
+                     uint64_t value,
+                     unsigned int count);
+static bool map_add(MMDB_writer_s *const writer,
+                    MMDB_writer_value_s *const map,
+                    const char *const key,
+                    MMDB_writer_value_s *const value);
+static MMDB_writer_value_s *string_value(MMDB_writer_s *const writer,
+                                         const char *const string);
+static MMDB_writer_value_s *
+names_value(MMDB_writer_s *const writer, const char *const name, uint32_t id);
+static MMDB_writer_value_s *flat_record(MMDB_writer_s *const writer,
+                                        uint32_t id);
+static MMDB_writer_value_s *city_record(MMDB_writer_s *const writer,
+                                        uint32_t id);
+static MMDB_writer_value_s *nested_record(MMDB_writer_s *const writer,
+                                          uint32_t id);
+static MMDB_writer_value_s *record_value(MMDB_writer_s *const writer,
+                                         synthetic_shape_e shape,
+                                         uint32_t id);
+
+void synthetic_db_init(synthetic_db_s *const db) {
+    memset(db, 0, sizeof(synthetic_db_s));
+    db->node_count = 1000000;
+    db->ip_version = 6;
+    db->ipv4_percent = 25;
+    db->shape = SYNTHETIC_SHAPE_FLAT;
+    db->seed = 1;
+}
+
+int synthetic_db_prepare(synthetic_db_s *const db) {
+    if ((db->ip_version != 4 && db->ip_version != 6) ||
+        (db->record_size != 0 && db->record_size != 24 &&
+         db->record_size != 28 && db->record_size != 32) ||
+        db->ipv4_percent > 100 || !(db->dedup_ratio >= 0.0) ||
+        db->dedup_ratio >= 1.0 || db->node_count == 0 ||
+        db->node_count > MAX_NODE_COUNT ||
+        synthetic_shape_name(db->shape) == NULL) {
+        return MMDB_INVALID_DATA_ERROR;
+    }
+
+    uint64_t networks = db->node_count / NODES_PER_NETWORK;
+    if (networks == 0) {
+        networks = 1;
+    }
+
+    uint64_t const max_ipv4_networks = (uint64_t)1 << MAX_IPV4_SLOT_BITS;
+    if (db->ip_version == 4) {
+        // There isn't room for more networks in the IPv4 address space.
+        if (networks > max_ipv4_networks) {
+            return MMDB_INVALID_DATA_ERROR;
+        }
+        db->ipv4_network_count = networks;
+    } else {
+        // The IPv4 networks that don't fit go into IPv6 instead.
+        db->ipv4_network_count = networks * db->ipv4_percent / 100;
+        if (db->ipv4_network_count > max_ipv4_networks) {
+            db->ipv4_network_count = max_ipv4_networks;
+        }
+    }
+    db->ipv6_network_count = networks - db->ipv4_network_count;
+    db->ipv4_slot_bits = bits_needed(db->ipv4_network_count);
+    db->ipv6_slot_bits = bits_needed(db->ipv6_network_count);
+
+    double records = (double)networks * (1.0 - db->dedup_ratio) + 0.5;
+    db->record_count = records < 1.0 ? 1 : (uint32_t)records;
+    if (db->record_count > networks) {
+        db->record_count = (uint32_t)networks;
+    }
+
+    return MMDB_SUCCESS;
+}
+
+uint64_t synthetic_db_network_count(const synthetic_db_s *const db) {
+    return db->ipv4_network_count + db->ipv6_network_count;
+}
+
+void synthetic_db_network(const synthetic_db_s *const db,
+                          uint64_t index,
+                          synthetic_network_s *const network) {
+    uint64_t const hash = mix(db->seed, index);
+    unsigned int const depth =
+        MIN_DEPTH_BELOW_SLOT +
+        (unsigned int)(hash %
+                       (MAX_DEPTH_BELOW_SLOT - MIN_DEPTH_BELOW_SLOT + 1));
+    uint64_t const bits = (hash >> 8) & (((uint64_t)1 << depth) - 1);
+
+    memset(network, 0, sizeof(synthetic_network_s));
+    // Records are handed out round robin, so every record is used and
+    // neighbouring networks have different records.
+    network->record_id = (uint32_t)(index % db->record_count);
+
+    if (index < db->ipv4_network_count) {
+        unsigned int const slot_bits = db->ipv4_slot_bits;
+        network->ip_version = 4;
+        network->prefix_length = (uint16_t)(slot_bits + depth);
+        put_bits(network->address, 0, index, slot_bits);
+        put_bits(network->address, slot_bits, bits, depth);
+        return;
+    }
+
+    unsigned int const slot_bits = db->ipv6_slot_bits;
+    network->ip_version = 6;
+    network->prefix_length = (uint16_t)(IPV6_PREFIX_BITS + slot_bits + depth);
+    put_bits(network->address, 0, IPV6_PREFIX, IPV6_PREFIX_BITS);
+    put_bits(network->address,
+             IPV6_PREFIX_BITS,
+             index - db->ipv4_network_count,
+             slot_bits);
+    put_bits(network->address, IPV6_PREFIX_BITS + slot_bits, bits, depth);
+}
+
+const char *synthetic_shape_name(synthetic_shape_e shape) {
+    switch (shape) {
+        case SYNTHETIC_SHAPE_FLAT:
+            return "flat";
+        case SYNTHETIC_SHAPE_CITY:
+            return "city";
+        case SYNTHETIC_SHAPE_NESTED:
+            return "nested";
+    }
+    return NULL;
+}
+
+int synthetic_shape_from_name(const char *const name,
+                              synthetic_shape_e *const shape) {
+    synthetic_shape_e const shapes[] = {SYNTHETIC_SHAPE_FLAT,
+                                        SYNTHETIC_SHAPE_CITY,
+                                        SYNTHETIC_SHAPE_NESTED};
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        if (strcmp(name, synthetic_shape_name(shapes[i])) == 0) {
+            *shape = shapes[i];
+            return MMDB_SUCCESS;
+        }
+    }
+    return MMDB_INVALID_DATA_ERROR;
+}
+
+int synthetic_db_write(const synthetic_db_s *const db,
+                       const char *const filename) {
+    char database_type[32];
+    snprintf(database_type,
+             sizeof(database_type),
+             "Synthetic-%s",
+             synthetic_shape_name(db->shape));
+
+    MMDB_writer_s *writer;
+    int status = MMDB_writer_new(db->ip_version, database_type, 0, &writer);
+    if (status != MMDB_SUCCESS) {
+        return status;
+    }
+
+    status = MMDB_writer_add_language(writer, "en");
+    if (status == MMDB_SUCCESS) {
+        status = MMDB_writer_add_description(
+            writer, "en", "Synthetic database for scale testing");
+    }
+    if (status == MMDB_SUCCESS && db->record_size != 0) {
+        status = MMDB_writer_set_record_size(writer, db->record_size);
+    }
+    MMDB_writer_set_build_epoch(writer, SYNTHETIC_BUILD_EPOCH);
+
+    uint64_t const network_count = synthetic_db_network_count(db);
+    for (uint64_t i = 0; i < network_count && status == MMDB_SUCCESS; i++) {
+        synthetic_network_s network;
+        synthetic_db_network(db, i, &network);
+
+        MMDB_writer_value_s *const value =
+            record_value(writer, db->shape, network.record_id);
+        if (value == NULL) {
+            status = MMDB_OUT_OF_MEMORY_ERROR;
+            break;
+        }
+        status = MMDB_writer_insert(writer,
+                                    network.address,
+                                    network.ip_version,
+                                    network.prefix_length,
+                                    value,
+                                    MMDB_WRITER_INSERT_REPLACE);
+    }
+
+    if (status == MMDB_SUCCESS) {
+        status = MMDB_writer_write(writer, filename);
+    }
+    MMDB_writer_free(writer);
+    return status;
+}
+
+static unsigned int bits_needed(uint64_t count) {
+    unsigned int bits = 0;
+    while (bits < 64 && ((uint64_t)1 << bits) < count) {
+        bits++;
+    }
+    return bits;
+}
+
+// This is the SplitMix64 finalizer, which is plenty for spreading the
+// networks around.
+static uint64_t mix(uint64_t seed, uint64_t index) {
+    uint64_t z = seed + (index + 1) * UINT64_C(0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+// Sets count bits of the address, starting offset bits from the most
+// significant bit, to the low count bits of value.
+static void put_bits(uint8_t *const address,
+                     unsigned int offset,
+                     uint64_t value,
+                     unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        if ((value >> (count - 1 - i)) & 1) {
+            unsigned int const bit = offset + i;
+            address[bit / 8] |= (uint8_t)(0x80 >> (bit % 8));
+        }
+    }
+}
+
+static bool map_add(MMDB_writer_s *const writer,
+                    MMDB_writer_value_s *const map,
+                    const char *const key,
+                    MMDB_writer_value_s *const value) {
+    return MMDB_writer_map_add(writer, map, key, strlen(key), value) ==
+           MMDB_SUCCESS;
+}
+
+static MMDB_writer_value_s *string_value(MMDB_writer_s *const writer,
+                                         const char *const string) {
+    return MMDB_writer_utf8_string(writer, string, strlen(string));
+}
+
+static MMDB_writer_value_s *
+names_value(MMDB_writer_s *const writer, const char *const name, uint32_t id) {
+    static const char *const languages[][2] = {
+        {"en", ""}, {"de", "-de"}, {"ja", "-ja"}};
+    MMDB_writer_value_s *const names = MMDB_writer_map(writer);
+    if (names == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < sizeof(languages) / sizeof(languages[0]); i++) {
+        char buffer[64];
+        snprintf(buffer,
+                 sizeof(buffer),
+                 "%s %u%s",
+                 name,
+                 (unsigned int)id,
+                 languages[i][1]);
+        if (!map_add(writer,
+                     names,
+                     languages[i][0],
+                     string_value(writer, buffer))) {
+            return NULL;
+        }
+    }
+    return names;
+}
+
+static MMDB_writer_value_s *flat_record(MMDB_writer_s *const writer,
+                                        uint32_t id) {
+    char name[32];
+    snprintf(name, sizeof(name), "record %u", (unsigned int)id);
+
+    MMDB_writer_value_s *const record = MMDB_writer_map(writer);
+    if (record == NULL ||
+        !map_add(writer, record, "id", MMDB_writer_uint32(writer, id)) ||
+        !map_add(writer, record, "name", string_value(writer, name)) ||
+        !map_add(
+            writer, record, "score", MMDB_writer_double(writer, id / 8.0)) ||
+        !map_add(
+            writer, record, "active", MMDB_writer_boolean(writer, id & 1))) {
+        return NULL;
+    }
+    return record;
+}
+
+static MMDB_writer_value_s *city_record(MMDB_writer_s *const writer,
+                                        uint32_t id) {
+    uint32_t const country_id = id % COUNTRY_COUNT;
+    uint32_t const subdivision_id = id % SUBDIVISION_COUNT;
+    char iso_code[8];
+    char time_zone[32];
+
+    MMDB_writer_value_s *const city = MMDB_writer_map(writer);
+    if (city == NULL ||
+        !map_add(writer, city, "geoname_id", MMDB_writer_uint32(writer, id)) ||
+        !map_add(writer, city, "names", names_value(writer, "City", id))) {
+        return NULL;
+    }
+
+    snprintf(iso_code,
+             sizeof(iso_code),
+             "%c%c",
+             'A' + (int)(country_id / 26 % 26),
+             'A' + (int)(country_id % 26));
+    MMDB_writer_value_s *const country = MMDB_writer_map(writer);
+    if (country == NULL ||
+        !map_add(writer,
+                 country,
+                 "geoname_id",
+                 MMDB_writer_uint32(writer, 1000000 + country_id)) ||
+        !map_add(writer, country, "iso_code", string_value(writer, iso_code)) ||
+        !map_add(writer,
+                 country,
+                 "names",
+                 names_value(writer, "Country", country_id))) {
+        return NULL;
+    }
+
+    snprintf(time_zone,
+             sizeof(time_zone),
+             "Zone/%u",
+             (unsigned int)(id % TIME_ZONE_COUNT));
+    MMDB_writer_value_s *const location = MMDB_writer_map(writer);
+    if (location == NULL ||
+        !map_add(writer,
+                 location,
+                 "accuracy_radius",
+                 MMDB_writer_uint16(writer, (uint16_t)(id % 1000 + 1))) ||
+        !map_add(writer,
+                 location,
+                 "latitude",
+                 MMDB_writer_double(writer, (id % 18000) / 100.0 - 90.0)) ||
+        !map_add(writer,
+                 location,
+                 "longitude",
+                 MMDB_writer_double(writer, (id % 36000) / 100.0 - 180.0)) ||
+        !map_add(writer,
+                 location,
+                 "time_zone",
+                 string_value(writer, time_zone))) {
+        return NULL;
+    }
+
+    snprintf(iso_code,
+             sizeof(iso_code),
+             "%u",
+             (unsigned int)(subdivision_id % 100));
+    MMDB_writer_value_s *const subdivision = MMDB_writer_map(writer);
+    MMDB_writer_value_s *const subdivisions = MMDB_writer_array(writer);
+    if (subdivision == NULL || subdivisions == NULL ||
+        !map_add(writer,
+                 subdivision,
+                 "geoname_id",
+                 MMDB_writer_uint32(writer, 2000000 + subdivision_id)) ||
+        !map_add(
+            writer, subdivision, "iso_code", string_value(writer, iso_code)) ||
+        !map_add(writer,
+                 subdivision,
+                 "names",
+                 names_value(writer, "Subdivision", subdivision_id)) ||
+        MMDB_writer_array_append(writer, subdivisions, subdivision) !=
+            MMDB_SUCCESS) {
+        return NULL;
+    }
+
+    MMDB_writer_value_s *const record = MMDB_writer_map(writer);
+    if (record == NULL ||
+        !map_add(writer, record, "id", MMDB_writer_uint32(writer, id)) ||
+        !map_add(writer, record, "city", city) ||
+        !map_add(writer, record, "country", country) ||
+        !map_add(writer, record, "location", location) ||
+        !map_add(writer, record, "subdivisions", subdivisions)) {
+        return NULL;
+    }
+    return record;
+}
+
+static MMDB_writer_value_s *nested_record(MMDB_writer_s *const writer,
+                                          uint32_t id) {
+    // The map at each level only depends on the level and on id shifted right
+    // by the level, so it is the same for twice as many records as the map
+    // above it.
+    MMDB_writer_value_s *child = NULL;
+    for (unsigned int level = SYNTHETIC_NESTED_DEPTH; level > 0; level--) {
+        MMDB_writer_value_s *const map = MMDB_writer_map(writer);
+        if (map == NULL ||
+            !map_add(writer,
+                     map,
+                     "level",
+                     MMDB_writer_uint16(writer, (uint16_t)level)) ||
+            !map_add(writer,
+                     map,
+                     "value",
+                     MMDB_writer_uint32(writer, id >> level)) ||
+            (child != NULL && !map_add(writer, map, "child", child))) {
+            return NULL;
+        }
+        child = map;
+    }
+
+    MMDB_writer_value_s *const record = MMDB_writer_map(writer);
+    if (record == NULL ||
+        !map_add(writer, record, "id", MMDB_writer_uint32(writer, id)) ||
+        !map_add(writer, record, "child", child)) {
+        return NULL;
+    }
+    return record;
+}
+
+static MMDB_writer_value_s *record_value(MMDB_writer_s *const writer,
+                                         synthetic_shape_e shape,
+                                         uint32_t id) {
+    switch (shape) {
+        case SYNTHETIC_SHAPE_FLAT:
+            return flat_record(writer, id);
+        case SYNTHETIC_SHAPE_CITY:
+            return city_record(writer, id);
+        case SYNTHETIC_SHAPE_NESTED:
+            return nested_record(writer, id);
+    }
+    return NULL;
+}
@@ -0,0 +1,78 @@
+#ifndef SYNTHETIC_DB_H
+#define SYNTHETIC_DB_H
+
+#include "maxminddb_writer.h"
+#include <stdint.h>
+
+// Synthetic databases are built from a handful of parameters so that tests and
+// benchmarks can run against databases far larger than the fixtures in
+// t/maxmind-db. The same parameters always produce the same database, and
+// synthetic_db_network() describes every network in it so that lookups can be
+// checked without keeping the networks around.
+
+typedef enum {
+    // A small map of scalars.
+    SYNTHETIC_SHAPE_FLAT,
+    // A map shaped like a GeoIP2 City record. The country and subdivision
+    // maps are shared by many records.
+    SYNTHETIC_SHAPE_CITY,
+    // A chain of nested maps where each level is shared by twice as many
+    // records as the level above it, so that the data section is full of
+    // pointers to maps which contain pointers.
+    SYNTHETIC_SHAPE_NESTED,
+} synthetic_shape_e;
+
+// The number of nested maps below the top level of a nested record.
+#define SYNTHETIC_NESTED_DEPTH (12)
+
+typedef struct synthetic_db_s {
+    // The number of search tree nodes to aim for. The actual number is within
+    // a few percent of it.
+    uint64_t node_count;
+    uint16_t ip_version;
+    // 24, 28 or 32 to force a record size, or 0 for the smallest that fits.
+    uint16_t record_size;
+    // The share of the networks that are IPv4 networks in an IPv6 database.
+    unsigned int ipv4_percent;
+    synthetic_shape_e shape;
+    // The share of the networks whose record is the same as another
+    // network's, from 0 (every record is distinct) up to but not including 1.
+    double dedup_ratio;
+    uint64_t seed;
+
+    // These are set by synthetic_db_prepare().
+    uint64_t ipv4_network_count;
+    uint64_t ipv6_network_count;
+    uint32_t record_count;
+    unsigned int ipv4_slot_bits;
+    unsigned int ipv6_slot_bits;
+} synthetic_db_s;
+
+typedef struct synthetic_network_s {
+    // 4 bytes for an IPv4 network and 16 for an IPv6 network.
+    uint8_t address[16];
+    uint16_t ip_version;
+    uint16_t prefix_length;
+    // The "id" stored in the network's record.
+    uint32_t record_id;
+} synthetic_network_s;
+
+// Sets the defaults: an IPv6 database of about a million nodes with a quarter
+// of its networks in IPv4, flat records and no duplicate records.
+extern void synthetic_db_init(synthetic_db_s *const db);
+// Checks the parameters and works out how many networks and records there are.
+// This returns MMDB_INVALID_DATA_ERROR if a parameter is out of range.
+extern int synthetic_db_prepare(synthetic_db_s *const db);
+extern uint64_t synthetic_db_network_count(const synthetic_db_s *const db);
+extern void synthetic_db_network(const synthetic_db_s *const db,
+                                 uint64_t index,
+                                 synthetic_network_s *const network);
+extern const char *synthetic_shape_name(synthetic_shape_e shape);
+extern int synthetic_shape_from_name(const char *const name,
+                                     synthetic_shape_e *const shape);
+// Writes the database to filename. synthetic_db_prepare() must have been
+// called first. This returns an MMDB status code.
+extern int synthetic_db_write(const synthetic_db_s *const db,
+                              const char *const filename);
+
+#endif
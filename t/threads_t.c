@@ -1,6 +1,15 @@
 #include "maxminddb_test_helper.h"
+#include "synthetic_db.h"
+#include <arpa/inet.h>
 #include <pthread.h>
 
+// The synthetic databases are small by default so that the test is quick. Set
+// MMDB_TEST_SYNTHETIC_NODES to run it against databases of that many nodes
+// instead.
+#define SYNTHETIC_DATABASE "threads_t-synthetic.mmdb"
+#define SYNTHETIC_NODES (200000)
+#define SYNTHETIC_THREADS (8)
+
 typedef struct thread_arg {
     int thread_id;
     MMDB_s *mmdb;
@@ -199,9 +208,210 @@ void run_tests(int mode, const char *mode_desc) {
     free(mmdb);
 }
 
+typedef struct synthetic_thread_arg {
+    int thread_id;
+    MMDB_s *mmdb;
+    const synthetic_db_s *db;
+    unsigned long long lookups;
+    char error[200];
+} synthetic_thread_arg_s;
+
+static bool check_synthetic_network(MMDB_s *mmdb,
+                                    const synthetic_db_s *db,
+                                    const synthetic_network_s *network,
+                                    char *error,
+                                    size_t error_size) {
+    struct sockaddr_storage address = {0};
+    uint16_t netmask = network->prefix_length;
+    if (network->ip_version == 4) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&address;
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, network->address, 4);
+        if (db->ip_version == 6) {
+            netmask += 96;
+        }
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&address;
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, network->address, 16);
+    }
+
+    char ip[INET6_ADDRSTRLEN];
+    inet_ntop(network->ip_version == 4 ? AF_INET : AF_INET6,
+              network->address,
+              ip,
+              sizeof(ip));
+
+    int mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_lookup_sockaddr(mmdb, (struct sockaddr *)&address, &mmdb_error);
+    if (mmdb_error != MMDB_SUCCESS || !result.found_entry) {
+        snprintf(error, error_size, "no entry for %s", ip);
+        return false;
+    }
+    if (result.netmask != netmask) {
+        snprintf(error,
+                 error_size,
+                 "netmask for %s is %d, not %d",
+                 ip,
+                 result.netmask,
+                 netmask);
+        return false;
+    }
+
+    MMDB_entry_data_s data;
+    int status = MMDB_get_value(&result.entry, &data, "id", NULL);
+    if (status != MMDB_SUCCESS || !data.has_data ||
+        data.type != MMDB_DATA_TYPE_UINT32 ||
+        data.uint32 != network->record_id) {
+        snprintf(error, error_size, "wrong id for %s", ip);
+        return false;
+    }
+
+    if (db->shape == SYNTHETIC_SHAPE_NESTED) {
+        // Follow the whole chain of nested maps, each of which is behind a
+        // pointer.
+        const char *path[SYNTHETIC_NESTED_DEPTH + 2];
+        for (int i = 0; i < SYNTHETIC_NESTED_DEPTH; i++) {
+            path[i] = "child";
+        }
+        path[SYNTHETIC_NESTED_DEPTH] = "value";
+        path[SYNTHETIC_NESTED_DEPTH + 1] = NULL;
+
+        status = MMDB_aget_value(&result.entry, &data, path);
+        if (status != MMDB_SUCCESS || !data.has_data ||
+            data.type != MMDB_DATA_TYPE_UINT32 ||
+            data.uint32 != network->record_id >> SYNTHETIC_NESTED_DEPTH) {
+            snprintf(error, error_size, "wrong nested value for %s", ip);
+            return false;
+        }
+    }
+    return true;
+}
+
+void *run_synthetic_thread(void *arg) {
+    synthetic_thread_arg_s *thread_arg = (synthetic_thread_arg_s *)arg;
+    uint64_t const network_count = synthetic_db_network_count(thread_arg->db);
+
+    for (uint64_t i = (uint64_t)thread_arg->thread_id; i < network_count;
+         i += SYNTHETIC_THREADS) {
+        synthetic_network_s network;
+        synthetic_db_network(thread_arg->db, i, &network);
+        if (!check_synthetic_network(thread_arg->mmdb,
+                                     thread_arg->db,
+                                     &network,
+                                     thread_arg->error,
+                                     sizeof(thread_arg->error))) {
+            break;
+        }
+        thread_arg->lookups++;
+    }
+
+    pthread_exit(NULL);
+}
+
+void run_synthetic_test(synthetic_db_s *db) {
+    const char *const nodes = getenv("MMDB_TEST_SYNTHETIC_NODES");
+    db->node_count =
+        nodes != NULL ? strtoull(nodes, NULL, 10) : SYNTHETIC_NODES;
+    // There is only room for about 9 million nodes worth of networks in an
+    // IPv4 database.
+    if (db->ip_version == 4 && db->node_count > 9000000) {
+        db->node_count = 9000000;
+    }
+
+    char description[MAX_DESCRIPTION_LENGTH];
+    snprintf(description,
+             sizeof(description),
+             "synthetic IPv%d %s database with %llu nodes",
+             db->ip_version,
+             synthetic_shape_name(db->shape),
+             (unsigned long long)db->node_count);
+
+    int status = synthetic_db_prepare(db);
+    cmp_ok(status, "==", MMDB_SUCCESS, "prepared %s", description);
+    if (status != MMDB_SUCCESS) {
+        return;
+    }
+    status = synthetic_db_write(db, SYNTHETIC_DATABASE);
+    cmp_ok(status, "==", MMDB_SUCCESS, "wrote %s", description);
+    if (status != MMDB_SUCCESS) {
+        return;
+    }
+
+    MMDB_s *mmdb = open_ok(SYNTHETIC_DATABASE, MMDB_MODE_MMAP, description);
+    if (db->record_size != 0) {
+        cmp_ok(mmdb->metadata.record_size,
+               "==",
+               db->record_size,
+               "record size of %s",
+               description);
+    }
+    double const node_ratio =
+        (double)mmdb->metadata.node_count / (double)db->node_count;
+    ok(node_ratio > 0.9 && node_ratio < 1.1,
+       "%s has %u nodes",
+       description,
+       (unsigned int)mmdb->metadata.node_count);
+
+    pthread_t threads[SYNTHETIC_THREADS];
+    synthetic_thread_arg_s thread_args[SYNTHETIC_THREADS];
+    for (int i = 0; i < SYNTHETIC_THREADS; i++) {
+        thread_args[i] = (synthetic_thread_arg_s){
+            .thread_id = i, .mmdb = mmdb, .db = db};
+        if (pthread_create(
+                &threads[i], NULL, run_synthetic_thread, &thread_args[i])) {
+            BAIL_OUT("pthread_create failed");
+        }
+    }
+
+    unsigned long long lookups = 0;
+    for (int i = 0; i < SYNTHETIC_THREADS; i++) {
+        if (pthread_join(threads[i], NULL)) {
+            BAIL_OUT("pthread_join failed");
+        }
+        ok(thread_args[i].error[0] == '\0',
+           "thread %d found the expected data in %s%s%s",
+           i,
+           description,
+           thread_args[i].error[0] == '\0' ? "" : " - ",
+           thread_args[i].error);
+        lookups += thread_args[i].lookups;
+    }
+    ok(lookups == synthetic_db_network_count(db),
+       "looked up all %llu networks in %s",
+       lookups,
+       description);
+
+    MMDB_close(mmdb);
+    free(mmdb);
+    remove(SYNTHETIC_DATABASE);
+}
+
+void run_synthetic_tests(void) {
+    synthetic_db_s db;
+
+    synthetic_db_init(&db);
+    db.record_size = 32;
+    run_synthetic_test(&db);
+
+    synthetic_db_init(&db);
+    db.shape = SYNTHETIC_SHAPE_CITY;
+    db.ipv4_percent = 50;
+    db.dedup_ratio = 0.9;
+    run_synthetic_test(&db);
+
+    synthetic_db_init(&db);
+    db.ip_version = 4;
+    db.shape = SYNTHETIC_SHAPE_NESTED;
+    db.record_size = 28;
+    run_synthetic_test(&db);
+}
+
 int main(void) {
     plan(NO_PLAN);
     for_all_modes(&run_tests);
+    run_synthetic_tests();
     done_testing();
     pthread_exit(NULL);
 }
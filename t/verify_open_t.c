@@ -0,0 +1,268 @@
+#include "maxminddb_test_helper.h"
+
+#define INVALID_DATABASE "verify_open_t.mmdb"
+
+static MMDB_s *open_database(const char *filename,
+                             uint32_t flags,
+                             const char *description) {
+    char *path = test_database_path(filename);
+    MMDB_s *mmdb = open_ok(path, flags, description);
+    free(path);
+    if (NULL == mmdb) {
+        BAIL_OUT("could not open %s", filename);
+    }
+    return mmdb;
+}
+
+static bool same_entry_data_lists(const MMDB_entry_data_list_s *checked,
+                                  const MMDB_entry_data_list_s *verified) {
+    for (; NULL != checked && NULL != verified;
+         checked = checked->next, verified = verified->next) {
+        const MMDB_entry_data_s *a = &checked->entry_data;
+        const MMDB_entry_data_s *b = &verified->entry_data;
+        if (a->type != b->type || a->offset != b->offset ||
+            a->offset_to_next != b->offset_to_next ||
+            a->data_size != b->data_size) {
+            return false;
+        }
+    }
+    return NULL == checked && NULL == verified;
+}
+
+/* Iterates over the networks of both handles together and checks that they
+ * find the same networks and decode the same data. */
+static void test_same_data(const char *filename) {
+    MMDB_s *checked = open_database(filename, MMDB_MODE_MMAP, "mmap mode");
+    MMDB_s *verified = open_database(
+        filename, MMDB_MODE_MMAP | MMDB_MODE_VERIFY, "verified mode");
+
+    ok(!(checked->flags & MMDB_MODE_VERIFY),
+       "the flags of %s don't have MMDB_MODE_VERIFY without it",
+       filename);
+    ok(verified->flags & MMDB_MODE_VERIFY,
+       "the flags of %s have MMDB_MODE_VERIFY once it is verified",
+       filename);
+
+    MMDB_network_iterator_s checked_iterator;
+    MMDB_network_iterator_s verified_iterator;
+    int status = MMDB_network_iterator_init(
+        checked, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &checked_iterator);
+    if (MMDB_SUCCESS == status) {
+        status = MMDB_network_iterator_init(
+            verified, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &verified_iterator);
+    }
+    cmp_ok(status, "==", MMDB_SUCCESS, "started iterating over %s", filename);
+
+    int networks = 0;
+    int same = 0;
+    MMDB_network_s checked_network;
+    MMDB_network_s verified_network;
+    int checked_status = MMDB_SUCCESS;
+    int verified_status = MMDB_SUCCESS;
+    while (MMDB_SUCCESS == status &&
+           MMDB_network_iterator_next(
+               &checked_iterator, &checked_network, &checked_status)) {
+        networks++;
+        if (!MMDB_network_iterator_next(
+                &verified_iterator, &verified_network, &verified_status) ||
+            checked_network.netmask != verified_network.netmask ||
+            checked_network.entry.offset != verified_network.entry.offset) {
+            break;
+        }
+
+        MMDB_entry_data_list_s *checked_list = NULL;
+        MMDB_entry_data_list_s *verified_list = NULL;
+        int const checked_error =
+            MMDB_get_entry_data_list(&checked_network.entry, &checked_list);
+        int const verified_error =
+            MMDB_get_entry_data_list(&verified_network.entry, &verified_list);
+        if (MMDB_SUCCESS == checked_error && MMDB_SUCCESS == verified_error &&
+            same_entry_data_lists(checked_list, verified_list)) {
+            same++;
+        }
+        MMDB_free_entry_data_list(checked_list);
+        MMDB_free_entry_data_list(verified_list);
+    }
+
+    cmp_ok(checked_status, "==", MMDB_SUCCESS, "iterated over %s", filename);
+    cmp_ok(verified_status,
+           "==",
+           MMDB_SUCCESS,
+           "iterated over %s in verified mode",
+           filename);
+    ok(networks > 0 && same == networks,
+       "all %d networks of %s have the same data in verified mode",
+       networks,
+       filename);
+
+    MMDB_close(checked);
+    free(checked);
+    MMDB_close(verified);
+    free(verified);
+}
+
+static void test_lookups(void) {
+    MMDB_s *checked = open_database(
+        "GeoIP2-City-Test.mmdb", MMDB_MODE_MMAP, "mmap mode");
+    MMDB_s *mmdb = open_database("GeoIP2-City-Test.mmdb",
+                                 MMDB_MODE_MMAP | MMDB_MODE_VERIFY,
+                                 "verified mode");
+
+    MMDB_lookup_result_s expect =
+        lookup_string_ok(checked, "81.2.69.160", "GeoIP2-City-Test.mmdb", "");
+    MMDB_lookup_result_s result =
+        lookup_string_ok(mmdb, "81.2.69.160", "GeoIP2-City-Test.mmdb", "");
+    ok(result.found_entry, "found 81.2.69.160");
+    MMDB_entry_data_s expect_data;
+    MMDB_get_value(&expect.entry, &expect_data, "city", "names", "en", NULL);
+    MMDB_entry_data_s entry_data;
+    int status = MMDB_get_value(
+        &result.entry, &entry_data, "city", "names", "en", NULL);
+    cmp_ok(status, "==", MMDB_SUCCESS, "got the name of the city");
+    ok(entry_data.has_data && expect_data.has_data &&
+           entry_data.data_size == expect_data.data_size &&
+           !memcmp(entry_data.utf8_string,
+                   expect_data.utf8_string,
+                   entry_data.data_size),
+       "the name is the same as without verifying");
+    MMDB_close(checked);
+    free(checked);
+
+    status = MMDB_get_value(&result.entry, &entry_data, "city", "nope", NULL);
+    cmp_ok(status,
+           "==",
+           MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR,
+           "a path that isn't in the data is still not found");
+
+    result = lookup_string_ok(mmdb, "::1", "GeoIP2-City-Test.mmdb", "");
+    ok(!result.found_entry, "::1 is not in the database");
+
+    MMDB_close(mmdb);
+    free(mmdb);
+
+    mmdb = open_database("MaxMind-DB-test-mixed-32.mmdb",
+                         MMDB_MODE_MMAP | MMDB_MODE_LAZY | MMDB_MODE_VERIFY,
+                         "lazy verified mode");
+    result = lookup_string_ok(mmdb, "1.1.1.1", "mixed-32", "");
+    ok(result.found_entry && result.netmask == 128,
+       "found 1.1.1.1 in lazy verified mode");
+    MMDB_close(mmdb);
+    free(mmdb);
+}
+
+static void test_invalid_database(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Verify Open Test", 0);
+    // A string that lookups return as it is but which isn't valid UTF-8.
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    map_add_ok(
+        writer, map, "name", MMDB_writer_utf8_string(writer, "\xFF\xFE", 2));
+    if (MMDB_writer_insert_network(
+            writer, "1.0.0.0/8", map, MMDB_WRITER_INSERT_REPLACE) !=
+        MMDB_SUCCESS) {
+        BAIL_OUT("could not insert 1.0.0.0/8");
+    }
+    write_ok(writer, INVALID_DATABASE);
+
+    MMDB_s mmdb;
+    int status = MMDB_open(INVALID_DATABASE, MMDB_MODE_MMAP, &mmdb);
+    cmp_ok(status, "==", MMDB_SUCCESS, "opened the database without verifying");
+    if (MMDB_SUCCESS == status) {
+        MMDB_close(&mmdb);
+    }
+
+    status =
+        MMDB_open(INVALID_DATABASE, MMDB_MODE_MMAP | MMDB_MODE_VERIFY, &mmdb);
+    cmp_ok(status,
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "MMDB_open fails for an invalid database in verified mode");
+    if (MMDB_SUCCESS == status) {
+        MMDB_close(&mmdb);
+    }
+
+    remove(INVALID_DATABASE);
+}
+
+/* An entry that MMDB_verify() didn't check, here one that starts in the middle
+ * of a string, is decoded with the bounds checks in verified mode too. */
+static void test_unverified_entry(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Verify Open Test", 0);
+    // The last byte of the data section is the control byte of a string of 30
+    // bytes, which would go past the end of the data section.
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    map_add_ok(writer, map, "name", MMDB_writer_utf8_string(writer, "abc^", 4));
+    if (MMDB_writer_insert_network(
+            writer, "1.0.0.0/8", map, MMDB_WRITER_INSERT_REPLACE) !=
+        MMDB_SUCCESS) {
+        BAIL_OUT("could not insert 1.0.0.0/8");
+    }
+    write_ok(writer, INVALID_DATABASE);
+
+    MMDB_s mmdb;
+    int status =
+        MMDB_open(INVALID_DATABASE, MMDB_MODE_MMAP | MMDB_MODE_VERIFY, &mmdb);
+    cmp_ok(status, "==", MMDB_SUCCESS, "opened the database in verified mode");
+    if (MMDB_SUCCESS != status) {
+        remove(INVALID_DATABASE);
+        return;
+    }
+    ok(mmdb.flags & MMDB_MODE_VERIFY, "the database is verified");
+
+    int gai_error;
+    int mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_lookup_string(&mmdb, "1.1.1.1", &gai_error, &mmdb_error);
+    ok(MMDB_SUCCESS == mmdb_error && result.found_entry, "found 1.1.1.1");
+    MMDB_entry_data_s entry_data;
+    status = MMDB_get_value(&result.entry, &entry_data, "name", NULL);
+    ok(MMDB_SUCCESS == status && entry_data.data_size == 4,
+       "the entry that the lookup found is decoded");
+
+    MMDB_entry_s entry = {.mmdb = &mmdb,
+                          .offset = mmdb.data_section_size - 1};
+    const char *const path[] = {NULL};
+    status = MMDB_aget_value(&entry, &entry_data, path);
+    cmp_ok(status,
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "MMDB_aget_value checks an entry that wasn't verified");
+    const char *string;
+    uint32_t length;
+    status = MMDB_get_utf8(&entry, path, &string, &length);
+    cmp_ok(status,
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "MMDB_get_utf8 checks an entry that wasn't verified");
+    MMDB_entry_data_list_s *list = NULL;
+    status = MMDB_get_entry_data_list(&entry, &list);
+    cmp_ok(status,
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "MMDB_get_entry_data_list checks an entry that wasn't verified");
+    MMDB_free_entry_data_list(list);
+    MMDB_entry_data_list_s elements[8];
+    MMDB_entry_data_arena_s arena;
+    MMDB_entry_data_arena_init(&arena, elements, sizeof(elements));
+    status = MMDB_get_entry_data_list_in_arena(&entry, &arena, &list);
+    cmp_ok(status,
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "MMDB_get_entry_data_list_in_arena checks an entry that wasn't "
+           "verified");
+    ok(mmdb.flags & MMDB_MODE_VERIFY, "the database is still verified");
+
+    MMDB_close(&mmdb);
+    remove(INVALID_DATABASE);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    test_same_data("GeoIP2-City-Test.mmdb");
+    test_same_data("MaxMind-DB-test-decoder.mmdb");
+    test_same_data("MaxMind-DB-test-ipv4-28.mmdb");
+    test_same_data("MaxMind-DB-test-mixed-24.mmdb");
+    test_lookups();
+    test_invalid_database();
+    test_unverified_entry();
+    done_testing();
+}
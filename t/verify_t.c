@@ -0,0 +1,336 @@
+#include "maxminddb_test_helper.h"
+
+#define DATABASE "verify_t.mmdb"
+#define CORRUPT_DATABASE "verify_t_corrupt.mmdb"
+
+typedef struct {
+    uint8_t *content;
+    size_t size;
+} file_s;
+
+static MMDB_writer_value_s *string_value(MMDB_writer_s *writer,
+                                         const char *string) {
+    return MMDB_writer_utf8_string(writer, string, strlen(string));
+}
+
+/* The writer stores each string and key once, so the tests can find them in
+ * the file to corrupt them. */
+static void insert_ok(MMDB_writer_s *writer,
+                      const char *network,
+                      const char *name) {
+    MMDB_writer_value_s *tags = MMDB_writer_array(writer);
+    MMDB_writer_array_append(writer, tags, string_value(writer, "Zürich"));
+    MMDB_writer_array_append(writer, tags, MMDB_writer_uint32(writer, 42));
+
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    map_add_ok(writer, map, "name", string_value(writer, name));
+    map_add_ok(writer, map, "is_flagged", MMDB_writer_boolean(writer, true));
+    map_add_ok(writer, map, "tags", tags);
+
+    int status = MMDB_writer_insert_network(
+        writer, network, map, MMDB_WRITER_INSERT_REPLACE);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("could not insert %s", network);
+    }
+}
+
+static void write_file_ok(const char *filename, const file_s *file) {
+    FILE *stream = fopen(filename, "wb");
+    if (NULL == stream ||
+        fwrite(file->content, 1, file->size, stream) != file->size) {
+        BAIL_OUT("could not write %s", filename);
+    }
+    fclose(stream);
+}
+
+static file_s write_database(void) {
+    MMDB_writer_s *writer =
+        new_writer_ok(6, "Verify Test", MMDB_WRITER_ALIAS_IPV4);
+    MMDB_writer_set_record_size(writer, 24);
+    insert_ok(writer, "1.0.0.0/8", "first network");
+    insert_ok(writer, "2.2.0.0/16", "second network");
+    insert_ok(writer, "2001:db8::/32", "third network");
+    write_ok(writer, DATABASE);
+
+    file_s file = {0};
+    FILE *stream = fopen(DATABASE, "rb");
+    if (NULL == stream || fseek(stream, 0, SEEK_END) != 0) {
+        BAIL_OUT("could not read %s", DATABASE);
+    }
+    long const size = ftell(stream);
+    rewind(stream);
+    file.size = (size_t)size;
+    file.content = malloc(file.size);
+    if (NULL == file.content ||
+        fread(file.content, 1, file.size, stream) != file.size) {
+        BAIL_OUT("could not read %s", DATABASE);
+    }
+    fclose(stream);
+    remove(DATABASE);
+    return file;
+}
+
+static size_t find_ok(const file_s *file, const char *string) {
+    size_t const length = strlen(string);
+    for (size_t i = 0; i + length <= file->size; i++) {
+        if (!memcmp(file->content + i, string, length)) {
+            return i;
+        }
+    }
+    BAIL_OUT("could not find %s", string);
+    return 0;
+}
+
+/* Returns the number of subtrees at the netmask that MMDB_verify_subtree()
+ * rejects, or -1 if the subtrees can't be found. */
+static int count_invalid_subtrees(const MMDB_s *const mmdb, uint16_t netmask) {
+    MMDB_network_subtree_s *subtrees;
+    size_t count;
+    int status =
+        MMDB_get_network_subtrees(mmdb, netmask, 0, &subtrees, &count);
+    if (status != MMDB_SUCCESS) {
+        return -1;
+    }
+    int invalid = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (MMDB_verify_subtree(&subtrees[i]) != MMDB_SUCCESS) {
+            invalid++;
+        }
+    }
+    MMDB_free_network_subtrees(subtrees);
+    return invalid;
+}
+
+/* Writes the file with length bytes at the offset changed and opens it. Use
+ * close_changed() to close it. */
+static void open_changed(file_s *file,
+                         size_t offset,
+                         const uint8_t *bytes,
+                         size_t length,
+                         MMDB_s *const mmdb) {
+    uint8_t original[8];
+    if (length > sizeof(original) || offset + length > file->size) {
+        BAIL_OUT("bad change at %zu", offset);
+    }
+    memcpy(original, file->content + offset, length);
+    memcpy(file->content + offset, bytes, length);
+    write_file_ok(CORRUPT_DATABASE, file);
+    memcpy(file->content + offset, original, length);
+
+    if (MMDB_open(CORRUPT_DATABASE, MMDB_MODE_MMAP, mmdb) != MMDB_SUCCESS) {
+        BAIL_OUT("could not open %s", CORRUPT_DATABASE);
+    }
+}
+
+static void close_changed(MMDB_s *const mmdb) {
+    MMDB_close(mmdb);
+    remove(CORRUPT_DATABASE);
+}
+
+/* Returns the status of MMDB_verify() for the file with one byte changed. */
+static int verify_changed(file_s *file, size_t offset, uint8_t byte) {
+    MMDB_s mmdb;
+    open_changed(file, offset, &byte, 1, &mmdb);
+    int status = MMDB_verify(&mmdb);
+    close_changed(&mmdb);
+    return status;
+}
+
+static void test_valid_databases(void) {
+    const char *databases[] = {"GeoIP2-City-Test.mmdb",
+                               "MaxMind-DB-test-decoder.mmdb",
+                               "MaxMind-DB-test-ipv4-24.mmdb",
+                               "MaxMind-DB-test-ipv6-28.mmdb",
+                               "MaxMind-DB-test-mixed-32.mmdb"};
+
+    for (size_t i = 0; i < sizeof(databases) / sizeof(databases[0]); i++) {
+        char *path = test_database_path(databases[i]);
+        MMDB_s *mmdb = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+        free(path);
+        if (NULL == mmdb) {
+            continue;
+        }
+
+        cmp_ok(MMDB_verify(mmdb),
+               "==",
+               MMDB_SUCCESS,
+               "%s is valid",
+               databases[i]);
+        cmp_ok(MMDB_verify_metadata(mmdb),
+               "==",
+               MMDB_SUCCESS,
+               "the metadata of %s is valid",
+               databases[i]);
+        cmp_ok(count_invalid_subtrees(mmdb, 8),
+               "==",
+               0,
+               "all of the /8s of %s are valid",
+               databases[i]);
+
+        MMDB_close(mmdb);
+        free(mmdb);
+    }
+}
+
+static void test_corrupt_data(file_s *file) {
+    cmp_ok(verify_changed(file, 0, file->content[0]),
+           "==",
+           MMDB_SUCCESS,
+           "the database written for the test is valid");
+
+    // The second byte of the "\xC3\xBC" for the u with an umlaut.
+    size_t offset = find_ok(file, "Zürich") + 2;
+    cmp_ok(verify_changed(file, offset, 0xFF),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a string with a byte that is never valid UTF-8");
+    cmp_ok(verify_changed(file, offset - 1, 'u'),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a string with an unexpected UTF-8 continuation byte");
+    cmp_ok(verify_changed(file, offset, 'u'),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a string with a truncated UTF-8 sequence");
+    cmp_ok(verify_changed(file, offset - 1, 0xC0),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a string with an overlong UTF-8 sequence");
+
+    // A key of the same size but with the type of a uint32.
+    offset = find_ok(file, "is_flagged");
+    cmp_ok(verify_changed(file,
+                          offset - 1,
+                          (uint8_t)((MMDB_DATA_TYPE_UINT32 << 5) | 10)),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a map key that isn't a string");
+
+    // The writer puts the keys before the records and the maps point to
+    // them, so the boolean follows the name and a two byte pointer. It is an
+    // extended type with its value in the size.
+    offset = find_ok(file, "first network") + strlen("first network") + 2;
+    cmp_ok(file->content[offset], "==", 1, "found the boolean");
+    cmp_ok(verify_changed(file, offset, 2),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a boolean with a value of 2");
+
+    // Lookups don't check strings, so only verifying finds this, and only
+    // in the subtree with the network.
+    MMDB_s mmdb;
+    uint8_t const invalid = 0xFF;
+    open_changed(file, find_ok(file, "third network"), &invalid, 1, &mmdb);
+    int gai_error;
+    int mmdb_error;
+    MMDB_lookup_result_s result =
+        MMDB_lookup_string(&mmdb, "2001:db8::1", &gai_error, &mmdb_error);
+    ok(mmdb_error == MMDB_SUCCESS && result.found_entry,
+       "the network with the invalid string can be looked up");
+    cmp_ok(MMDB_verify(&mmdb),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "but it isn't valid");
+    cmp_ok(count_invalid_subtrees(&mmdb, 8),
+           "==",
+           1,
+           "only the /8 with the network is invalid");
+    close_changed(&mmdb);
+}
+
+static void test_corrupt_search_tree(file_s *file) {
+    write_file_ok(DATABASE, file);
+    MMDB_s mmdb;
+    if (MMDB_open(DATABASE, MMDB_MODE_MMAP, &mmdb) != MMDB_SUCCESS) {
+        BAIL_OUT("could not open %s", DATABASE);
+    }
+    size_t const separator =
+        (size_t)(mmdb.data_section - mmdb.file_content) - 1;
+    MMDB_search_node_s node;
+    if (MMDB_read_node(&mmdb, 0, &node) != MMDB_SUCCESS ||
+        node.left_record_type != MMDB_RECORD_TYPE_SEARCH_NODE) {
+        BAIL_OUT("unexpected root node");
+    }
+    uint32_t const child = (uint32_t)node.left_record;
+    MMDB_close(&mmdb);
+    remove(DATABASE);
+
+    cmp_ok(verify_changed(file, separator, 1),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "a data section separator that isn't all zeros");
+
+    // With 24 bit records, each node is 6 bytes and the left record is the
+    // first 3 of them.
+    cmp_ok(verify_changed(file, 0, 0xFF),
+           "==",
+           MMDB_CORRUPT_SEARCH_TREE_ERROR,
+           "a record past the end of the data section");
+
+    uint8_t const loop[3] = {
+        (uint8_t)(child >> 16), (uint8_t)(child >> 8), (uint8_t)child};
+    open_changed(file, (size_t)child * 6, loop, sizeof(loop), &mmdb);
+    cmp_ok(MMDB_verify(&mmdb),
+           "==",
+           MMDB_CORRUPT_SEARCH_TREE_ERROR,
+           "a node that points to itself");
+    close_changed(&mmdb);
+}
+
+/* Each level is a map with two keys that point to the same map of the level
+ * below, so there are 2^SHARED_LEVELS paths through the values of a record.
+ * Every value should still only be checked once. */
+#define SHARED_LEVELS 40
+
+static void test_shared_values(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Verify Test", 0);
+    MMDB_writer_value_s *value = string_value(writer, "bottom");
+    for (int i = 0; i < SHARED_LEVELS; i++) {
+        MMDB_writer_value_s *map = MMDB_writer_map(writer);
+        map_add_ok(writer, map, "left", value);
+        map_add_ok(writer, map, "right", value);
+        if (MMDB_writer_intern(writer, map, &value) != MMDB_SUCCESS) {
+            BAIL_OUT("could not intern level %d", i);
+        }
+    }
+    // Records that point to different values that share the levels below.
+    const char *networks[] = {"1.0.0.0/8", "3.0.0.0/8", "5.0.0.0/8"};
+    for (size_t i = 0; i < sizeof(networks) / sizeof(networks[0]); i++) {
+        MMDB_writer_value_s *map = MMDB_writer_map(writer);
+        map_add_ok(writer, map, "name", string_value(writer, networks[i]));
+        map_add_ok(writer, map, "shared", value);
+        if (MMDB_writer_insert_network(
+                writer, networks[i], map, MMDB_WRITER_INSERT_REPLACE) !=
+            MMDB_SUCCESS) {
+            BAIL_OUT("could not insert %s", networks[i]);
+        }
+    }
+    write_ok(writer, DATABASE);
+
+    MMDB_s mmdb;
+    if (MMDB_open(DATABASE, MMDB_MODE_MMAP, &mmdb) != MMDB_SUCCESS) {
+        BAIL_OUT("could not open %s", DATABASE);
+    }
+    cmp_ok(MMDB_verify(&mmdb),
+           "==",
+           MMDB_SUCCESS,
+           "values shared %d levels deep are checked once",
+           SHARED_LEVELS);
+    cmp_ok(count_invalid_subtrees(&mmdb, 8),
+           "==",
+           0,
+           "and once for each subtree");
+    MMDB_close(&mmdb);
+    remove(DATABASE);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    test_valid_databases();
+    test_shared_values();
+    file_s file = write_database();
+    test_corrupt_data(&file);
+    test_corrupt_search_tree(&file);
+    free(file.content);
+    done_testing();
+}
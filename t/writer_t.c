@@ -0,0 +1,581 @@
+#include "maxminddb_test_helper.h"
+
+#ifndef _WIN32
+    #include <arpa/inet.h>
+#endif
+
+#define WRITER_TEST_DATABASE "writer_t.mmdb"
+
+static const struct {
+    int layout;
+    const char *name;
+} layouts[] = {
+    {MMDB_WRITER_LAYOUT_DEPTH_FIRST, "depth first"},
+    {MMDB_WRITER_LAYOUT_BLOCKED, "blocked"},
+    {MMDB_WRITER_LAYOUT_VAN_EMDE_BOAS, "van Emde Boas"},
+};
+
+static MMDB_writer_value_s *string_value(MMDB_writer_s *writer,
+                                         const char *string) {
+    return MMDB_writer_utf8_string(writer, string, strlen(string));
+}
+
+static void insert_ok(MMDB_writer_s *writer,
+                      const char *network,
+                      MMDB_writer_value_s *value,
+                      int policy) {
+    int status = MMDB_writer_insert_network(writer, network, value, policy);
+    cmp_ok(status, "==", MMDB_SUCCESS, "inserted %s", network);
+}
+
+static MMDB_writer_value_s *
+name_and_number(MMDB_writer_s *writer, const char *name, uint32_t number) {
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    map_add_ok(writer, map, "name", string_value(writer, name));
+    map_add_ok(writer, map, "number", MMDB_writer_uint32(writer, number));
+    return map;
+}
+
+static void test_lookup(MMDB_s *mmdb,
+                        const char *ip,
+                        const char *name,
+                        uint16_t netmask) {
+    MMDB_lookup_result_s result =
+        lookup_string_ok(mmdb, ip, WRITER_TEST_DATABASE, "mmap mode");
+    ok(result.found_entry, "found an entry for %s", ip);
+    if (!result.found_entry) {
+        return;
+    }
+    cmp_ok(result.netmask, "==", netmask, "netmask for %s", ip);
+
+    MMDB_entry_data_s entry_data =
+        data_ok(&result, MMDB_DATA_TYPE_UTF8_STRING, "name", "name", NULL);
+    char *string = dup_entry_string_or_bail(entry_data);
+    is(string, name, "name for %s", ip);
+    free(string);
+}
+
+static void test_metadata_and_lookups(void) {
+    MMDB_writer_s *writer =
+        new_writer_ok(6, "Writer Test", MMDB_WRITER_ALIAS_IPV4);
+    MMDB_writer_add_language(writer, "en");
+    MMDB_writer_add_language(writer, "de");
+    MMDB_writer_add_description(writer, "en", "A test database");
+    MMDB_writer_set_build_epoch(writer, 1700000000);
+
+    insert_ok(writer,
+              "1.2.3.0/24",
+              name_and_number(writer, "ipv4", 1),
+              MMDB_WRITER_INSERT_REPLACE);
+    insert_ok(writer,
+              "2001:db8::/32",
+              name_and_number(writer, "ipv6", 2),
+              MMDB_WRITER_INSERT_REPLACE);
+
+    MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+
+    cmp_ok(mmdb->metadata.ip_version, "==", 6, "ip_version is 6");
+    cmp_ok(mmdb->metadata.record_size, "==", 24, "small databases use 24 bits");
+    is(mmdb->metadata.database_type, "Writer Test", "database_type");
+    cmp_ok(mmdb->metadata.build_epoch, "==", 1700000000, "build_epoch");
+    cmp_ok(mmdb->metadata.languages.count, "==", 2, "two languages");
+    if (mmdb->metadata.languages.count == 2) {
+        is(mmdb->metadata.languages.names[0], "en", "first language");
+        is(mmdb->metadata.languages.names[1], "de", "second language");
+    }
+    cmp_ok(mmdb->metadata.description.count, "==", 1, "one description");
+    if (mmdb->metadata.description.count == 1) {
+        is(mmdb->metadata.description.descriptions[0]->description,
+           "A test database",
+           "description");
+    }
+
+    test_lookup(mmdb, "1.2.3.4", "ipv4", 120);
+    test_lookup(mmdb, "::1.2.3.4", "ipv4", 120);
+    test_lookup(mmdb, "::ffff:1.2.3.4", "ipv4", 120);
+    test_lookup(mmdb, "2002:102:304::", "ipv4", 40);
+    test_lookup(mmdb, "2001:db8::1", "ipv6", 32);
+
+    const char *missing[] = {"1.2.4.0", "2001:db9::", "::"};
+    for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+        MMDB_lookup_result_s result = lookup_string_ok(
+            mmdb, missing[i], WRITER_TEST_DATABASE, "mmap mode");
+        ok(!result.found_entry, "no entry for %s", missing[i]);
+    }
+
+    close_and_remove(mmdb, WRITER_TEST_DATABASE);
+}
+
+static void test_deduplication(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Writer Test", 0);
+    insert_ok(writer,
+              "1.0.0.0/24",
+              name_and_number(writer, "same", 1),
+              MMDB_WRITER_INSERT_REPLACE);
+    insert_ok(writer,
+              "2.0.0.0/24",
+              name_and_number(writer, "same", 1),
+              MMDB_WRITER_INSERT_REPLACE);
+    insert_ok(writer,
+              "3.0.0.0/24",
+              name_and_number(writer, "other", 1),
+              MMDB_WRITER_INSERT_REPLACE);
+
+    MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+
+    MMDB_lookup_result_s a =
+        lookup_string_ok(mmdb, "1.0.0.1", WRITER_TEST_DATABASE, "mmap mode");
+    MMDB_lookup_result_s b =
+        lookup_string_ok(mmdb, "2.0.0.1", WRITER_TEST_DATABASE, "mmap mode");
+    MMDB_lookup_result_s c =
+        lookup_string_ok(mmdb, "3.0.0.1", WRITER_TEST_DATABASE, "mmap mode");
+    ok(a.found_entry && b.found_entry && c.found_entry, "found all entries");
+    cmp_ok(a.entry.offset,
+           "==",
+           b.entry.offset,
+           "equal values are stored once");
+    cmp_ok(a.entry.offset,
+           "!=",
+           c.entry.offset,
+           "different values are stored separately");
+
+    close_and_remove(mmdb, WRITER_TEST_DATABASE);
+}
+
+static MMDB_writer_value_s *uint32_map(MMDB_writer_s *writer,
+                                       const char *key,
+                                       uint32_t value) {
+    MMDB_writer_value_s *map = MMDB_writer_map(writer);
+    map_add_ok(writer, map, key, MMDB_writer_uint32(writer, value));
+    return map;
+}
+
+static bool has_uint32(MMDB_lookup_result_s *result,
+                       const char *const *path,
+                       uint32_t expect) {
+    MMDB_entry_data_s entry_data;
+    int status = MMDB_aget_value(&result->entry, &entry_data, path);
+    return status == MMDB_SUCCESS && entry_data.has_data &&
+           entry_data.type == MMDB_DATA_TYPE_UINT32 &&
+           entry_data.uint32 == expect;
+}
+
+static bool has_key(MMDB_lookup_result_s *result, const char *const *path) {
+    MMDB_entry_data_s entry_data;
+    int status = MMDB_aget_value(&result->entry, &entry_data, path);
+    return status == MMDB_SUCCESS && entry_data.has_data;
+}
+
+static void test_policy(int policy, const char *description) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Writer Test", 0);
+
+    MMDB_writer_value_s *outer = MMDB_writer_map(writer);
+    map_add_ok(writer, outer, "a", MMDB_writer_uint32(writer, 1));
+    map_add_ok(writer, outer, "b", uint32_map(writer, "x", 1));
+    insert_ok(writer, "10.0.0.0/8", outer, MMDB_WRITER_INSERT_REPLACE);
+
+    MMDB_writer_value_s *inner = MMDB_writer_map(writer);
+    map_add_ok(writer, inner, "b", uint32_map(writer, "y", 2));
+    map_add_ok(writer, inner, "c", MMDB_writer_uint32(writer, 3));
+    insert_ok(writer, "10.1.0.0/16", inner, policy);
+
+    MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+
+    const char *a[] = {"a", NULL};
+    const char *bx[] = {"b", "x", NULL};
+    const char *by[] = {"b", "y", NULL};
+    const char *c[] = {"c", NULL};
+
+    MMDB_lookup_result_s outside =
+        lookup_string_ok(mmdb, "10.2.0.1", WRITER_TEST_DATABASE, description);
+    ok(outside.found_entry && has_uint32(&outside, a, 1) &&
+           has_uint32(&outside, bx, 1) && !has_key(&outside, c),
+       "%s - the rest of the /8 keeps its data",
+       description);
+
+    MMDB_lookup_result_s inside =
+        lookup_string_ok(mmdb, "10.1.0.1", WRITER_TEST_DATABASE, description);
+    ok(inside.found_entry, "%s - found an entry in the /16", description);
+    if (!inside.found_entry) {
+        close_and_remove(mmdb, WRITER_TEST_DATABASE);
+        return;
+    }
+
+    if (policy == MMDB_WRITER_INSERT_REPLACE) {
+        cmp_ok(inside.netmask, "==", 16, "%s - netmask", description);
+        ok(!has_key(&inside, a) && !has_key(&inside, bx) &&
+               has_uint32(&inside, by, 2) && has_uint32(&inside, c, 3),
+           "%s - the /16 has the new data",
+           description);
+    } else if (policy == MMDB_WRITER_INSERT_KEEP) {
+        cmp_ok(inside.netmask, "==", 8, "%s - netmask", description);
+        ok(has_uint32(&inside, a, 1) && has_uint32(&inside, bx, 1) &&
+               !has_key(&inside, by) && !has_key(&inside, c),
+           "%s - the /16 has the old data",
+           description);
+    } else {
+        cmp_ok(inside.netmask, "==", 16, "%s - netmask", description);
+        ok(has_uint32(&inside, a, 1) && has_uint32(&inside, bx, 1) &&
+               has_uint32(&inside, by, 2) && has_uint32(&inside, c, 3),
+           "%s - the /16 has the merged data",
+           description);
+    }
+
+    close_and_remove(mmdb, WRITER_TEST_DATABASE);
+}
+
+static void test_policies(void) {
+    test_policy(MMDB_WRITER_INSERT_REPLACE, "replace");
+    test_policy(MMDB_WRITER_INSERT_KEEP, "keep");
+    test_policy(MMDB_WRITER_INSERT_MERGE, "merge");
+}
+
+static char *dump_entry(MMDB_entry_s *entry) {
+    MMDB_entry_data_list_s *entry_data_list;
+    int status = MMDB_get_entry_data_list(entry, &entry_data_list);
+    if (status != MMDB_SUCCESS) {
+        BAIL_OUT("MMDB_get_entry_data_list failed");
+    }
+
+    FILE *stream = tmpfile();
+    if (!stream) {
+        BAIL_OUT("tmpfile failed");
+    }
+    MMDB_dump_entry_data_list(stream, entry_data_list, 0);
+    MMDB_free_entry_data_list(entry_data_list);
+
+    long size = ftell(stream);
+    char *dump = calloc(1, (size_t)size + 1);
+    if (!dump) {
+        BAIL_OUT("could not allocate memory");
+    }
+    rewind(stream);
+    if (fread(dump, 1, (size_t)size, stream) != (size_t)size) {
+        BAIL_OUT("could not read the dump");
+    }
+    fclose(stream);
+    return dump;
+}
+
+// Looks up every network of source in copy and checks that the data is the
+// same.
+static void
+same_data_ok(MMDB_s *source, MMDB_s *copy, const char *description) {
+    MMDB_network_iterator_s iterator;
+    MMDB_network_s network;
+    int status;
+    size_t count = 0;
+    bool all_match = true;
+    MMDB_network_iterator_init(
+        source, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        char ip[INET6_ADDRSTRLEN];
+        if (!inet_ntop(network.ip_version == 4 ? AF_INET : AF_INET6,
+                       network.address,
+                       ip,
+                       sizeof(ip))) {
+            BAIL_OUT("inet_ntop failed");
+        }
+        int gai_error, mmdb_error;
+        MMDB_lookup_result_s result =
+            MMDB_lookup_string(copy, ip, &gai_error, &mmdb_error);
+        if (!result.found_entry) {
+            all_match = false;
+            continue;
+        }
+
+        char *expect = dump_entry(&network.entry);
+        char *got = dump_entry(&result.entry);
+        if (strcmp(expect, got) != 0) {
+            all_match = false;
+        }
+        free(expect);
+        free(got);
+        count++;
+    }
+    cmp_ok(count, ">", 0, "looked up the networks - %s", description);
+    ok(all_match, "the copy has the same data - %s", description);
+}
+
+static void test_round_trip(const char *filename) {
+    char *path = test_database_path(filename);
+    MMDB_s *source = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    MMDB_writer_s *writer =
+        new_writer_ok(source->metadata.ip_version, "Writer Test", 0);
+    MMDB_network_iterator_s iterator;
+    MMDB_network_s network;
+    int status;
+    MMDB_network_iterator_init(
+        source, MMDB_ITERATOR_SKIP_EMPTY_NETWORKS, &iterator);
+    while (MMDB_network_iterator_next(&iterator, &network, &status)) {
+        MMDB_entry_data_list_s *entry_data_list;
+        status = MMDB_get_entry_data_list(&network.entry, &entry_data_list);
+        if (status != MMDB_SUCCESS) {
+            break;
+        }
+        MMDB_writer_value_s *value;
+        status = MMDB_writer_value_from_entry_data_list(
+            writer, entry_data_list, &value);
+        MMDB_free_entry_data_list(entry_data_list);
+        if (status != MMDB_SUCCESS) {
+            break;
+        }
+        status = MMDB_writer_insert(writer,
+                                    network.address,
+                                    network.ip_version,
+                                    network.netmask,
+                                    value,
+                                    MMDB_WRITER_INSERT_REPLACE);
+        if (status != MMDB_SUCCESS) {
+            break;
+        }
+    }
+    cmp_ok(status, "==", MMDB_SUCCESS, "copied every network - %s", filename);
+
+    MMDB_s *copy = write_and_open(writer, WRITER_TEST_DATABASE);
+
+    same_data_ok(source, copy, filename);
+
+    MMDB_close(source);
+    free(source);
+    close_and_remove(copy, WRITER_TEST_DATABASE);
+}
+
+static void test_record_sizes(void) {
+    uint16_t record_sizes[] = {24, 28, 32};
+    for (size_t i = 0; i < sizeof(record_sizes) / sizeof(record_sizes[0]);
+         i++) {
+        MMDB_writer_s *writer = new_writer_ok(6, "Writer Test", 0);
+        cmp_ok(MMDB_writer_set_record_size(writer, record_sizes[i]),
+               "==",
+               MMDB_SUCCESS,
+               "set the record size to %d",
+               record_sizes[i]);
+        insert_ok(writer,
+                  "1.2.3.0/24",
+                  name_and_number(writer, "ipv4", 1),
+                  MMDB_WRITER_INSERT_REPLACE);
+
+        MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+        cmp_ok(mmdb->metadata.record_size,
+               "==",
+               record_sizes[i],
+               "the database uses the record size");
+        test_lookup(mmdb, "1.2.3.4", "ipv4", 120);
+        close_and_remove(mmdb, WRITER_TEST_DATABASE);
+    }
+}
+
+static void test_sorted_map_keys(void) {
+    MMDB_writer_s *writer =
+        new_writer_ok(4, "Writer Test", MMDB_WRITER_SORT_MAP_KEYS);
+    MMDB_writer_value_s *first = MMDB_writer_map(writer);
+    map_add_ok(writer, first, "b", MMDB_writer_uint32(writer, 2));
+    map_add_ok(writer, first, "a", MMDB_writer_uint32(writer, 1));
+    insert_ok(writer, "1.0.0.0/8", first, MMDB_WRITER_INSERT_REPLACE);
+    MMDB_writer_value_s *second = MMDB_writer_map(writer);
+    map_add_ok(writer, second, "a", MMDB_writer_uint32(writer, 1));
+    map_add_ok(writer, second, "b", MMDB_writer_uint32(writer, 2));
+    insert_ok(writer, "3.0.0.0/8", second, MMDB_WRITER_INSERT_REPLACE);
+
+    MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+
+    MMDB_lookup_result_s a =
+        lookup_string_ok(mmdb, "1.0.0.1", WRITER_TEST_DATABASE, "mmap mode");
+    MMDB_lookup_result_s b =
+        lookup_string_ok(mmdb, "3.0.0.1", WRITER_TEST_DATABASE, "mmap mode");
+    ok(a.found_entry && b.found_entry, "found both entries");
+    cmp_ok(a.entry.offset,
+           "==",
+           b.entry.offset,
+           "maps with the keys in a different order are stored once");
+
+    char *dump = dump_entry(&a.entry);
+    ok(strstr(dump, "\"a\"") < strstr(dump, "\"b\""), "the keys are sorted");
+    free(dump);
+
+    close_and_remove(mmdb, WRITER_TEST_DATABASE);
+}
+
+static void test_intern(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Writer Test", 0);
+    MMDB_writer_value_s *canonical;
+    cmp_ok(MMDB_writer_intern(
+               writer, name_and_number(writer, "shared", 1), &canonical),
+           "==",
+           MMDB_SUCCESS,
+           "MMDB_writer_intern");
+    insert_ok(writer, "1.0.0.0/8", canonical, MMDB_WRITER_INSERT_REPLACE);
+    insert_ok(writer, "3.0.0.0/8", canonical, MMDB_WRITER_INSERT_REPLACE);
+
+    MMDB_writer_value_s *outer = MMDB_writer_map(writer);
+    map_add_ok(writer, outer, "inner", canonical);
+    map_add_ok(writer, outer, "name", string_value(writer, "outer"));
+    insert_ok(writer, "5.0.0.0/8", outer, MMDB_WRITER_INSERT_REPLACE);
+
+    MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+
+    test_lookup(mmdb, "1.0.0.1", "shared", 8);
+    test_lookup(mmdb, "3.0.0.1", "shared", 8);
+    test_lookup(mmdb, "5.0.0.1", "outer", 8);
+
+    close_and_remove(mmdb, WRITER_TEST_DATABASE);
+}
+
+static void test_alias_flags(void) {
+    MMDB_writer_s *writer =
+        new_writer_ok(6, "Writer Test", MMDB_WRITER_ALIAS_6TO4);
+    insert_ok(writer,
+              "1.2.3.0/24",
+              name_and_number(writer, "ipv4", 1),
+              MMDB_WRITER_INSERT_REPLACE);
+
+    MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+
+    test_lookup(mmdb, "2002:102:304::", "ipv4", 40);
+    const char *missing[] = {"::ffff:1.2.3.4", "2001:0:102:304::"};
+    for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+        MMDB_lookup_result_s result = lookup_string_ok(
+            mmdb, missing[i], WRITER_TEST_DATABASE, "mmap mode");
+        ok(!result.found_entry, "no alias for %s", missing[i]);
+    }
+
+    close_and_remove(mmdb, WRITER_TEST_DATABASE);
+}
+
+static void test_tree_layouts(void) {
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        MMDB_writer_s *writer =
+            new_writer_ok(6, "Writer Test", MMDB_WRITER_ALIAS_IPV4);
+        cmp_ok(MMDB_writer_set_tree_layout(writer, layouts[i].layout),
+               "==",
+               MMDB_SUCCESS,
+               "set the %s layout",
+               layouts[i].name);
+        insert_ok(writer,
+                  "1.2.3.0/24",
+                  name_and_number(writer, "ipv4", 1),
+                  MMDB_WRITER_INSERT_REPLACE);
+        insert_ok(writer,
+                  "2001:db8::/32",
+                  name_and_number(writer, "ipv6", 2),
+                  MMDB_WRITER_INSERT_REPLACE);
+        insert_ok(writer,
+                  "2001:db8:1::/48",
+                  name_and_number(writer, "more specific", 3),
+                  MMDB_WRITER_INSERT_REPLACE);
+
+        MMDB_s *mmdb = write_and_open(writer, WRITER_TEST_DATABASE);
+        test_lookup(mmdb, "1.2.3.4", "ipv4", 120);
+        test_lookup(mmdb, "::ffff:1.2.3.4", "ipv4", 120);
+        test_lookup(mmdb, "2002:102:304::", "ipv4", 40);
+        test_lookup(mmdb, "2001:db8:8000::1", "ipv6", 33);
+        test_lookup(mmdb, "2001:db8:1::1", "more specific", 48);
+        close_and_remove(mmdb, WRITER_TEST_DATABASE);
+    }
+}
+
+static void test_relayout(const char *filename) {
+    char *path = test_database_path(filename);
+    MMDB_s *source = open_ok(path, MMDB_MODE_MMAP, "mmap mode");
+    free(path);
+
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        int status = MMDB_writer_relayout(
+            source, WRITER_TEST_DATABASE, layouts[i].layout);
+        cmp_ok(status,
+               "==",
+               MMDB_SUCCESS,
+               "MMDB_writer_relayout with the %s layout - %s",
+               layouts[i].name,
+               filename);
+        if (status != MMDB_SUCCESS) {
+            continue;
+        }
+
+        MMDB_s *copy =
+            open_ok(WRITER_TEST_DATABASE, MMDB_MODE_MMAP, "mmap mode");
+        cmp_ok(copy->metadata.node_count,
+               "==",
+               source->metadata.node_count,
+               "the node count is the same - %s",
+               filename);
+        ok(copy->file_size == source->file_size,
+           "the file size is the same - %s",
+           filename);
+        size_t const tree_size = (size_t)source->metadata.node_count *
+                                 source->full_record_byte_size;
+        ok(memcmp(copy->file_content + tree_size,
+                  source->file_content + tree_size,
+                  (size_t)source->file_size - tree_size) == 0,
+           "the data section and metadata are the same - %s",
+           filename);
+        same_data_ok(source, copy, filename);
+        close_and_remove(copy, WRITER_TEST_DATABASE);
+    }
+
+    MMDB_close(source);
+    free(source);
+}
+
+static void test_errors(void) {
+    MMDB_writer_s *writer = new_writer_ok(4, "Writer Test", 0);
+
+    cmp_ok(MMDB_writer_set_record_size(writer, 20),
+           "==",
+           MMDB_UNKNOWN_DATABASE_FORMAT_ERROR,
+           "a record size of 20 is rejected");
+    cmp_ok(MMDB_writer_set_tree_layout(writer, 3),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "an unknown tree layout is rejected");
+
+    MMDB_writer_value_s *value = MMDB_writer_uint32(writer, 1);
+    cmp_ok(MMDB_writer_insert_network(
+               writer, "1.2.3.0/33", value, MMDB_WRITER_INSERT_REPLACE),
+           "==",
+           MMDB_INVALID_NETWORK_ADDRESS_ERROR,
+           "a /33 IPv4 network is rejected");
+    cmp_ok(MMDB_writer_insert_network(
+               writer, "not an ip", value, MMDB_WRITER_INSERT_REPLACE),
+           "==",
+           MMDB_INVALID_NETWORK_ADDRESS_ERROR,
+           "an invalid address is rejected");
+    cmp_ok(MMDB_writer_insert_network(
+               writer, "2001:db8::/32", value, MMDB_WRITER_INSERT_REPLACE),
+           "==",
+           MMDB_IPV6_LOOKUP_IN_IPV4_DATABASE_ERROR,
+           "an IPv6 network in an IPv4 database is rejected");
+
+    MMDB_writer_value_s *map = name_and_number(writer, "map", 1);
+    insert_ok(writer, "1.2.3.0/24", map, MMDB_WRITER_INSERT_REPLACE);
+    MMDB_writer_value_s *array = MMDB_writer_array(writer);
+    cmp_ok(MMDB_writer_map_add(writer, array, "key", 3, value),
+           "==",
+           MMDB_INVALID_DATA_ERROR,
+           "adding a key to an array is an error");
+
+    MMDB_writer_free(writer);
+}
+
+int main(void) {
+    plan(NO_PLAN);
+    test_metadata_and_lookups();
+    test_deduplication();
+    test_policies();
+    test_record_sizes();
+    test_round_trip("MaxMind-DB-test-decoder.mmdb");
+    test_round_trip("GeoIP2-City-Test.mmdb");
+    test_sorted_map_keys();
+    test_intern();
+    test_alias_flags();
+    test_tree_layouts();
+    test_relayout("MaxMind-DB-test-decoder.mmdb");
+    test_relayout("MaxMind-DB-test-ipv4-28.mmdb");
+    test_relayout("MaxMind-DB-test-mixed-32.mmdb");
+    test_relayout("GeoIP2-City-Test.mmdb");
+    test_errors();
+    done_testing();
+}